@@ -10,6 +10,10 @@
 
 #include "VirtHID.hpp"
 #include "VirtHID_Device.hpp"
+#include "VirtHID_UserClient.hpp"
+#include "VirtHID_Events.hpp"
+#include "VirtHID_Batch.hpp"
+#include "VirtHID_Provision.hpp"
 #include "debug.h"
 
 #define super IOService
@@ -18,6 +22,12 @@ OSDefineMetaClassAndStructors(it_kotleni_virthid, IOService);
 bool it_kotleni_virthid::start(IOService *provider) {
     LogD("Executing 'it_kotleni_virthid::start()'.");
     
+    m_work_loop = IOWorkLoop::workLoop();
+    if (!m_work_loop) {
+        LogD("Unable to create the work loop.");
+        return false;
+    }
+    
     bool ret = super::start(provider);
     if (ret) {
         LogD("Calling 'it_kotleni_virthid:registerService()'.");
@@ -31,31 +41,43 @@ void it_kotleni_virthid::stop(IOService *provider) {
     LogD("Executing 'it_kotleni_virthid:stop()'.");
     
     // Terminate and release every managed HID device.
-    OSCollectionIterator *iter = OSCollectionIterator::withCollection(m_hid_devices);
-    if (iter) {
-        const OSString *key = nullptr;
-        while ((key = (OSString *)iter->getNextObject())) {
-            it_kotleni_virthid_device *device = (it_kotleni_virthid_device *)m_hid_devices->getObject(key);
-            
-            if (device) {
-                LogD("Terminating device '%s'.", device->name()->getCStringNoCopy());
-                device->terminate();
-                device->release();
-            }
+    it_kotleni_virthid_device *device = nullptr;
+    uint32_t cursor = 0;
+    while ((device = m_hid_devices.copyNext(&cursor))) {
+        it_kotleni_virthid_device *removed = m_hid_devices.remove(device->handle);
+        
+        if (removed) {
+            LogD("Terminating device '%s'.", device->name()->getCStringNoCopy());
+            removed->terminate();
+            uninternDescriptor(removed->reportDescriptor);
+            removed->release();
         }
         
-        iter->release();
+        device->release();
     }
     
     super::stop(provider);
 }
 
+IOWorkLoop *it_kotleni_virthid::getWorkLoop() const {
+    return m_work_loop;
+}
+
 bool it_kotleni_virthid::init(OSDictionary *dictionary) {
     LogD("Executing 'it_kotleni_virthid:init()'.");
     
-    m_hid_devices = OSDictionary::withCapacity(1);
-    if (!m_hid_devices) {
-        LogD("Unable to inizialize HID devices dictionary.");
+    if (!m_hid_devices.init()) {
+        LogD("Unable to inizialize HID devices registry.");
+        return false;
+    }
+    
+    m_event_subscribers_lock = IOLockAlloc();
+    if (!m_event_subscribers_lock) {
+        return false;
+    }
+    
+    m_descriptors_lock = IOLockAlloc();
+    if (!m_descriptors_lock) {
         return false;
     }
     
@@ -65,248 +87,614 @@ bool it_kotleni_virthid::init(OSDictionary *dictionary) {
 void it_kotleni_virthid::free() {
     LogD("Executing 'it_kotleni_virthid:free()'.");
     
-    // Clear the HID devices dictionary.
-    if (m_hid_devices) {
-        m_hid_devices->release();
+    m_hid_devices.free();
+    
+    while (m_event_subscribers.count() > 0) {
+        it_kotleni_virthid_userclient *subscriber = m_event_subscribers.at(0);
+        m_event_subscribers.remove(subscriber);
+        subscriber->release();
+    }
+    
+    if (m_event_subscribers_lock) {
+        IOLockFree(m_event_subscribers_lock);
+    }
+    
+    if (m_descriptors_lock) {
+        IOLockFree(m_descriptors_lock);
+    }
+    
+    if (m_work_loop) {
+        m_work_loop->release();
     }
     
     super::free();
 }
 
+/**
+ *  Return a string holding a copy of 'len' characters, or null.
+ */
+static OSString *virthid_new_string(const char *chars, UInt32 len) {
+    char *c_string = (char *)IOMalloc(len + 1);
+    if (!c_string) return nullptr;
+    
+    if (len) memcpy(c_string, chars, len);
+    c_string[len] = 0;
+    OSString *string = OSString::withCString(c_string);
+    IOFree(c_string, len + 1);
+    
+    return string;
+}
+
 bool it_kotleni_virthid::methodCreate(char *name, UInt8 name_len,
                                    unsigned char *report_descriptor,
                                    UInt16 report_descriptor_len,
                                    char *serial_number, UInt16 serial_number_len,
-                                   UInt32 vendor_id, UInt32 product_id) {
-    it_kotleni_virthid_device *device = nullptr;
-    
+                                   UInt32 vendor_id, UInt32 product_id,
+                                   UInt32 *handle) {
+    it_kotleni_virthid_report_descriptor *descriptor = nullptr;
     OSString *key = nullptr;
     OSString *serial_number_s = nullptr;
+    bool ret = false;
     
     if (report_descriptor_len == 0 || name_len == 0) return false;
     
-    {
-        char *c_name = (char *)IOMalloc(name_len + 1);
-        if (!c_name) return false;
-        memcpy(c_name, name, name_len);
-        c_name[name_len] = 0;
-        key = OSString::withCString(c_name);
-        IOFree(c_name, name_len + 1);
-    }
-    if (!key) return false;
+    key = virthid_new_string(name, name_len);
+    if (!key) goto end;
     
-    // Has the device already been created?
-    device = (it_kotleni_virthid_device *)m_hid_devices->getObject(key);
-    if (device) return false;
+    serial_number_s = virthid_new_string(serial_number, serial_number_len);
+    if (!serial_number_s) goto end;
     
-    device = OSTypeAlloc(it_kotleni_virthid_device);
-    if (!device) goto fail;
-    
-    if (report_descriptor_len >= 4) {
-        if (report_descriptor[0] == 0x05 && report_descriptor[1] == 0x01 &&
-            report_descriptor[2] == 0x09 && report_descriptor[3] == 0x02) {
-            device->isMouse = true;
-        } else if (report_descriptor[0] == 0x05 && report_descriptor[1] == 0x01 &&
-                   report_descriptor[2] == 0x09 && report_descriptor[3] == 0x06) {
-            device->isKeyboard = true;
+    descriptor = internDescriptor(report_descriptor, report_descriptor_len);
+    if (!descriptor) goto end;
+    
+    ret = createDevice(key, descriptor, serial_number_s, vendor_id, product_id, handle);
+    
+end:
+    if (descriptor) uninternDescriptor(descriptor);
+    if (key) key->release();
+    if (serial_number_s) serial_number_s->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodCreateBatch(unsigned char *batch, UInt32 batch_len, UInt16 descriptor_len,
+                                               UInt32 *created, UInt32 *failed, bool *truncated) {
+    virthid_provision_reader reader(batch, batch_len, descriptor_len);
+    virthid_batch_result result = virthid_batch_end;
+    virthid_provision_record record;
+    const char *name = nullptr;
+    const char *serial_number = nullptr;
+    
+    it_kotleni_virthid_report_descriptor *descriptor = nullptr;
+    
+    *created = 0;
+    *failed = 0;
+    *truncated = false;
+    
+    if (!reader.valid()) return kIOReturnBadArgument;
+    
+    // Intern once, every device of the batch shares the descriptor and its layout.
+    descriptor = internDescriptor(reader.descriptor(), descriptor_len);
+    if (!descriptor) return kIOReturnBadArgument;
+    
+    while ((result = reader.next(&record, &name, &serial_number)) == virthid_batch_next) {
+        UInt32 handle = virthid_invalid_handle;
+        OSString *key = nullptr;
+        OSString *serial_number_s = nullptr;
+        
+        if (record.name_len > 0) {
+            key = virthid_new_string(name, record.name_len);
+            serial_number_s = virthid_new_string(serial_number, record.serial_number_len);
         }
-        else {
-            device->isKeyboard = true;
+        
+        if (key && serial_number_s &&
+            createDevice(key, descriptor, serial_number_s, record.vendor_id, record.product_id, &handle)) {
+            (*created)++;
+        } else {
+            (*failed)++;
         }
+        
+        if (key) key->release();
+        if (serial_number_s) serial_number_s->release();
+        
+        reader.setHandle(handle);
     }
     
-    {
-        char *c_serial_number = (char *)IOMalloc(serial_number_len + 1);
-        if (!c_serial_number) return false;
-        memcpy(c_serial_number, serial_number, serial_number_len);
-        c_serial_number[serial_number_len] = 0;
-        serial_number_s = OSString::withCString(c_serial_number);
-        IOFree(c_serial_number, serial_number_len + 1);
+    *truncated = result == virthid_batch_truncated;
+    
+    LogD("Created %u devices from a batch, %u failed.", *created, *failed);
+    
+    uninternDescriptor(descriptor);
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid::methodClone(UInt32 source, char *name, UInt8 name_len,
+                                         char *serial_number, UInt16 serial_number_len,
+                                         UInt32 vendor_id, UInt32 product_id, UInt32 *handle) {
+    it_kotleni_virthid_device *device = nullptr;
+    it_kotleni_virthid_report_descriptor *descriptor = nullptr;
+    OSString *key = nullptr;
+    OSString *serial_number_s = nullptr;
+    IOReturn ret = kIOReturnNoMemory;
+    
+    if (name_len == 0) return kIOReturnBadArgument;
+    
+    device = m_hid_devices.copy(source);
+    if (!device) return kIOReturnNotFound;
+    
+    key = virthid_new_string(name, name_len);
+    if (!key) goto end;
+    
+    // Whatever is not given is taken from the source device.
+    if (serial_number_len) {
+        serial_number_s = virthid_new_string(serial_number, serial_number_len);
+    } else {
+        serial_number_s = device->newSerialNumberString();
     }
-    if (!serial_number_s) goto fail;
+    if (!serial_number_s) goto end;
+    
+    if (!vendor_id) vendor_id = device->vendorID();
+    if (!product_id) product_id = device->productID();
+    
+    // Looked up again rather than reused, the source may be destroyed meanwhile.
+    descriptor = internDescriptor(device->reportDescriptor->bytes(), device->reportDescriptor->length());
+    if (!descriptor) goto end;
+    
+    ret = createDevice(key, descriptor, serial_number_s, vendor_id, product_id, handle) ?
+        kIOReturnSuccess : kIOReturnError;
+    
+end:
+    if (descriptor) uninternDescriptor(descriptor);
+    if (key) key->release();
+    if (serial_number_s) serial_number_s->release();
+    device->release();
     
-    device->setSerialNumberString(serial_number_s);
+    return ret;
+}
+
+it_kotleni_virthid_report_descriptor *it_kotleni_virthid::internDescriptor(const unsigned char *bytes,
+                                                                           UInt16 length) {
+    it_kotleni_virthid_report_descriptor *descriptor = nullptr;
+    it_kotleni_virthid_report_descriptor *created = nullptr;
+    virthid_parse_result result;
+    uint32_t hash = virthid_hash_bytes(bytes, length);
+    
+    IOLockLock(m_descriptors_lock);
+    descriptor = m_descriptors.acquire(bytes, length, hash);
+    IOLockUnlock(m_descriptors_lock);
+    if (descriptor) return descriptor;
+    
+    // Parse outside of the lock, then check whether a concurrent caller won.
+    created = it_kotleni_virthid_report_descriptor::withBytes(bytes, length, &result);
+    if (!created) return nullptr;
+    
+    IOLockLock(m_descriptors_lock);
+    descriptor = m_descriptors.acquire(created->bytes(), length, created->hash());
+    if (!descriptor && m_descriptors.insert(created)) {
+        descriptor = created;
+        created = nullptr;
+    }
+    IOLockUnlock(m_descriptors_lock);
+    
+    // The table keeps the reference of the descriptor it stores.
+    if (created) created->release();
+    
+    return descriptor;
+}
+
+void it_kotleni_virthid::uninternDescriptor(it_kotleni_virthid_report_descriptor *descriptor) {
+    bool removed = false;
+    
+    IOLockLock(m_descriptors_lock);
+    removed = m_descriptors.release(descriptor);
+    IOLockUnlock(m_descriptors_lock);
+    
+    if (removed) descriptor->release();
+}
+
+bool it_kotleni_virthid::createDevice(OSString *name, it_kotleni_virthid_report_descriptor *descriptor,
+                                   OSString *serial_number, UInt32 vendor_id, UInt32 product_id,
+                                   UInt32 *handle) {
+    it_kotleni_virthid_device *device = nullptr;
+    
+    // Has the device already been created?
+    device = m_hid_devices.copyNamed(name->getCStringNoCopy(), name->getLength());
+    if (device) {
+        device->release();
+        return false;
+    }
+    
+    device = OSTypeAlloc(it_kotleni_virthid_device);
+    if (!device) return false;
+    
+    device->setReportDescriptor(descriptor);
+    device->isMouse = device->reportLayout->deviceClass() == virthid_class_mouse;
+    device->isKeyboard = device->reportLayout->deviceClass() == virthid_class_keyboard;
+    
+    device->setSerialNumberString(serial_number);
     device->setVendorID(vendor_id);
     device->setProductID(product_id);
     
     LogD("Attempting to init a new virtual device with name: '%s'; "
          "serial number ('%s'); vendor ID (%d); product ID (%d).",
-         key->getCStringNoCopy(), serial_number_s->getCStringNoCopy(),
+         name->getCStringNoCopy(), serial_number->getCStringNoCopy(),
          vendor_id, product_id);
     
     if (!device->init(nullptr)) {
         goto fail;
     }
     
-    device->reportDescriptor = (unsigned char *)IOMalloc(report_descriptor_len);
-    if (!device->reportDescriptor) {
+    device->setName(name);
+    
+    // Started before it is published, so no lookup ever finds a device half built.
+    if (!device->attach(this)) {
+        goto fail;
+    }
+    
+    if (!device->start(this)) {
+        LogD("Unable to start the device.");
+        device->detach(this);
         goto fail;
     }
-    memcpy(device->reportDescriptor, report_descriptor, report_descriptor_len);
-    device->reportDescriptor_len = report_descriptor_len;
     
-    device->setName(key);
-    if (!m_hid_devices->setObject(key, device)) {
+    // The caller holds a use of the descriptor, so it is still interned.
+    IOLockLock(m_descriptors_lock);
+    m_descriptors.retain(descriptor);
+    IOLockUnlock(m_descriptors_lock);
+    
+    // Checked again under the registry lock, a concurrent create may have won.
+    device->handle = m_hid_devices.add(device);
+    if (device->handle == virthid_invalid_handle) {
+        uninternDescriptor(descriptor);
+        device->terminate();
         goto fail;
     }
     
-    device->attach(this);
-    device->start(this);
+    if (handle) *handle = device->handle;
     
-    key->release();
-    serial_number_s->release();
+    notifyRegistryEvent(virthid_event_created, device);
+    
+    device->release();
     
     return true;
     
 fail:
-    key->release();
-    if (serial_number_s) serial_number_s->release();
-    if (device) device->release();
+    device->release();
     
     return false;
 }
 
 bool it_kotleni_virthid::methodDestroy(char *name, UInt8 name_len) {
-    OSString *key = nullptr;
-    it_kotleni_virthid_device *device = nullptr;
+    // Only the caller that removes the device from the registry terminates it.
+    it_kotleni_virthid_device *removed = m_hid_devices.removeNamed(name, name_len);
+    if (!removed) return false;
     
-    if (name_len == 0) return false;
+    removed->terminate();
+    notifyRegistryEvent(virthid_event_destroyed, removed);
+    uninternDescriptor(removed->reportDescriptor);
+    removed->release();
     
-    {
-        char *cname = (char *)IOMalloc(name_len + 1);
-        if (!cname) return false;
-        memcpy(cname, name, name_len);
-        cname[name_len] = 0;
-        key = OSString::withCString(cname);
-        IOFree(cname, name_len + 1);
-    }
-    if (!key) goto end;
-    
-    device = (it_kotleni_virthid_device *)m_hid_devices->getObject(key);
-    if (!device) goto end;
+    return true;
+}
+
+bool it_kotleni_virthid::methodSend(char *name, UInt8 name_len,
+                                 unsigned char *report_descriptor,
+                                 UInt16 report_descriptor_len, uint64_t timestamp,
+                                 UInt32 *depth, UInt32 *flow) {
+    it_kotleni_virthid_device *device = m_hid_devices.copyNamed(name, name_len);
+    if (!device) return false;
     
-    device->terminate();
-    m_hid_devices->removeObject(key);
-    key->release();
+    bool ret = device->sendInputReport(report_descriptor, report_descriptor_len, timestamp, depth, flow);
     device->release();
     
-    return true;
+    return ret;
+}
+
+bool it_kotleni_virthid::methodSendHandle(UInt32 handle, unsigned char *report, UInt16 report_len,
+                                          uint64_t timestamp, UInt32 *depth, UInt32 *flow) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return false;
     
-end:
-    if (key) key->release();
-    return false;
+    bool ret = device->sendInputReport(report, report_len, timestamp, depth, flow);
+    device->release();
+    
+    return ret;
 }
 
-bool it_kotleni_virthid::methodSend(char *name, UInt8 name_len,
-                                 unsigned char *report_descriptor,
-                                 UInt16 report_descriptor_len) {
-    it_kotleni_virthid_device *device = nullptr;
-    OSString *key = nullptr;
-    IOMemoryDescriptor *report = nullptr;
-    bool ret = false;
+bool it_kotleni_virthid::methodSendBatch(unsigned char *batch, UInt32 batch_len, uint64_t timestamp,
+                                      SInt32 *status, UInt32 status_count,
+                                      UInt32 *processed, UInt32 *failed) {
+    virthid_batch_reader reader(batch, batch_len);
+    virthid_batch_result result;
+    
+    UInt32 handle = 0;
+    const uint8_t *report = nullptr;
+    UInt16 report_len = 0;
     
-    if (name_len == 0) return false;
+    *processed = 0;
+    *failed = 0;
     
-    {
-        char *cname = (char *)IOMalloc(name_len + 1);
-        if (!cname) return false;
-        memcpy(cname, name, name_len);
-        cname[name_len] = 0;
-        key = OSString::withCString(cname);
-        IOFree(cname, name_len + 1);
+    while ((result = reader.next(&handle, &report, &report_len)) == virthid_batch_next) {
+        IOReturn ret = kIOReturnSuccess;
+        
+        it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+        if (!device) {
+            ret = kIOReturnNotFound;
+        } else {
+            if (!device->sendInputReport(report, report_len, timestamp)) ret = kIOReturnDeviceError;
+            device->release();
+        }
+        
+        if (ret != kIOReturnSuccess) (*failed)++;
+        if (status && *processed < status_count) status[*processed] = ret;
+        (*processed)++;
     }
-    if (!key) goto end;
     
-    device = (it_kotleni_virthid_device *)m_hid_devices->getObject(key);
-    if (!device) goto end;
+    LogD("Sent batch of %u reports, %u failed.", *processed, *failed);
     
-    report = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0,
-                                                         report_descriptor_len);
-    if (!report) goto end;
+    return result == virthid_batch_end;
+}
+
+bool it_kotleni_virthid::methodDoorbell(UInt32 handle, uint64_t timestamp) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return false;
     
-    LogD("Handling report of size: %d.", (int)report->getLength());
-    report->writeBytes(0, report_descriptor, report_descriptor_len);
+    IOReturn ret = device->drainInputRing(timestamp);
+    device->release();
     
-    if (device->handleReport(report, kIOHIDReportTypeInput) == kIOReturnSuccess) {
-        LogD("Report correctly sent to device.");
-        ret = true;
+    return ret == kIOReturnSuccess;
+}
+
+bool it_kotleni_virthid::methodInputRing(UInt32 handle, IOMemoryDescriptor **memory) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return false;
+    
+    *memory = device->copyInputRing();
+    device->release();
+    
+    return *memory != nullptr;
+}
+
+IOReturn it_kotleni_virthid::methodSetCoalescing(UInt32 handle, bool enable) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->setCoalescing(enable);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSetWatermarks(UInt32 handle, UInt32 high, UInt32 low) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->setWatermarks(high, low);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSubscribeFlow(UInt32 handle, bool enable, IOService *userClient) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = kIOReturnSuccess;
+    if (enable) {
+        if (!device->subscribeFlow(userClient)) ret = kIOReturnNoResources;
     } else {
-        LogD("Error while sending report to device.");
+        device->unsubscribeFlow(userClient);
     }
+    device->release();
+    
+    return ret;
+}
+
+bool it_kotleni_virthid::methodStateMemory(UInt32 handle, IOMemoryDescriptor **memory) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return false;
+    
+    *memory = device->copyStateMemory();
+    device->release();
+    
+    return *memory != nullptr;
+}
+
+IOReturn it_kotleni_virthid::methodSetPolling(UInt32 handle, UInt32 interval_us, bool skip_identical) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
     
-    report->release();
-    key->release();
+    IOReturn ret = device->setPolling(interval_us, skip_identical);
+    device->release();
     
     return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSchedule(UInt32 handle, unsigned char *records, UInt32 records_len,
+                                            UInt32 *scheduled) {
+    *scheduled = 0;
     
-end:
-    if (key) key->release();
-    if (report) report->release();
-    return false;
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->scheduleReports(records, records_len, scheduled);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSetCapture(UInt32 handle, bool enable) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->setCapture(enable);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodReadCapture(UInt32 handle, unsigned char *buf, UInt32 buf_len,
+                                               UInt32 *copied, UInt32 *dropped) {
+    *copied = 0;
+    *dropped = 0;
+    
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->readCapture(buf, buf_len, copied, dropped);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodReplay(UInt32 handle, unsigned char *log, UInt32 log_len, UInt32 speed,
+                                          uint64_t timestamp, UInt32 *replayed) {
+    *replayed = 0;
+    
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->replayLog(log, log_len, speed, timestamp, replayed);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSetReportState(UInt32 handle, UInt32 type, unsigned char *report,
+                                                  UInt32 report_len) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->setReportState(type, report, report_len);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSendKeys(UInt32 handle, unsigned char *events, UInt32 events_len,
+                                            uint64_t timestamp, UInt32 *sent) {
+    *sent = 0;
+    
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->sendKeyEvents(events, events_len, timestamp, sent);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodSendEvents(UInt32 handle, unsigned char *events, UInt32 events_len,
+                                              uint64_t timestamp, UInt32 *sent) {
+    *sent = 0;
+    
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->sendEvents(events, events_len, timestamp, sent);
+    device->release();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid::methodStats(UInt32 handle, virthid_device_stats *stats) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    device->copyStats(stats);
+    device->release();
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid::methodLatency(UInt32 handle, UInt32 direction, virthid_histogram_snapshot *snapshot) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return kIOReturnNotFound;
+    
+    IOReturn ret = device->copyLatency(direction, snapshot);
+    device->release();
+    
+    return ret;
 }
 
+void it_kotleni_virthid::methodRecordLatency(UInt32 handle, UInt32 direction, uint64_t latency) {
+    it_kotleni_virthid_device *device = m_hid_devices.copy(handle);
+    if (!device) return;
+    
+    device->recordLatency(direction, latency);
+    device->release();
+}
 
 bool it_kotleni_virthid::methodList(char *buf, UInt16 buf_len,
                                  UInt16 *needed, UInt16 *items) {
-    if (buf_len == 0) return false;
-    
     LogD("Building HID virtual devices list.");
     
-    UInt16 current_len = 0;
-    *needed = 0;
-    *items = 0;
-    
-    // Iterate through managed HID devices.
-    OSCollectionIterator *iter = OSCollectionIterator::withCollection(m_hid_devices);
-    if (iter) {
-        const OSString *key = nullptr;
-        while ((key = (OSString *)iter->getNextObject())) {
-            UInt8 key_len = key->getLength();
-            
-            if (key_len + 1 + current_len > buf_len) {
-                *needed = buf_len + key_len + 1;
-                break;
-            }
-            
-            memcpy(buf + current_len, key->getCStringNoCopy(), key_len);
-            buf[current_len + key_len] = 0;
-            current_len += key_len + 1;
-            (*items)++;
-        }
-        
-        iter->release();
-    }
-    
-    if (*needed != 0) return false;
-    return true;
+    return m_hid_devices.listNames(buf, buf_len, needed, items);
+}
+
+IOReturn it_kotleni_virthid::methodListEntries(UInt32 *cursor, unsigned char *buf, UInt32 buf_len,
+                                               UInt32 *count, UInt32 *used, UInt32 *generation) {
+    // A page that cannot hold one entry still tells the client how much room it needs.
+    m_hid_devices.listEntries(cursor, buf, buf_len, count, used, generation);
+    return kIOReturnSuccess;
 }
 
 bool it_kotleni_virthid::methodSubscribe(char *name, UInt8 name_len, IOService *userClient) {
-    OSString *key = nullptr;
-    it_kotleni_virthid_device *device = nullptr;
+    it_kotleni_virthid_device *device = m_hid_devices.copyNamed(name, name_len);
+    if (!device) return false;
+
+    bool ret = device->subscribe(userClient);
+    device->release();
+
+    return ret;
+}
 
-    if (name_len == 0) return false;
+void it_kotleni_virthid::methodUnsubscribe(IOService *userClient) {
+    it_kotleni_virthid_device *device = nullptr;
+    uint32_t cursor = 0;
 
-    {
-        char *cname = (char *)IOMalloc(name_len + 1);
-        if (!cname) return false;
-        memcpy(cname, name, name_len);
-        cname[name_len] = 0;
-        key = OSString::withCString(cname);
-        IOFree(cname, name_len + 1);
+    while ((device = m_hid_devices.copyNext(&cursor))) {
+        device->unsubscribe(userClient);
+        device->release();
     }
-    if (!key) goto end;
+}
 
-    device = (it_kotleni_virthid_device *)m_hid_devices->getObject(key);
-    if (!device) goto end;
+bool it_kotleni_virthid::methodSubscribeEvents(IOService *userClient) {
+    it_kotleni_virthid_userclient *subscriber = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+    bool added = false;
+    bool ret = false;
 
-    device->subscribe(userClient);
+    if (!subscriber) return false;
 
-    key->release();
+    IOLockLock(m_event_subscribers_lock);
+    ret = m_event_subscribers.add(subscriber, &added);
+    if (added) subscriber->retain();
+    IOLockUnlock(m_event_subscribers_lock);
 
-    return true;
+    return ret;
+}
 
-end:
-    if (key) key->release();
-    return false;
+void it_kotleni_virthid::methodUnsubscribeEvents(IOService *userClient) {
+    it_kotleni_virthid_userclient *subscriber = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+    bool removed = false;
+
+    if (!subscriber) return;
+
+    IOLockLock(m_event_subscribers_lock);
+    removed = m_event_subscribers.remove(subscriber);
+    IOLockUnlock(m_event_subscribers_lock);
+
+    if (removed) subscriber->release();
+}
+
+void it_kotleni_virthid::notifyRegistryEvent(UInt32 type, it_kotleni_virthid_device *device) {
+    const OSString *name = device->name();
+
+    IOLockLock(m_event_subscribers_lock);
+    for (UInt32 i = 0; i < m_event_subscribers.count(); i++) {
+        m_event_subscribers.at(i)->notifyRegistryEvent(type, device->handle, name->getCStringNoCopy(),
+                                                       (UInt8)name->getLength());
+    }
+    IOLockUnlock(m_event_subscribers_lock);
 }
@@ -9,6 +9,40 @@
 #define virthid_h
 
 #include <IOKit/IOService.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOLocks.h>
+
+#include "VirtHID_Core.hpp"
+#include "VirtHID_Subscribers.hpp"
+#include "VirtHID_Stats.hpp"
+#include "VirtHID_Histogram.hpp"
+#include "VirtHID_Intern.hpp"
+
+class it_kotleni_virthid_device;
+class it_kotleni_virthid_userclient;
+class it_kotleni_virthid_report_descriptor;
+
+/**
+ *  IORWLock based lock for 'virthid_core'.
+ */
+struct virthid_rw_lock {
+    IORWLock *lock = nullptr;
+    
+    bool init() {
+        lock = IORWLockAlloc();
+        return lock != nullptr;
+    }
+    
+    void free() {
+        if (lock) IORWLockFree(lock);
+        lock = nullptr;
+    }
+    
+    void lockShared() { IORWLockRead(lock); }
+    void unlockShared() { IORWLockUnlock(lock); }
+    void lockExclusive() { IORWLockWrite(lock); }
+    void unlockExclusive() { IORWLockUnlock(lock); }
+};
 
 class it_kotleni_virthid : public IOService {
     OSDeclareDefaultStructors(it_kotleni_virthid)
@@ -20,6 +54,11 @@ public:
     virtual bool start(IOService *provider) override;
     virtual void stop(IOService *provider) override;
     
+    /**
+     *  Return the work loop shared by every managed device.
+     */
+    virtual IOWorkLoop *getWorkLoop() const override;
+    
     /**
      *  Create a new virtual device.
      *
@@ -31,13 +70,52 @@ public:
      *  @param serial_number_len     Length of 'serial_number'
      *  @param vendor_id             A vendor ID.
      *  @param product_id            A product ID.
+     *  @param handle                If not null, receives the handle of the new device.
      *
      *  @return True on success.
      */
     virtual bool methodCreate(char *name, UInt8 name_len,
                               unsigned char *report_descriptor, UInt16 report_descriptor_len,
                               char *serial_number = nullptr, UInt16 serial_number_len = 0,
-                              UInt32 vendor_id = 0, UInt32 product_id = 0);
+                              UInt32 vendor_id = 0, UInt32 product_id = 0,
+                              UInt32 *handle = nullptr);
+    
+    /**
+     *  Create many devices sharing one report descriptor, parsed only once.
+     *  See 'VirtHID_Provision.hpp' for the layout; the handle of each new
+     *  device is written back into its record, 'virthid_invalid_handle'
+     *  marking the records that failed. Devices already created are kept.
+     *
+     *  @param batch          The provisioning batch.
+     *  @param batch_len      Length of 'batch'.
+     *  @param descriptor_len Length of the report descriptor at the start of 'batch'.
+     *  @param created        Receives the number of devices created.
+     *  @param failed         Receives the number of records that could not be created.
+     *  @param truncated      Receives true if the batch ended with a truncated record.
+     *
+     *  @return kIOReturnSuccess once the records have been walked, even if some
+     *          failed, kIOReturnBadArgument on a malformed descriptor.
+     */
+    virtual IOReturn methodCreateBatch(unsigned char *batch, UInt32 batch_len, UInt16 descriptor_len,
+                                       UInt32 *created, UInt32 *failed, bool *truncated);
+    
+    /**
+     *  Create a new virtual device with the configuration of an existing one.
+     *
+     *  @param source            Handle of the device to clone.
+     *  @param name              A unique device name.
+     *  @param name_len          Length of 'name'.
+     *  @param serial_number     A serial number, the source's one if empty.
+     *  @param serial_number_len Length of 'serial_number'.
+     *  @param vendor_id         A vendor ID, the source's one if zero.
+     *  @param product_id        A product ID, the source's one if zero.
+     *  @param handle            If not null, receives the handle of the new device.
+     *
+     *  @return kIOReturnNotFound if there is no such source device.
+     */
+    virtual IOReturn methodClone(UInt32 source, char *name, UInt8 name_len,
+                                 char *serial_number, UInt16 serial_number_len,
+                                 UInt32 vendor_id, UInt32 product_id, UInt32 *handle);
     
     /**
      *  Destroy a given device.
@@ -56,26 +134,280 @@ public:
      *  @param name_len              Length of 'name'.
      *  @param report_descriptor     A report descriptor for this device.
      *  @param report_descriptor_len Length of 'report_descriptor'.
+     *  @param timestamp             When the call entered the driver, see 'virthid_latency_input'.
+     *  @param depth                 If not null, receives the pending report count of the device.
+     *  @param flow                  If not null, receives the 'virthid_flow_state' of the device.
      *
      *  @return True on success.
      */
     virtual bool methodSend(char *name, UInt8 name_len,
                             unsigned char *report_descriptor,
-                            UInt16 report_descriptor_len);
+                            UInt16 report_descriptor_len, uint64_t timestamp,
+                            UInt32 *depth = nullptr, UInt32 *flow = nullptr);
+    
+    /**
+     *  Send a report to the device identified by a handle returned from 'methodCreate'.
+     *  Unlike 'methodSend' this does not allocate anything to find the device.
+     *
+     *  @param handle     A device handle.
+     *  @param report     The report to send.
+     *  @param report_len Length of 'report'.
+     *  @param timestamp  When the call entered the driver, see 'virthid_latency_input'.
+     *  @param depth      If not null, receives the pending report count of the device.
+     *  @param flow       If not null, receives the 'virthid_flow_state' of the device.
+     *
+     *  @return True on success.
+     */
+    virtual bool methodSendHandle(UInt32 handle, unsigned char *report, UInt16 report_len, uint64_t timestamp,
+                                  UInt32 *depth = nullptr, UInt32 *flow = nullptr);
+    
+    /**
+     *  Send every report of a batch, in order. See 'VirtHID_Batch.hpp' for the layout.
+     *
+     *  @param batch        The batch buffer.
+     *  @param batch_len    Length of 'batch'.
+     *  @param timestamp    When the call entered the driver, see 'virthid_latency_input'.
+     *  @param status       If not null, receives the status of each record.
+     *  @param status_count Number of entries in 'status'.
+     *  @param processed    Receives the number of records processed.
+     *  @param failed       Receives the number of records that could not be sent.
+     *
+     *  @return False if the batch ended with a truncated record.
+     */
+    virtual bool methodSendBatch(unsigned char *batch, UInt32 batch_len, uint64_t timestamp,
+                                 SInt32 *status, UInt32 status_count,
+                                 UInt32 *processed, UInt32 *failed);
+    
+    /**
+     *  Deliver the reports pending in a device's input ring.
+     *
+     *  @param handle    A device handle.
+     *  @param timestamp When the call entered the driver, see 'virthid_latency_input'.
+     *
+     *  @return True on success.
+     */
+    virtual bool methodDoorbell(UInt32 handle, uint64_t timestamp);
+    
+    /**
+     *  Return the input ring of a device, to be mapped into a client task.
+     *
+     *  @param handle A device handle.
+     *  @param memory Receives the ring memory, with an increased reference count.
+     *
+     *  @return True on success.
+     */
+    virtual bool methodInputRing(UInt32 handle, IOMemoryDescriptor **memory);
+    
+    /**
+     *  Enable or disable coalescing of relative motion on a device.
+     *
+     *  @param handle A device handle.
+     *  @param enable Whether to coalesce.
+     *
+     *  @return kIOReturnUnsupported if the device reports no relative data.
+     */
+    virtual IOReturn methodSetCoalescing(UInt32 handle, bool enable);
+    
+    /**
+     *  Set the backlog watermarks of a device. See 'VirtHID_Flow.hpp'.
+     *
+     *  @param handle A device handle.
+     *  @param high   Pending reports at which the device becomes congested.
+     *  @param low    Pending reports at which it becomes writable again.
+     *
+     *  @return kIOReturnUnsupported unless the device is coalescing,
+     *          kIOReturnBadArgument unless low < high.
+     */
+    virtual IOReturn methodSetWatermarks(UInt32 handle, UInt32 high, UInt32 low);
+    
+    /**
+     *  Tell a user client whenever a congested device becomes writable again.
+     *
+     *  @param handle     A device handle.
+     *  @param enable     Whether to subscribe or unsubscribe.
+     *  @param userClient The subscribing user client.
+     *
+     *  @return kIOReturnNoResources if the device already has the maximum
+     *          number of flow subscribers.
+     */
+    virtual IOReturn methodSubscribeFlow(UInt32 handle, bool enable, IOService *userClient);
+    
+    /**
+     *  Return the state block of a device, to be mapped into a client task.
+     *
+     *  @param handle A device handle.
+     *  @param memory Receives the state memory, with an increased reference count.
+     *
+     *  @return True on success.
+     */
+    virtual bool methodStateMemory(UInt32 handle, IOMemoryDescriptor **memory);
+    
+    /**
+     *  Start or stop delivering the state of a device at a fixed rate.
+     *
+     *  @param handle         A device handle.
+     *  @param interval_us    The interval in microseconds, 0 to stop.
+     *  @param skip_identical Whether to leave out frames identical to the last one.
+     *
+     *  @return kIOReturnBadArgument if the interval is out of bounds.
+     */
+    virtual IOReturn methodSetPolling(UInt32 handle, UInt32 interval_us, bool skip_identical);
+    
+    /**
+     *  Schedule reports for delivery at given deadlines. See 'VirtHID_Schedule.hpp' for the layout.
+     *
+     *  @param handle      A device handle.
+     *  @param records     The schedule records.
+     *  @param records_len Length of 'records'.
+     *  @param scheduled   Receives the number of reports scheduled.
+     *
+     *  @return kIOReturnSuccess if every record has been scheduled.
+     */
+    virtual IOReturn methodSchedule(UInt32 handle, unsigned char *records, UInt32 records_len,
+                                    UInt32 *scheduled);
+    
+    /**
+     *  Start or stop capturing the input reports of a device.
+     *
+     *  @param handle A device handle.
+     *  @param enable Whether to capture.
+     *
+     *  @return kIOReturnSuccess on success.
+     */
+    virtual IOReturn methodSetCapture(UInt32 handle, bool enable);
+    
+    /**
+     *  Move captured log bytes out of a device. See 'VirtHID_Log.hpp' for the format.
+     *
+     *  @param handle  A device handle.
+     *  @param buf     Receives the log bytes.
+     *  @param buf_len Length of 'buf'.
+     *  @param copied  Receives the number of bytes copied.
+     *  @param dropped Receives the number of reports lost since the last read.
+     *
+     *  @return kIOReturnSuccess on success.
+     */
+    virtual IOReturn methodReadCapture(UInt32 handle, unsigned char *buf, UInt32 buf_len,
+                                       UInt32 *copied, UInt32 *dropped);
+    
+    /**
+     *  Replay a report log on a device.
+     *
+     *  @param handle    A device handle.
+     *  @param log       The log.
+     *  @param log_len   Length of 'log'.
+     *  @param speed     Replay speed multiplier, 0 for as fast as possible.
+     *  @param timestamp When the call entered the driver, see 'virthid_latency_input'.
+     *  @param replayed  Receives the number of reports sent or scheduled.
+     *
+     *  @return kIOReturnSuccess if the whole log has been replayed or, with a
+     *          non-zero speed, is playing.
+     */
+    virtual IOReturn methodReplay(UInt32 handle, unsigned char *log, UInt32 log_len, UInt32 speed,
+                                  uint64_t timestamp, UInt32 *replayed);
+    
+    /**
+     *  Set the report a device answers GET_REPORT with for a type and report ID.
+     *
+     *  @param handle     A device handle.
+     *  @param type       A report type, see 'virthid_report_input'.
+     *  @param report     The report.
+     *  @param report_len Length of 'report'.
+     *
+     *  @return kIOReturnBadArgument if the device defines no such report.
+     */
+    virtual IOReturn methodSetReportState(UInt32 handle, UInt32 type, unsigned char *report, UInt32 report_len);
+    
+    /**
+     *  Press and release keys of a keyboard device, see 'virthid_key_event'.
+     *
+     *  @param handle     A device handle.
+     *  @param events     Key events.
+     *  @param events_len Length of 'events'.
+     *  @param timestamp  When the call entered the driver, see 'virthid_latency_input'.
+     *  @param sent       Receives the number of reports delivered.
+     *
+     *  @return kIOReturnUnsupported if the device has no keyboard report.
+     */
+    virtual IOReturn methodSendKeys(UInt32 handle, unsigned char *events, UInt32 events_len, uint64_t timestamp,
+                                    UInt32 *sent);
+    
+    /**
+     *  Pack input events into reports of a device, see 'virthid_input_event'.
+     *
+     *  @param handle     A device handle.
+     *  @param events     Input events.
+     *  @param events_len Length of 'events'.
+     *  @param timestamp  When the call entered the driver, see 'virthid_latency_input'.
+     *  @param sent       Receives the number of reports delivered.
+     *
+     *  @return kIOReturnUnsupported if no event maps to the device's reports.
+     */
+    virtual IOReturn methodSendEvents(UInt32 handle, unsigned char *events, UInt32 events_len, uint64_t timestamp,
+                                      UInt32 *sent);
+    
+    /**
+     *  Return the counters of a device.
+     *
+     *  @param handle A device handle.
+     *  @param stats  Receives the counters.
+     *
+     *  @return kIOReturnNotFound if there is no such device.
+     */
+    virtual IOReturn methodStats(UInt32 handle, virthid_device_stats *stats);
+    
+    /**
+     *  Return a snapshot of a device latency histogram.
+     *
+     *  @param handle    A device handle.
+     *  @param direction 'virthid_latency_input' or 'virthid_latency_output'.
+     *  @param snapshot  Receives the histogram.
+     *
+     *  @return kIOReturnBadArgument on an unknown direction.
+     */
+    virtual IOReturn methodLatency(UInt32 handle, UInt32 direction, virthid_histogram_snapshot *snapshot);
+    
+    /**
+     *  Record a latency in a device histogram, if the device still exists.
+     *
+     *  @param handle    A device handle.
+     *  @param direction 'virthid_latency_input' or 'virthid_latency_output'.
+     *  @param latency   The latency, in nanoseconds.
+     */
+    virtual void methodRecordLatency(UInt32 handle, UInt32 direction, uint64_t latency);
     
     /**
      *  Return the names of the currently managed virtual devices,
      *  separated by '\x00'.
      *
-     *  @param buf     A buffer in which to store the virtual devices' names.
+     *  @param buf     A buffer in which to store the virtual devices' names, may be
+     *                 null if 'buf_len' is zero.
      *  @param buf_len Length of 'buf'.
-     *  @param needed  A suggestion for the next size of 'buf', if currenly insufficient.
+     *  @param needed  The size 'buf' needs to hold every name, if currenly insufficient.
      *  @param items   The number of returned items.
      *
      *  @return True on success, False on insufficent buffer size.
      */
     virtual bool methodList(char *buf, UInt16 buf_len,
                             UInt16 *needed, UInt16 *items);
+    
+    /**
+     *  List the managed devices a page at a time. See 'VirtHID_List.hpp' for the layout.
+     *
+     *  @param cursor     Where to start, zero for the first page. Receives where
+     *                    the next page starts, or 'virthid_list_end'.
+     *  @param buf        Receives the entries, may be null to only read the generation.
+     *  @param buf_len    Length of 'buf'.
+     *  @param count      Receives the number of entries.
+     *  @param used       Receives the number of bytes written or, if not even
+     *                    one entry fits in 'buf', the size the next entry needs.
+     *  @param generation Receives the registry generation. Pages of a listing
+     *                    with different generations may be inconsistent.
+     *
+     *  @return kIOReturnSuccess, a short buffer is reported through 'count' and 'used'.
+     */
+    virtual IOReturn methodListEntries(UInt32 *cursor, unsigned char *buf, UInt32 buf_len,
+                                       UInt32 *count, UInt32 *used, UInt32 *generation);
 
     /**
      *  Subscribe userclient to setReport calls on the given device.
@@ -87,12 +419,87 @@ public:
      *  @return True on success.
      */
     virtual bool methodSubscribe(char *name, UInt8 name_len, IOService *userClient);
+    
+    /**
+     *  Unsubscribe userclient from every device it is subscribed to, output
+     *  reports and flow notifications alike.
+     *
+     *  @param userClient UserClient that is going away.
+     */
+    virtual void methodUnsubscribe(IOService *userClient);
+    
+    /**
+     *  Notify a user client whenever a device is created or destroyed.
+     *  Event subscribers are retained until unsubscribed.
+     *
+     *  @param userClient The subscribing user client.
+     *
+     *  @return False if there are already too many event subscribers.
+     */
+    virtual bool methodSubscribeEvents(IOService *userClient);
+    
+    /**
+     *  Stop notifying a user client of registry events, if it was.
+     *
+     *  @param userClient The subscribed user client.
+     */
+    virtual void methodUnsubscribeEvents(IOService *userClient);
+
+protected:
+    /**
+     *  Tell every event subscriber about a created or destroyed device.
+     */
+    virtual void notifyRegistryEvent(UInt32 type, it_kotleni_virthid_device *device);
+    
+    /**
+     *  Create, register and start a device. While registered the device
+     *  holds a use of its interned descriptor.
+     *
+     *  @param descriptor An interned descriptor the caller holds a use of.
+     *
+     *  @return False if the name is taken or on failure.
+     */
+    virtual bool createDevice(OSString *name, it_kotleni_virthid_report_descriptor *descriptor,
+                              OSString *serial_number, UInt32 vendor_id, UInt32 product_id,
+                              UInt32 *handle);
+    
+    /**
+     *  Return the interned descriptor with the given bytes, interning a new
+     *  one if needed, with a use for the caller.
+     *
+     *  @return The descriptor, or null if malformed or on allocation failure.
+     */
+    it_kotleni_virthid_report_descriptor *internDescriptor(const unsigned char *bytes, UInt16 length);
+    
+    /**
+     *  Drop a use of an interned descriptor, releasing it with its last use.
+     */
+    void uninternDescriptor(it_kotleni_virthid_report_descriptor *descriptor);
 
 private:
     /**
-     *  Keep track of managed/created HID devices.
+     *  Keep track of managed/created HID devices, addressed by handle or name.
+     *  Safe to use from any number of user clients at once.
+     */
+    virthid_core<it_kotleni_virthid_device, virthid_rw_lock> m_hid_devices;
+    
+    /**
+     *  User clients notified of registry events, protected by 'm_event_subscribers_lock'.
+     */
+    virthid_subscriber_set<it_kotleni_virthid_userclient> m_event_subscribers;
+    IOLock *m_event_subscribers_lock = nullptr;
+    
+    /**
+     *  Report descriptors of the managed devices, each stored once however
+     *  many devices use it. Protected by 'm_descriptors_lock'.
+     */
+    virthid_intern_table<it_kotleni_virthid_report_descriptor> m_descriptors;
+    IOLock *m_descriptors_lock = nullptr;
+    
+    /**
+     *  Work loop running the event sources of every managed device.
      */
-    OSDictionary *m_hid_devices;
+    IOWorkLoop *m_work_loop = nullptr;
 };
 
 #endif
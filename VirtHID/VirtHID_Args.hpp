@@ -0,0 +1,88 @@
+//
+//  VirtHID_Args.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_args_h
+#define virthid_args_h
+
+#include <stdint.h>
+
+/**
+ *  Unpack the scalar arguments of a selector in order. Values that do not
+ *  fit the destination are rejected instead of truncated, and the first
+ *  failure sticks, so a method unpacks everything and checks 'ok' once:
+ *
+ *      virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+ *      in.range(&name_ptr, &name_len, 1, UINT8_MAX);
+ *      in.value(&vendor_id);
+ *      if (!in.ok()) return kIOReturnBadArgument;
+ */
+class virthid_scalars {
+public:
+    virthid_scalars(const uint64_t *scalars, uint32_t count)
+        : m_scalars(scalars), m_count(count), m_next(0), m_ok(true) {}
+
+    /**
+     *  Read a value no larger than 'max', by default the largest 'V'.
+     */
+    template <typename V>
+    void value(V *out, uint64_t max = (uint64_t)(V)~0ull) {
+        uint64_t scalar = 0;
+        if (!take(&scalar) || scalar > max) {
+            m_ok = false;
+            return;
+        }
+        *out = (V)scalar;
+    }
+
+    void flag(bool *out) {
+        uint64_t scalar = 0;
+        if (take(&scalar)) *out = scalar != 0;
+    }
+
+    /**
+     *  Read a user buffer passed as an address followed by a length between
+     *  'min_len' and 'max_len'. An empty buffer may have any address.
+     */
+    template <typename P, typename L>
+    void range(P **address, L *length, uint32_t min_len, uint32_t max_len) {
+        uint64_t scalar = 0, len = 0;
+        if (!take(&scalar) || !take(&len) || len < min_len || len > max_len) {
+            m_ok = false;
+            return;
+        }
+        *address = (P *)(uintptr_t)scalar;
+        *length = (L)len;
+    }
+
+    /**
+     *  Return the number of scalars not read yet, for optional trailing arguments.
+     */
+    uint32_t remaining() const {
+        return m_next < m_count ? m_count - m_next : 0;
+    }
+
+    bool ok() const {
+        return m_ok;
+    }
+
+private:
+    bool take(uint64_t *scalar) {
+        if (m_next >= m_count) {
+            m_ok = false;
+            return false;
+        }
+        *scalar = m_scalars[m_next++];
+        return true;
+    }
+
+    const uint64_t *m_scalars;
+    uint32_t m_count;
+    uint32_t m_next;
+    bool m_ok;
+};
+
+#endif
@@ -0,0 +1,88 @@
+//
+//  VirtHID_Batch.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_batch_h
+#define virthid_batch_h
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  A batch is a sequence of records, each made of this header followed by
+ *  'length' report bytes and padded to a multiple of four bytes.
+ */
+typedef struct virthid_batch_record {
+    uint32_t handle;
+    uint16_t length;
+    uint16_t reserved;
+} virthid_batch_record;
+
+/**
+ *  Largest batch buffer accepted in a single call.
+ */
+const uint32_t virthid_max_batch = 1 << 20;
+
+/**
+ *  Return the space taken by a record carrying 'report_len' bytes.
+ */
+inline uint32_t virthid_batch_record_size(uint16_t report_len) {
+    return (sizeof(virthid_batch_record) + report_len + 3) & ~3u;
+}
+
+enum virthid_batch_result {
+    virthid_batch_end,
+    virthid_batch_next,
+    virthid_batch_truncated,
+};
+
+/**
+ *  Walk the records of a batch. Each header is copied out once before it is
+ *  validated, so the buffer may be shared with a user task.
+ */
+class virthid_batch_reader {
+public:
+    virthid_batch_reader(const uint8_t *batch, uint32_t batch_len)
+        : m_batch(batch), m_batch_len(batch_len), m_offset(0) {}
+
+    /**
+     *  Step to the next record.
+     *
+     *  @param handle     Receives the device handle.
+     *  @param report     Receives a pointer to the report bytes inside the batch.
+     *  @param report_len Receives the report length.
+     *
+     *  @return 'virthid_batch_next' with a record, 'virthid_batch_end' once the
+     *          batch is exhausted, or 'virthid_batch_truncated' if the remaining
+     *          bytes do not hold a full record.
+     */
+    virthid_batch_result next(uint32_t *handle, const uint8_t **report, uint16_t *report_len) {
+        uint32_t remaining = m_batch_len - m_offset;
+        if (remaining == 0) return virthid_batch_end;
+        if (remaining < sizeof(virthid_batch_record)) return virthid_batch_truncated;
+
+        virthid_batch_record record;
+        memcpy(&record, m_batch + m_offset, sizeof(record));
+
+        if (sizeof(record) + record.length > remaining) return virthid_batch_truncated;
+
+        *handle = record.handle;
+        *report = m_batch + m_offset + sizeof(record);
+        *report_len = record.length;
+
+        uint32_t size = virthid_batch_record_size(record.length);
+        m_offset = size < remaining ? m_offset + size : m_batch_len;
+
+        return virthid_batch_next;
+    }
+
+private:
+    const uint8_t *m_batch;
+    uint32_t m_batch_len;
+    uint32_t m_offset;
+};
+
+#endif
@@ -0,0 +1,32 @@
+//
+//  VirtHID_Clock.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_clock_h
+#define virthid_clock_h
+
+#include <IOKit/IOLib.h>
+
+/**
+ *  Kernel implementation of the clock the portable components are written
+ *  against: monotonic nanoseconds, the same timebase as CLOCK_UPTIME_RAW.
+ */
+struct virthid_uptime_clock {
+    uint64_t now() const {
+        uint64_t abstime = 0, ns = 0;
+        clock_get_uptime(&abstime);
+        absolutetime_to_nanoseconds(abstime, &ns);
+        return ns;
+    }
+
+    static uint64_t toAbsoluteTime(uint64_t ns) {
+        uint64_t abstime = 0;
+        nanoseconds_to_absolutetime(ns, &abstime);
+        return abstime;
+    }
+};
+
+#endif
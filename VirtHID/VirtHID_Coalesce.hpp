@@ -0,0 +1,196 @@
+//
+//  VirtHID_Coalesce.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_coalesce_h
+#define virthid_coalesce_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Types.hpp"
+#include "VirtHID_Descriptor.hpp"
+
+/**
+ *  Number of distinct reports a coalescing device may have pending.
+ */
+const uint32_t virthid_coalesce_depth = 8;
+
+/**
+ *  Return true if any input report of the layout carries relative data.
+ */
+inline bool virthid_has_relative_input(const virthid_report_layout *layout) {
+    for (uint32_t i = 0; i < layout->fieldCount(); i++) {
+        const virthid_field *field = layout->field(i);
+        if (layout->report(field->report)->type != virthid_report_input) continue;
+        if ((field->flags & virthid_field_variable) && (field->flags & virthid_field_relative)) return true;
+    }
+
+    return false;
+}
+
+/**
+ *  Merge 'report' into 'pending' by adding up their relative elements.
+ *
+ *  Reports only merge if they are the same input report, every other field
+ *  (buttons, absolute axes, arrays) is identical and every sum stays within
+ *  the element's logical range. So merging never loses motion nor a button
+ *  transition, it only shortens the sequence of reports.
+ *
+ *  @return True if 'report' has been merged, 'pending' is untouched otherwise.
+ */
+inline bool virthid_motion_merge(const virthid_report_layout *layout, uint8_t *pending,
+                                 const uint8_t *report, uint32_t report_len) {
+    const virthid_report_info *info = layout->find(virthid_report_input, report, report_len);
+    if (!info || info->length != report_len || !layout->hasAllFields()) return false;
+    if (layout->usesReportIds() && pending[0] != report[0]) return false;
+
+    bool has_motion = false;
+    uint32_t last_field = info->first_field + info->field_count;
+
+    for (uint32_t i = info->first_field; i < last_field; i++) {
+        const virthid_field *field = layout->field(i);
+        bool relative = (field->flags & virthid_field_variable) && (field->flags & virthid_field_relative);
+
+        for (uint32_t element = 0; element < field->count; element++) {
+            int64_t a = virthid_field_get(field, pending, element);
+            int64_t b = virthid_field_get(field, report, element);
+
+            if (!relative) {
+                if (a != b) return false;
+                continue;
+            }
+
+            int64_t sum = a + b;
+            if (sum < field->logical_min || sum > field->logical_max) return false;
+            has_motion = true;
+        }
+    }
+
+    if (!has_motion) return false;
+
+    for (uint32_t i = info->first_field; i < last_field; i++) {
+        const virthid_field *field = layout->field(i);
+        if (!(field->flags & virthid_field_variable) || !(field->flags & virthid_field_relative)) continue;
+
+        for (uint32_t element = 0; element < field->count; element++) {
+            int32_t sum = virthid_field_get(field, pending, element) + virthid_field_get(field, report, element);
+            virthid_field_set(field, pending, sum, element);
+        }
+    }
+
+    return true;
+}
+
+/**
+ *  Bounded FIFO of pending input reports where a new report is merged into
+ *  the most recent one whenever 'virthid_motion_merge' allows it.
+ *
+ *  Entries live in caller provided storage, one slot of 'stride' bytes per
+ *  entry, so the queue holds reports as large as the device's largest input
+ *  report. Not thread-safe, callers provide the locking.
+ */
+class virthid_coalesce_queue {
+public:
+    /**
+     *  Return the storage needed for reports of up to 'stride' bytes.
+     */
+    static uint32_t storageSize(uint32_t stride) {
+        return stride * virthid_coalesce_depth;
+    }
+
+    /**
+     *  Attach the storage and drop every pending report. Until then the
+     *  queue accepts nothing.
+     *
+     *  @param storage 'storageSize(stride)' bytes.
+     */
+    void init(uint8_t *storage, uint32_t stride) {
+        m_storage = storage;
+        m_stride = stride;
+        m_head = 0;
+        m_count = 0;
+    }
+
+    /**
+     *  Queue a report, merging it into the last pending one if possible.
+     *
+     *  @param layout     The layout of the device.
+     *  @param report     The report, at most 'stride' bytes.
+     *  @param report_len Length of 'report'.
+     *  @param was_empty  Set to true if the queue was empty before.
+     *  @param timestamp  When the report was sent. A merged report keeps
+     *                    the timestamp of the one it was merged into.
+     *
+     *  @return False if the report could neither be merged nor queued.
+     */
+    bool submit(const virthid_report_layout *layout, const uint8_t *report, uint32_t report_len,
+                bool *was_empty, uint64_t timestamp = 0) {
+        *was_empty = m_count == 0;
+        if (report_len > m_stride) return false;
+
+        if (m_count > 0) {
+            uint32_t last = (m_head + m_count - 1) % virthid_coalesce_depth;
+            if (m_sizes[last] == report_len && virthid_motion_merge(layout, slot(last), report, report_len)) {
+                return true;
+            }
+        }
+
+        if (m_count == virthid_coalesce_depth) return false;
+
+        uint32_t next = (m_head + m_count) % virthid_coalesce_depth;
+        memcpy(slot(next), report, report_len);
+        m_sizes[next] = report_len;
+        m_timestamps[next] = timestamp;
+        m_count++;
+
+        return true;
+    }
+
+    /**
+     *  Take the oldest pending report.
+     *
+     *  @param report     A buffer of at least 'stride' bytes.
+     *  @param report_len Receives the report length.
+     *  @param timestamp  If not null, receives the timestamp it was submitted with.
+     *
+     *  @return False if nothing is pending.
+     */
+    bool pop(uint8_t *report, uint32_t *report_len, uint64_t *timestamp = nullptr) {
+        if (m_count == 0) return false;
+
+        memcpy(report, slot(m_head), m_sizes[m_head]);
+        *report_len = m_sizes[m_head];
+        if (timestamp) *timestamp = m_timestamps[m_head];
+
+        m_head = (m_head + 1) % virthid_coalesce_depth;
+        m_count--;
+
+        return true;
+    }
+
+    uint32_t size() const {
+        return m_count;
+    }
+
+    uint32_t stride() const {
+        return m_stride;
+    }
+
+private:
+    uint8_t *slot(uint32_t index) {
+        return m_storage + index * m_stride;
+    }
+
+    uint8_t *m_storage = nullptr;
+    uint32_t m_stride = 0;
+    uint32_t m_sizes[virthid_coalesce_depth] = {};
+    uint64_t m_timestamps[virthid_coalesce_depth] = {};
+    uint32_t m_head = 0;
+    uint32_t m_count = 0;
+};
+
+#endif
@@ -0,0 +1,174 @@
+//
+//  VirtHID_Core.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_core_h
+#define virthid_core_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Registry.hpp"
+#include "VirtHID_List.hpp"
+
+/**
+ *  Platform-neutral part of the driver: the device registry, with lookup by
+ *  name and both listing formats, over any device type.
+ *
+ *  Besides what 'virthid_registry' needs, 'T' needs:
+ *
+ *      virthid_handle handle;           // As returned by 'add'.
+ *      const char *nameBytes() const;   // The name, not NUL-terminated.
+ *      uint8_t nameLength() const;
+ *      void describe(virthid_list_entry *entry) const;  // IDs, class and 'name_len'.
+ */
+template <typename T, typename Lock, uint32_t N = virthid_max_devices>
+class virthid_core : public virthid_registry<T, Lock, N> {
+    typedef virthid_registry<T, Lock, N> registry;
+
+public:
+    /**
+     *  Matches the device with a given name.
+     */
+    struct name_match {
+        const char *name;
+        uint32_t name_len;
+
+        bool operator()(const T *device) const {
+            return device->nameLength() == name_len && memcmp(device->nameBytes(), name, name_len) == 0;
+        }
+    };
+
+    /**
+     *  Register a device under its name.
+     *
+     *  @return The new handle, or 'virthid_invalid_handle' if the name is taken or if full.
+     */
+    virthid_handle add(T *device) {
+        return registry::insert(device, name_match{device->nameBytes(), device->nameLength()});
+    }
+
+    /**
+     *  Resolve a name without allocating.
+     *
+     *  @return The device with an increased reference count, or null.
+     */
+    T *copyNamed(const char *name, uint32_t name_len) {
+        if (name_len == 0) return nullptr;
+        return registry::copyMatching(name_match{name, name_len});
+    }
+
+    /**
+     *  Unregister the device with a given name. Of concurrent callers only
+     *  one gets the device, along with the registry's reference.
+     *
+     *  @return The device, or null.
+     */
+    T *removeNamed(const char *name, uint32_t name_len) {
+        T *device = copyNamed(name, name_len);
+        if (!device) return nullptr;
+
+        T *removed = registry::remove(device->handle);
+        device->release();
+
+        return removed;
+    }
+
+    /**
+     *  Write the device names, each followed by a NUL byte.
+     *
+     *  @param needed Receives the size needed to hold every name, if 'buf' is too short.
+     *  @param items  Receives the number of names written.
+     *
+     *  @return False if 'buf' is too short.
+     */
+    bool listNames(char *buf, uint16_t buf_len, uint16_t *needed, uint16_t *items) {
+        uint32_t cursor = 0;
+        uint32_t used = 0;
+        uint32_t total_len = 0;
+        T *device = nullptr;
+
+        *needed = 0;
+        *items = 0;
+
+        while ((device = registry::copyNext(&cursor))) {
+            uint8_t name_len = device->nameLength();
+
+            // Keep counting once full, so 'needed' covers every name.
+            total_len += name_len + 1;
+            if (total_len <= buf_len) {
+                memcpy(buf + used, device->nameBytes(), name_len);
+                buf[used + name_len] = 0;
+                used += name_len + 1;
+                (*items)++;
+            }
+
+            device->release();
+        }
+
+        if (total_len > buf_len) {
+            *needed = total_len > UINT16_MAX ? UINT16_MAX : (uint16_t)total_len;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     *  Write a page of list entries, see 'VirtHID_List.hpp'.
+     *
+     *  @param cursor     Where to start, zero for the first page. Receives where
+     *                    the next page starts, or 'virthid_list_end'.
+     *  @param buf        Receives the entries, may be null to only read the generation.
+     *  @param used       Receives the bytes written or, if not even one entry
+     *                    fits in 'buf', the size the next entry needs.
+     *  @param generation Receives the registry generation.
+     *
+     *  @return False if not even one entry fits in 'buf'.
+     */
+    bool listEntries(uint32_t *cursor, uint8_t *buf, uint32_t buf_len,
+                     uint32_t *count, uint32_t *used, uint32_t *generation) {
+        virthid_list_writer writer(buf, buf ? buf_len : 0);
+        virthid_list_entry entry = {};
+        uint32_t position = *cursor;
+        uint32_t previous = position;
+        bool more = false;
+        T *device = nullptr;
+
+        *count = 0;
+        *used = 0;
+        *generation = registry::generation();
+
+        if (!buf || position == virthid_list_end) return true;
+
+        while ((device = registry::copyNext(&position, &entry.handle))) {
+            device->describe(&entry);
+
+            bool added = writer.append(&entry, device->nameBytes());
+            device->release();
+
+            // Resume from this device on the next page.
+            if (!added) {
+                position = previous;
+                more = true;
+                break;
+            }
+            previous = position;
+        }
+
+        *count = writer.count();
+        *used = writer.used();
+        *cursor = more ? position : virthid_list_end;
+
+        if (more && writer.count() == 0) {
+            *used = virthid_list_entry_size(entry.name_len);
+            return false;
+        }
+        return true;
+    }
+
+};
+
+#endif
@@ -0,0 +1,423 @@
+//
+//  VirtHID_Descriptor.cpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include <string.h>
+
+#include "VirtHID_Descriptor.hpp"
+
+/**
+ *  Item types and tags, as defined by the HID specification (6.2.2).
+ */
+enum {
+    item_type_main = 0,
+    item_type_global = 1,
+    item_type_local = 2,
+};
+
+enum {
+    main_input = 0x8,
+    main_output = 0x9,
+    main_collection = 0xa,
+    main_feature = 0xb,
+    main_end_collection = 0xc,
+};
+
+enum {
+    global_usage_page = 0x0,
+    global_logical_min = 0x1,
+    global_logical_max = 0x2,
+    global_report_size = 0x7,
+    global_report_id = 0x8,
+    global_report_count = 0x9,
+    global_push = 0xa,
+    global_pop = 0xb,
+};
+
+enum {
+    local_usage = 0x0,
+    local_usage_min = 0x1,
+    local_usage_max = 0x2,
+};
+
+const uint32_t max_push_depth = 4;
+const uint32_t max_usages = 16;
+const uint32_t max_report_bits = 8 * 0xffff;
+
+struct globals {
+    uint32_t usage_page;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint32_t report_size;
+    uint32_t report_count;
+    uint32_t report_id;
+};
+
+struct virthid_report_layout::state {
+    globals global;
+    globals stack[max_push_depth];
+    uint32_t stack_depth;
+
+    // Usages are kept extended, with the page in the high 16 bits. A page of
+    // zero means the usage was short and takes the page of the main item.
+    uint32_t usages[max_usages];
+    uint32_t usage_count;
+    uint32_t usage_min;
+    uint32_t usage_max;
+    bool has_usage_min;
+    bool has_usage_max;
+
+    void clearLocals() {
+        usage_count = 0;
+        has_usage_min = false;
+        has_usage_max = false;
+    }
+
+    uint32_t resolve(uint32_t usage) const {
+        return (usage >> 16) ? usage : ((global.usage_page << 16) | usage);
+    }
+
+    /**
+     *  Return the extended usage of element 'i' of a variable main item.
+     */
+    uint32_t usageAt(uint32_t i) const {
+        if (i < usage_count) return resolve(usages[i]);
+
+        if (has_usage_min && has_usage_max) {
+            uint32_t min = resolve(usage_min), max = resolve(usage_max);
+            uint32_t usage = min + (i - usage_count);
+            return usage <= max ? usage : max;
+        }
+
+        return usage_count ? resolve(usages[usage_count - 1]) : 0;
+    }
+};
+
+void virthid_report_layout::reset() {
+    memset(m_index, 0, sizeof(m_index));
+    memset(m_max_length, 0, sizeof(m_max_length));
+    m_report_count = 0;
+    m_field_count = 0;
+    m_uses_ids = false;
+    m_valid = false;
+    m_fields_complete = true;
+    m_class = virthid_class_other;
+}
+
+virthid_parse_result virthid_report_layout::parse(const uint8_t *descriptor, uint32_t descriptor_len) {
+    state st;
+    uint32_t collection_depth = 0;
+    uint32_t pos = 0;
+
+    reset();
+    memset(&st, 0, sizeof(st));
+
+    while (pos < descriptor_len) {
+        uint8_t prefix = descriptor[pos++];
+
+        // Long items carry no information we use, skip them.
+        if (prefix == 0xfe) {
+            if (pos + 2 > descriptor_len) return virthid_parse_malformed;
+            pos += 2 + descriptor[pos];
+            if (pos > descriptor_len) return virthid_parse_malformed;
+            continue;
+        }
+
+        uint32_t size = prefix & 0x3;
+        if (size == 3) size = 4;
+        if (pos + size > descriptor_len) return virthid_parse_malformed;
+
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < size; i++) {
+            value |= (uint32_t)descriptor[pos + i] << (8 * i);
+        }
+        int32_t svalue = (int32_t)value;
+        if (size == 1) svalue = (int8_t)value;
+        if (size == 2) svalue = (int16_t)value;
+        pos += size;
+
+        uint8_t type = (prefix >> 2) & 0x3;
+        uint8_t tag = prefix >> 4;
+
+        switch (type) {
+            case item_type_main: {
+                virthid_parse_result result = virthid_parse_ok;
+
+                switch (tag) {
+                    case main_input:
+                        result = addMainItem(virthid_report_input, value, &st);
+                        break;
+                    case main_output:
+                        result = addMainItem(virthid_report_output, value, &st);
+                        break;
+                    case main_feature:
+                        result = addMainItem(virthid_report_feature, value, &st);
+                        break;
+                    case main_collection:
+                        // Classify by the first recognized application collection.
+                        if (collection_depth == 0 && value == 0x01 && m_class == virthid_class_other) {
+                            uint32_t usage = st.usageAt(0);
+                            if (usage == 0x00010001 || usage == 0x00010002) {
+                                m_class = virthid_class_mouse;
+                            } else if (usage == 0x00010006 || usage == 0x00010007) {
+                                m_class = virthid_class_keyboard;
+                            } else if (usage == 0x00010004 || usage == 0x00010005 || usage == 0x00010008) {
+                                m_class = virthid_class_gamepad;
+                            }
+                        }
+                        collection_depth++;
+                        break;
+                    case main_end_collection:
+                        if (collection_depth == 0) return virthid_parse_malformed;
+                        collection_depth--;
+                        break;
+                    default:
+                        return virthid_parse_malformed;
+                }
+
+                if (result != virthid_parse_ok) return result;
+                st.clearLocals();
+                break;
+            }
+            case item_type_global:
+                switch (tag) {
+                    case global_usage_page:
+                        st.global.usage_page = value & 0xffff;
+                        break;
+                    case global_logical_min:
+                        st.global.logical_min = svalue;
+                        break;
+                    case global_logical_max:
+                        st.global.logical_max = svalue;
+                        break;
+                    case global_report_size:
+                        if (value == 0 || value > 32) return virthid_parse_malformed;
+                        st.global.report_size = value;
+                        break;
+                    case global_report_id:
+                        if (value == 0 || value > 0xff) return virthid_parse_malformed;
+                        // IDs must be declared before any report, or by none at all.
+                        if (!m_uses_ids && m_report_count > 0) return virthid_parse_malformed;
+                        st.global.report_id = value;
+                        m_uses_ids = true;
+                        break;
+                    case global_report_count:
+                        if (value > max_report_bits) return virthid_parse_malformed;
+                        st.global.report_count = value;
+                        break;
+                    case global_push:
+                        if (st.stack_depth == max_push_depth) return virthid_parse_malformed;
+                        st.stack[st.stack_depth++] = st.global;
+                        break;
+                    case global_pop:
+                        if (st.stack_depth == 0) return virthid_parse_malformed;
+                        st.global = st.stack[--st.stack_depth];
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            case item_type_local: {
+                // Short usages stay page-less until the main item resolves them.
+                uint32_t usage = size == 4 ? value : value & 0xffff;
+
+                switch (tag) {
+                    case local_usage:
+                        if (st.usage_count < max_usages) st.usages[st.usage_count++] = usage;
+                        break;
+                    case local_usage_min:
+                        st.usage_min = usage;
+                        st.has_usage_min = true;
+                        break;
+                    case local_usage_max:
+                        st.usage_max = usage;
+                        st.has_usage_max = true;
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            }
+            default:
+                return virthid_parse_malformed;
+        }
+    }
+
+    if (collection_depth != 0) return virthid_parse_malformed;
+
+    finish();
+    m_valid = true;
+
+    return virthid_parse_ok;
+}
+
+virthid_parse_result virthid_report_layout::addMainItem(uint8_t type, uint32_t flags, state *st) {
+    const globals &g = st->global;
+    uint32_t bits = g.report_size * g.report_count;
+
+    if (bits == 0) return virthid_parse_ok;
+
+    uint8_t index = m_index[type][g.report_id];
+    if (!index) {
+        if (m_report_count == virthid_max_reports) return virthid_parse_too_complex;
+
+        virthid_report_info *info = &m_reports[m_report_count++];
+        memset(info, 0, sizeof(*info));
+        info->type = type;
+        info->id = (uint8_t)g.report_id;
+
+        index = (uint8_t)m_report_count;
+        m_index[type][g.report_id] = index;
+    }
+
+    virthid_report_info *info = &m_reports[index - 1];
+    uint32_t offset = info->bit_length;
+
+    if (offset + bits > max_report_bits) return virthid_parse_malformed;
+    info->bit_length += bits;
+
+    // Padding takes room in the report but needs no field.
+    if (flags & virthid_field_constant) return virthid_parse_ok;
+
+    // A logical range that starts at zero or above is unsigned.
+    int32_t logical_max = g.logical_max;
+    if (g.logical_min >= 0 && logical_max < 0 && g.report_size < 32) {
+        logical_max = (int32_t)((uint32_t)logical_max & ((1u << g.report_size) - 1));
+    }
+
+    // Arrays get a single field, variables one field per run of usages.
+    uint32_t element = 0;
+    while (element < g.report_count) {
+        uint32_t first = st->usageAt(element);
+        uint32_t last = first;
+        uint32_t count = 1;
+
+        if (flags & virthid_field_variable) {
+            bool repeating = false;
+            while (element + count < g.report_count) {
+                uint32_t usage = st->usageAt(element + count);
+                if (usage == last) {
+                    repeating = true;
+                } else if (!repeating && usage == last + 1 && (usage >> 16) == (first >> 16)) {
+                    last = usage;
+                } else {
+                    break;
+                }
+                count++;
+            }
+        } else {
+            count = g.report_count;
+            if (st->has_usage_min && st->has_usage_max) {
+                first = st->resolve(st->usage_min);
+                last = st->resolve(st->usage_max);
+            } else if (st->usage_count > 0) {
+                last = st->resolve(st->usages[st->usage_count - 1]);
+            }
+            if ((last >> 16) != (first >> 16) || last < first) last = first;
+        }
+
+        if (m_field_count < virthid_max_fields) {
+            virthid_field *field = &m_fields[m_field_count++];
+            field->usage_page = (uint16_t)(first >> 16);
+            field->usage_min = (uint16_t)first;
+            field->usage_max = (uint16_t)last;
+            field->count = (uint16_t)count;
+            field->bit_offset = offset + element * g.report_size;
+            field->bit_size = (uint8_t)g.report_size;
+            field->flags = (uint8_t)(flags & (virthid_field_variable | virthid_field_relative));
+            field->report = index - 1;
+            field->reserved = 0;
+            field->logical_min = g.logical_min;
+            field->logical_max = logical_max;
+        } else {
+            m_fields_complete = false;
+        }
+
+        element += count;
+    }
+
+    return virthid_parse_ok;
+}
+
+void virthid_report_layout::finish() {
+    // Group fields by report, keeping their order within each report.
+    for (uint32_t i = 1; i < m_field_count; i++) {
+        virthid_field field = m_fields[i];
+        uint32_t j = i;
+        while (j > 0 && m_fields[j - 1].report > field.report) {
+            m_fields[j] = m_fields[j - 1];
+            j--;
+        }
+        m_fields[j] = field;
+    }
+
+    for (uint32_t i = 0; i < m_report_count; i++) {
+        virthid_report_info *info = &m_reports[i];
+        info->length = (uint16_t)((m_uses_ids ? 1 : 0) + (info->bit_length + 7) / 8);
+        info->field_count = 0;
+
+        if (info->length > m_max_length[info->type]) m_max_length[info->type] = info->length;
+    }
+
+    for (uint32_t i = m_field_count; i-- > 0;) {
+        virthid_field *field = &m_fields[i];
+        if (m_uses_ids) field->bit_offset += 8;
+
+        virthid_report_info *info = &m_reports[field->report];
+        info->first_field = (uint16_t)i;
+        info->field_count++;
+    }
+}
+
+const virthid_field *virthid_report_layout::findField(const virthid_report_info *info, uint16_t usage_page,
+                                                      uint16_t usage, uint32_t *element) const {
+    if (!info) return nullptr;
+
+    for (uint32_t i = info->first_field; i < info->first_field + info->field_count; i++) {
+        const virthid_field *field = &m_fields[i];
+        if (field->usage_page != usage_page) continue;
+        if (usage < field->usage_min || usage > field->usage_max) continue;
+
+        if (element) {
+            *element = (field->flags & virthid_field_variable) ? usage - field->usage_min : 0;
+        }
+        return field;
+    }
+
+    return nullptr;
+}
+
+int32_t virthid_field_get(const virthid_field *field, const uint8_t *report, uint32_t element) {
+    uint32_t offset = field->bit_offset + element * field->bit_size;
+    uint64_t raw = 0;
+
+    for (uint32_t i = 0; i < field->bit_size; i++) {
+        uint32_t bit = offset + i;
+        raw |= (uint64_t)((report[bit >> 3] >> (bit & 7)) & 1) << i;
+    }
+
+    // Sign-extend fields whose logical range goes negative.
+    if (field->logical_min < 0 && field->bit_size < 32 && (raw & (1ull << (field->bit_size - 1)))) {
+        raw |= ~0ull << field->bit_size;
+    }
+
+    return (int32_t)raw;
+}
+
+void virthid_field_set(const virthid_field *field, uint8_t *report, int32_t value, uint32_t element) {
+    uint32_t offset = field->bit_offset + element * field->bit_size;
+    uint32_t raw = (uint32_t)value;
+
+    for (uint32_t i = 0; i < field->bit_size; i++) {
+        uint32_t bit = offset + i;
+        uint8_t mask = (uint8_t)(1 << (bit & 7));
+        if ((raw >> i) & 1) {
+            report[bit >> 3] |= mask;
+        } else {
+            report[bit >> 3] &= (uint8_t)~mask;
+        }
+    }
+}
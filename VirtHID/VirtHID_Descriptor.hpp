@@ -0,0 +1,201 @@
+//
+//  VirtHID_Descriptor.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_descriptor_h
+#define virthid_descriptor_h
+
+#include <stdint.h>
+
+/**
+ *  Report types, in the same order as 'IOHIDReportType'.
+ */
+enum {
+    virthid_report_input = 0,
+    virthid_report_output,
+    virthid_report_feature,
+
+    virthid_report_type_count
+};
+
+/**
+ *  Device class derived from the first recognized top-level application collection.
+ */
+enum virthid_device_class {
+    virthid_class_other = 0,
+    virthid_class_mouse,
+    virthid_class_keyboard,
+    virthid_class_gamepad,
+};
+
+enum virthid_parse_result {
+    virthid_parse_ok = 0,
+    virthid_parse_malformed,
+    virthid_parse_too_complex,
+};
+
+/**
+ *  Main item flags kept in 'virthid_field::flags'.
+ */
+enum {
+    virthid_field_constant = 1 << 0,
+    virthid_field_variable = 1 << 1,
+    virthid_field_relative = 1 << 2,
+};
+
+/**
+ *  Limits of a parsed layout. Descriptors with more distinct reports are
+ *  reported as too complex, extra fields are not recorded.
+ */
+const uint32_t virthid_max_reports = 32;
+const uint32_t virthid_max_fields = 64;
+
+/**
+ *  A run of 'count' report elements of 'bit_size' bits each, starting at
+ *  'bit_offset' from the start of the report (report ID included).
+ *
+ *  For variable fields element 'i' has usage min(usage_min + i, usage_max).
+ *  For array fields each element holds one usage of [usage_min, usage_max].
+ */
+typedef struct virthid_field {
+    uint16_t usage_page;
+    uint16_t usage_min;
+    uint16_t usage_max;
+    uint16_t count;
+    uint32_t bit_offset;
+    uint8_t bit_size;
+    uint8_t flags;
+    uint8_t report;
+    uint8_t reserved;
+    int32_t logical_min;
+    int32_t logical_max;
+} virthid_field;
+
+/**
+ *  A report of a given type and ID, and the fields it is made of.
+ */
+typedef struct virthid_report_info {
+    uint8_t type;
+    uint8_t id;
+    uint16_t length;
+    uint16_t first_field;
+    uint16_t field_count;
+    uint32_t bit_length;
+} virthid_report_info;
+
+/**
+ *  Compact description of the reports defined by a HID report descriptor,
+ *  built once by 'parse' and then queried in O(1).
+ */
+class virthid_report_layout {
+public:
+    virthid_report_layout() {
+        reset();
+    }
+
+    void reset();
+
+    /**
+     *  Parse a report descriptor.
+     *
+     *  @param descriptor     The report descriptor.
+     *  @param descriptor_len Length of 'descriptor'.
+     *
+     *  @return 'virthid_parse_malformed' if the descriptor is not valid, or
+     *          'virthid_parse_too_complex' if it exceeds 'virthid_max_reports'.
+     *          Only after 'virthid_parse_ok' does the layout validate reports.
+     */
+    virthid_parse_result parse(const uint8_t *descriptor, uint32_t descriptor_len);
+
+    /**
+     *  Return the report of the given type and ID, or null.
+     */
+    const virthid_report_info *find(uint8_t type, uint8_t id) const {
+        if (type >= virthid_report_type_count) return nullptr;
+
+        uint8_t index = m_index[type][id];
+        return index ? &m_reports[index - 1] : nullptr;
+    }
+
+    /**
+     *  Return the report a raw report buffer refers to, or null.
+     */
+    const virthid_report_info *find(uint8_t type, const uint8_t *report, uint32_t report_len) const {
+        if (report_len == 0) return nullptr;
+        return find(type, m_uses_ids ? report[0] : 0);
+    }
+
+    /**
+     *  Check that a report has a known ID and the exact length of that report.
+     *  Always true if the descriptor could not be fully parsed.
+     */
+    bool validate(uint8_t type, const uint8_t *report, uint32_t report_len) const {
+        if (!m_valid) return true;
+
+        const virthid_report_info *info = find(type, report, report_len);
+        return info && info->length == report_len;
+    }
+
+    /**
+     *  Return the length of the largest report of a type, report ID included.
+     */
+    uint32_t maxReportLength(uint8_t type) const {
+        return type < virthid_report_type_count ? m_max_length[type] : 0;
+    }
+
+    /**
+     *  Return the first field of a report that carries the given usage, or null.
+     *
+     *  @param element Receives the index of the element holding the usage.
+     */
+    const virthid_field *findField(const virthid_report_info *info, uint16_t usage_page,
+                                   uint16_t usage, uint32_t *element = nullptr) const;
+
+    const virthid_field *field(uint32_t index) const {
+        return index < m_field_count ? &m_fields[index] : nullptr;
+    }
+
+    const virthid_report_info *report(uint32_t index) const {
+        return index < m_report_count ? &m_reports[index] : nullptr;
+    }
+
+    uint32_t reportCount() const { return m_report_count; }
+    uint32_t fieldCount() const { return m_field_count; }
+    bool usesReportIds() const { return m_uses_ids; }
+    bool isValid() const { return m_valid; }
+    bool hasAllFields() const { return m_fields_complete; }
+    virthid_device_class deviceClass() const { return m_class; }
+
+private:
+    struct state;
+
+    virthid_parse_result addMainItem(uint8_t type, uint32_t flags, state *st);
+    void finish();
+
+    virthid_report_info m_reports[virthid_max_reports];
+    virthid_field m_fields[virthid_max_fields];
+    uint8_t m_index[virthid_report_type_count][256];
+    uint32_t m_max_length[virthid_report_type_count];
+    uint32_t m_report_count;
+    uint32_t m_field_count;
+    bool m_uses_ids;
+    bool m_valid;
+    bool m_fields_complete;
+    virthid_device_class m_class;
+};
+
+/**
+ *  Read element 'element' of a field from a report. The caller guarantees
+ *  the report is as long as the field's report.
+ */
+int32_t virthid_field_get(const virthid_field *field, const uint8_t *report, uint32_t element = 0);
+
+/**
+ *  Write element 'element' of a field into a report, truncated to the field size.
+ */
+void virthid_field_set(const virthid_field *field, uint8_t *report, int32_t value, uint32_t element = 0);
+
+#endif
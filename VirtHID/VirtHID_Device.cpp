@@ -7,11 +7,31 @@
 
 #include <IOKit/IOLib.h>
 #include "VirtHID_Device.hpp"
+#include "VirtHID_Ring.hpp"
+#include "VirtHID_OutputRing.hpp"
 #include "debug.h"
 
 #define super IOHIDDevice
 OSDefineMetaClassAndStructors(it_kotleni_virthid_device, IOHIDDevice)
 
+/**
+ *  Events copied out of the caller's buffer, or key events translated to
+ *  input events, at a time.
+ */
+static const UInt32 virthid_event_chunk = 32;
+
+/**
+ *  Hands the reports of a 'virthid_encoder' to the HID stack.
+ */
+struct virthid_device_sink {
+    it_kotleni_virthid_device *device;
+    uint64_t timestamp;
+    
+    bool send(const uint8_t *report, uint32_t report_len) {
+        return device->sendInputReport(report, (UInt16)report_len, timestamp);
+    }
+};
+
 bool it_kotleni_virthid_device::init(OSDictionary *dict) {
     LogD("Initializing a new virtual HID device.");
     
@@ -19,6 +39,62 @@ bool it_kotleni_virthid_device::init(OSDictionary *dict) {
         return false;
     }
     
+    m_input_ring_lock = IOLockAlloc();
+    if (!m_input_ring_lock) {
+        return false;
+    }
+    
+    m_subscribers_lock = IOLockAlloc();
+    if (!m_subscribers_lock) {
+        return false;
+    }
+    
+    m_coalesce_lock = IOLockAlloc();
+    if (!m_coalesce_lock) {
+        return false;
+    }
+    
+    m_schedule_lock = IOLockAlloc();
+    if (!m_schedule_lock) {
+        return false;
+    }
+    
+    m_capture_lock = IOLockAlloc();
+    if (!m_capture_lock) {
+        return false;
+    }
+    
+    m_poll_lock = IOLockAlloc();
+    if (!m_poll_lock) {
+        return false;
+    }
+    
+    // Sized from the layout, which is set before 'init'.
+    m_report_cache_size = virthid_report_cache::storageSize(reportLayout);
+    if (m_report_cache_size > 0) {
+        m_report_cache_storage = (uint8_t *)IOMalloc(m_report_cache_size);
+        if (!m_report_cache_storage) {
+            return false;
+        }
+    }
+    m_report_cache.init(reportLayout, m_report_cache_storage);
+    
+    m_encoder_lock = IOLockAlloc();
+    if (!m_encoder_lock) {
+        return false;
+    }
+    
+    m_encoder = (virthid_encoder *)IOMalloc(sizeof(virthid_encoder));
+    if (!m_encoder) {
+        return false;
+    }
+    
+    // Events are only accepted if the descriptor has reports they map to.
+    if (!m_encoder->init(reportLayout)) {
+        IOFree(m_encoder, sizeof(*m_encoder));
+        m_encoder = nullptr;
+    }
+    
     if (isMouse) {
         setProperty("HIDDefaultBehavior", "Mouse");
     } else if (isKeyboard) {
@@ -30,21 +106,159 @@ bool it_kotleni_virthid_device::init(OSDictionary *dict) {
 
 bool it_kotleni_virthid_device::start(IOService *provider) {
     LogD("Executing 'it_kotleni_virthid_device::start()'.");
-    return super::start(provider);
+    
+    // Preallocate the input report buffers before the HID stack can call us.
+    UInt32 count = 0;
+    m_report_buffer_capacity = reportLayout->isValid() ?
+        reportLayout->maxReportLength(virthid_report_input) : virthid_max_report;
+    for (; m_report_buffer_capacity > 0 && count < virthid_report_pool_size; count++) {
+        m_report_buffers[count] = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0,
+                                                                              m_report_buffer_capacity);
+        if (!m_report_buffers[count]) break;
+    }
+    m_report_pool.fill(count);
+    
+    // Devices without input reports need no buffers.
+    if (count == 0 && m_report_buffer_capacity > 0) {
+        LogD("Unable to allocate report buffers.");
+        return false;
+    }
+    
+    // Event sources run on the driver's work loop, shared by every device.
+    m_work_loop = provider->getWorkLoop();
+    if (!m_work_loop) {
+        return false;
+    }
+    m_work_loop->retain();
+    
+    m_coalesce_source = IOInterruptEventSource::interruptEventSource(this, &it_kotleni_virthid_device::sDrainCoalescedReports);
+    if (!m_coalesce_source) {
+        goto fail;
+    }
+    
+    if (m_work_loop->addEventSource(m_coalesce_source) != kIOReturnSuccess) {
+        m_coalesce_source->release();
+        m_coalesce_source = nullptr;
+        goto fail;
+    }
+    
+    m_schedule_timer = IOTimerEventSource::timerEventSource(this, &it_kotleni_virthid_device::sDispatchScheduledReports);
+    if (!m_schedule_timer) {
+        goto fail;
+    }
+    
+    if (m_work_loop->addEventSource(m_schedule_timer) != kIOReturnSuccess) {
+        m_schedule_timer->release();
+        m_schedule_timer = nullptr;
+        goto fail;
+    }
+    
+    m_poll_timer = IOTimerEventSource::timerEventSource(this, &it_kotleni_virthid_device::sDispatchPolledReport);
+    if (!m_poll_timer) {
+        goto fail;
+    }
+    
+    if (m_work_loop->addEventSource(m_poll_timer) != kIOReturnSuccess) {
+        m_poll_timer->release();
+        m_poll_timer = nullptr;
+        goto fail;
+    }
+    
+    m_stats_timer = IOTimerEventSource::timerEventSource(this, &it_kotleni_virthid_device::sPublishStats);
+    if (!m_stats_timer) {
+        goto fail;
+    }
+    
+    if (m_work_loop->addEventSource(m_stats_timer) != kIOReturnSuccess) {
+        m_stats_timer->release();
+        m_stats_timer = nullptr;
+        goto fail;
+    }
+    
+    if (super::start(provider)) return true;
+    
+fail:
+    // The work loop must not call into a device that never started.
+    removeEventSources();
+    return false;
 }
 
 void it_kotleni_virthid_device::stop(IOService *provider) {
     LogD("Executing 'it_kotleni_virthid_device::stop()'.");
     
+    removeEventSources();
+    
     super::stop(provider);
 }
 
+void it_kotleni_virthid_device::removeEventSources() {
+    if (m_coalesce_source) {
+        m_coalesce_source->disable();
+        m_work_loop->removeEventSource(m_coalesce_source);
+    }
+    
+    if (m_schedule_timer) {
+        m_schedule_timer->cancelTimeout();
+        m_work_loop->removeEventSource(m_schedule_timer);
+    }
+    
+    if (m_poll_timer) {
+        IOLockLock(m_poll_lock);
+        m_polling = false;
+        IOLockUnlock(m_poll_lock);
+        
+        m_poll_timer->cancelTimeout();
+        m_work_loop->removeEventSource(m_poll_timer);
+    }
+    
+    if (m_stats_timer) {
+        m_stats_timer->cancelTimeout();
+        m_work_loop->removeEventSource(m_stats_timer);
+    }
+}
+
 void it_kotleni_virthid_device::free() {
     LogD("Executing 'it_kotleni_virthid_device::free()'.");
     
-    if (reportDescriptor) IOFree(reportDescriptor, reportDescriptor_len);
+    if (reportDescriptor) reportDescriptor->release();
     if (m_name) m_name->release();
     if (m_serial_number_string) m_serial_number_string->release();
+    if (m_vendor_id) m_vendor_id->release();
+    if (m_product_id) m_product_id->release();
+    if (m_input_ring) m_input_ring->release();
+    if (m_input_ring_lock) IOLockFree(m_input_ring_lock);
+    if (m_subscribers_lock) IOLockFree(m_subscribers_lock);
+    if (m_coalesce_lock) IOLockFree(m_coalesce_lock);
+    if (m_coalesce_storage) IOFree(m_coalesce_storage, m_coalesce_storage_size);
+    if (m_coalesce_source) m_coalesce_source->release();
+    if (m_schedule_timer) m_schedule_timer->release();
+    if (m_stats_timer) m_stats_timer->release();
+    if (m_poll_timer) m_poll_timer->release();
+    if (m_state) m_state->release();
+    if (m_poll_storage) IOFree(m_poll_storage, 2 * m_poll_capacity);
+    if (m_poll_lock) IOLockFree(m_poll_lock);
+    if (m_schedule) IOFree(m_schedule, m_schedule_size);
+    if (m_replay_log) IOFree(m_replay_log, m_replay_log_len);
+    if (m_schedule_lock) IOLockFree(m_schedule_lock);
+    if (m_capture_buffer) IOFree(m_capture_buffer, virthid_capture_size);
+    if (m_capture_lock) IOLockFree(m_capture_lock);
+    if (m_report_cache_storage) IOFree(m_report_cache_storage, m_report_cache_size);
+    if (m_encoder) IOFree(m_encoder, sizeof(*m_encoder));
+    if (m_encoder_lock) IOLockFree(m_encoder_lock);
+    if (m_work_loop) m_work_loop->release();
+    while (m_subscribers.count() > 0) {
+        it_kotleni_virthid_userclient *subscriber = m_subscribers.at(0);
+        m_subscribers.remove(subscriber);
+        subscriber->release();
+    }
+    while (m_flow_subscribers.count() > 0) {
+        it_kotleni_virthid_userclient *subscriber = m_flow_subscribers.at(0);
+        m_flow_subscribers.remove(subscriber);
+        subscriber->release();
+    }
+    for (UInt32 i = 0; i < virthid_report_pool_size; i++) {
+        if (m_report_buffers[i]) m_report_buffers[i]->release();
+    }
     
     super::free();
 }
@@ -53,8 +267,726 @@ OSString *it_kotleni_virthid_device::name() {
     return m_name;
 }
 
-void it_kotleni_virthid_device::subscribe(IOService *userClient) {
-    m_user_client = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+const char *it_kotleni_virthid_device::nameBytes() const {
+    return m_name ? m_name->getCStringNoCopy() : "";
+}
+
+UInt8 it_kotleni_virthid_device::nameLength() const {
+    return m_name ? (UInt8)m_name->getLength() : 0;
+}
+
+void it_kotleni_virthid_device::describe(virthid_list_entry *entry) const {
+    entry->vendor_id = vendorID();
+    entry->product_id = productID();
+    entry->device_class = reportLayout->deviceClass();
+    entry->name_len = nameLength();
+}
+
+UInt32 it_kotleni_virthid_device::vendorID() const {
+    return m_vendor_id ? m_vendor_id->unsigned32BitValue() : 0;
+}
+
+UInt32 it_kotleni_virthid_device::productID() const {
+    return m_product_id ? m_product_id->unsigned32BitValue() : 0;
+}
+
+bool it_kotleni_virthid_device::subscribe(IOService *userClient) {
+    it_kotleni_virthid_userclient *subscriber = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+    bool added = false;
+    bool ret = false;
+    
+    if (!subscriber) return false;
+    
+    IOLockLock(m_subscribers_lock);
+    ret = m_subscribers.add(subscriber, &added);
+    if (added) subscriber->retain();
+    IOLockUnlock(m_subscribers_lock);
+    
+    return ret;
+}
+
+void it_kotleni_virthid_device::unsubscribe(IOService *userClient) {
+    it_kotleni_virthid_userclient *subscriber = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+    bool removed = false;
+    
+    if (!subscriber) return;
+    
+    IOLockLock(m_subscribers_lock);
+    removed = m_subscribers.remove(subscriber);
+    IOLockUnlock(m_subscribers_lock);
+    
+    if (removed) subscriber->release();
+    
+    unsubscribeFlow(userClient);
+}
+
+bool it_kotleni_virthid_device::subscribeFlow(IOService *userClient) {
+    it_kotleni_virthid_userclient *subscriber = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+    bool added = false;
+    bool ret = false;
+    
+    if (!subscriber) return false;
+    
+    IOLockLock(m_subscribers_lock);
+    ret = m_flow_subscribers.add(subscriber, &added);
+    if (added) subscriber->retain();
+    IOLockUnlock(m_subscribers_lock);
+    
+    return ret;
+}
+
+void it_kotleni_virthid_device::unsubscribeFlow(IOService *userClient) {
+    it_kotleni_virthid_userclient *subscriber = OSDynamicCast(it_kotleni_virthid_userclient, userClient);
+    bool removed = false;
+    
+    if (!subscriber) return;
+    
+    IOLockLock(m_subscribers_lock);
+    removed = m_flow_subscribers.remove(subscriber);
+    IOLockUnlock(m_subscribers_lock);
+    
+    if (removed) subscriber->release();
+}
+
+bool it_kotleni_virthid_device::sendInputReport(const unsigned char *report, UInt16 report_len, uint64_t timestamp,
+                                                UInt32 *depth, UInt32 *flow) {
+    bool sent = false;
+    bool queued = false;
+    bool was_empty = false;
+    UInt32 backlog = 0;
+    UInt32 before = 0;
+    uint32_t state = virthid_flow_clear;
+    
+    if (!reportLayout->validate(virthid_report_input, report, report_len)) {
+        LogD("Rejecting report of size %d, it does not match the report descriptor.", (int)report_len);
+        virthid_stat_add(&m_stats.reports_rejected);
+        statsChanged();
+        return false;
+    }
+    
+    // Delivered before returning, so only what the work loop has yet to drain is pending.
+    if (!__atomic_load_n(&m_coalescing, __ATOMIC_RELAXED)) {
+        sent = dispatchInputReport(report, report_len, timestamp);
+        if (!sent) return false;
+        
+        if (depth) *depth = m_flow.depth();
+        if (flow) *flow = m_flow.state();
+        return true;
+    }
+    
+    IOLockLock(m_coalesce_lock);
+    before = m_coalesce_queue.size();
+    queued = m_coalesce_queue.submit(reportLayout, report, report_len, &was_empty, timestamp);
+    virthid_stat_max(&m_stats.coalesce_high_water, m_coalesce_queue.size());
+    
+    // A report merged into a pending one adds nothing to the backlog.
+    if (queued && m_coalesce_queue.size() > before) {
+        backlog = m_flow.enter(&state);
+    } else {
+        backlog = m_flow.depth();
+        state = m_flow.state();
+    }
+    IOLockUnlock(m_coalesce_lock);
+    
+    if (!queued) {
+        LogD("Coalescing queue full, rejecting report.");
+        return false;
+    }
+    
+    if (depth) *depth = backlog;
+    if (flow) *flow = state;
+    
+    // Only the first pending report needs to schedule a delivery.
+    if (was_empty && m_coalesce_source) m_coalesce_source->interruptOccurred(nullptr, nullptr, 0);
+    
+    return true;
+}
+
+IOReturn it_kotleni_virthid_device::setCoalescing(bool enable) {
+    if (!m_coalesce_source) return kIOReturnNotReady;
+    if (enable && (!virthid_has_relative_input(reportLayout) || m_report_buffer_capacity == 0)) {
+        return kIOReturnUnsupported;
+    }
+    
+    // Slots are sized like the report buffers, for the largest input report.
+    IOLockLock(m_coalesce_lock);
+    if (enable && !m_coalesce_storage) {
+        UInt32 stride = m_report_buffer_capacity;
+        UInt32 size = virthid_coalesce_queue::storageSize(stride) + stride;
+        
+        m_coalesce_storage = (uint8_t *)IOMalloc(size);
+        if (!m_coalesce_storage) {
+            IOLockUnlock(m_coalesce_lock);
+            return kIOReturnNoMemory;
+        }
+        
+        m_coalesce_storage_size = size;
+        m_coalesce_scratch = m_coalesce_storage + virthid_coalesce_queue::storageSize(stride);
+        m_coalesce_queue.init(m_coalesce_storage, stride);
+    }
+    IOLockUnlock(m_coalesce_lock);
+    
+    // Reports still pending when disabling are delivered by the work loop.
+    __atomic_store_n(&m_coalescing, enable, __ATOMIC_RELAXED);
+    
+    return kIOReturnSuccess;
+}
+
+void it_kotleni_virthid_device::sDrainCoalescedReports(OSObject *owner, IOInterruptEventSource *sender, int count) {
+    it_kotleni_virthid_device *target = OSDynamicCast(it_kotleni_virthid_device, owner);
+    if (target) target->drainCoalescedReports();
+}
+
+void it_kotleni_virthid_device::drainCoalescedReports() {
+    uint32_t report_len = 0;
+    uint64_t timestamp = 0;
+    
+    // Only the work loop drains, so the scratch slot needs no lock once filled.
+    for (;;) {
+        IOLockLock(m_coalesce_lock);
+        bool popped = m_coalesce_queue.pop(m_coalesce_scratch, &report_len, &timestamp);
+        IOLockUnlock(m_coalesce_lock);
+        
+        if (!popped) break;
+        dispatchInputReport(m_coalesce_scratch, (UInt16)report_len, timestamp);
+        leaveBacklog();
+    }
+}
+
+void it_kotleni_virthid_device::leaveBacklog() {
+    if (!m_flow.leave()) return;
+    
+    IOLockLock(m_subscribers_lock);
+    for (UInt32 i = 0; i < m_flow_subscribers.count(); i++) {
+        m_flow_subscribers.at(i)->notifyWritable(handle);
+    }
+    IOLockUnlock(m_subscribers_lock);
+}
+
+IOReturn it_kotleni_virthid_device::setWatermarks(UInt32 high, UInt32 low) {
+    // Other paths have no backlog the device could count, see 'sendInputReport'.
+    if (!__atomic_load_n(&m_coalescing, __ATOMIC_RELAXED)) return kIOReturnUnsupported;
+    if (!m_flow.setWatermarks(high, low)) return kIOReturnBadArgument;
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid_device::scheduleReports(const unsigned char *records, UInt32 records_len, UInt32 *scheduled) {
+    virthid_schedule_reader reader(records, records_len);
+    const uint8_t *report = nullptr;
+    uint16_t report_len = 0;
+    uint64_t deadline = 0;
+    IOReturn ret = kIOReturnSuccess;
+    int next;
+    
+    *scheduled = 0;
+    
+    ret = lockSchedule();
+    if (ret != kIOReturnSuccess) return ret;
+    
+    while ((next = reader.next(&deadline, &report, &report_len)) > 0) {
+        ret = scheduleLocked(deadline, report, report_len);
+        if (ret != kIOReturnSuccess) break;
+        (*scheduled)++;
+    }
+    if (next < 0) ret = kIOReturnBadArgument;
+    
+    unlockSchedule();
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid_device::lockSchedule() {
+    if (!m_schedule_timer) return kIOReturnNotReady;
+    
+    IOLockLock(m_schedule_lock);
+    
+    // Slots are sized like the report buffers, for the largest input report.
+    if (!m_schedule) {
+        UInt32 stride = m_report_buffer_capacity;
+        UInt32 size = sizeof(virthid_device_schedule) + virthid_device_schedule::storageSize(stride) + stride;
+        
+        m_schedule = (virthid_device_schedule *)IOMalloc(size);
+        if (!m_schedule) {
+            IOLockUnlock(m_schedule_lock);
+            return kIOReturnNoMemory;
+        }
+        
+        m_schedule_size = size;
+        m_schedule_scratch = (uint8_t *)(m_schedule + 1) + virthid_device_schedule::storageSize(stride);
+        m_schedule->reset((uint8_t *)(m_schedule + 1), stride);
+    }
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid_device::scheduleLocked(uint64_t deadline, const unsigned char *report, UInt32 report_len) {
+    if (!reportLayout->validate(virthid_report_input, report, report_len) || report_len > m_schedule->stride()) {
+        return kIOReturnBadArgument;
+    }
+    
+    if (!m_schedule->push(deadline, report, report_len)) return kIOReturnNoSpace;
+    
+    virthid_stat_max(&m_stats.schedule_high_water, m_schedule->size());
+    return kIOReturnSuccess;
+}
+
+void it_kotleni_virthid_device::unlockSchedule() {
+    uint64_t deadline = 0;
+    
+    // Arm under the lock, so the timer always targets the earliest deadline.
+    if (m_schedule->nextDeadline(&deadline)) {
+        m_schedule_timer->wakeAtTime(virthid_uptime_clock::toAbsoluteTime(deadline));
+    }
+    
+    IOLockUnlock(m_schedule_lock);
+}
+
+void it_kotleni_virthid_device::sDispatchScheduledReports(OSObject *owner, IOTimerEventSource *sender) {
+    it_kotleni_virthid_device *target = OSDynamicCast(it_kotleni_virthid_device, owner);
+    if (target) target->dispatchScheduledReports();
+}
+
+void it_kotleni_virthid_device::dispatchScheduledReports() {
+    virthid_uptime_clock clock;
+    uint32_t report_len = 0;
+    uint64_t deadline = 0, lateness = 0;
+    
+    // Only the work loop dispatches, so the scratch slot needs no lock once filled.
+    // A scheduled report's latency runs from its deadline.
+    for (;;) {
+        IOLockLock(m_schedule_lock);
+        bool popped = m_schedule && m_schedule->popDue(clock, m_schedule_scratch, &report_len, &lateness);
+        if (m_schedule) refillReplayLocked();
+        if (!popped && m_schedule && m_schedule->nextDeadline(&deadline)) {
+            m_schedule_timer->wakeAtTime(virthid_uptime_clock::toAbsoluteTime(deadline));
+        }
+        IOLockUnlock(m_schedule_lock);
+        
+        if (!popped) break;
+        dispatchInputReport(m_schedule_scratch, (UInt16)report_len, clock.now() - lateness);
+    }
+}
+
+IOMemoryDescriptor *it_kotleni_virthid_device::copyStateMemory() {
+    IOLockLock(m_poll_lock);
+    
+    // The state holds the largest input report. Frames are built in kernel
+    // memory: the frame being delivered, then the last one delivered.
+    if (!m_state) {
+        UInt32 capacity = m_report_buffer_capacity;
+        
+        m_poll_storage = (uint8_t *)IOMalloc(2 * capacity);
+        if (m_poll_storage) {
+            m_state = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                            virthid_state_size(capacity), page_size);
+        }
+        
+        if (m_state) {
+            virthid_state_shared *state = (virthid_state_shared *)m_state->getBytesNoCopy();
+            memset(state, 0, virthid_state_size(capacity));
+            state->capacity = capacity;
+            
+            m_poll_capacity = capacity;
+            m_poller.init(m_poll_storage + capacity, capacity);
+        } else {
+            LogD("Error while allocating the state block.");
+            if (m_poll_storage) IOFree(m_poll_storage, 2 * capacity);
+            m_poll_storage = nullptr;
+        }
+    }
+    
+    if (m_state) m_state->retain();
+    
+    IOLockUnlock(m_poll_lock);
+    
+    return m_state;
+}
+
+IOReturn it_kotleni_virthid_device::setPolling(UInt32 interval_us, bool skip_identical) {
+    IOMemoryDescriptor *state = nullptr;
+    
+    if (!m_poll_timer) return kIOReturnNotReady;
+    
+    if (interval_us == 0) {
+        IOLockLock(m_poll_lock);
+        m_polling = false;
+        m_poll_timer->cancelTimeout();
+        IOLockUnlock(m_poll_lock);
+        return kIOReturnSuccess;
+    }
+    
+    if (interval_us < virthid_poll_min_interval_us || interval_us > virthid_poll_max_interval_us) {
+        return kIOReturnBadArgument;
+    }
+    
+    // Polling reads the state block, make sure there is one even if it was never mapped.
+    state = copyStateMemory();
+    if (!state) return kIOReturnNoMemory;
+    state->release();
+    
+    IOLockLock(m_poll_lock);
+    m_pacer.start(virthid_uptime_clock(), (uint64_t)interval_us * 1000);
+    m_poller.reset(skip_identical);
+    m_polling = true;
+    m_poll_timer->wakeAtTime(virthid_uptime_clock::toAbsoluteTime(m_pacer.nextDeadline()));
+    IOLockUnlock(m_poll_lock);
+    
+    return kIOReturnSuccess;
+}
+
+void it_kotleni_virthid_device::sDispatchPolledReport(OSObject *owner, IOTimerEventSource *sender) {
+    it_kotleni_virthid_device *target = OSDynamicCast(it_kotleni_virthid_device, owner);
+    if (target) target->dispatchPolledReport();
+}
+
+void it_kotleni_virthid_device::dispatchPolledReport() {
+    uint64_t timestamp = virthid_uptime_clock().now();
+    uint8_t *report = m_poll_storage;
+    uint32_t report_len = 0;
+    bool due = false;
+    
+    IOLockLock(m_poll_lock);
+    if (!m_polling) {
+        IOLockUnlock(m_poll_lock);
+        return;
+    }
+    
+    // The deadline grid is fixed, a late timer delivers one frame and moves on.
+    if (m_pacer.tick(virthid_uptime_clock())) {
+        due = m_poller.frame((const virthid_state_shared *)m_state->getBytesNoCopy(), report, &report_len);
+    }
+    m_poll_timer->wakeAtTime(virthid_uptime_clock::toAbsoluteTime(m_pacer.nextDeadline()));
+    IOLockUnlock(m_poll_lock);
+    
+    if (!due) return;
+    
+    if (!reportLayout->validate(virthid_report_input, report, report_len)) {
+        virthid_stat_add(&m_stats.reports_rejected);
+        statsChanged();
+        return;
+    }
+    
+    dispatchInputReport(report, (UInt16)report_len, timestamp);
+}
+
+IOReturn it_kotleni_virthid_device::setCapture(bool enable) {
+    IOReturn ret = kIOReturnSuccess;
+    
+    IOLockLock(m_capture_lock);
+    
+    if (enable && !m_capturing) {
+        if (!m_capture_buffer) m_capture_buffer = (uint8_t *)IOMalloc(virthid_capture_size);
+        
+        if (m_capture_buffer) {
+            // Every capture starts a new log, anything not read yet is lost.
+            m_capture.begin(m_capture_buffer, virthid_capture_size, virthid_uptime_clock().now());
+            m_capture_dropped = 0;
+        } else {
+            ret = kIOReturnNoMemory;
+        }
+    }
+    
+    if (ret == kIOReturnSuccess) __atomic_store_n(&m_capturing, enable, __ATOMIC_RELAXED);
+    
+    IOLockUnlock(m_capture_lock);
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid_device::readCapture(unsigned char *buf, UInt32 buf_len, UInt32 *copied, UInt32 *dropped) {
+    *copied = 0;
+    *dropped = 0;
+    
+    IOLockLock(m_capture_lock);
+    
+    if (!m_capture_buffer) {
+        IOLockUnlock(m_capture_lock);
+        return kIOReturnNotReady;
+    }
+    
+    *copied = m_capture.prefix(buf_len);
+    memcpy(buf, m_capture.data(), *copied);
+    m_capture.consume(*copied);
+    
+    *dropped = m_capture_dropped;
+    m_capture_dropped = 0;
+    
+    IOLockUnlock(m_capture_lock);
+    
+    return kIOReturnSuccess;
+}
+
+void it_kotleni_virthid_device::captureReport(const unsigned char *report, UInt16 report_len) {
+    uint64_t now = virthid_uptime_clock().now();
+    
+    IOLockLock(m_capture_lock);
+    if (m_capturing && !m_capture.append(now, report, report_len)) m_capture_dropped++;
+    IOLockUnlock(m_capture_lock);
+}
+
+IOReturn it_kotleni_virthid_device::replayLog(const unsigned char *log, UInt32 log_len, UInt32 speed,
+                                             uint64_t timestamp, UInt32 *replayed) {
+    virthid_log_reader reader(log, log_len);
+    const uint8_t *report = nullptr;
+    uint32_t report_len = 0;
+    uint64_t recorded = 0;
+    uint8_t *copy = nullptr;
+    IOReturn ret = kIOReturnSuccess;
+    UInt32 count = 0;
+    int next;
+    
+    *replayed = 0;
+    if (!reader.begin()) return kIOReturnBadArgument;
+    
+    // At maximum speed reports are sent right away, in order.
+    if (speed == 0) {
+        while ((next = reader.next(&recorded, &report, &report_len)) > 0) {
+            if (report_len > UINT16_MAX || !sendInputReport(report, (UInt16)report_len, timestamp)) {
+                return kIOReturnDeviceError;
+            }
+            (*replayed)++;
+        }
+        
+        return next < 0 ? kIOReturnBadArgument : kIOReturnSuccess;
+    }
+    
+    // The caller's buffer is gone once this returns, the stream plays from a
+    // copy, checked whole first so a scheduled replay never stops halfway.
+    copy = (uint8_t *)IOMalloc(log_len);
+    if (!copy) return kIOReturnNoMemory;
+    memcpy(copy, log, log_len);
+    
+    reader = virthid_log_reader(copy, log_len);
+    reader.begin();
+    while ((next = reader.next(&recorded, &report, &report_len)) > 0) {
+        if (!reportLayout->validate(virthid_report_input, report, report_len) ||
+            report_len > m_report_buffer_capacity) {
+            break;
+        }
+        count++;
+    }
+    if (next != 0 || count == 0) {
+        IOFree(copy, log_len);
+        return next != 0 ? kIOReturnBadArgument : kIOReturnSuccess;
+    }
+    
+    ret = lockSchedule();
+    if (ret != kIOReturnSuccess) {
+        IOFree(copy, log_len);
+        return ret;
+    }
+    
+    if (m_replay_log) {
+        unlockSchedule();
+        IOFree(copy, log_len);
+        return kIOReturnBusy;
+    }
+    
+    // The first report plays now, the others keep their spacing divided by 'speed'.
+    m_replay_log = copy;
+    m_replay_log_len = log_len;
+    m_replay_reader = virthid_log_reader(copy, log_len);
+    m_replay_reader.begin();
+    m_replay_pending = m_replay_reader.next(&m_replay_timestamp, &m_replay_report, &m_replay_report_len) > 0;
+    m_replay_first = m_replay_timestamp;
+    m_replay_start = virthid_uptime_clock().now();
+    m_replay_speed = speed;
+    refillReplayLocked();
+    
+    unlockSchedule();
+    
+    *replayed = count;
+    return kIOReturnSuccess;
+}
+
+void it_kotleni_virthid_device::refillReplayLocked() {
+    while (m_replay_log) {
+        if (!m_replay_pending) {
+            m_replay_pending = m_replay_reader.next(&m_replay_timestamp, &m_replay_report, &m_replay_report_len) > 0;
+        }
+        
+        if (!m_replay_pending) {
+            IOFree(m_replay_log, m_replay_log_len);
+            m_replay_log = nullptr;
+            m_replay_log_len = 0;
+            break;
+        }
+        
+        uint64_t deadline = m_replay_start + (m_replay_timestamp - m_replay_first) / m_replay_speed;
+        if (scheduleLocked(deadline, m_replay_report, m_replay_report_len) == kIOReturnNoSpace) break;
+        m_replay_pending = false;
+    }
+}
+
+bool it_kotleni_virthid_device::dispatchInputReport(const unsigned char *report, UInt16 report_len,
+                                                    uint64_t timestamp) {
+    IOBufferMemoryDescriptor *buffer = nullptr;
+    SInt32 slot = -1;
+    bool ret = false;
+    
+    if (report_len <= m_report_buffer_capacity) slot = m_report_pool.take();
+    
+    if (slot >= 0) {
+        buffer = m_report_buffers[slot];
+        buffer->setLength(report_len);
+    } else {
+        // Pool exhausted or report too large, allow a bounded number of one-off buffers.
+        if (__atomic_add_fetch(&m_report_fallbacks, 1, __ATOMIC_RELAXED) > virthid_report_pool_fallbacks) {
+            __atomic_sub_fetch(&m_report_fallbacks, 1, __ATOMIC_RELAXED);
+            LogD("Report buffers exhausted.");
+            virthid_stat_add(&m_stats.report_failures);
+            statsChanged();
+            return false;
+        }
+        
+        buffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, report_len);
+        if (!buffer) {
+            __atomic_sub_fetch(&m_report_fallbacks, 1, __ATOMIC_RELAXED);
+            virthid_stat_add(&m_stats.report_failures);
+            statsChanged();
+            return false;
+        }
+    }
+    
+    if (__atomic_load_n(&m_capturing, __ATOMIC_RELAXED)) captureReport(report, report_len);
+    m_report_cache.store(virthid_report_input, report, report_len);
+    
+    LogD("Handling report of size: %d.", (int)buffer->getLength());
+    buffer->writeBytes(0, report, report_len);
+    
+    if (handleReport(buffer, kIOHIDReportTypeInput) == kIOReturnSuccess) {
+        LogD("Report correctly sent to device.");
+        virthid_stat_add(&m_stats.reports_in);
+        virthid_stat_add(&m_stats.bytes_in, report_len);
+        ret = true;
+    } else {
+        LogD("Error while sending report to device.");
+        virthid_stat_add(&m_stats.report_failures);
+    }
+    statsChanged();
+    
+    if (slot >= 0) {
+        m_report_pool.give(slot);
+    } else {
+        buffer->release();
+        __atomic_sub_fetch(&m_report_fallbacks, 1, __ATOMIC_RELAXED);
+    }
+    
+    if (ret) m_latency[virthid_latency_input].record(virthid_uptime_clock().now() - timestamp);
+    
+    return ret;
+}
+
+void it_kotleni_virthid_device::copyStats(virthid_device_stats *stats) {
+    virthid_stats_copy(&m_stats, stats);
+}
+
+void it_kotleni_virthid_device::recordLatency(UInt32 direction, uint64_t latency) {
+    if (direction < virthid_latency_direction_count) m_latency[direction].record(latency);
+}
+
+IOReturn it_kotleni_virthid_device::copyLatency(UInt32 direction, virthid_histogram_snapshot *snapshot) {
+    if (direction >= virthid_latency_direction_count) return kIOReturnBadArgument;
+    
+    m_latency[direction].snapshot(snapshot);
+    return kIOReturnSuccess;
+}
+
+void it_kotleni_virthid_device::statsChanged() {
+    // Only the first change after a publication arms the timer.
+    if (__atomic_load_n(&m_stats_pending, __ATOMIC_RELAXED)) return;
+    if (__atomic_exchange_n(&m_stats_pending, true, __ATOMIC_RELAXED)) return;
+    
+    if (m_stats_timer) m_stats_timer->setTimeoutMS(virthid_stats_interval_ms);
+}
+
+void it_kotleni_virthid_device::sPublishStats(OSObject *owner, IOTimerEventSource *sender) {
+    it_kotleni_virthid_device *target = OSDynamicCast(it_kotleni_virthid_device, owner);
+    if (target) target->publishStats();
+}
+
+void it_kotleni_virthid_device::publishStats() {
+    virthid_device_stats stats;
+    
+    __atomic_store_n(&m_stats_pending, false, __ATOMIC_RELAXED);
+    virthid_stats_copy(&m_stats, &stats);
+    
+    OSDictionary *dict = OSDictionary::withCapacity(9);
+    if (!dict) return;
+    
+    struct {
+        const char *key;
+        uint64_t value;
+    } counters[] = {
+        {"ReportsIn", stats.reports_in},
+        {"BytesIn", stats.bytes_in},
+        {"ReportsRejected", stats.reports_rejected},
+        {"ReportFailures", stats.report_failures},
+        {"OutputReports", stats.output_reports},
+        {"SubscriberDrops", stats.subscriber_drops},
+        {"SubscriberQueueHighWater", stats.subscriber_queue_high_water},
+        {"CoalesceHighWater", stats.coalesce_high_water},
+        {"ScheduleHighWater", stats.schedule_high_water},
+    };
+    
+    for (UInt32 i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        OSNumber *number = OSNumber::withNumber(counters[i].value, 64);
+        if (!number) continue;
+        dict->setObject(counters[i].key, number);
+        number->release();
+    }
+    
+    setProperty("Statistics", dict);
+    dict->release();
+}
+
+IOMemoryDescriptor *it_kotleni_virthid_device::copyInputRing() {
+    IOLockLock(m_input_ring_lock);
+    
+    if (!m_input_ring) {
+        m_input_ring = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                             sizeof(virthid_ring_shared), page_size);
+        if (m_input_ring) {
+            virthid_ring((virthid_ring_shared *)m_input_ring->getBytesNoCopy()).reset();
+        } else {
+            LogD("Error while allocating the input ring.");
+        }
+    }
+    
+    if (m_input_ring) m_input_ring->retain();
+    
+    IOLockUnlock(m_input_ring_lock);
+    
+    return m_input_ring;
+}
+
+IOReturn it_kotleni_virthid_device::drainInputRing(uint64_t timestamp) {
+    unsigned char report[virthid_max_report];
+    uint32_t report_len = 0;
+    
+    IOLockLock(m_input_ring_lock);
+    
+    if (!m_input_ring) {
+        IOLockUnlock(m_input_ring_lock);
+        return kIOReturnNotReady;
+    }
+    
+    virthid_ring ring((virthid_ring_shared *)m_input_ring->getBytesNoCopy());
+    do {
+        virthid_ring_result result;
+        while ((result = ring.pop(report, &report_len)) != virthid_ring_empty) {
+            if (result == virthid_ring_popped) {
+                sendInputReport(report, (UInt16)report_len, timestamp);
+            } else {
+                LogD("Skipping malformed input ring entry.");
+            }
+        }
+    } while (!ring.park());
+    
+    IOLockUnlock(m_input_ring_lock);
+    
+    return kIOReturnSuccess;
 }
 
 void it_kotleni_virthid_device::setName(OSString *name) {
@@ -62,6 +994,12 @@ void it_kotleni_virthid_device::setName(OSString *name) {
     m_name = name;
 }
 
+void it_kotleni_virthid_device::setReportDescriptor(it_kotleni_virthid_report_descriptor *descriptor) {
+    descriptor->retain();
+    reportDescriptor = descriptor;
+    reportLayout = descriptor->layout();
+}
+
 void it_kotleni_virthid_device::setSerialNumberString(OSString *serialNumberString) {
     if (serialNumberString) {
         serialNumberString->retain();
@@ -80,25 +1018,144 @@ void it_kotleni_virthid_device::setProductID(uint32_t productID) {
 
 IOReturn it_kotleni_virthid_device::newReportDescriptor(IOMemoryDescriptor **descriptor) const {
     LogD("Executing 'it_kotleni_virthid_device::newReportDescriptor()'.");
-    IOBufferMemoryDescriptor *buffer =
-        IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, reportDescriptor_len);
     
-    if (!buffer) {
-        LogD("Error while allocating new IOBufferMemoryDescriptor.");
-        return kIOReturnNoResources;
+    // Every device sharing the descriptor hands out the same buffer, the HID stack only reads it.
+    *descriptor = reportDescriptor->copyBuffer();
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid_device::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options) {
+    uint64_t timestamp = virthid_uptime_clock().now();
+    UInt32 report_len = (UInt32)report->getLength();
+    
+    uint8_t small[virthid_max_report];
+    uint8_t *buf = small;
+    
+    // Nothing larger fits in a subscriber's output ring.
+    if (report_len > virthid_max_output_report) return kIOReturnBadArgument;
+    
+    if (report_len > sizeof(small)) {
+        buf = (uint8_t *)IOMalloc(report_len);
+        if (!buf) return kIOReturnNoMemory;
     }
     
-    buffer->writeBytes(0, reportDescriptor, reportDescriptor_len);
-    *descriptor = buffer;
+    // Read the report once, every subscriber queues its own copy.
+    report->readBytes(0, buf, report_len);
+    
+    virthid_stat_add(&m_stats.output_reports);
+    
+    // What the host sets is what it reads back.
+    if (reportType < kIOHIDReportTypeCount) {
+        m_report_cache.store(reportType, buf, report_len);
+    }
+    
+    IOLockLock(m_subscribers_lock);
+    for (UInt32 i = 0; i < m_subscribers.count(); i++) {
+        UInt32 depth = 0;
+        uint64_t landed = 0;
+        if (m_subscribers.at(i)->notifySubscriber(reportType, buf, report_len, handle, timestamp,
+                                                  &depth, &landed) == kIOReturnOverrun) {
+            virthid_stat_add(&m_stats.subscriber_drops);
+        }
+        virthid_stat_max(&m_stats.subscriber_queue_high_water, depth);
+        if (landed) m_latency[virthid_latency_output].record(landed - timestamp);
+    }
+    IOLockUnlock(m_subscribers_lock);
+    
+    if (buf != small) IOFree(buf, report_len);
+    
+    statsChanged();
     
     return kIOReturnSuccess;
 }
 
-IOReturn it_kotleni_virthid_device::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options) {
-    // No one is listening yet.
-    if (!m_user_client) return kIOReturnSuccess;
+IOReturn it_kotleni_virthid_device::getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options) {
+    UInt8 report_id = options & 0xff;
+    UInt32 report_len = (UInt32)report->getLength();
+    UInt32 copied = 0;
+    
+    uint8_t small[virthid_max_report];
+    uint8_t *buf = small;
+    
+    if (reportType >= kIOHIDReportTypeCount) return kIOReturnBadArgument;
+    
+    if (report_len > sizeof(small)) {
+        buf = (uint8_t *)IOMalloc(report_len);
+        if (!buf) return kIOReturnNoMemory;
+    }
+    
+    // Answered from the cache, userspace is never involved.
+    copied = m_report_cache.load(reportType, report_id, buf, report_len);
+    if (copied) report->writeBytes(0, buf, copied);
+    
+    if (buf != small) IOFree(buf, report_len);
+    
+    return copied ? kIOReturnSuccess : kIOReturnUnsupported;
+}
 
-    return m_user_client->notifySubscriber(report);
+IOReturn it_kotleni_virthid_device::setReportState(UInt32 type, const unsigned char *report, UInt32 report_len) {
+    if (type >= virthid_report_type_count) return kIOReturnBadArgument;
+    if (!m_report_cache.store(type, report, report_len)) return kIOReturnBadArgument;
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid_device::sendKeyEvents(const unsigned char *events, UInt32 events_len, uint64_t timestamp,
+                                                 UInt32 *sent) {
+    virthid_input_event batch[2 * virthid_event_chunk];
+    virthid_key_event event;
+    virthid_device_sink sink = {this, timestamp};
+    UInt32 count = 0;
+    
+    *sent = 0;
+    
+    if (!m_encoder || !isKeyboard) return kIOReturnUnsupported;
+    if (events_len % sizeof(event)) return kIOReturnBadArgument;
+    
+    IOLockLock(m_encoder_lock);
+    for (UInt32 offset = 0; offset < events_len; offset += sizeof(event)) {
+        // Copied once, the events may be shared with a user task.
+        memcpy(&event, events + offset, sizeof(event));
+        
+        // Every transition is synced on its own, the encoder skips those that change nothing.
+        batch[count++] = {virthid_input_key, 0, event.usage, (int16_t)(event.down != 0), 0};
+        batch[count++] = {virthid_input_sync, 0, 0, 0, 0};
+        
+        if (count == 2 * virthid_event_chunk) {
+            *sent += m_encoder->encode(batch, count, sink);
+            count = 0;
+        }
+    }
+    if (count > 0) *sent += m_encoder->encode(batch, count, sink);
+    IOLockUnlock(m_encoder_lock);
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid_device::sendEvents(const unsigned char *events, UInt32 events_len, uint64_t timestamp,
+                                              UInt32 *sent) {
+    virthid_input_event batch[virthid_event_chunk];
+    virthid_device_sink sink = {this, timestamp};
+    UInt32 count = events_len / sizeof(virthid_input_event);
+    
+    *sent = 0;
+    
+    if (!m_encoder) return kIOReturnUnsupported;
+    if (events_len % sizeof(virthid_input_event)) return kIOReturnBadArgument;
+    
+    IOLockLock(m_encoder_lock);
+    for (UInt32 i = 0; i < count; i += virthid_event_chunk) {
+        UInt32 n = count - i < virthid_event_chunk ? count - i : virthid_event_chunk;
+        
+        // Copied before encoding, the events may be shared with a user task.
+        // Only the last chunk ends with a sync, so chunking adds no reports.
+        memcpy(batch, events + i * sizeof(virthid_input_event), n * sizeof(virthid_input_event));
+        *sent += m_encoder->encode(batch, n, sink, i + n == count);
+    }
+    IOLockUnlock(m_encoder_lock);
+    
+    return kIOReturnSuccess;
 }
 
 OSString *it_kotleni_virthid_device::newProductString() const {
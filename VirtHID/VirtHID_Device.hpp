@@ -9,7 +9,35 @@
 #define virthid_device_h
 
 #include "IOKit/hid/IOHIDDevice.h"
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOLocks.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOInterruptEventSource.h>
+#include <IOKit/IOTimerEventSource.h>
+
 #include "VirtHID_UserClient.hpp"
+#include "VirtHID_Pool.hpp"
+#include "VirtHID_Subscribers.hpp"
+#include "VirtHID_Descriptor.hpp"
+#include "VirtHID_ReportCache.hpp"
+#include "VirtHID_Encoder.hpp"
+#include "VirtHID_Poll.hpp"
+#include "VirtHID_ReportDescriptor.hpp"
+#include "VirtHID_Coalesce.hpp"
+#include "VirtHID_Flow.hpp"
+#include "VirtHID_Schedule.hpp"
+#include "VirtHID_Clock.hpp"
+#include "VirtHID_Log.hpp"
+#include "VirtHID_Stats.hpp"
+#include "VirtHID_Histogram.hpp"
+#include "VirtHID_List.hpp"
+
+typedef virthid_schedule<virthid_uptime_clock> virthid_device_schedule;
+
+/**
+ *  Minimum interval between two updates of the "Statistics" property.
+ */
+const UInt32 virthid_stats_interval_ms = 1000;
 
 class it_kotleni_virthid_device : public IOHIDDevice {
     OSDeclareDefaultStructors(it_kotleni_virthid_device)
@@ -29,6 +57,14 @@ public:
      */
     virtual void setName(OSString *name);
     
+    /**
+     *  Set the report descriptor, before 'init'.
+     *  The reference count is automatically increased.
+     *
+     *  @param descriptor The report descriptor.
+     */
+    virtual void setReportDescriptor(it_kotleni_virthid_report_descriptor *descriptor);
+    
     /**
      *  Set the serial number string.
      *  The reference count is automatically increased.
@@ -57,13 +93,273 @@ public:
      *  @return The device name.
      */
     virtual OSString *name();
+    
+    /**
+     *  Return the bytes and length of the device name, see 'virthid_core'.
+     */
+    const char *nameBytes() const;
+    UInt8 nameLength() const;
+    
+    /**
+     *  Fill the IDs, class and name length of a list entry.
+     */
+    void describe(virthid_list_entry *entry) const;
+    
+    /**
+     *  Return the vendor and product IDs, or zero if not set.
+     */
+    virtual UInt32 vendorID() const;
+    virtual UInt32 productID() const;
 
     /**
-     *  Store a callback to be called whenever setReport is called on device.
+     *  Add a user client to the subscribers notified whenever setReport is
+     *  called on the device. Subscribers are retained until unsubscribed.
+     *
+     *  @param userClient The subscribing user client.
+     *
+     *  @return False if the device already has the maximum number of subscribers.
+     */
+    virtual bool subscribe(IOService *userClient);
+    
+    /**
+     *  Remove a user client from the subscribers and flow subscribers, if present.
+     *
+     *  @param userClient The subscribed user client.
+     */
+    virtual void unsubscribe(IOService *userClient);
+    
+    /**
+     *  Add a user client to the flow subscribers, told whenever the device
+     *  drains from congested to its low watermark. Retained until unsubscribed.
+     *
+     *  @param userClient The subscribing user client.
+     *
+     *  @return False if the device already has the maximum number of flow subscribers.
+     */
+    virtual bool subscribeFlow(IOService *userClient);
+    
+    /**
+     *  Remove a user client from the flow subscribers only, if present.
+     *
+     *  @param userClient The subscribed user client.
+     */
+    virtual void unsubscribeFlow(IOService *userClient);
+    
+    /**
+     *  Deliver an input report to the HID stack.
+     *
+     *  @param report     The report to send.
+     *  @param report_len Length of 'report'.
+     *  @param timestamp  When the report entered the driver, input latency runs from there.
+     *  @param depth      If not null, receives the pending report count of the device.
+     *                    A report sent without coalescing has reached the HID
+     *                    stack when this returns, so it is not counted; only
+     *                    coalesced reports still waiting for the work loop are.
+     *                    Scheduled reports and input ring entries are not
+     *                    either, their producers hear about a full schedule
+     *                    or ring directly.
+     *  @param flow       If not null, receives the 'virthid_flow_state' of the device.
+     *
+     *  @return True on success.
+     */
+    virtual bool sendInputReport(const unsigned char *report, UInt16 report_len, uint64_t timestamp,
+                                 UInt32 *depth = nullptr, UInt32 *flow = nullptr);
+    
+    /**
+     *  Set the backlog watermarks reported on the send path. See 'VirtHID_Flow.hpp'.
+     *  Only coalesced reports make a backlog, so coalescing must be enabled.
+     *
+     *  @param high Pending reports at which the device becomes congested.
+     *  @param low  Pending reports at which a congested device becomes writable again.
+     *
+     *  @return kIOReturnUnsupported unless the device is coalescing,
+     *          kIOReturnBadArgument unless low < high <= 'virthid_flow_max_watermark'.
+     */
+    virtual IOReturn setWatermarks(UInt32 high, UInt32 low);
+    
+    /**
+     *  Enable or disable coalescing of relative motion. While enabled, input
+     *  reports are queued and delivered from the work loop, and a report
+     *  arriving while another is still pending is merged into it when
+     *  'virthid_motion_merge' allows. Reports of any input length coalesce.
+     *
+     *  @param enable Whether to coalesce.
+     *
+     *  @return kIOReturnNotReady if the device is not started,
+     *          kIOReturnUnsupported if no input report carries relative data,
+     *          kIOReturnNoMemory if the queue cannot be allocated.
+     */
+    virtual IOReturn setCoalescing(bool enable);
+    
+    /**
+     *  Schedule input reports for delivery at given deadlines. Reports are
+     *  delivered by a timer on the work loop, in deadline order. The schedule
+     *  holds 'virthid_schedule_capacity' reports, fewer on devices with input
+     *  reports above 'virthid_max_report' bytes, see 'virthid_schedule_budget'.
+     *
+     *  @param records     Schedule records, see 'virthid_schedule_record'.
+     *  @param records_len Length of 'records'.
+     *  @param scheduled   Receives the number of reports scheduled.
+     *
+     *  @return kIOReturnNoSpace once the schedule is full, kIOReturnBadArgument
+     *          on a truncated record or a report not matching the descriptor.
+     *          Records before the failing one stay scheduled.
+     */
+    virtual IOReturn scheduleReports(const unsigned char *records, UInt32 records_len, UInt32 *scheduled);
+    
+    /**
+     *  Start or stop capturing the input reports delivered to the HID stack
+     *  into a report log, see 'VirtHID_Log.hpp'. Starting a capture discards
+     *  whatever was not read from the previous one.
+     *
+     *  @param enable Whether to capture.
+     *
+     *  @return kIOReturnNoMemory if the capture buffer cannot be allocated.
+     */
+    virtual IOReturn setCapture(bool enable);
+    
+    /**
+     *  Move the captured log out of the device, as many whole records as fit.
+     *  Concatenating every read gives back the complete log.
+     *
+     *  @param buf     Receives the log bytes.
+     *  @param buf_len Length of 'buf'.
+     *  @param copied  Receives the number of bytes copied.
+     *  @param dropped Receives the number of reports lost since the last read
+     *                 because the capture buffer was full.
+     *
+     *  @return kIOReturnNotReady if nothing was ever captured.
+     */
+    virtual IOReturn readCapture(unsigned char *buf, UInt32 buf_len, UInt32 *copied, UInt32 *dropped);
+    
+    /**
+     *  Replay a report log.
+     *
+     *  @param log       The log.
+     *  @param log_len   Length of 'log'.
+     *  @param speed     0 to send every report right away, otherwise the
+     *                   reports are scheduled 'speed' times faster than recorded.
+     *  @param timestamp When the call entered the driver, the input latency
+     *                   of reports sent right away runs from there.
+     *  @param replayed  Receives the number of reports sent or scheduled.
+     *
+     *  A scheduled replay is copied into the device and streamed through the
+     *  schedule, which is refilled as reports are delivered, so logs need not
+     *  fit in 'virthid_schedule_capacity'.
+     *
+     *  @return kIOReturnBadArgument on a malformed log, nothing is played then,
+     *          kIOReturnBusy while a previous scheduled replay is still playing.
+     */
+    virtual IOReturn replayLog(const unsigned char *log, UInt32 log_len, UInt32 speed, uint64_t timestamp,
+                               UInt32 *replayed);
+    
+    /**
+     *  Replace the report 'getReport' answers with for a type and report ID.
+     *  Input reports are also stored whenever they are sent, and output and
+     *  feature reports whenever the host sets them.
+     *
+     *  @param type       A report type, see 'virthid_report_input'.
+     *  @param report     The report, report ID included if the device uses them.
+     *  @param report_len Length of 'report'.
+     *
+     *  @return kIOReturnBadArgument if the descriptor defines no such report.
+     */
+    virtual IOReturn setReportState(UInt32 type, const unsigned char *report, UInt32 report_len);
+    
+    /**
+     *  Press and release keys of a keyboard, see 'virthid_key_event'. The
+     *  device keeps the pressed keys and delivers the report they translate
+     *  to after every transition that changes it.
+     *
+     *  @param events     Key events.
+     *  @param events_len Length of 'events', a multiple of the event size.
+     *  @param timestamp  When the call entered the driver, input latency runs from there.
+     *  @param sent       Receives the number of reports delivered.
+     *
+     *  @return kIOReturnUnsupported if the device has no keyboard report.
+     */
+    virtual IOReturn sendKeyEvents(const unsigned char *events, UInt32 events_len, uint64_t timestamp,
+                                   UInt32 *sent);
+    
+    /**
+     *  Pack input events into reports and deliver them, see 'virthid_input_event'.
+     *  Buttons and keys stay pressed across calls, and reports are delivered
+     *  on every sync event and at the end of the call.
+     *
+     *  @param events     Input events.
+     *  @param events_len Length of 'events', a multiple of the event size.
+     *  @param timestamp  When the call entered the driver, input latency runs from there.
+     *  @param sent       Receives the number of reports delivered.
+     *
+     *  @return kIOReturnUnsupported if no event maps to the device's reports.
+     */
+    virtual IOReturn sendEvents(const unsigned char *events, UInt32 events_len, uint64_t timestamp,
+                                UInt32 *sent);
+    
+    /**
+     *  Take a snapshot of the device counters. They are also published as
+     *  the "Statistics" property, at most once per 'virthid_stats_interval_ms'.
+     *
+     *  @param stats Receives the counters.
+     */
+    virtual void copyStats(virthid_device_stats *stats);
+    
+    /**
+     *  Record a latency, see 'virthid_latency_input' and 'virthid_latency_output'.
+     *
+     *  @param direction The direction measured.
+     *  @param latency   The latency, in nanoseconds.
+     */
+    virtual void recordLatency(UInt32 direction, uint64_t latency);
+    
+    /**
+     *  Take a snapshot of a latency histogram, without pausing traffic.
+     *
+     *  @param direction The direction measured.
+     *  @param snapshot  Receives the histogram.
+     *
+     *  @return kIOReturnBadArgument on an unknown direction.
+     */
+    virtual IOReturn copyLatency(UInt32 direction, virthid_histogram_snapshot *snapshot);
+    
+    /**
+     *  Return the input ring shared with userspace, creating it on first use.
+     *  The reference count is automatically increased.
+     *
+     *  @return The ring memory, or null on allocation failure.
+     */
+    virtual IOMemoryDescriptor *copyInputRing();
+    
+    /**
+     *  Deliver every report pending in the input ring, then arm its doorbell.
+     *
+     *  @param timestamp When the doorbell entered the driver, input latency runs from there.
+     *
+     *  @return kIOReturnNotReady if the ring was never mapped.
+     */
+    virtual IOReturn drainInputRing(uint64_t timestamp);
+    
+    /**
+     *  Return the state block shared with userspace, creating it on first use.
+     *  It holds reports as large as the largest input report of the device,
+     *  see 'virthid_state_shared'. The reference count is automatically increased.
+     *
+     *  @return The state memory, or null on allocation failure.
+     */
+    virtual IOMemoryDescriptor *copyStateMemory();
+    
+    /**
+     *  Start or stop polling mode. While polling, a timer delivers the report
+     *  last published in the state block at a fixed interval, whether or not
+     *  it changed, like a device reporting at its own rate.
+     *
+     *  @param interval_us    The interval in microseconds, 0 to stop polling.
+     *  @param skip_identical Whether to leave out frames identical to the last one.
      *
-     *  @param subscriber Reference to callback.
+     *  @return kIOReturnBadArgument if the interval is out of bounds,
+     *          kIOReturnNoMemory if the state block cannot be allocated.
      */
-    virtual void subscribe(IOService *userClient);
+    virtual IOReturn setPolling(UInt32 interval_us, bool skip_identical);
     
     virtual OSString *newProductString() const override;
     virtual OSString *newSerialNumberString() const override;
@@ -75,17 +371,220 @@ public:
     virtual IOReturn setReport(IOMemoryDescriptor *report, IOHIDReportType reportType,
                                IOOptionBits options = 0) override;
 
-    unsigned char *reportDescriptor = nullptr;
-    UInt16 reportDescriptor_len;
+    virtual IOReturn getReport(IOMemoryDescriptor *report, IOHIDReportType reportType,
+                               IOOptionBits options = 0) override;
+
+protected:
+    /**
+     *  Take every event source this device added off the work loop.
+     */
+    void removeEventSources();
+    
+    /**
+     *  Hand an input report to the HID stack right away, recording its
+     *  input latency from 'timestamp' once it was handled.
+     */
+    virtual bool dispatchInputReport(const unsigned char *report, UInt16 report_len, uint64_t timestamp);
+    
+    /**
+     *  Take a report out of the backlog, telling flow subscribers once a
+     *  congested device drained to its low watermark.
+     */
+    void leaveBacklog();
+    
+    /**
+     *  Deliver the pending coalesced reports, on the work loop.
+     */
+    virtual void drainCoalescedReports();
+    
+    static void sDrainCoalescedReports(OSObject *owner, IOInterruptEventSource *sender, int count);
+    
+    /**
+     *  Deliver the scheduled reports that are due and re-arm the timer, on the work loop.
+     */
+    virtual void dispatchScheduledReports();
+    
+    static void sDispatchScheduledReports(OSObject *owner, IOTimerEventSource *sender);
+    
+    /**
+     *  Deliver a frame of the polled state if one is due and re-arm the timer, on the work loop.
+     */
+    virtual void dispatchPolledReport();
+    
+    static void sDispatchPolledReport(OSObject *owner, IOTimerEventSource *sender);
+    
+    /**
+     *  Take 'm_schedule_lock', allocating the schedule on first use.
+     *  'unlockSchedule' re-arms the timer for the earliest deadline.
+     */
+    IOReturn lockSchedule();
+    void unlockSchedule();
+    
+    /**
+     *  Validate and schedule a report, with 'm_schedule_lock' held.
+     */
+    IOReturn scheduleLocked(uint64_t deadline, const unsigned char *report, UInt32 report_len);
+    
+    /**
+     *  Move reports of the streamed replay into the schedule while it has room,
+     *  with 'm_schedule_lock' held. Frees the replayed log once it is all scheduled.
+     */
+    void refillReplayLocked();
+    
+    /**
+     *  Append a report to the capture log.
+     */
+    void captureReport(const unsigned char *report, UInt16 report_len);
+    
+    /**
+     *  Note that counters changed, so they get published soon.
+     */
+    void statsChanged();
+    
+    /**
+     *  Publish the counters as the "Statistics" property, on the work loop.
+     */
+    virtual void publishStats();
+    
+    static void sPublishStats(OSObject *owner, IOTimerEventSource *sender);
+
+public:
+
+    /**
+     *  Report descriptor shared with every device created from the same
+     *  bytes, and the reports it defines. Set once on creation.
+     */
+    it_kotleni_virthid_report_descriptor *reportDescriptor = nullptr;
+    const virthid_report_layout *reportLayout = nullptr;
     
     bool isMouse = false;
     bool isKeyboard = false;
+    
+    /**
+     *  Handle assigned by the driver on creation.
+     */
+    UInt32 handle = 0;
 private:
     OSString *m_name = nullptr;
     OSString *m_serial_number_string = nullptr;
     OSNumber *m_vendor_id = nullptr;
     OSNumber *m_product_id = nullptr;
-    it_kotleni_virthid_userclient *m_user_client = nullptr;
+    
+    /**
+     *  User clients receiving output reports, protected by 'm_subscribers_lock'.
+     */
+    virthid_subscriber_set<it_kotleni_virthid_userclient> m_subscribers;
+    IOLock *m_subscribers_lock = nullptr;
+    
+    /**
+     *  User clients told when the device becomes writable again, also
+     *  protected by 'm_subscribers_lock'.
+     */
+    virthid_subscriber_set<it_kotleni_virthid_userclient> m_flow_subscribers;
+    
+    /**
+     *  Input ring shared with userspace, and the lock serializing its consumers.
+     */
+    IOBufferMemoryDescriptor *m_input_ring = nullptr;
+    IOLock *m_input_ring_lock = nullptr;
+    
+    /**
+     *  Reusable input report buffers, so the send path does not allocate.
+     */
+    IOBufferMemoryDescriptor *m_report_buffers[virthid_report_pool_size] = {};
+    virthid_index_pool<virthid_report_pool_size> m_report_pool;
+    UInt32 m_report_buffer_capacity = 0;
+    UInt32 m_report_fallbacks = 0;
+    
+    /**
+     *  Pending reports while coalescing, protected by 'm_coalesce_lock'.
+     *  The storage is allocated when coalescing is first enabled and holds
+     *  the queue slots followed by the slot the work loop drains into.
+     */
+    bool m_coalescing = false;
+    virthid_coalesce_queue m_coalesce_queue;
+    uint8_t *m_coalesce_storage = nullptr;
+    uint8_t *m_coalesce_scratch = nullptr;
+    UInt32 m_coalesce_storage_size = 0;
+    IOLock *m_coalesce_lock = nullptr;
+    IOWorkLoop *m_work_loop = nullptr;
+    IOInterruptEventSource *m_coalesce_source = nullptr;
+    
+    /**
+     *  Reports accepted on the send path and not handed to the HID stack yet.
+     */
+    virthid_flow m_flow;
+    
+    /**
+     *  Scheduled reports, allocated on first use and protected by 'm_schedule_lock'.
+     *  The allocation holds the schedule, its report slots and the slot the
+     *  work loop dispatches from.
+     */
+    virthid_device_schedule *m_schedule = nullptr;
+    uint8_t *m_schedule_scratch = nullptr;
+    UInt32 m_schedule_size = 0;
+    IOLock *m_schedule_lock = nullptr;
+    IOTimerEventSource *m_schedule_timer = nullptr;
+    
+    /**
+     *  Scheduled replay: the device's copy of the log, the reader walking it,
+     *  the record the schedule had no room for yet and the time base.
+     *  Protected by 'm_schedule_lock'.
+     */
+    uint8_t *m_replay_log = nullptr;
+    UInt32 m_replay_log_len = 0;
+    virthid_log_reader m_replay_reader{nullptr, 0};
+    bool m_replay_pending = false;
+    uint64_t m_replay_timestamp = 0;
+    const uint8_t *m_replay_report = nullptr;
+    uint32_t m_replay_report_len = 0;
+    uint64_t m_replay_first = 0;
+    uint64_t m_replay_start = 0;
+    UInt32 m_replay_speed = 0;
+    
+    /**
+     *  Polling mode: the state block, the frame clock and the timer
+     *  delivering frames. Protected by 'm_poll_lock'.
+     */
+    bool m_polling = false;
+    IOBufferMemoryDescriptor *m_state = nullptr;
+    uint8_t *m_poll_storage = nullptr;
+    UInt32 m_poll_capacity = 0;
+    virthid_pacer<virthid_uptime_clock> m_pacer;
+    virthid_poller m_poller;
+    IOLock *m_poll_lock = nullptr;
+    IOTimerEventSource *m_poll_timer = nullptr;
+    
+    /**
+     *  Capture log, protected by 'm_capture_lock'.
+     */
+    bool m_capturing = false;
+    virthid_log_writer m_capture;
+    uint8_t *m_capture_buffer = nullptr;
+    UInt32 m_capture_dropped = 0;
+    IOLock *m_capture_lock = nullptr;
+    
+    /**
+     *  Last report of every type and ID, answering 'getReport'.
+     */
+    virthid_report_cache m_report_cache;
+    uint8_t *m_report_cache_storage = nullptr;
+    UInt32 m_report_cache_size = 0;
+    
+    /**
+     *  Encoder compiled from the layout, with the pressed buttons and keys.
+     *  Protected by 'm_encoder_lock'.
+     */
+    virthid_encoder *m_encoder = nullptr;
+    IOLock *m_encoder_lock = nullptr;
+    
+    /**
+     *  Counters, and the timer publishing them while they change.
+     */
+    virthid_device_stats m_stats = {};
+    virthid_histogram m_latency[virthid_latency_direction_count];
+    bool m_stats_pending = false;
+    IOTimerEventSource *m_stats_timer = nullptr;
 };
 
 #endif
@@ -0,0 +1,587 @@
+//
+//  VirtHID_Encoder.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_encoder_h
+#define virthid_encoder_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Types.hpp"
+#include "VirtHID_Descriptor.hpp"
+#include "VirtHID_Keyboard.hpp"
+
+/**
+ *  Types of 'virthid_input_event'.
+ */
+enum virthid_input_event_type {
+    virthid_input_sync = 0,     // Deliver the reports changed since the last sync.
+    virthid_input_move,         // 'value' and 'value2': relative X and Y.
+    virthid_input_scroll,       // 'value' and 'value2': vertical wheel and horizontal pan.
+    virthid_input_button,       // 'code': button number from 1, 'value': non-zero when pressed.
+    virthid_input_key,          // 'code': keyboard page usage, 'value': non-zero when pressed.
+    virthid_input_axis,         // 'code': generic desktop usage, 'value' and 'value2': low and high half.
+};
+
+/**
+ *  An input event sent with 'send_events'. Events change the reports of
+ *  the device, which are delivered on every sync and at the end of a call.
+ */
+typedef struct virthid_input_event {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t code;
+    int16_t value;
+    int16_t value2;
+} virthid_input_event;
+
+static_assert(sizeof(virthid_input_event) == 8, "Input events are eight bytes.");
+
+/**
+ *  Return the 32-bit value of an axis event.
+ */
+inline int32_t virthid_input_axis_value(const virthid_input_event *event) {
+    return (int32_t)((uint32_t)(uint16_t)event->value | (uint32_t)(uint16_t)event->value2 << 16);
+}
+
+const uint16_t virthid_usage_page_generic_desktop = 0x01;
+const uint16_t virthid_usage_page_button = 0x09;
+const uint16_t virthid_usage_page_consumer = 0x0c;
+
+const uint16_t virthid_usage_x = 0x30;
+const uint16_t virthid_usage_y = 0x31;
+const uint16_t virthid_usage_wheel = 0x38;
+const uint16_t virthid_usage_ac_pan = 0x238;
+
+/**
+ *  Input reports an encoder writes to, buttons and generic desktop axes it maps.
+ */
+const uint32_t virthid_encoder_max_reports = 4;
+const uint32_t virthid_encoder_buttons = 32;
+const uint32_t virthid_encoder_axes = 16;
+
+/**
+ *  How an encoder packs events, chosen once from the layout.
+ */
+enum virthid_encoder_kind {
+    virthid_encoder_none = 0,
+    virthid_encoder_generic,        // Through the fields of the layout.
+    virthid_encoder_boot_mouse,     // Buttons, X, Y and an optional wheel, one byte each.
+    virthid_encoder_boot_keyboard,  // Modifiers, a reserved byte and six key bytes.
+};
+
+/**
+ *  Packs input events into the input reports of a device.
+ *
+ *  'init' compiles the layout into direct targets for every event, and
+ *  picks a specialized path for the standard boot mouse and keyboard
+ *  layouts, which then pack bytes without looking at fields at all.
+ *
+ *  Relative data accumulates until the next sync and is clamped to the
+ *  field's logical range. A report is only delivered if it carries motion
+ *  or differs from the last one delivered. Key events follow
+ *  'virthid_keyboard', including ErrorRollOver.
+ *
+ *  Not thread-safe, callers provide the locking.
+ */
+class virthid_encoder {
+public:
+    /**
+     *  Compile a layout.
+     *
+     *  @param layout      The layout of the device.
+     *  @param specialized Whether to use a specialized path if one matches.
+     *
+     *  @return False if no event can be packed into the layout's reports.
+     */
+    bool init(const virthid_report_layout *layout, bool specialized = true) {
+        m_layout = layout;
+        m_kind = virthid_encoder_none;
+        m_slot_count = 0;
+        m_keyboard_slot = no_slot;
+
+        clear(&m_x);
+        clear(&m_y);
+        clear(&m_wheel);
+        clear(&m_pan);
+        for (uint32_t i = 0; i < virthid_encoder_buttons; i++) clear(&m_buttons[i]);
+        for (uint32_t i = 0; i < virthid_encoder_axes; i++) clear(&m_axes[i]);
+
+        if (!layout->isValid() || !layout->hasAllFields()) return false;
+
+        if (specialized && isBootMouse()) {
+            m_kind = virthid_encoder_boot_mouse;
+        } else if (specialized && isBootKeyboard()) {
+            m_kind = virthid_encoder_boot_keyboard;
+        } else {
+            compile();
+            if (m_slot_count > 0) m_kind = virthid_encoder_generic;
+        }
+
+        reset();
+        return m_kind != virthid_encoder_none;
+    }
+
+    virthid_encoder_kind kind() const {
+        return m_kind;
+    }
+
+    /**
+     *  Release every button and key, forget pending motion.
+     */
+    void reset() {
+        memset(&m_boot, 0, sizeof(m_boot));
+
+        for (uint32_t i = 0; i < m_slot_count; i++) {
+            slot &s = m_slots[i];
+            memset(s.pending, 0, s.info->length);
+            if (m_layout->usesReportIds()) s.pending[0] = s.info->id;
+            memcpy(s.last, s.pending, s.info->length);
+            s.dirty = false;
+        }
+
+        if (m_keyboard_slot != no_slot) m_keyboard.reset(nullptr);
+    }
+
+    /**
+     *  Pack events and deliver the resulting reports, ending with a sync.
+     *
+     *  @param events A sequence of events.
+     *  @param count  Number of events.
+     *  @param sink   Receives the reports through 'bool send(const uint8_t *report, uint32_t report_len)'.
+     *  @param end    False if more events of the same sequence follow in
+     *                another call, which then does the final sync.
+     *
+     *  @return The number of reports 'sink' accepted.
+     */
+    template <typename Sink>
+    uint32_t encode(const virthid_input_event *events, uint32_t count, Sink &sink, bool end = true) {
+        switch (m_kind) {
+            case virthid_encoder_boot_mouse:
+                return run<virthid_encoder_boot_mouse>(events, count, sink, end);
+            case virthid_encoder_boot_keyboard:
+                return run<virthid_encoder_boot_keyboard>(events, count, sink, end);
+            case virthid_encoder_generic:
+                return run<virthid_encoder_generic>(events, count, sink, end);
+            default:
+                return 0;
+        }
+    }
+
+private:
+    static const uint8_t no_slot = 0xff;
+
+    /**
+     *  Where an event lands: element 'element' of field 'field', in the
+     *  report of slot 'slot'.
+     */
+    struct target {
+        uint8_t slot;
+        uint8_t relative;
+        uint16_t field;
+        uint16_t element;
+    };
+
+    struct slot {
+        const virthid_report_info *info;
+        bool dirty;
+        uint8_t pending[virthid_max_report];
+        uint8_t last[virthid_max_report];
+    };
+
+    /**
+     *  State of the specialized paths.
+     */
+    struct boot_state {
+        uint8_t report[8];
+        uint8_t last[8];
+        int32_t dx, dy, wheel;
+        bool dirty;
+        uint32_t keys_pressed;
+        uint32_t keys[virthid_keyboard_usages / 32];
+    };
+
+    static void clear(target *t) {
+        t->slot = no_slot;
+        t->relative = 0;
+        t->field = 0;
+        t->element = 0;
+    }
+
+    static int32_t clamp(int64_t value, const virthid_field *field) {
+        if (value < field->logical_min) return field->logical_min;
+        if (value > field->logical_max) return field->logical_max;
+        return (int32_t)value;
+    }
+
+    static int32_t clamp8(int32_t value) {
+        return value < -127 ? -127 : value > 127 ? 127 : value;
+    }
+
+    /**
+     *  Return the only input report of the layout, or null.
+     */
+    const virthid_report_info *onlyInputReport() const {
+        const virthid_report_info *only = nullptr;
+
+        for (uint32_t i = 0; i < m_layout->reportCount(); i++) {
+            const virthid_report_info *info = m_layout->report(i);
+            if (info->type != virthid_report_input) continue;
+            if (only) return nullptr;
+            only = info;
+        }
+
+        return only;
+    }
+
+    const virthid_field *fieldAt(const virthid_report_info *info, uint32_t bit_offset) const {
+        for (uint32_t f = info->first_field; f < info->first_field + info->field_count; f++) {
+            const virthid_field *field = m_layout->field(f);
+            if (field->bit_offset == bit_offset && !(field->flags & virthid_field_constant)) return field;
+        }
+
+        return nullptr;
+    }
+
+    static bool isAxis(const virthid_field *field, uint16_t usage) {
+        return field && field->usage_page == virthid_usage_page_generic_desktop && field->usage_min == usage &&
+               field->bit_size == 8 && field->count == 1 && (field->flags & virthid_field_relative) &&
+               field->logical_min == -127 && field->logical_max == 127;
+    }
+
+    bool isBootMouse() {
+        const virthid_report_info *info = onlyInputReport();
+        if (!info || m_layout->usesReportIds() || (info->length != 3 && info->length != 4)) return false;
+
+        const virthid_field *buttons = fieldAt(info, 0);
+        if (!buttons || buttons->usage_page != virthid_usage_page_button || buttons->bit_size != 1 ||
+            buttons->count > 8 || buttons->usage_min != 1 || !(buttons->flags & virthid_field_variable)) {
+            return false;
+        }
+
+        // X and Y may come as one field of two elements.
+        const virthid_field *x = fieldAt(info, 8);
+        if (!x || x->bit_size != 8 || !(x->flags & virthid_field_relative)) return false;
+        if (x->count == 2) {
+            if (x->usage_min != virthid_usage_x || x->usage_max < virthid_usage_y) return false;
+            if (x->logical_min != -127 || x->logical_max != 127) return false;
+        } else if (!isAxis(x, virthid_usage_x) || !isAxis(fieldAt(info, 16), virthid_usage_y)) {
+            return false;
+        }
+
+        m_boot_length = info->length;
+        m_boot_buttons = (uint8_t)buttons->count;
+        return info->length == 3 || isAxis(fieldAt(info, 24), virthid_usage_wheel);
+    }
+
+    bool isBootKeyboard() {
+        const virthid_report_info *info = onlyInputReport();
+        if (!info || m_layout->usesReportIds() || info->length != 8) return false;
+
+        const virthid_field *modifiers = fieldAt(info, 0);
+        if (!modifiers || modifiers->usage_page != virthid_usage_page_keyboard || modifiers->bit_size != 1 ||
+            modifiers->count != 8 || modifiers->usage_min != 0xe0 || !(modifiers->flags & virthid_field_variable)) {
+            return false;
+        }
+
+        const virthid_field *keys = fieldAt(info, 16);
+        if (!keys || keys->usage_page != virthid_usage_page_keyboard || keys->bit_size != 8 || keys->count != 6 ||
+            (keys->flags & virthid_field_variable) || keys->usage_min != 0 || keys->logical_min != 0) {
+            return false;
+        }
+
+        m_boot_key_max = keys->usage_max < 0xe0 ? (uint8_t)keys->usage_max : 0xdf;
+        return true;
+    }
+
+    /**
+     *  Return the slot of a report, adding it if there is room.
+     */
+    uint8_t slotFor(const virthid_report_info *info) {
+        for (uint32_t i = 0; i < m_slot_count; i++) {
+            if (m_slots[i].info == info) return (uint8_t)i;
+        }
+
+        if (m_slot_count == virthid_encoder_max_reports) return no_slot;
+
+        m_slots[m_slot_count].info = info;
+        return (uint8_t)m_slot_count++;
+    }
+
+    /**
+     *  Point a target at a field element, unless an earlier report claimed it.
+     */
+    void bind(target *t, const virthid_report_info *info, uint32_t field, uint32_t element) {
+        if (t->slot != no_slot) return;
+
+        uint8_t s = slotFor(info);
+        if (s == no_slot) return;
+
+        t->slot = s;
+        t->field = (uint16_t)field;
+        t->element = (uint16_t)element;
+        t->relative = (m_layout->field(field)->flags & virthid_field_relative) != 0;
+    }
+
+    void compile() {
+        for (uint32_t i = 0; i < m_layout->reportCount(); i++) {
+            const virthid_report_info *info = m_layout->report(i);
+            if (info->type != virthid_report_input || info->length > virthid_max_report) continue;
+
+            for (uint32_t f = info->first_field; f < info->first_field + info->field_count; f++) {
+                const virthid_field *field = m_layout->field(f);
+                if ((field->flags & virthid_field_constant) || !(field->flags & virthid_field_variable)) continue;
+
+                for (uint32_t element = 0; element < field->count; element++) {
+                    uint32_t usage = field->usage_min + element;
+                    if (usage > field->usage_max) usage = field->usage_max;
+
+                    if (field->usage_page == virthid_usage_page_button) {
+                        if (usage >= 1 && usage <= virthid_encoder_buttons) bind(&m_buttons[usage - 1], info, f, element);
+                    } else if (field->usage_page == virthid_usage_page_generic_desktop) {
+                        if (usage == virthid_usage_x && (field->flags & virthid_field_relative)) bind(&m_x, info, f, element);
+                        if (usage == virthid_usage_y && (field->flags & virthid_field_relative)) bind(&m_y, info, f, element);
+                        if (usage == virthid_usage_wheel) bind(&m_wheel, info, f, element);
+                        if (usage >= virthid_usage_x && usage < virthid_usage_x + virthid_encoder_axes) {
+                            bind(&m_axes[usage - virthid_usage_x], info, f, element);
+                        }
+                    } else if (field->usage_page == virthid_usage_page_consumer && usage == virthid_usage_ac_pan) {
+                        bind(&m_pan, info, f, element);
+                    }
+                }
+            }
+        }
+
+        if (m_keyboard.init(m_layout)) {
+            m_keyboard_slot = slotFor(m_keyboard.reportInfo());
+        }
+    }
+
+    /**
+     *  Add to a relative target or set an absolute one.
+     */
+    void write(const target &t, int32_t value, bool add) {
+        if (t.slot == no_slot) return;
+
+        slot &s = m_slots[t.slot];
+        const virthid_field *field = m_layout->field(t.field);
+        int64_t next = value;
+
+        if (add && t.relative) next += virthid_field_get(field, s.pending, t.element);
+
+        virthid_field_set(field, s.pending, clamp(next, field), t.element);
+        s.dirty = true;
+    }
+
+    void applyGeneric(const virthid_input_event *event) {
+        switch (event->type) {
+            case virthid_input_move:
+                write(m_x, event->value, true);
+                write(m_y, event->value2, true);
+                break;
+            case virthid_input_scroll:
+                write(m_wheel, event->value, true);
+                write(m_pan, event->value2, true);
+                break;
+            case virthid_input_button:
+                if (event->code >= 1 && event->code <= virthid_encoder_buttons) {
+                    write(m_buttons[event->code - 1], event->value != 0, false);
+                }
+                break;
+            case virthid_input_key:
+                if (m_keyboard_slot != no_slot) {
+                    slot &s = m_slots[m_keyboard_slot];
+                    if (m_keyboard.apply(event->code, event->value != 0, s.pending)) s.dirty = true;
+                }
+                break;
+            case virthid_input_axis:
+                if (event->code >= virthid_usage_x && event->code < virthid_usage_x + virthid_encoder_axes) {
+                    write(m_axes[event->code - virthid_usage_x], virthid_input_axis_value(event), false);
+                }
+                break;
+        }
+    }
+
+    /**
+     *  Return true if a relative element of a report is not at rest.
+     *
+     *  @param rest Whether to put those elements back to rest.
+     */
+    bool motion(uint8_t *report, const virthid_report_info *info, bool rest) const {
+        bool moved = false;
+        const virthid_field *first = m_layout->field(info->first_field);
+
+        for (const virthid_field *field = first; field < first + info->field_count; field++) {
+            if (!(field->flags & virthid_field_relative) || !(field->flags & virthid_field_variable)) continue;
+
+            for (uint32_t element = 0; element < field->count; element++) {
+                if (virthid_field_get(field, report, element) == 0) continue;
+                moved = true;
+                if (rest) virthid_field_set(field, report, 0, element);
+            }
+        }
+
+        return moved;
+    }
+
+    template <typename Sink>
+    uint32_t flushGeneric(Sink &sink) {
+        uint32_t sent = 0;
+
+        for (uint32_t i = 0; i < m_slot_count; i++) {
+            slot &s = m_slots[i];
+            if (!s.dirty) continue;
+            s.dirty = false;
+
+            bool moved = motion(s.pending, s.info, false);
+            if (!moved && memcmp(s.pending, s.last, s.info->length) == 0) continue;
+
+            if (sink.send(s.pending, s.info->length)) sent++;
+            memcpy(s.last, s.pending, s.info->length);
+
+            // Motion is delivered once, the next report starts from rest.
+            if (moved) motion(s.pending, s.info, true);
+        }
+
+        return sent;
+    }
+
+    void applyBootMouse(const virthid_input_event *event) {
+        switch (event->type) {
+            case virthid_input_move:
+                m_boot.dx = clamp8(m_boot.dx + event->value);
+                m_boot.dy = clamp8(m_boot.dy + event->value2);
+                m_boot.dirty = true;
+                break;
+            case virthid_input_scroll:
+                if (m_boot_length == 4) m_boot.wheel = clamp8(m_boot.wheel + event->value);
+                m_boot.dirty = true;
+                break;
+            case virthid_input_button:
+                if (event->code >= 1 && event->code <= m_boot_buttons) {
+                    uint8_t bit = (uint8_t)(1 << (event->code - 1));
+                    m_boot.report[0] = event->value ? (m_boot.report[0] | bit) : (m_boot.report[0] & ~bit);
+                    m_boot.dirty = true;
+                }
+                break;
+        }
+    }
+
+    template <typename Sink>
+    uint32_t flushBootMouse(Sink &sink) {
+        uint32_t length = m_boot_length;
+        if (!m_boot.dirty) return 0;
+        m_boot.dirty = false;
+
+        m_boot.report[1] = (uint8_t)m_boot.dx;
+        m_boot.report[2] = (uint8_t)m_boot.dy;
+        m_boot.report[3] = (uint8_t)m_boot.wheel;
+        bool motion = m_boot.dx || m_boot.dy || m_boot.wheel;
+        m_boot.dx = m_boot.dy = m_boot.wheel = 0;
+
+        if (!motion && memcmp(m_boot.report, m_boot.last, length) == 0) return 0;
+        memcpy(m_boot.last, m_boot.report, length);
+
+        return sink.send(m_boot.report, length) ? 1 : 0;
+    }
+
+    void applyBootKeyboard(const virthid_input_event *event) {
+        uint16_t usage = event->code;
+        bool down = event->value != 0;
+
+        if (event->type != virthid_input_key) return;
+
+        if (usage >= 0xe0 && usage <= 0xe7) {
+            uint8_t bit = (uint8_t)(1 << (usage - 0xe0));
+            m_boot.report[0] = down ? (m_boot.report[0] | bit) : (m_boot.report[0] & ~bit);
+            m_boot.dirty = true;
+            return;
+        }
+
+        if (usage > m_boot_key_max) return;
+
+        uint32_t bit = 1u << (usage % 32);
+        if (((m_boot.keys[usage / 32] & bit) != 0) == down) return;
+
+        m_boot.keys[usage / 32] ^= bit;
+        m_boot.keys_pressed += down ? 1 : -1;
+
+        // Same order as 'virthid_keyboard': by usage, or ErrorRollOver everywhere.
+        uint32_t next = 2;
+        if (m_boot.keys_pressed > 6) {
+            memset(m_boot.report + 2, virthid_usage_error_rollover, 6);
+        } else {
+            for (uint32_t word = 0; word < virthid_keyboard_usages / 32; word++) {
+                for (uint32_t bits = m_boot.keys[word]; bits; bits &= bits - 1) {
+                    m_boot.report[next++] = (uint8_t)(word * 32 + __builtin_ctz(bits));
+                }
+            }
+            memset(m_boot.report + next, 0, 8 - next);
+        }
+        m_boot.dirty = true;
+    }
+
+    template <typename Sink>
+    uint32_t flushBootKeyboard(Sink &sink) {
+        if (!m_boot.dirty) return 0;
+        m_boot.dirty = false;
+
+        if (memcmp(m_boot.report, m_boot.last, 8) == 0) return 0;
+        memcpy(m_boot.last, m_boot.report, 8);
+
+        return sink.send(m_boot.report, 8) ? 1 : 0;
+    }
+
+    template <virthid_encoder_kind K, typename Sink>
+    uint32_t flush(Sink &sink) {
+        if constexpr (K == virthid_encoder_boot_mouse) return flushBootMouse(sink);
+        else if constexpr (K == virthid_encoder_boot_keyboard) return flushBootKeyboard(sink);
+        else return flushGeneric(sink);
+    }
+
+    template <virthid_encoder_kind K, typename Sink>
+    uint32_t run(const virthid_input_event *events, uint32_t count, Sink &sink, bool end) {
+        uint32_t sent = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            // Copied once, the events may be shared with a user task.
+            virthid_input_event event;
+            memcpy(&event, &events[i], sizeof(event));
+
+            if (event.type == virthid_input_sync) {
+                sent += flush<K>(sink);
+            } else if constexpr (K == virthid_encoder_boot_mouse) {
+                applyBootMouse(&event);
+            } else if constexpr (K == virthid_encoder_boot_keyboard) {
+                applyBootKeyboard(&event);
+            } else {
+                applyGeneric(&event);
+            }
+        }
+
+        return end ? sent + flush<K>(sink) : sent;
+    }
+
+    const virthid_report_layout *m_layout = nullptr;
+    virthid_encoder_kind m_kind = virthid_encoder_none;
+
+    target m_x, m_y, m_wheel, m_pan;
+    target m_buttons[virthid_encoder_buttons];
+    target m_axes[virthid_encoder_axes];
+    slot m_slots[virthid_encoder_max_reports];
+    uint32_t m_slot_count = 0;
+
+    virthid_keyboard m_keyboard;
+    uint8_t m_keyboard_slot = no_slot;
+
+    uint32_t m_boot_length = 0;
+    uint8_t m_boot_buttons = 0;
+    uint8_t m_boot_key_max = 0;
+    boot_state m_boot;
+};
+
+#endif
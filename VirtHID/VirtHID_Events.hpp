@@ -0,0 +1,191 @@
+//
+//  VirtHID_Events.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_events_h
+#define virthid_events_h
+
+#include <stdint.h>
+#include <string.h>
+
+enum virthid_event_type {
+    virthid_event_created = 1,
+    virthid_event_destroyed,
+
+    // Events were lost, the client must resync with a full listing.
+    virthid_event_overflow,
+};
+
+/**
+ *  Number of registry events a client may have pending.
+ */
+const uint32_t virthid_event_queue_size = 64;
+
+/**
+ *  A batch of events is a sequence of records, each made of this header
+ *  followed by 'name_len' name bytes (not NUL-terminated), padded to a
+ *  multiple of four bytes.
+ */
+typedef struct virthid_event_record {
+    uint32_t type;
+    uint32_t handle;
+    uint8_t name_len;
+    uint8_t reserved[3];
+} virthid_event_record;
+
+/**
+ *  Space taken by the largest record. A buffer at least this large always
+ *  makes progress.
+ */
+const uint32_t virthid_event_max_record = (sizeof(virthid_event_record) + 255 + 3) & ~3u;
+
+inline uint32_t virthid_event_record_size(uint8_t name_len) {
+    return (sizeof(virthid_event_record) + name_len + 3) & ~3u;
+}
+
+/**
+ *  Bounded FIFO of registry events. When an event does not fit, every
+ *  pending event is discarded and replaced by a single overflow marker;
+ *  events pushed afterwards queue up behind it as usual, so a client that
+ *  resyncs on the marker and then applies what follows ends up current.
+ *
+ *  The object is large and has no constructor, allocate it where needed and
+ *  call 'reset' before use. Not thread-safe, callers provide the locking.
+ */
+template <uint32_t N = virthid_event_queue_size>
+class virthid_event_queue {
+public:
+    void reset() {
+        m_head = 0;
+        m_count = 0;
+        m_overflow = false;
+    }
+
+    /**
+     *  Queue an event.
+     *
+     *  @param was_empty Set to true if nothing was pending before, that is
+     *                   when the client needs to be told.
+     *
+     *  @return False if the queue overflowed.
+     */
+    bool push(uint32_t type, uint32_t handle, const char *name, uint8_t name_len, bool *was_empty) {
+        *was_empty = pending() == 0;
+
+        if (m_count == N) {
+            m_head = 0;
+            m_count = 0;
+            m_overflow = true;
+            return false;
+        }
+
+        event *e = &m_events[(m_head + m_count) % N];
+        e->type = type;
+        e->handle = handle;
+        e->name_len = name_len;
+        memcpy(e->name, name, name_len);
+        m_count++;
+
+        return true;
+    }
+
+    /**
+     *  Move as many pending events as fit into a buffer, the overflow marker first.
+     *
+     *  @param buf     Receives the records.
+     *  @param buf_len Length of 'buf'.
+     *  @param used    Receives the number of bytes written.
+     *
+     *  @return The number of records written.
+     */
+    uint32_t drain(uint8_t *buf, uint32_t buf_len, uint32_t *used) {
+        uint32_t count = 0;
+        *used = 0;
+
+        if (m_overflow) {
+            if (!write(buf, buf_len, used, virthid_event_overflow, 0, nullptr, 0)) return 0;
+            m_overflow = false;
+            count++;
+        }
+
+        while (m_count > 0) {
+            event *e = &m_events[m_head];
+            if (!write(buf, buf_len, used, e->type, e->handle, e->name, e->name_len)) break;
+
+            m_head = (m_head + 1) % N;
+            m_count--;
+            count++;
+        }
+
+        return count;
+    }
+
+    /**
+     *  Return the number of records a drain would produce with enough space.
+     */
+    uint32_t pending() const {
+        return m_count + (m_overflow ? 1 : 0);
+    }
+
+private:
+    struct event {
+        uint32_t type;
+        uint32_t handle;
+        uint8_t name_len;
+        char name[255];
+    };
+
+    static bool write(uint8_t *buf, uint32_t buf_len, uint32_t *used,
+                      uint32_t type, uint32_t handle, const char *name, uint8_t name_len) {
+        uint32_t size = virthid_event_record_size(name_len);
+        if (size > buf_len - *used) return false;
+
+        virthid_event_record record = {type, handle, name_len, {0, 0, 0}};
+        memcpy(buf + *used, &record, sizeof(record));
+        memset(buf + *used + sizeof(record), 0, size - sizeof(record));
+        if (name_len) memcpy(buf + *used + sizeof(record), name, name_len);
+        *used += size;
+
+        return true;
+    }
+
+    event m_events[N];
+    uint32_t m_head;
+    uint32_t m_count;
+    bool m_overflow;
+};
+
+/**
+ *  Walk the records of an event batch.
+ *
+ *  @return 1 with a record, 0 at the end, -1 on a truncated record.
+ */
+class virthid_event_reader {
+public:
+    virthid_event_reader(const uint8_t *buf, uint32_t buf_len) : m_buf(buf), m_buf_len(buf_len), m_offset(0) {}
+
+    int next(virthid_event_record *record, const char **name) {
+        uint32_t remaining = m_buf_len - m_offset;
+        if (remaining == 0) return 0;
+        if (remaining < sizeof(*record)) return -1;
+
+        memcpy(record, m_buf + m_offset, sizeof(*record));
+        uint32_t size = virthid_event_record_size(record->name_len);
+        if (sizeof(*record) + record->name_len > remaining) return -1;
+
+        *name = (const char *)(m_buf + m_offset + sizeof(*record));
+        m_offset = size < remaining ? m_offset + size : m_buf_len;
+
+        return 1;
+    }
+
+private:
+    const uint8_t *m_buf;
+    uint32_t m_buf_len;
+    uint32_t m_offset;
+};
+
+#endif
@@ -0,0 +1,125 @@
+//
+//  VirtHID_Flow.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_flow_h
+#define virthid_flow_h
+
+#include <stdint.h>
+
+/**
+ *  Flow state returned on the send path.
+ */
+enum virthid_flow_state {
+    virthid_flow_clear = 0,
+
+    // The backlog reached the high watermark, producers should slow down
+    // until the device's 'subscribe_flow' notification arrives.
+    virthid_flow_congested,
+};
+
+/**
+ *  Default watermarks, in pending reports. The high one leaves headroom
+ *  below the coalescing queue depth, so producers hear about congestion
+ *  before reports get rejected.
+ */
+const uint32_t virthid_flow_default_high = 6;
+const uint32_t virthid_flow_default_low = 2;
+
+/**
+ *  Largest high watermark a client may set.
+ */
+const uint32_t virthid_flow_max_watermark = 4096;
+
+/**
+ *  Pending report count of a device with high/low watermark hysteresis.
+ *  Every report entering the backlog calls 'enter' and, once handed on or
+ *  dropped, 'leave'. Reaching the high watermark makes the flow congested;
+ *  it only clears once the backlog drains to the low watermark, and exactly
+ *  one 'leave' reports that transition.
+ *
+ *  A transition is never lost: the report that made the flow congested is
+ *  still pending when it does so, and its own 'leave' comes later.
+ *
+ *  Lock-free, safe to use from any number of threads.
+ */
+class virthid_flow {
+public:
+    /**
+     *  Reset the count and state and use the default watermarks.
+     */
+    void reset() {
+        __atomic_store_n(&m_depth, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_state, virthid_flow_clear, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_high, virthid_flow_default_high, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_low, virthid_flow_default_low, __ATOMIC_RELAXED);
+    }
+
+    /**
+     *  Change the watermarks. Takes effect with the next 'enter' or 'leave'.
+     *
+     *  @return False unless 0 <= low < high <= 'virthid_flow_max_watermark'.
+     */
+    bool setWatermarks(uint32_t high, uint32_t low) {
+        if (high == 0 || high > virthid_flow_max_watermark || low >= high) return false;
+
+        __atomic_store_n(&m_high, high, __ATOMIC_RELAXED);
+        __atomic_store_n(&m_low, low, __ATOMIC_RELAXED);
+
+        return true;
+    }
+
+    /**
+     *  Count a report entering the backlog.
+     *
+     *  @param state Receives the resulting 'virthid_flow_state'.
+     *
+     *  @return The backlog depth, this report included.
+     */
+    uint32_t enter(uint32_t *state) {
+        uint32_t depth = __atomic_add_fetch(&m_depth, 1, __ATOMIC_SEQ_CST);
+
+        if (depth >= __atomic_load_n(&m_high, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&m_state, virthid_flow_congested, __ATOMIC_SEQ_CST);
+            *state = virthid_flow_congested;
+        } else {
+            *state = __atomic_load_n(&m_state, __ATOMIC_SEQ_CST);
+        }
+
+        return depth;
+    }
+
+    /**
+     *  Count a report leaving the backlog.
+     *
+     *  @return True if this drained a congested flow to the low watermark,
+     *          the caller then tells producers they may write again.
+     */
+    bool leave() {
+        uint32_t depth = __atomic_sub_fetch(&m_depth, 1, __ATOMIC_SEQ_CST);
+        if (depth > __atomic_load_n(&m_low, __ATOMIC_RELAXED)) return false;
+
+        uint32_t expected = virthid_flow_congested;
+        return __atomic_compare_exchange_n(&m_state, &expected, virthid_flow_clear, false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+
+    uint32_t depth() const {
+        return __atomic_load_n(&m_depth, __ATOMIC_SEQ_CST);
+    }
+
+    uint32_t state() const {
+        return __atomic_load_n(&m_state, __ATOMIC_SEQ_CST);
+    }
+
+private:
+    uint32_t m_depth = 0;
+    uint32_t m_state = virthid_flow_clear;
+    uint32_t m_high = virthid_flow_default_high;
+    uint32_t m_low = virthid_flow_default_low;
+};
+
+#endif
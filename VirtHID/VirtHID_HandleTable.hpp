@@ -0,0 +1,149 @@
+//
+//  VirtHID_HandleTable.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_handle_table_h
+#define virthid_handle_table_h
+
+#include <stdint.h>
+
+/**
+ *  A device handle is a 32-bit value: the low bits index a slot of the
+ *  handle table and the high bits carry that slot's generation, so a stale
+ *  handle never resolves to a device that later reused the same slot.
+ *  The top four bits are always clear, so a handle can be tagged with a
+ *  memory type for 'clientMemoryForType'. Zero is never a valid handle.
+ */
+typedef uint32_t virthid_handle;
+
+const virthid_handle virthid_invalid_handle = 0;
+
+const uint32_t virthid_handle_index_bits = 16;
+const uint32_t virthid_handle_index_mask = (1u << virthid_handle_index_bits) - 1;
+const uint32_t virthid_handle_generation_mask = 0xfff;
+const uint32_t virthid_handle_mask = 0x0fffffff;
+
+/**
+ *  Maximum number of devices a single driver instance can manage.
+ */
+const uint32_t virthid_max_devices = 1024;
+
+/**
+ *  Fixed-size table mapping handles to objects with O(1) insert, lookup and
+ *  removal and no allocation. It does not own or retain the stored objects
+ *  and does no locking of its own.
+ */
+template <typename T, uint32_t N = virthid_max_devices>
+class virthid_handle_table {
+    static_assert(N > 0 && N <= virthid_handle_index_mask + 1, "Too many handle slots.");
+
+public:
+    virthid_handle_table() {
+        for (uint32_t i = 0; i < N; i++) {
+            m_slots[i].object = nullptr;
+            m_slots[i].generation = 1;
+            m_slots[i].next_free = i + 1;
+        }
+        m_free_head = 0;
+        m_count = 0;
+    }
+
+    /**
+     *  Store an object in a free slot.
+     *
+     *  @param object The object to store, must not be null.
+     *
+     *  @return The new handle, or 'virthid_invalid_handle' if the table is full.
+     */
+    virthid_handle insert(T *object) {
+        if (!object || m_free_head >= N) return virthid_invalid_handle;
+
+        uint32_t index = m_free_head;
+        slot &s = m_slots[index];
+        m_free_head = s.next_free;
+        s.object = object;
+        m_count++;
+
+        return makeHandle(index, s.generation);
+    }
+
+    /**
+     *  Resolve a handle.
+     *
+     *  @return The stored object, or null if the handle is stale or invalid.
+     */
+    T *lookup(virthid_handle handle) const {
+        uint32_t index = handle & virthid_handle_index_mask;
+        if (index >= N) return nullptr;
+
+        const slot &s = m_slots[index];
+        if (s.generation != (handle >> virthid_handle_index_bits)) return nullptr;
+
+        return s.object;
+    }
+
+    /**
+     *  Release a handle. Its slot generation is bumped so that the handle,
+     *  and every copy of it, stops resolving.
+     *
+     *  @return The object that was stored, or null if the handle was not valid.
+     */
+    T *remove(virthid_handle handle) {
+        T *object = lookup(handle);
+        if (!object) return nullptr;
+
+        uint32_t index = handle & virthid_handle_index_mask;
+        slot &s = m_slots[index];
+        s.object = nullptr;
+        s.generation = (s.generation + 1) & virthid_handle_generation_mask;
+        if (s.generation == 0) s.generation = 1;
+        s.next_free = m_free_head;
+        m_free_head = index;
+        m_count--;
+
+        return object;
+    }
+
+    /**
+     *  Return the object stored in a slot, or null if the slot is free.
+     *
+     *  @param index  A slot index, below 'capacity'.
+     *  @param handle If not null, receives the handle of the object.
+     */
+    T *at(uint32_t index, virthid_handle *handle = nullptr) const {
+        const slot &s = m_slots[index];
+        if (s.object && handle) *handle = makeHandle(index, s.generation);
+        return s.object;
+    }
+
+    static uint32_t capacity() {
+        return N;
+    }
+
+    /**
+     *  Return the number of stored objects.
+     */
+    uint32_t count() const {
+        return m_count;
+    }
+
+private:
+    struct slot {
+        T *object;
+        uint32_t generation;
+        uint32_t next_free;
+    };
+
+    static virthid_handle makeHandle(uint32_t index, uint32_t generation) {
+        return (generation << virthid_handle_index_bits) | index;
+    }
+
+    slot m_slots[N];
+    uint32_t m_free_head;
+    uint32_t m_count;
+};
+
+#endif
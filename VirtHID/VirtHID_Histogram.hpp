@@ -0,0 +1,133 @@
+//
+//  VirtHID_Histogram.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_histogram_h
+#define virthid_histogram_h
+
+#include <stdint.h>
+
+/**
+ *  Directions a device measures latency for.
+ *
+ *  input:  from the sending call entering 'externalMethod' to 'handleReport'
+ *          returning, whichever path the report took: coalesced reports keep
+ *          the time of the oldest report merged into them, scheduled reports
+ *          count from their deadline and polled frames from their timer firing.
+ *  output: from 'setReport' entry to the subscriber notification being sent, or to
+ *          the report landing in the subscriber's output ring.
+ */
+enum {
+    virthid_latency_input = 0,
+    virthid_latency_output,
+
+    virthid_latency_direction_count
+};
+
+/**
+ *  Log-linear bucketing: values below 2^sub_bits get a bucket each, above
+ *  that every power of two is split into 2^sub_bits equal buckets, so a
+ *  bucket is never wider than 1/16 of its values. Values of 2^max_bits and
+ *  above (about 68 seconds in nanoseconds) land in the last bucket.
+ */
+const uint32_t virthid_histogram_sub_bits = 4;
+const uint32_t virthid_histogram_max_bits = 36;
+const uint32_t virthid_histogram_buckets =
+    (virthid_histogram_max_bits - virthid_histogram_sub_bits + 1) << virthid_histogram_sub_bits;
+
+typedef struct virthid_histogram_snapshot {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[virthid_histogram_buckets];
+} virthid_histogram_snapshot;
+
+/**
+ *  Return the bucket a value is counted in.
+ */
+inline uint32_t virthid_histogram_bucket(uint64_t value) {
+    const uint32_t sub_count = 1u << virthid_histogram_sub_bits;
+
+    if (value < sub_count) return (uint32_t)value;
+    if (value >> virthid_histogram_max_bits) return virthid_histogram_buckets - 1;
+
+    uint32_t msb = 63 - __builtin_clzll(value);
+    uint32_t shift = msb - virthid_histogram_sub_bits;
+    return (shift + 1) * sub_count + (uint32_t)((value >> shift) & (sub_count - 1));
+}
+
+/**
+ *  Return the smallest value counted in a bucket.
+ */
+inline uint64_t virthid_histogram_bucket_lowest(uint32_t bucket) {
+    const uint32_t sub_count = 1u << virthid_histogram_sub_bits;
+
+    if (bucket < sub_count) return bucket;
+
+    uint32_t shift = bucket / sub_count - 1;
+    return (uint64_t)(sub_count + bucket % sub_count) << shift;
+}
+
+/**
+ *  Return the value below which 'permille' thousandths of the snapshot fall,
+ *  as the lowest value of the bucket holding it.
+ */
+inline uint64_t virthid_histogram_percentile(const virthid_histogram_snapshot *snapshot, uint32_t permille) {
+    uint64_t target = (snapshot->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    if (target == 0) return 0;
+
+    for (uint32_t i = 0; i < virthid_histogram_buckets; i++) {
+        seen += snapshot->buckets[i];
+        if (seen >= target) return virthid_histogram_bucket_lowest(i);
+    }
+
+    return snapshot->max;
+}
+
+/**
+ *  Lock-free latency histogram. Recording is a few relaxed atomic adds, so
+ *  any number of threads may record while another takes a snapshot.
+ */
+class virthid_histogram {
+public:
+    virthid_histogram() : m_sum(0), m_max(0) {
+        for (uint32_t i = 0; i < virthid_histogram_buckets; i++) m_buckets[i] = 0;
+    }
+
+    void record(uint64_t value) {
+        __atomic_fetch_add(&m_buckets[virthid_histogram_bucket(value)], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&m_sum, value, __ATOMIC_RELAXED);
+
+        uint64_t max = __atomic_load_n(&m_max, __ATOMIC_RELAXED);
+        while (value > max &&
+               !__atomic_compare_exchange_n(&m_max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+
+    /**
+     *  Copy the histogram without stopping writers. Every bucket is read
+     *  atomically and 'count' is the sum of the copied buckets, so the
+     *  snapshot is self-consistent; 'sum' and 'max' may already include
+     *  a few values recorded while copying.
+     */
+    void snapshot(virthid_histogram_snapshot *out) const {
+        out->count = 0;
+        for (uint32_t i = 0; i < virthid_histogram_buckets; i++) {
+            out->buckets[i] = __atomic_load_n(&m_buckets[i], __ATOMIC_RELAXED);
+            out->count += out->buckets[i];
+        }
+        out->sum = __atomic_load_n(&m_sum, __ATOMIC_RELAXED);
+        out->max = __atomic_load_n(&m_max, __ATOMIC_RELAXED);
+    }
+
+private:
+    uint64_t m_buckets[virthid_histogram_buckets];
+    uint64_t m_sum;
+    uint64_t m_max;
+};
+
+#endif
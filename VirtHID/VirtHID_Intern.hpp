@@ -0,0 +1,185 @@
+//
+//  VirtHID_Intern.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_intern_h
+#define virthid_intern_h
+
+#include <stdint.h>
+
+#include "VirtHID_HandleTable.hpp"
+
+/**
+ *  FNV-1a hash of a byte string.
+ */
+inline uint32_t virthid_hash_bytes(const uint8_t *bytes, uint32_t len) {
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ *  Return the smallest power of two holding 'n' entries at most half full.
+ */
+constexpr uint32_t virthid_intern_slots(uint32_t n, uint32_t slots = 1) {
+    return slots >= 2 * n ? slots : virthid_intern_slots(n, slots * 2);
+}
+
+/**
+ *  Hash table of up to 'N' distinct objects addressed by their content, each
+ *  with a count of users. An object stays interned as long as it has users.
+ *
+ *  'T' needs 'uint32_t hash() const' and 'bool equals(const uint8_t *, uint32_t) const'.
+ *  The table does not own or retain the stored objects and does no locking
+ *  of its own.
+ */
+template <typename T, uint32_t N = virthid_max_devices>
+class virthid_intern_table {
+    static const uint32_t S = virthid_intern_slots(N);
+
+public:
+    virthid_intern_table() {
+        for (uint32_t i = 0; i < S; i++) {
+            m_slots[i].object = nullptr;
+            m_slots[i].hash = 0;
+            m_slots[i].users = 0;
+        }
+        m_count = 0;
+    }
+
+    /**
+     *  Find an object by content and add a user to it.
+     *
+     *  @return The object, or null if no object has this content.
+     */
+    T *acquire(const uint8_t *bytes, uint32_t len, uint32_t hash) {
+        for (uint32_t i = hash & (S - 1); m_slots[i].object; i = (i + 1) & (S - 1)) {
+            slot &s = m_slots[i];
+            if (s.hash == hash && s.object->equals(bytes, len)) {
+                s.users++;
+                return s.object;
+            }
+        }
+
+        return nullptr;
+    }
+
+    /**
+     *  Store an object with a single user. The caller makes sure no object
+     *  with the same content is stored already.
+     *
+     *  @return False if the table is full.
+     */
+    bool insert(T *object) {
+        if (!object || m_count >= N) return false;
+
+        uint32_t i = object->hash() & (S - 1);
+        while (m_slots[i].object) i = (i + 1) & (S - 1);
+
+        m_slots[i].object = object;
+        m_slots[i].hash = object->hash();
+        m_slots[i].users = 1;
+        m_count++;
+
+        return true;
+    }
+
+    /**
+     *  Add a user to a stored object.
+     *
+     *  @return False if the object is not stored.
+     */
+    bool retain(T *object) {
+        uint32_t i = find(object);
+        if (i == S) return false;
+
+        m_slots[i].users++;
+        return true;
+    }
+
+    /**
+     *  Remove a user from a stored object, and the object itself with its last user.
+     *
+     *  @return True if the object has been removed.
+     */
+    bool release(T *object) {
+        uint32_t i = find(object);
+        if (i == S) return false;
+
+        if (--m_slots[i].users > 0) return false;
+
+        erase(i);
+        m_count--;
+        return true;
+    }
+
+    /**
+     *  Return the number of users of a stored object, zero if it is not stored.
+     */
+    uint32_t users(T *object) const {
+        uint32_t i = find(object);
+        return i == S ? 0 : m_slots[i].users;
+    }
+
+    /**
+     *  Return the number of stored objects.
+     */
+    uint32_t count() const {
+        return m_count;
+    }
+
+private:
+    struct slot {
+        T *object;
+        uint32_t hash;
+        uint32_t users;
+    };
+
+    uint32_t find(T *object) const {
+        if (!object) return S;
+
+        for (uint32_t i = object->hash() & (S - 1); m_slots[i].object; i = (i + 1) & (S - 1)) {
+            if (m_slots[i].object == object) return i;
+        }
+
+        return S;
+    }
+
+    /**
+     *  Empty a slot, moving back the entries that probed past it so that
+     *  lookups never need tombstones.
+     */
+    void erase(uint32_t i) {
+        uint32_t j = i;
+
+        for (;;) {
+            m_slots[i].object = nullptr;
+
+            for (;;) {
+                j = (j + 1) & (S - 1);
+                if (!m_slots[j].object) return;
+
+                // Entries whose home slot lies in (i, j] are still reachable.
+                uint32_t home = m_slots[j].hash & (S - 1);
+                bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+                if (!reachable) break;
+            }
+
+            m_slots[i] = m_slots[j];
+            i = j;
+        }
+    }
+
+    slot m_slots[S];
+    uint32_t m_count;
+};
+
+#endif
@@ -0,0 +1,281 @@
+//
+//  VirtHID_Keyboard.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_keyboard_h
+#define virthid_keyboard_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Types.hpp"
+#include "VirtHID_Descriptor.hpp"
+
+const uint16_t virthid_usage_page_keyboard = 0x07;
+const uint16_t virthid_usage_error_rollover = 0x01;
+
+/**
+ *  Number of keyboard usages tracked, the whole 8-bit range of the keyboard page.
+ */
+const uint32_t virthid_keyboard_usages = 256;
+
+/**
+ *  Array fields of a keyboard report that are filled with pressed keys.
+ */
+const uint32_t virthid_keyboard_max_arrays = 4;
+
+/**
+ *  A key transition sent with 'send_keys'. Events are applied in order.
+ */
+typedef struct virthid_key_event {
+    uint16_t usage;     // Keyboard page usage, modifiers included.
+    uint8_t down;       // Non-zero when pressed.
+    uint8_t reserved;
+} virthid_key_event;
+
+static_assert(sizeof(virthid_key_event) == 4, "Key events are four bytes.");
+
+/**
+ *  Pressed keys of a keyboard and the input report they translate to.
+ *
+ *  The report is the first input report carrying keyboard page fields.
+ *  Usages covered by a variable field (modifiers, NKRO bitmaps) set their
+ *  own element, every other pressed usage goes into the array fields (6KRO)
+ *  in usage order. If more keys are pressed than the arrays hold, every
+ *  array element reports ErrorRollOver, as the HID specification asks.
+ *
+ *  Not thread-safe, callers provide the locking.
+ */
+class virthid_keyboard {
+public:
+    /**
+     *  Find the keyboard report of a layout and release every key.
+     *
+     *  @return False if the layout has no usable keyboard input report.
+     */
+    bool init(const virthid_report_layout *layout) {
+        m_layout = layout;
+        m_info = nullptr;
+        m_array_count = 0;
+        m_array_capacity = 0;
+        memset(m_array_mask, 0, sizeof(m_array_mask));
+
+        for (uint32_t i = 0; i < virthid_keyboard_usages; i++) {
+            m_keys[i].field = no_field;
+            m_keys[i].element = 0;
+        }
+
+        if (!layout->isValid() || !layout->hasAllFields()) return false;
+
+        for (uint32_t i = 0; i < layout->reportCount() && !m_info; i++) {
+            const virthid_report_info *info = layout->report(i);
+            if (info->type != virthid_report_input || info->length > virthid_max_report) continue;
+
+            for (uint32_t f = info->first_field; f < info->first_field + info->field_count; f++) {
+                if (!isKeyField(layout->field(f))) continue;
+                m_info = info;
+                break;
+            }
+        }
+        if (!m_info) return false;
+
+        for (uint32_t f = m_info->first_field; f < m_info->first_field + m_info->field_count; f++) {
+            const virthid_field *field = layout->field(f);
+            if (!isKeyField(field)) continue;
+
+            if (!(field->flags & virthid_field_variable)) {
+                if (m_array_count < virthid_keyboard_max_arrays) {
+                    m_arrays[m_array_count++] = (uint16_t)f;
+                    m_array_capacity += field->count;
+                }
+                continue;
+            }
+
+            for (uint32_t element = 0; element < field->count; element++) {
+                uint32_t usage = field->usage_min + element;
+                if (usage > field->usage_max || usage >= virthid_keyboard_usages) break;
+                if (m_keys[usage].field != no_field) continue;
+
+                m_keys[usage].field = (uint16_t)f;
+                m_keys[usage].element = (uint16_t)element;
+            }
+        }
+
+        // Whatever no variable field covers goes into the arrays, if they can hold it.
+        for (uint32_t usage = 0; usage < virthid_keyboard_usages; usage++) {
+            for (uint32_t a = 0; a < m_array_count && m_keys[usage].field == no_field; a++) {
+                const virthid_field *field = layout->field(m_arrays[a]);
+                if (usage < field->usage_min || usage > field->usage_max) continue;
+                m_keys[usage].field = array_field;
+                m_array_mask[usage / 32] |= 1u << (usage % 32);
+            }
+        }
+
+        reset(nullptr);
+        return true;
+    }
+
+    /**
+     *  Return the length of the keyboard report, report ID included.
+     */
+    uint32_t reportLength() const {
+        return m_info ? m_info->length : 0;
+    }
+
+    /**
+     *  Return the keyboard report, or null if 'init' failed.
+     */
+    const virthid_report_info *reportInfo() const {
+        return m_info;
+    }
+
+    /**
+     *  Release every key.
+     *
+     *  @param report If not null, receives the resulting report.
+     *
+     *  @return True if the report changed and has to be sent.
+     */
+    bool reset(uint8_t *report) {
+        uint8_t before[virthid_max_report];
+
+        memset(m_pressed, 0, sizeof(m_pressed));
+        m_pressed_count = 0;
+        m_array_pressed = 0;
+
+        if (!m_info) return false;
+
+        memcpy(before, m_report, m_info->length);
+        memset(m_report, 0, m_info->length);
+        if (m_layout->usesReportIds()) m_report[0] = m_info->id;
+        if (report) memcpy(report, m_report, m_info->length);
+
+        return memcmp(before, m_report, m_info->length) != 0;
+    }
+
+    /**
+     *  Apply a key transition.
+     *
+     *  @param usage  A keyboard page usage.
+     *  @param down   Whether the key is pressed.
+     *  @param report Receives the new report, of 'reportLength' bytes, if it changed.
+     *
+     *  @return True if the report changed and has to be sent. Repeated
+     *          transitions and keys the report cannot express change nothing.
+     */
+    bool apply(uint16_t usage, bool down, uint8_t *report) {
+        if (!m_info || usage >= virthid_keyboard_usages || isPressed(usage) == down) return false;
+
+        uint32_t word = usage / 32;
+        uint32_t bit = 1u << (usage % 32);
+        const key &k = m_keys[usage];
+
+        if (down) {
+            m_pressed[word] |= bit;
+            m_pressed_count++;
+        } else {
+            m_pressed[word] &= ~bit;
+            m_pressed_count--;
+        }
+
+        if (k.field == no_field) return false;
+
+        if (k.field == array_field) {
+            m_array_pressed += down ? 1 : -1;
+            if (!fillArrays()) return false;
+        } else {
+            virthid_field_set(m_layout->field(k.field), m_report, down ? 1 : 0, k.element);
+        }
+
+        memcpy(report, m_report, m_info->length);
+        return true;
+    }
+
+    bool isPressed(uint16_t usage) const {
+        return usage < virthid_keyboard_usages && (m_pressed[usage / 32] & (1u << (usage % 32)));
+    }
+
+    uint32_t pressedCount() const {
+        return m_pressed_count;
+    }
+
+private:
+    static const uint16_t no_field = 0xffff;
+    static const uint16_t array_field = 0xfffe;
+
+    struct key {
+        uint16_t field;
+        uint16_t element;
+    };
+
+    static bool isKeyField(const virthid_field *field) {
+        return field->usage_page == virthid_usage_page_keyboard && !(field->flags & virthid_field_constant) &&
+               field->bit_size > 0;
+    }
+
+    /**
+     *  Rewrite the array fields from the pressed keys.
+     *
+     *  @return False if the arrays did not change.
+     */
+    bool fillArrays() {
+        uint8_t before[virthid_max_report];
+        uint8_t pending[virthid_keyboard_usages];
+        uint32_t pending_count = 0;
+        bool rollover = m_array_pressed > m_array_capacity;
+
+        memcpy(before, m_report, m_info->length);
+
+        for (uint32_t word = 0; !rollover && word < virthid_keyboard_usages / 32; word++) {
+            for (uint32_t bits = m_pressed[word] & m_array_mask[word]; bits; bits &= bits - 1) {
+                pending[pending_count++] = (uint8_t)(word * 32 + __builtin_ctz(bits));
+            }
+        }
+
+        for (uint32_t a = 0; a < m_array_count; a++) {
+            const virthid_field *field = m_layout->field(m_arrays[a]);
+            uint32_t next = 0;
+
+            for (uint32_t element = 0; element < field->count; element++) {
+                uint32_t value = rollover ? virthid_usage_error_rollover : 0;
+
+                // Pending usages are in order, each array takes those in its range.
+                while (!rollover && next < pending_count) {
+                    uint32_t usage = pending[next++];
+                    if (usage < field->usage_min || usage > field->usage_max) continue;
+                    value = usage;
+                    break;
+                }
+
+                // Array elements hold an index into the usage range, zero meaning none.
+                int32_t index = 0;
+                if (value && value >= field->usage_min) index = (int32_t)(value - field->usage_min) + field->logical_min;
+
+                if (field->bit_size == 8 && (field->bit_offset & 7) == 0) {
+                    m_report[field->bit_offset / 8 + element] = (uint8_t)index;
+                } else {
+                    virthid_field_set(field, m_report, index, element);
+                }
+            }
+        }
+
+        return memcmp(before, m_report, m_info->length) != 0;
+    }
+
+    const virthid_report_layout *m_layout = nullptr;
+    const virthid_report_info *m_info = nullptr;
+    key m_keys[virthid_keyboard_usages];
+    uint16_t m_arrays[virthid_keyboard_max_arrays];
+    uint32_t m_array_count = 0;
+    uint32_t m_array_capacity = 0;
+    uint32_t m_array_pressed = 0;
+    uint32_t m_array_mask[virthid_keyboard_usages / 32] = {};
+    uint32_t m_pressed[virthid_keyboard_usages / 32] = {};
+    uint32_t m_pressed_count = 0;
+    uint8_t m_report[virthid_max_report] = {};
+};
+
+#endif
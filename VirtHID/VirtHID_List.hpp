@@ -0,0 +1,109 @@
+//
+//  VirtHID_List.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_list_h
+#define virthid_list_h
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  A device listing is a sequence of entries, each made of this header
+ *  followed by 'name_len' name bytes (not NUL-terminated), padded to a
+ *  multiple of four bytes.
+ */
+typedef struct virthid_list_entry {
+    uint32_t handle;
+    uint32_t vendor_id;
+    uint32_t product_id;
+    uint8_t device_class;
+    uint8_t name_len;
+    uint16_t reserved;
+} virthid_list_entry;
+
+/**
+ *  Space taken by the largest entry. A listing buffer at least this large
+ *  always makes progress.
+ */
+const uint32_t virthid_list_max_entry = (sizeof(virthid_list_entry) + 255 + 3) & ~3u;
+
+/**
+ *  Cursor value returned once the listing is complete.
+ */
+const uint32_t virthid_list_end = 0xffffffff;
+
+inline uint32_t virthid_list_entry_size(uint8_t name_len) {
+    return (sizeof(virthid_list_entry) + name_len + 3) & ~3u;
+}
+
+/**
+ *  Append entries to a listing buffer.
+ */
+class virthid_list_writer {
+public:
+    virthid_list_writer(uint8_t *buf, uint32_t buf_len) : m_buf(buf), m_buf_len(buf_len), m_used(0), m_count(0) {}
+
+    /**
+     *  Append an entry.
+     *
+     *  @return False if it does not fit, the buffer is left untouched.
+     */
+    bool append(const virthid_list_entry *entry, const char *name) {
+        uint32_t size = virthid_list_entry_size(entry->name_len);
+        if (size > m_buf_len - m_used) return false;
+
+        memcpy(m_buf + m_used, entry, sizeof(*entry));
+        memcpy(m_buf + m_used + sizeof(*entry), name, entry->name_len);
+        memset(m_buf + m_used + sizeof(*entry) + entry->name_len, 0,
+               size - sizeof(*entry) - entry->name_len);
+        m_used += size;
+        m_count++;
+
+        return true;
+    }
+
+    uint32_t used() const { return m_used; }
+    uint32_t count() const { return m_count; }
+
+private:
+    uint8_t *m_buf;
+    uint32_t m_buf_len;
+    uint32_t m_used;
+    uint32_t m_count;
+};
+
+/**
+ *  Walk the entries of a listing buffer.
+ *
+ *  @return 1 with an entry, 0 at the end, -1 on a truncated entry.
+ */
+class virthid_list_reader {
+public:
+    virthid_list_reader(const uint8_t *buf, uint32_t buf_len) : m_buf(buf), m_buf_len(buf_len), m_offset(0) {}
+
+    int next(virthid_list_entry *entry, const char **name) {
+        uint32_t remaining = m_buf_len - m_offset;
+        if (remaining == 0) return 0;
+        if (remaining < sizeof(*entry)) return -1;
+
+        memcpy(entry, m_buf + m_offset, sizeof(*entry));
+        uint32_t size = virthid_list_entry_size(entry->name_len);
+        if (sizeof(*entry) + entry->name_len > remaining) return -1;
+
+        *name = (const char *)(m_buf + m_offset + sizeof(*entry));
+        m_offset = size < remaining ? m_offset + size : m_buf_len;
+
+        return 1;
+    }
+
+private:
+    const uint8_t *m_buf;
+    uint32_t m_buf_len;
+    uint32_t m_offset;
+};
+
+#endif
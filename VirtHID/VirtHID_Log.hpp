@@ -0,0 +1,226 @@
+//
+//  VirtHID_Log.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_log_h
+#define virthid_log_h
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  A report log starts with this header, followed by one record per report:
+ *
+ *      varint  nanoseconds since the previous record (since 'base' for the first)
+ *      varint  report length
+ *      bytes   the report, report ID included when the descriptor uses IDs
+ *
+ *  Varints are unsigned LEB128. A log read back in chunks stays valid when
+ *  the chunks are concatenated.
+ */
+typedef struct virthid_log_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t base;
+} virthid_log_header;
+
+const uint32_t virthid_log_magic = 0x474c4856; // 'VHLG'
+const uint16_t virthid_log_version = 1;
+
+/**
+ *  Size of the in-kernel capture buffer of a device.
+ */
+const uint32_t virthid_capture_size = 256 * 1024;
+
+/**
+ *  Largest encoding of a record header: two 64-bit varints.
+ */
+const uint32_t virthid_log_max_record_header = 20;
+
+inline uint32_t virthid_varint_put(uint8_t *out, uint64_t value) {
+    uint32_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+    return len;
+}
+
+/**
+ *  Decode a varint.
+ *
+ *  @return The number of bytes read, 0 if the varint is truncated or too long.
+ */
+inline uint32_t virthid_varint_get(const uint8_t *in, uint32_t in_len, uint64_t *value) {
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < in_len && i < 10; i++) {
+        result |= (uint64_t)(in[i] & 0x7f) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *  Append reports to a log held in a caller provided buffer. Not thread-safe.
+ */
+class virthid_log_writer {
+public:
+    virthid_log_writer() : m_buffer(nullptr), m_capacity(0), m_size(0), m_header(false), m_last(0) {}
+
+    /**
+     *  Start a new log in 'buffer', dropping anything written before.
+     *
+     *  @return False if the buffer cannot even hold the header.
+     */
+    bool begin(uint8_t *buffer, uint32_t capacity, uint64_t base) {
+        m_buffer = capacity < sizeof(virthid_log_header) ? nullptr : buffer;
+        m_capacity = capacity;
+        m_size = 0;
+        m_header = false;
+        m_last = base;
+        if (!m_buffer) return false;
+
+        virthid_log_header header = {virthid_log_magic, virthid_log_version, 0, base};
+        memcpy(m_buffer, &header, sizeof(header));
+        m_size = sizeof(header);
+        m_header = true;
+
+        return true;
+    }
+
+    /**
+     *  Append a report. Timestamps must not go backwards, earlier ones are
+     *  recorded with a zero delta.
+     *
+     *  @return False if the buffer is full.
+     */
+    bool append(uint64_t timestamp, const uint8_t *report, uint32_t report_len) {
+        uint8_t header[virthid_log_max_record_header];
+        uint64_t delta = timestamp > m_last ? timestamp - m_last : 0;
+
+        uint32_t header_len = virthid_varint_put(header, delta);
+        header_len += virthid_varint_put(header + header_len, report_len);
+        if (!m_buffer || m_capacity - m_size < header_len + report_len) return false;
+
+        memcpy(m_buffer + m_size, header, header_len);
+        if (report_len) memcpy(m_buffer + m_size + header_len, report, report_len);
+        m_size += header_len + report_len;
+        m_last += delta;
+
+        return true;
+    }
+
+    /**
+     *  Return the length of the longest prefix of the buffer made of whole
+     *  records (and the header) that fits in 'max' bytes.
+     */
+    uint32_t prefix(uint32_t max) const {
+        uint32_t offset = 0;
+
+        if (m_header) {
+            if (max < sizeof(virthid_log_header)) return 0;
+            offset = sizeof(virthid_log_header);
+        }
+
+        while (offset < m_size) {
+            uint64_t delta = 0, length = 0;
+            uint32_t len = virthid_varint_get(m_buffer + offset, m_size - offset, &delta);
+            len += virthid_varint_get(m_buffer + offset + len, m_size - offset - len, &length);
+            if (offset + len + length > max) break;
+            offset += len + (uint32_t)length;
+        }
+
+        return offset;
+    }
+
+    /**
+     *  Drop the first 'len' bytes, which must be a value returned by 'prefix'.
+     *  Later records keep their timestamps.
+     */
+    void consume(uint32_t len) {
+        if (len == 0) return;
+
+        memmove(m_buffer, m_buffer + len, m_size - len);
+        m_size -= len;
+        m_header = false;
+    }
+
+    const uint8_t *data() const { return m_buffer; }
+    uint32_t size() const { return m_size; }
+
+private:
+    uint8_t *m_buffer;
+    uint32_t m_capacity;
+    uint32_t m_size;
+    bool m_header;
+    uint64_t m_last;
+};
+
+/**
+ *  Read the reports of a log. The log is untrusted, everything is bounds checked.
+ */
+class virthid_log_reader {
+public:
+    virthid_log_reader(const uint8_t *log, uint32_t log_len)
+        : m_log(log), m_log_len(log_len), m_offset(0), m_last(0) {}
+
+    /**
+     *  Check the header.
+     *
+     *  @return False if this is not a log of a supported version.
+     */
+    bool begin() {
+        virthid_log_header header;
+        if (m_log_len < sizeof(header)) return false;
+
+        memcpy(&header, m_log, sizeof(header));
+        if (header.magic != virthid_log_magic || header.version != virthid_log_version) return false;
+
+        m_offset = sizeof(header);
+        m_last = header.base;
+
+        return true;
+    }
+
+    /**
+     *  Return the next report.
+     *
+     *  @return 1 with a report, 0 at the end, -1 on a truncated record.
+     */
+    int next(uint64_t *timestamp, const uint8_t **report, uint32_t *report_len) {
+        uint64_t delta = 0, length = 0;
+        uint32_t remaining = m_log_len - m_offset;
+        if (remaining == 0) return 0;
+
+        uint32_t len = virthid_varint_get(m_log + m_offset, remaining, &delta);
+        if (len == 0) return -1;
+
+        uint32_t len2 = virthid_varint_get(m_log + m_offset + len, remaining - len, &length);
+        if (len2 == 0 || length > remaining - len - len2) return -1;
+
+        m_last += delta;
+        *timestamp = m_last;
+        *report = m_log + m_offset + len + len2;
+        *report_len = (uint32_t)length;
+        m_offset += len + len2 + (uint32_t)length;
+
+        return 1;
+    }
+
+private:
+    const uint8_t *m_log;
+    uint32_t m_log_len;
+    uint32_t m_offset;
+    uint64_t m_last;
+};
+
+#endif
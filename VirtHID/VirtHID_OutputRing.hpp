@@ -0,0 +1,225 @@
+//
+//  VirtHID_OutputRing.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_output_ring_h
+#define virthid_output_ring_h
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  Bytes of record space in an output ring. Must be a power of two.
+ */
+const uint32_t virthid_output_ring_capacity = 64 * 1024;
+
+/**
+ *  Every output or feature report is one record: this header followed by
+ *  'size' report bytes, padded to a multiple of eight bytes. A record never
+ *  wraps around the end of the ring; if it does not fit, the producer fills
+ *  the rest with a record of size 'virthid_output_record_wrap' and starts
+ *  over at the beginning.
+ */
+typedef struct virthid_output_record {
+    uint32_t size;
+    uint32_t handle;
+    uint64_t timestamp;
+    uint8_t type;
+    uint8_t reserved[7];
+} virthid_output_record;
+
+const uint32_t virthid_output_record_wrap = 0xffffffff;
+
+/**
+ *  Largest report a record can carry.
+ */
+const uint32_t virthid_max_output_report = virthid_output_ring_capacity / 2 - sizeof(virthid_output_record);
+
+/**
+ *  Layout of an output ring shared between the driver, producing, and one
+ *  user task, consuming. 'head' and 'tail' are free-running byte counters
+ *  owned by the producer and the consumer respectively, each on its own
+ *  cache line.
+ *
+ *  'armed' works like in 'virthid_ring_shared': the consumer sets it once it
+ *  has drained the ring, and only a producer that clears it sends a wakeup.
+ *  'dropped' counts reports that found the ring full.
+ */
+typedef struct virthid_output_ring_shared {
+    uint32_t head;
+    uint8_t reserved0[60];
+    uint32_t tail;
+    uint8_t reserved1[60];
+    uint32_t armed;
+    uint32_t capacity;
+    uint64_t dropped;
+    uint8_t reserved2[48];
+    uint8_t data[virthid_output_ring_capacity];
+} virthid_output_ring_shared;
+
+static_assert((virthid_output_ring_capacity & (virthid_output_ring_capacity - 1)) == 0,
+              "Output ring capacity must be a power of two.");
+static_assert(sizeof(virthid_output_record) % 8 == 0,
+              "Output records must keep the ring eight byte aligned.");
+
+enum virthid_output_ring_result {
+    virthid_output_ring_empty,
+    virthid_output_ring_popped,
+    virthid_output_ring_malformed,
+};
+
+/**
+ *  Accessor for a 'virthid_output_ring_shared' block. Neither side trusts
+ *  the indices owned by the other one, since the consumer is a user task.
+ *  Producers have to be serialized by the caller.
+ */
+class virthid_output_ring {
+public:
+    explicit virthid_output_ring(virthid_output_ring_shared *shared) : m_shared(shared) {}
+
+    /**
+     *  Reset the ring to its empty, armed state.
+     */
+    void reset() {
+        memset(m_shared, 0, sizeof(virthid_output_ring_shared));
+        m_shared->capacity = virthid_output_ring_capacity;
+        __atomic_store_n(&m_shared->armed, 1, __ATOMIC_SEQ_CST);
+    }
+
+    /**
+     *  Return the space a record carrying 'size' report bytes takes.
+     */
+    static uint32_t recordSize(uint32_t size) {
+        return (sizeof(virthid_output_record) + size + 7) & ~7u;
+    }
+
+    /**
+     *  Producer: append a report.
+     *
+     *  @param record        Header of the record, 'size' is the length of 'report'.
+     *  @param report        The report bytes.
+     *  @param ring_doorbell Set to true if the consumer has to be woken up.
+     *
+     *  @return False if the ring is full, the report too large or the
+     *          consumer index corrupt. The report is counted as dropped.
+     */
+    bool push(const virthid_output_record *record, const void *report, bool *ring_doorbell) {
+        *ring_doorbell = false;
+
+        uint32_t head = __atomic_load_n(&m_shared->head, __ATOMIC_RELAXED);
+        uint32_t tail = __atomic_load_n(&m_shared->tail, __ATOMIC_ACQUIRE);
+        uint32_t used = head - tail;
+        uint32_t offset = head & (virthid_output_ring_capacity - 1);
+        uint32_t size = recordSize(record->size);
+        uint32_t skip = virthid_output_ring_capacity - offset < size ? virthid_output_ring_capacity - offset : 0;
+
+        if (record->size > virthid_max_output_report || used > virthid_output_ring_capacity ||
+            (used & 7) || virthid_output_ring_capacity - used < skip + size) {
+            __atomic_fetch_add(&m_shared->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        if (skip) {
+            uint32_t wrap = virthid_output_record_wrap;
+            memcpy(m_shared->data + offset, &wrap, sizeof(wrap));
+            offset = 0;
+        }
+
+        memcpy(m_shared->data + offset, record, sizeof(*record));
+        memcpy(m_shared->data + offset + sizeof(*record), report, record->size);
+
+        __atomic_store_n(&m_shared->head, head + skip + size, __ATOMIC_SEQ_CST);
+        *ring_doorbell = __atomic_exchange_n(&m_shared->armed, 0, __ATOMIC_SEQ_CST) != 0;
+
+        return true;
+    }
+
+    /**
+     *  Consumer: take the oldest report.
+     *
+     *  @param record     Receives the record header.
+     *  @param report     Receives the report bytes, truncated to 'report_len'.
+     *  @param report_len Length of 'report'.
+     *
+     *  @return 'virthid_output_ring_popped' with a report, 'virthid_output_ring_empty'
+     *          if there is nothing to take, or 'virthid_output_ring_malformed' if
+     *          a record or the indices were corrupt, in which case everything
+     *          pending is discarded.
+     */
+    virthid_output_ring_result pop(virthid_output_record *record, void *report, uint32_t report_len) {
+        uint32_t tail = __atomic_load_n(&m_shared->tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&m_shared->head, __ATOMIC_ACQUIRE);
+        uint32_t used = head - tail;
+
+        if (used == 0) return virthid_output_ring_empty;
+        if (used > virthid_output_ring_capacity || (used & 7)) return discard(head);
+
+        uint32_t offset = tail & (virthid_output_ring_capacity - 1);
+        memcpy(&record->size, m_shared->data + offset, sizeof(record->size));
+
+        if (record->size == virthid_output_record_wrap) {
+            uint32_t skip = virthid_output_ring_capacity - offset;
+            if (skip >= used) return discard(head);
+
+            tail += skip;
+            used -= skip;
+            offset = 0;
+        }
+
+        memcpy(record, m_shared->data + offset, sizeof(*record));
+
+        if (record->size > virthid_max_output_report || recordSize(record->size) > used ||
+            offset + recordSize(record->size) > virthid_output_ring_capacity) {
+            return discard(head);
+        }
+
+        memcpy(report, m_shared->data + offset + sizeof(*record), record->size < report_len ? record->size : report_len);
+        __atomic_store_n(&m_shared->tail, tail + recordSize(record->size), __ATOMIC_RELEASE);
+
+        return virthid_output_ring_popped;
+    }
+
+    /**
+     *  Consumer: arm the wakeup before going idle.
+     *
+     *  @return True if the ring is still empty and the consumer may go idle,
+     *          false if reports arrived meanwhile and have to be drained.
+     */
+    bool park() {
+        __atomic_store_n(&m_shared->armed, 1, __ATOMIC_SEQ_CST);
+        uint32_t tail = __atomic_load_n(&m_shared->tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&m_shared->head, __ATOMIC_SEQ_CST);
+
+        return head == tail;
+    }
+
+    /**
+     *  Return the bytes of records waiting for the consumer, the whole
+     *  capacity if the consumer index is corrupt.
+     */
+    uint32_t pending() const {
+        uint32_t used = __atomic_load_n(&m_shared->head, __ATOMIC_RELAXED) -
+                        __atomic_load_n(&m_shared->tail, __ATOMIC_ACQUIRE);
+        return used > virthid_output_ring_capacity ? virthid_output_ring_capacity : used;
+    }
+
+    /**
+     *  Return the number of reports that found the ring full.
+     */
+    uint64_t dropped() const {
+        return __atomic_load_n(&m_shared->dropped, __ATOMIC_RELAXED);
+    }
+
+private:
+    virthid_output_ring_result discard(uint32_t head) {
+        __atomic_store_n(&m_shared->tail, head, __ATOMIC_RELEASE);
+        return virthid_output_ring_malformed;
+    }
+
+    virthid_output_ring_shared *m_shared;
+};
+
+#endif
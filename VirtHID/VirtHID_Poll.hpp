@@ -0,0 +1,241 @@
+//
+//  VirtHID_Poll.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_poll_h
+#define virthid_poll_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Types.hpp"
+
+/**
+ *  Bounds of the polling interval, in microseconds: 8 kHz down to 1 Hz.
+ */
+const uint32_t virthid_poll_min_interval_us = 125;
+const uint32_t virthid_poll_max_interval_us = 1000000;
+
+/**
+ *  Times a polling reader retries while the client is writing the state.
+ */
+const uint32_t virthid_state_read_retries = 4;
+
+/**
+ *  The current state of a polled device, shared with the client: this
+ *  header followed by 'capacity' report bytes, enough for the largest input
+ *  report of the device. The client writes it like a seqlock: 'sequence' is
+ *  made odd, 'length' and the report are written, then 'sequence' is made
+ *  even again with release semantics.
+ */
+typedef struct virthid_state_shared {
+    uint32_t sequence;
+    uint32_t length;
+    uint32_t capacity;
+    uint8_t reserved[52];
+} virthid_state_shared;
+
+/**
+ *  Return the size of a state block holding reports of up to 'capacity' bytes.
+ */
+inline uint32_t virthid_state_size(uint32_t capacity) {
+    return sizeof(virthid_state_shared) + capacity;
+}
+
+/**
+ *  Return the report bytes following the header of a state block.
+ */
+inline uint8_t *virthid_state_report(virthid_state_shared *state) {
+    return (uint8_t *)(state + 1);
+}
+
+inline const uint8_t *virthid_state_report(const virthid_state_shared *state) {
+    return (const uint8_t *)(state + 1);
+}
+
+/**
+ *  Read the state a client published.
+ *
+ *  @param capacity   Report bytes of the state block, as allocated. The
+ *                    'capacity' field is shared with the client and not trusted.
+ *  @param report     A buffer of at least 'capacity' bytes.
+ *  @param report_len Receives the report length.
+ *
+ *  @return False if the state is empty, malformed or kept being written
+ *          during every retry. The reader never waits on the client.
+ */
+inline bool virthid_state_read(const virthid_state_shared *state, uint32_t capacity,
+                               uint8_t *report, uint32_t *report_len) {
+    const uint8_t *bytes = virthid_state_report(state);
+
+    for (uint32_t retry = 0; retry < virthid_state_read_retries; retry++) {
+        uint32_t sequence = __atomic_load_n(&state->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) continue;
+
+        uint32_t length = __atomic_load_n(&state->length, __ATOMIC_RELAXED);
+        if (length == 0 || length > capacity) return false;
+
+        for (uint32_t i = 0; i < length; i++) report[i] = __atomic_load_n(&bytes[i], __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&state->sequence, __ATOMIC_RELAXED) != sequence) continue;
+
+        *report_len = length;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ *  Client side of 'virthid_state_read': publish a new state.
+ *
+ *  @return False if the report does not fit the state block.
+ */
+inline bool virthid_state_write(virthid_state_shared *state, const uint8_t *report, uint32_t report_len) {
+    uint8_t *bytes = virthid_state_report(state);
+    uint32_t sequence = __atomic_load_n(&state->sequence, __ATOMIC_RELAXED);
+
+    if (report_len > state->capacity) return false;
+
+    __atomic_store_n(&state->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&state->length, report_len, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < report_len; i++) __atomic_store_n(&bytes[i], report[i], __ATOMIC_RELAXED);
+
+    __atomic_store_n(&state->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ *  Fixed-rate frame clock. Deadlines are computed from the start time, so
+ *  timer latency never accumulates into drift. A late tick delivers a single
+ *  frame and skips the ones it missed, like a device that only reports at
+ *  its own rate, rather than bursting to catch up.
+ *
+ *  'Clock' provides 'uint64_t now() const' in nanoseconds.
+ */
+template <typename Clock>
+class virthid_pacer {
+public:
+    /**
+     *  Start pacing, the first frame being due one interval from now.
+     */
+    void start(const Clock &clock, uint64_t interval) {
+        m_interval = interval;
+        m_next = clock.now() + interval;
+        m_frames = 0;
+        m_missed = 0;
+    }
+
+    /**
+     *  Check whether a frame is due and, if so, move to the next deadline.
+     *
+     *  @return True if a frame has to be delivered now.
+     */
+    bool tick(const Clock &clock) {
+        uint64_t now = clock.now();
+        if (now < m_next) return false;
+
+        uint64_t late = (now - m_next) / m_interval;
+        m_next += (late + 1) * m_interval;
+        m_missed += late;
+        m_frames++;
+
+        return true;
+    }
+
+    /**
+     *  Return the deadline of the next frame.
+     */
+    uint64_t nextDeadline() const {
+        return m_next;
+    }
+
+    uint64_t interval() const { return m_interval; }
+    uint64_t frames() const { return m_frames; }
+    uint64_t missed() const { return m_missed; }
+
+private:
+    uint64_t m_interval = 0;
+    uint64_t m_next = 0;
+    uint64_t m_frames = 0;
+    uint64_t m_missed = 0;
+};
+
+/**
+ *  Turns the shared state into the frames of a polled device, optionally
+ *  dropping frames identical to the last one delivered.
+ */
+class virthid_poller {
+public:
+    /**
+     *  Attach the buffer keeping the last frame.
+     *
+     *  @param last     A buffer of 'capacity' bytes.
+     *  @param capacity Report bytes of the state block.
+     */
+    void init(uint8_t *last, uint32_t capacity) {
+        m_last = last;
+        m_capacity = capacity;
+        reset(false);
+    }
+
+    void reset(bool skip_identical) {
+        m_skip_identical = skip_identical;
+        m_last_len = 0;
+        m_skipped = 0;
+    }
+
+    /**
+     *  Build the next frame.
+     *
+     *  @param state      The shared state, 'capacity' report bytes long.
+     *  @param report     A buffer of at least 'capacity' bytes.
+     *  @param report_len Receives the report length.
+     *
+     *  @return False if there is nothing to deliver. Until the client
+     *          publishes a state, and while it cannot be read, the last
+     *          frame is repeated.
+     */
+    bool frame(const virthid_state_shared *state, uint8_t *report, uint32_t *report_len) {
+        uint32_t length = 0;
+        bool fresh = virthid_state_read(state, m_capacity, report, &length);
+
+        if (!fresh) {
+            if (m_last_len == 0 || m_skip_identical) return false;
+            memcpy(report, m_last, m_last_len);
+            *report_len = m_last_len;
+            return true;
+        }
+
+        if (m_skip_identical && length == m_last_len && memcmp(report, m_last, length) == 0) {
+            m_skipped++;
+            return false;
+        }
+
+        memcpy(m_last, report, length);
+        m_last_len = length;
+        *report_len = length;
+
+        return true;
+    }
+
+    uint64_t skipped() const {
+        return m_skipped;
+    }
+
+private:
+    bool m_skip_identical = false;
+    uint32_t m_last_len = 0;
+    uint64_t m_skipped = 0;
+    uint8_t *m_last = nullptr;
+    uint32_t m_capacity = 0;
+};
+
+#endif
@@ -0,0 +1,100 @@
+//
+//  VirtHID_Pool.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_pool_h
+#define virthid_pool_h
+
+#include <stdint.h>
+
+/**
+ *  Number of preallocated report buffers per device.
+ */
+const uint32_t virthid_report_pool_size = 4;
+
+/**
+ *  Number of one-off report buffers a device may have outstanding once its
+ *  pool is exhausted.
+ */
+const uint32_t virthid_report_pool_fallbacks = 16;
+
+/**
+ *  Lock-free free list of the indices [0, N). Callers keep the actual
+ *  objects in an array of their own and use the pool to hand out slots.
+ *
+ *  The head carries a tag that changes on every update, so a stale head
+ *  never wins a compare-and-swap (ABA).
+ */
+template <uint32_t N>
+class virthid_index_pool {
+    static_assert(N > 0 && N < UINT32_MAX, "Invalid pool size.");
+
+public:
+    virthid_index_pool() : m_head(pack(0, N)) {
+        for (uint32_t i = 0; i < N; i++) m_next[i] = N;
+    }
+
+    /**
+     *  Make the indices [0, count) available. Not thread-safe, to be called
+     *  before the pool is shared.
+     */
+    void fill(uint32_t count) {
+        if (count > N) count = N;
+        for (uint32_t i = 0; i < count; i++) {
+            m_next[i] = i + 1 < count ? i + 1 : N;
+        }
+        m_head = pack(0, count > 0 ? 0 : N);
+    }
+
+    /**
+     *  Take a free index.
+     *
+     *  @return The index, or -1 if the pool is exhausted.
+     */
+    int32_t take() {
+        uint64_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            uint32_t index = (uint32_t)head;
+            if (index >= N) return -1;
+
+            uint32_t next = __atomic_load_n(&m_next[index], __ATOMIC_RELAXED);
+            if (__atomic_compare_exchange_n(&m_head, &head, pack(tag(head) + 1, next), true,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return (int32_t)index;
+            }
+        }
+    }
+
+    /**
+     *  Return an index obtained from 'take'.
+     */
+    void give(uint32_t index) {
+        uint64_t head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+
+        for (;;) {
+            __atomic_store_n(&m_next[index], (uint32_t)head, __ATOMIC_RELAXED);
+            if (__atomic_compare_exchange_n(&m_head, &head, pack(tag(head) + 1, index), true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                return;
+            }
+        }
+    }
+
+private:
+    static uint64_t pack(uint32_t tag, uint32_t index) {
+        return ((uint64_t)tag << 32) | index;
+    }
+
+    static uint32_t tag(uint64_t head) {
+        return (uint32_t)(head >> 32);
+    }
+
+    uint64_t m_head;
+    uint32_t m_next[N];
+};
+
+#endif
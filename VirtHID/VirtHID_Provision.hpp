@@ -0,0 +1,119 @@
+//
+//  VirtHID_Provision.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_provision_h
+#define virthid_provision_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Batch.hpp"
+
+/**
+ *  A provisioning batch creates many devices sharing one report descriptor.
+ *  It starts with the descriptor, padded to a multiple of four bytes, and
+ *  goes on with one record per device: this header followed by 'name_len'
+ *  name bytes and 'serial_number_len' serial number bytes, padded to a
+ *  multiple of four bytes.
+ *
+ *  The buffer is read and written: 'handle' receives the handle of the new
+ *  device, or 'virthid_invalid_handle' if it could not be created.
+ */
+typedef struct virthid_provision_record {
+    uint32_t handle;
+    uint32_t vendor_id;
+    uint32_t product_id;
+    uint8_t name_len;
+    uint8_t reserved;
+    uint16_t serial_number_len;
+} virthid_provision_record;
+
+/**
+ *  Return the offset of the first record of a batch.
+ */
+inline uint32_t virthid_provision_records_offset(uint16_t descriptor_len) {
+    return ((uint32_t)descriptor_len + 3) & ~3u;
+}
+
+/**
+ *  Return the space taken by a record.
+ */
+inline uint32_t virthid_provision_record_size(uint8_t name_len, uint16_t serial_number_len) {
+    return (sizeof(virthid_provision_record) + name_len + serial_number_len + 3) & ~3u;
+}
+
+/**
+ *  Walk the records of a provisioning batch. Each header is copied out once
+ *  before it is validated, so the buffer may be shared with a user task.
+ */
+class virthid_provision_reader {
+public:
+    virthid_provision_reader(uint8_t *batch, uint32_t batch_len, uint16_t descriptor_len)
+        : m_batch(batch), m_batch_len(batch_len), m_descriptor_len(descriptor_len),
+          m_offset(virthid_provision_records_offset(descriptor_len)), m_record(0) {
+        if (m_offset > m_batch_len) m_offset = m_batch_len;
+    }
+
+    /**
+     *  Return false if the batch is too short to hold its descriptor.
+     */
+    bool valid() const {
+        return m_descriptor_len > 0 && m_descriptor_len <= m_batch_len;
+    }
+
+    const uint8_t *descriptor() const { return m_batch; }
+    uint16_t descriptorLength() const { return m_descriptor_len; }
+
+    /**
+     *  Step to the next record.
+     *
+     *  @param record        Receives the record header.
+     *  @param name          Receives a pointer to the name bytes inside the batch.
+     *  @param serial_number Receives a pointer to the serial number bytes inside the batch.
+     *
+     *  @return 'virthid_batch_next' with a record, 'virthid_batch_end' once the
+     *          batch is exhausted, or 'virthid_batch_truncated' if the remaining
+     *          bytes do not hold a full record.
+     */
+    virthid_batch_result next(virthid_provision_record *record, const char **name, const char **serial_number) {
+        uint32_t remaining = m_batch_len - m_offset;
+        if (remaining == 0) return virthid_batch_end;
+        if (remaining < sizeof(*record)) return virthid_batch_truncated;
+
+        memcpy(record, m_batch + m_offset, sizeof(*record));
+
+        if (sizeof(*record) + record->name_len + record->serial_number_len > remaining) {
+            return virthid_batch_truncated;
+        }
+
+        *name = (const char *)(m_batch + m_offset + sizeof(*record));
+        *serial_number = *name + record->name_len;
+        m_record = m_offset;
+
+        uint32_t size = virthid_provision_record_size(record->name_len, record->serial_number_len);
+        m_offset = size < remaining ? m_offset + size : m_batch_len;
+
+        return virthid_batch_next;
+    }
+
+    /**
+     *  Store the handle of the device created from the last record returned by 'next'.
+     */
+    void setHandle(uint32_t handle) {
+        memcpy(m_batch + m_record + offsetof(virthid_provision_record, handle), &handle, sizeof(handle));
+    }
+
+private:
+    uint8_t *m_batch;
+    uint32_t m_batch_len;
+    uint16_t m_descriptor_len;
+    uint32_t m_offset;
+    uint32_t m_record;
+};
+
+#endif
@@ -0,0 +1,106 @@
+//
+//  VirtHID_Queue.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_queue_h
+#define virthid_queue_h
+
+#include <stdint.h>
+
+/**
+ *  Number of output reports a subscriber may have pending.
+ */
+const uint32_t virthid_subscriber_queue_size = 64;
+
+/**
+ *  What a queue does with a new item when it is full.
+ */
+enum virthid_drop_policy {
+    virthid_drop_newest = 0,
+    virthid_drop_oldest = 1,
+};
+
+/**
+ *  Bounded single-producer/single-consumer queue of fixed-size items.
+ *  Items that do not fit are dropped according to the policy and counted.
+ *  Multiple producers must be serialized by the caller, and so must the
+ *  consumer when 'virthid_drop_oldest' is used, since the producer then
+ *  advances the tail too.
+ */
+template <typename T, uint32_t N>
+class virthid_queue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "Queue size must be a power of two.");
+
+public:
+    virthid_queue() : m_head(0), m_tail(0), m_dropped(0) {}
+
+    /**
+     *  Producer: append an item.
+     *
+     *  @param item   The item to append.
+     *  @param policy What to drop if the queue is full.
+     *
+     *  @return False if an item had to be dropped.
+     */
+    bool push(const T &item, virthid_drop_policy policy = virthid_drop_newest) {
+        uint32_t head = __atomic_load_n(&m_head, __ATOMIC_RELAXED);
+        uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        bool dropped = false;
+
+        if (head - tail >= N) {
+            __atomic_add_fetch(&m_dropped, 1, __ATOMIC_RELAXED);
+            if (policy == virthid_drop_newest) return false;
+
+            __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+            dropped = true;
+        }
+
+        m_items[head & (N - 1)] = item;
+        __atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+
+        return !dropped;
+    }
+
+    /**
+     *  Consumer: take the oldest item.
+     *
+     *  @return False if the queue is empty.
+     */
+    bool pop(T *item) {
+        uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) return false;
+
+        *item = m_items[tail & (N - 1)];
+        __atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+    /**
+     *  Return the number of pending items.
+     */
+    uint32_t size() const {
+        uint32_t tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+        return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) - tail;
+    }
+
+    /**
+     *  Return the number of items dropped because the queue was full.
+     */
+    uint64_t dropped() const {
+        return __atomic_load_n(&m_dropped, __ATOMIC_RELAXED);
+    }
+
+private:
+    T m_items[N];
+    uint32_t m_head;
+    uint32_t m_tail;
+    uint64_t m_dropped;
+};
+
+#endif
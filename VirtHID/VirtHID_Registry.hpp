@@ -0,0 +1,169 @@
+//
+//  VirtHID_Registry.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_registry_h
+#define virthid_registry_h
+
+#include <stdint.h>
+
+#include "VirtHID_HandleTable.hpp"
+
+/**
+ *  Thread-safe registry of reference counted objects, addressed by handle.
+ *
+ *  Lookups only take 'Lock' shared and hand out a retained object, so
+ *  concurrent users of different (or the same) objects never serialize on
+ *  the registry; only 'insert' and 'remove' take it exclusive.
+ *
+ *  'T' needs 'retain()' and 'release()'. 'Lock' needs 'init()', 'free()',
+ *  'lockShared()', 'unlockShared()', 'lockExclusive()' and 'unlockExclusive()'.
+ */
+template <typename T, typename Lock, uint32_t N = virthid_max_devices>
+class virthid_registry {
+public:
+    bool init() {
+        return m_lock.init();
+    }
+
+    void free() {
+        m_lock.free();
+    }
+
+    /**
+     *  Add an object, unless 'conflict' matches one already registered.
+     *  The registry keeps its own reference.
+     *
+     *  @param object   The object to add.
+     *  @param conflict Predicate called as 'conflict(T *)' on every registered object.
+     *
+     *  @return The new handle, or 'virthid_invalid_handle' on conflict or if full.
+     */
+    template <typename Pred>
+    virthid_handle insert(T *object, const Pred &conflict) {
+        virthid_handle handle = virthid_invalid_handle;
+
+        m_lock.lockExclusive();
+        if (!findLocked(conflict, nullptr)) {
+            handle = m_table.insert(object);
+            if (handle != virthid_invalid_handle) {
+                object->retain();
+                __atomic_add_fetch(&m_generation, 1, __ATOMIC_RELEASE);
+            }
+        }
+        m_lock.unlockExclusive();
+
+        return handle;
+    }
+
+    /**
+     *  Remove an object. The registry's reference goes to the caller.
+     *
+     *  @return The object, or null if the handle was not valid.
+     */
+    T *remove(virthid_handle handle) {
+        m_lock.lockExclusive();
+        T *object = m_table.remove(handle);
+        if (object) __atomic_add_fetch(&m_generation, 1, __ATOMIC_RELEASE);
+        m_lock.unlockExclusive();
+
+        return object;
+    }
+
+    /**
+     *  Resolve a handle.
+     *
+     *  @return The object with an increased reference count, or null.
+     */
+    T *copy(virthid_handle handle) {
+        m_lock.lockShared();
+        T *object = m_table.lookup(handle);
+        if (object) object->retain();
+        m_lock.unlockShared();
+
+        return object;
+    }
+
+    /**
+     *  Return the first object matching a predicate.
+     *
+     *  @return The object with an increased reference count, or null.
+     */
+    template <typename Pred>
+    T *copyMatching(const Pred &pred) {
+        T *object = nullptr;
+
+        m_lock.lockShared();
+        findLocked(pred, &object);
+        if (object) object->retain();
+        m_lock.unlockShared();
+
+        return object;
+    }
+
+    /**
+     *  Iterate without holding the lock between steps. Start with a zero
+     *  cursor; objects added or removed meanwhile may or may not be seen.
+     *
+     *  @param cursor Position of the iteration, updated.
+     *  @param handle If not null, receives the handle of the object.
+     *
+     *  @return The next object with an increased reference count, or null at the end.
+     */
+    T *copyNext(uint32_t *cursor, virthid_handle *handle = nullptr) {
+        T *object = nullptr;
+
+        m_lock.lockShared();
+        while (!object && *cursor < N) {
+            object = m_table.at((*cursor)++, handle);
+        }
+        if (object) object->retain();
+        m_lock.unlockShared();
+
+        return object;
+    }
+
+    /**
+     *  Return a number that changes whenever an object is added or removed,
+     *  so clients can tell whether a listing is still current.
+     */
+    uint32_t generation() const {
+        return __atomic_load_n(&m_generation, __ATOMIC_ACQUIRE);
+    }
+
+    uint32_t count() {
+        m_lock.lockShared();
+        uint32_t count = m_table.count();
+        m_lock.unlockShared();
+
+        return count;
+    }
+
+private:
+    template <typename Pred>
+    bool findLocked(const Pred &pred, T **found) const {
+        uint32_t remaining = m_table.count();
+
+        for (uint32_t i = 0; i < N && remaining > 0; i++) {
+            T *object = m_table.at(i);
+            if (!object) continue;
+            remaining--;
+
+            if (pred(object)) {
+                if (found) *found = object;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    virthid_handle_table<T, N> m_table;
+    Lock m_lock;
+    uint32_t m_generation = 0;
+};
+
+#endif
@@ -0,0 +1,147 @@
+//
+//  VirtHID_ReportCache.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_report_cache_h
+#define virthid_report_cache_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Descriptor.hpp"
+
+/**
+ *  Last report of every type and ID a layout defines, so that GET_REPORT can
+ *  be answered without a round trip to userspace. Until a report is stored,
+ *  it reads as zeros after its report ID.
+ *
+ *  All reports live in one storage block of 'storageSize' bytes. Readers
+ *  never block: every entry has a sequence counter that is odd while a
+ *  writer copies, readers retry if it moved. Writers of the same entry
+ *  exclude each other through the counter. The bytes are copied as relaxed
+ *  atomic words, so a torn copy is only ever discarded, never undefined.
+ *
+ *  Layouts that could not be fully parsed cache nothing.
+ */
+class virthid_report_cache {
+public:
+    /**
+     *  Return the storage needed for the reports of a layout.
+     */
+    static uint32_t storageSize(const virthid_report_layout *layout) {
+        uint32_t size = 0;
+        if (!layout->isValid()) return 0;
+
+        for (uint32_t i = 0; i < layout->reportCount(); i++) {
+            size += words(layout->report(i)->length) * sizeof(uint64_t);
+        }
+
+        return size;
+    }
+
+    /**
+     *  Lay the reports of a layout out in 'storage', of at least 'storageSize' bytes.
+     */
+    void init(const virthid_report_layout *layout, uint8_t *storage) {
+        uint32_t offset = 0;
+
+        m_layout = layout;
+        m_storage = (uint64_t *)storage;
+        m_count = layout->isValid() ? layout->reportCount() : 0;
+
+        for (uint32_t i = 0; i < m_count; i++) {
+            const virthid_report_info *info = layout->report(i);
+            entry &e = m_entries[i];
+
+            e.offset = offset;
+            e.length = info->length;
+            e.sequence = 0;
+            offset += words(info->length);
+
+            memset(m_storage + e.offset, 0, words(info->length) * sizeof(uint64_t));
+            if (layout->usesReportIds()) *((uint8_t *)(m_storage + e.offset)) = info->id;
+        }
+    }
+
+    /**
+     *  Store a report, replacing the previous one with the same type and ID.
+     *
+     *  @return False if the layout defines no such report or the length differs.
+     */
+    bool store(uint8_t type, const uint8_t *report, uint32_t report_len) {
+        entry *e = find(type, report, report_len);
+        if (!e || e->length != report_len) return false;
+
+        uint32_t sequence = __atomic_load_n(&e->sequence, __ATOMIC_RELAXED);
+        do {
+            while (sequence & 1) sequence = __atomic_load_n(&e->sequence, __ATOMIC_RELAXED);
+        } while (!__atomic_compare_exchange_n(&e->sequence, &sequence, sequence + 1, true,
+                                              __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+        uint64_t *slot = m_storage + e->offset;
+        for (uint32_t i = 0; i < report_len; i += sizeof(uint64_t)) {
+            uint64_t word = 0;
+            memcpy(&word, report + i, report_len - i < sizeof(word) ? report_len - i : sizeof(word));
+            __atomic_store_n(&slot[i / sizeof(uint64_t)], word, __ATOMIC_RELAXED);
+        }
+
+        __atomic_store_n(&e->sequence, sequence + 2, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     *  Copy the last report of a type and ID.
+     *
+     *  @param out     Receives the report, truncated to 'out_len'.
+     *  @param out_len Length of 'out'.
+     *
+     *  @return The number of bytes copied, zero if the layout defines no such report.
+     */
+    uint32_t load(uint8_t type, uint8_t id, uint8_t *out, uint32_t out_len) const {
+        const virthid_report_info *info = m_count ? m_layout->find(type, id) : nullptr;
+        if (!info) return 0;
+
+        const entry &e = m_entries[info - m_layout->report(0)];
+        const uint64_t *slot = m_storage + e.offset;
+        uint32_t len = e.length < out_len ? e.length : out_len;
+
+        for (;;) {
+            uint32_t sequence = __atomic_load_n(&e.sequence, __ATOMIC_ACQUIRE);
+            if (sequence & 1) continue;
+
+            for (uint32_t i = 0; i < len; i += sizeof(uint64_t)) {
+                uint64_t word = __atomic_load_n(&slot[i / sizeof(uint64_t)], __ATOMIC_RELAXED);
+                memcpy(out + i, &word, len - i < sizeof(word) ? len - i : sizeof(word));
+            }
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&e.sequence, __ATOMIC_RELAXED) == sequence) return len;
+        }
+    }
+
+private:
+    struct entry {
+        uint32_t offset;    // In words.
+        uint32_t length;
+        uint32_t sequence;
+    };
+
+    static uint32_t words(uint32_t length) {
+        return (length + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    }
+
+    entry *find(uint8_t type, const uint8_t *report, uint32_t report_len) {
+        const virthid_report_info *info = m_count ? m_layout->find(type, report, report_len) : nullptr;
+        return info ? &m_entries[info - m_layout->report(0)] : nullptr;
+    }
+
+    const virthid_report_layout *m_layout = nullptr;
+    uint64_t *m_storage = nullptr;
+    uint32_t m_count = 0;
+    entry m_entries[virthid_max_reports];
+};
+
+#endif
@@ -0,0 +1,71 @@
+//
+//  VirtHID_ReportDescriptor.cpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include <IOKit/IOLib.h>
+
+#include "VirtHID_ReportDescriptor.hpp"
+#include "VirtHID_Intern.hpp"
+#include "debug.h"
+
+#define super OSObject
+OSDefineMetaClassAndStructors(it_kotleni_virthid_report_descriptor, OSObject)
+
+it_kotleni_virthid_report_descriptor *it_kotleni_virthid_report_descriptor::withBytes(const unsigned char *bytes,
+                                                                                      UInt16 length,
+                                                                                      virthid_parse_result *result) {
+    it_kotleni_virthid_report_descriptor *descriptor = nullptr;
+    
+    *result = virthid_parse_malformed;
+    if (length == 0) return nullptr;
+    
+    descriptor = OSTypeAlloc(it_kotleni_virthid_report_descriptor);
+    if (!descriptor) return nullptr;
+    
+    if (!descriptor->init()) goto fail;
+    
+    descriptor->m_buffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, length);
+    if (!descriptor->m_buffer) goto fail;
+    
+    // Copy first, the caller's buffer may be shared with userspace.
+    descriptor->m_buffer->writeBytes(0, bytes, length);
+    descriptor->m_bytes = (const unsigned char *)descriptor->m_buffer->getBytesNoCopy();
+    descriptor->m_length = length;
+    descriptor->m_hash = virthid_hash_bytes(descriptor->m_bytes, length);
+    
+    descriptor->m_layout = (virthid_report_layout *)IOMalloc(sizeof(virthid_report_layout));
+    if (!descriptor->m_layout) goto fail;
+    
+    *result = descriptor->m_layout->parse(descriptor->m_bytes, length);
+    switch (*result) {
+        case virthid_parse_ok:
+            break;
+        case virthid_parse_too_complex:
+            LogD("Report descriptor too complex, reports will not be validated.");
+            break;
+        default:
+            LogD("Malformed report descriptor.");
+            goto fail;
+    }
+    
+    return descriptor;
+    
+fail:
+    descriptor->release();
+    return nullptr;
+}
+
+void it_kotleni_virthid_report_descriptor::free() {
+    if (m_layout) IOFree(m_layout, sizeof(*m_layout));
+    if (m_buffer) m_buffer->release();
+    
+    super::free();
+}
+
+IOMemoryDescriptor *it_kotleni_virthid_report_descriptor::copyBuffer() const {
+    m_buffer->retain();
+    return m_buffer;
+}
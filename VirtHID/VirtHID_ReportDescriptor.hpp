@@ -0,0 +1,64 @@
+//
+//  VirtHID_ReportDescriptor.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_report_descriptor_h
+#define virthid_report_descriptor_h
+
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <string.h>
+
+#include "VirtHID_Descriptor.hpp"
+
+/**
+ *  An immutable report descriptor and its parsed layout, shared by every
+ *  device created from the same bytes. See 'VirtHID_Intern.hpp'.
+ */
+class it_kotleni_virthid_report_descriptor : public OSObject {
+    OSDeclareDefaultStructors(it_kotleni_virthid_report_descriptor)
+    
+public:
+    /**
+     *  Copy and parse a report descriptor.
+     *
+     *  @param bytes  The report descriptor.
+     *  @param length Length of 'bytes'.
+     *  @param result Receives the result of parsing.
+     *
+     *  @return The new descriptor, or null on allocation failure or if malformed.
+     */
+    static it_kotleni_virthid_report_descriptor *withBytes(const unsigned char *bytes, UInt16 length,
+                                                           virthid_parse_result *result);
+    
+    virtual void free(void) override;
+    
+    const unsigned char *bytes() const { return m_bytes; }
+    UInt16 length() const { return m_length; }
+    uint32_t hash() const { return m_hash; }
+    const virthid_report_layout *layout() const { return m_layout; }
+    
+    bool equals(const uint8_t *bytes, uint32_t length) const {
+        return length == m_length && memcmp(bytes, m_bytes, length) == 0;
+    }
+    
+    /**
+     *  Return the buffer handed to the HID stack by 'newReportDescriptor'.
+     *  The reference count is automatically increased.
+     */
+    IOMemoryDescriptor *copyBuffer() const;
+    
+private:
+    /**
+     *  The bytes live in 'm_buffer', allocated once and only ever read.
+     */
+    IOBufferMemoryDescriptor *m_buffer = nullptr;
+    const unsigned char *m_bytes = nullptr;
+    UInt16 m_length = 0;
+    uint32_t m_hash = 0;
+    virthid_report_layout *m_layout = nullptr;
+};
+
+#endif
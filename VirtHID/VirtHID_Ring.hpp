@@ -0,0 +1,154 @@
+//
+//  VirtHID_Ring.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_ring_h
+#define virthid_ring_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Types.hpp"
+
+/**
+ *  Number of report slots in a ring. Must be a power of two.
+ */
+const uint32_t virthid_ring_slot_count = 256;
+
+typedef struct virthid_ring_slot {
+    uint32_t size;
+    uint8_t data[virthid_max_report];
+} virthid_ring_slot;
+
+/**
+ *  Layout of a ring shared between one producer and one consumer.
+ *  'head' and 'tail' are free-running counters owned by the producer and
+ *  the consumer respectively, each on its own cache line.
+ *
+ *  'armed' is set by the consumer when it has drained the ring and is about
+ *  to go idle. The producer clears it after publishing a report and, if it
+ *  was set, has to ring the doorbell. This way the doorbell is only rung when
+ *  the ring goes from empty to non-empty.
+ */
+typedef struct virthid_ring_shared {
+    uint32_t head;
+    uint8_t reserved0[60];
+    uint32_t tail;
+    uint8_t reserved1[60];
+    uint32_t armed;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint8_t reserved2[52];
+    virthid_ring_slot slots[virthid_ring_slot_count];
+} virthid_ring_shared;
+
+static_assert((virthid_ring_slot_count & (virthid_ring_slot_count - 1)) == 0,
+              "Ring slot count must be a power of two.");
+
+enum virthid_ring_result {
+    virthid_ring_empty,
+    virthid_ring_popped,
+    virthid_ring_malformed,
+};
+
+/**
+ *  Accessor for a 'virthid_ring_shared' block. The consumer side never trusts
+ *  the contents of the block, since the other side may be a user task.
+ */
+class virthid_ring {
+public:
+    explicit virthid_ring(virthid_ring_shared *shared) : m_shared(shared) {}
+
+    /**
+     *  Reset the ring to its empty, armed state.
+     */
+    void reset() {
+        memset(m_shared, 0, sizeof(virthid_ring_shared));
+        m_shared->slot_count = virthid_ring_slot_count;
+        m_shared->slot_size = virthid_max_report;
+        __atomic_store_n(&m_shared->armed, 1, __ATOMIC_SEQ_CST);
+    }
+
+    /**
+     *  Producer: append a report.
+     *
+     *  @param report        The report bytes.
+     *  @param report_len    Length of 'report'.
+     *  @param ring_doorbell Set to true if the consumer has to be woken up.
+     *
+     *  @return False if the ring is full or the report too large.
+     */
+    bool push(const void *report, uint32_t report_len, bool *ring_doorbell) {
+        *ring_doorbell = false;
+        if (report_len > virthid_max_report) return false;
+
+        uint32_t head = __atomic_load_n(&m_shared->head, __ATOMIC_RELAXED);
+        uint32_t tail = __atomic_load_n(&m_shared->tail, __ATOMIC_ACQUIRE);
+        if (head - tail >= virthid_ring_slot_count) return false;
+
+        virthid_ring_slot *slot = &m_shared->slots[head & (virthid_ring_slot_count - 1)];
+        memcpy(slot->data, report, report_len);
+        slot->size = report_len;
+
+        __atomic_store_n(&m_shared->head, head + 1, __ATOMIC_SEQ_CST);
+        *ring_doorbell = __atomic_exchange_n(&m_shared->armed, 0, __ATOMIC_SEQ_CST) != 0;
+
+        return true;
+    }
+
+    /**
+     *  Consumer: take the oldest report.
+     *
+     *  @param report     A buffer of at least 'virthid_max_report' bytes.
+     *  @param report_len Receives the report length.
+     *
+     *  @return 'virthid_ring_popped' with a report, 'virthid_ring_empty' if there
+     *          is nothing to take, or 'virthid_ring_malformed' if a slot or the
+     *          indices were corrupt. A malformed slot is skipped, corrupt
+     *          indices discard everything pending.
+     */
+    virthid_ring_result pop(void *report, uint32_t *report_len) {
+        uint32_t tail = __atomic_load_n(&m_shared->tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&m_shared->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) return virthid_ring_empty;
+        if (head - tail > virthid_ring_slot_count) {
+            __atomic_store_n(&m_shared->tail, head, __ATOMIC_RELEASE);
+            return virthid_ring_malformed;
+        }
+
+        virthid_ring_slot *slot = &m_shared->slots[tail & (virthid_ring_slot_count - 1)];
+        uint32_t size = __atomic_load_n(&slot->size, __ATOMIC_RELAXED);
+        bool valid = size <= virthid_max_report;
+        if (valid) {
+            memcpy(report, slot->data, size);
+            *report_len = size;
+        }
+
+        __atomic_store_n(&m_shared->tail, tail + 1, __ATOMIC_RELEASE);
+
+        return valid ? virthid_ring_popped : virthid_ring_malformed;
+    }
+
+    /**
+     *  Consumer: arm the doorbell before going idle.
+     *
+     *  @return True if the ring is still empty and the consumer may go idle,
+     *          false if reports arrived meanwhile and have to be drained.
+     */
+    bool park() {
+        __atomic_store_n(&m_shared->armed, 1, __ATOMIC_SEQ_CST);
+        uint32_t tail = __atomic_load_n(&m_shared->tail, __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&m_shared->head, __ATOMIC_SEQ_CST);
+
+        return head == tail;
+    }
+
+private:
+    virthid_ring_shared *m_shared;
+};
+
+#endif
@@ -0,0 +1,234 @@
+//
+//  VirtHID_Schedule.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_schedule_h
+#define virthid_schedule_h
+
+#include <stdint.h>
+#include <string.h>
+
+#include "VirtHID_Types.hpp"
+
+/**
+ *  Number of reports a device may have scheduled.
+ */
+const uint32_t virthid_schedule_capacity = 1024;
+
+/**
+ *  Bytes of report slots a schedule may take. Devices whose reports are
+ *  larger than 'virthid_max_report' get proportionally fewer slots.
+ */
+const uint32_t virthid_schedule_budget = virthid_schedule_capacity * virthid_max_report;
+
+/**
+ *  A schedule submission is a sequence of records, each made of this header
+ *  followed by 'length' report bytes and padded to a multiple of eight bytes.
+ *  'deadline' is absolute, in nanoseconds of the uptime clock
+ *  (CLOCK_UPTIME_RAW in userspace).
+ */
+typedef struct virthid_schedule_record {
+    uint64_t deadline;
+    uint16_t length;
+    uint16_t reserved;
+    uint32_t reserved1;
+} virthid_schedule_record;
+
+/**
+ *  Return the space taken by a record carrying 'report_len' bytes.
+ */
+inline uint32_t virthid_schedule_record_size(uint16_t report_len) {
+    return (sizeof(virthid_schedule_record) + report_len + 7) & ~7u;
+}
+
+/**
+ *  Walk the records of a schedule submission, copying each header out once
+ *  before validating it.
+ *
+ *  @return 1 with a record, 0 at the end, -1 on a truncated record.
+ */
+class virthid_schedule_reader {
+public:
+    virthid_schedule_reader(const uint8_t *records, uint32_t records_len)
+        : m_records(records), m_records_len(records_len), m_offset(0) {}
+
+    int next(uint64_t *deadline, const uint8_t **report, uint16_t *report_len) {
+        uint32_t remaining = m_records_len - m_offset;
+        if (remaining == 0) return 0;
+        if (remaining < sizeof(virthid_schedule_record)) return -1;
+
+        virthid_schedule_record record;
+        memcpy(&record, m_records + m_offset, sizeof(record));
+        if (sizeof(record) + record.length > remaining) return -1;
+
+        *deadline = record.deadline;
+        *report = m_records + m_offset + sizeof(record);
+        *report_len = record.length;
+
+        uint32_t size = virthid_schedule_record_size(record.length);
+        m_offset = size < remaining ? m_offset + size : m_records_len;
+
+        return 1;
+    }
+
+private:
+    const uint8_t *m_records;
+    uint32_t m_records_len;
+    uint32_t m_offset;
+};
+
+/**
+ *  Bounded queue of reports sorted by deadline, reports sharing a deadline
+ *  keep their submission order. It is written against an abstract clock:
+ *  'Clock' only needs a 'uint64_t now() const' returning nanoseconds.
+ *
+ *  Reports are kept in caller provided storage, one slot of 'stride' bytes
+ *  each, so they can be as large as the device's largest input report.
+ *
+ *  The object is large and has no constructor, allocate it where needed and
+ *  call 'reset' before use. Not thread-safe, callers provide the locking.
+ */
+template <typename Clock, uint32_t N = virthid_schedule_capacity>
+class virthid_schedule {
+public:
+    /**
+     *  Return how many reports of up to 'stride' bytes a schedule holds.
+     */
+    static uint32_t capacityFor(uint32_t stride) {
+        uint32_t capacity = stride > virthid_max_report ? virthid_schedule_budget / stride : N;
+        if (capacity == 0) capacity = 1;
+        return capacity < N ? capacity : N;
+    }
+
+    /**
+     *  Return the storage needed for reports of up to 'stride' bytes.
+     */
+    static uint32_t storageSize(uint32_t stride) {
+        return capacityFor(stride) * stride;
+    }
+
+    /**
+     *  Attach the storage and drop every scheduled report.
+     *
+     *  @param storage 'storageSize(stride)' bytes.
+     */
+    void reset(uint8_t *storage, uint32_t stride) {
+        m_storage = storage;
+        m_stride = stride;
+        m_capacity = capacityFor(stride);
+        m_count = 0;
+        m_sequence = 0;
+        for (uint32_t i = 0; i < m_capacity; i++) m_free[i] = m_capacity - 1 - i;
+    }
+
+    /**
+     *  Schedule a report.
+     *
+     *  @return False if the schedule is full or the report too large.
+     */
+    bool push(uint64_t deadline, const uint8_t *report, uint32_t report_len) {
+        if (m_count == m_capacity || report_len > m_stride) return false;
+
+        uint32_t slot = m_free[m_capacity - 1 - m_count];
+        memcpy(m_storage + slot * m_stride, report, report_len);
+        m_sizes[slot] = report_len;
+
+        node n = {deadline, m_sequence++, slot};
+        uint32_t i = m_count++;
+        while (i > 0) {
+            uint32_t parent = (i - 1) / 2;
+            if (!before(n, m_heap[parent])) break;
+            m_heap[i] = m_heap[parent];
+            i = parent;
+        }
+        m_heap[i] = n;
+
+        return true;
+    }
+
+    /**
+     *  Return the earliest deadline, if anything is scheduled.
+     */
+    bool nextDeadline(uint64_t *deadline) const {
+        if (m_count == 0) return false;
+
+        *deadline = m_heap[0].deadline;
+        return true;
+    }
+
+    /**
+     *  Take the earliest report if its deadline has passed.
+     *
+     *  @param clock      The clock to compare deadlines against.
+     *  @param report     A buffer of at least 'stride' bytes.
+     *  @param report_len Receives the report length.
+     *  @param lateness   If not null, receives how late the report is, in nanoseconds.
+     *
+     *  @return False if nothing is due.
+     */
+    bool popDue(const Clock &clock, uint8_t *report, uint32_t *report_len, uint64_t *lateness = nullptr) {
+        if (m_count == 0) return false;
+
+        uint64_t now = clock.now();
+        node first = m_heap[0];
+        if (first.deadline > now) return false;
+
+        memcpy(report, m_storage + first.slot * m_stride, m_sizes[first.slot]);
+        *report_len = m_sizes[first.slot];
+        if (lateness) *lateness = now - first.deadline;
+
+        m_count--;
+        m_free[m_capacity - 1 - m_count] = first.slot;
+
+        node last = m_heap[m_count];
+        uint32_t i = 0;
+        for (;;) {
+            uint32_t child = 2 * i + 1;
+            if (child >= m_count) break;
+            if (child + 1 < m_count && before(m_heap[child + 1], m_heap[child])) child++;
+            if (!before(m_heap[child], last)) break;
+            m_heap[i] = m_heap[child];
+            i = child;
+        }
+        m_heap[i] = last;
+
+        return true;
+    }
+
+    uint32_t size() const {
+        return m_count;
+    }
+
+    uint32_t capacity() const {
+        return m_capacity;
+    }
+
+    uint32_t stride() const {
+        return m_stride;
+    }
+
+private:
+    struct node {
+        uint64_t deadline;
+        uint64_t sequence;
+        uint32_t slot;
+    };
+
+    static bool before(const node &a, const node &b) {
+        return a.deadline != b.deadline ? a.deadline < b.deadline : a.sequence < b.sequence;
+    }
+
+    node m_heap[N];
+    uint32_t m_sizes[N];
+    uint32_t m_free[N];
+    uint8_t *m_storage;
+    uint32_t m_stride;
+    uint32_t m_capacity;
+    uint32_t m_count;
+    uint64_t m_sequence;
+};
+
+#endif
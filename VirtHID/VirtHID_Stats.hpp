@@ -0,0 +1,59 @@
+//
+//  VirtHID_Stats.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_stats_h
+#define virthid_stats_h
+
+#include <stdint.h>
+
+/**
+ *  Counters of a device. Updated with relaxed atomics from the hot paths,
+ *  so a snapshot is consistent per counter but not across counters.
+ */
+typedef struct virthid_device_stats {
+    uint64_t reports_in;        // Input reports accepted by the HID stack.
+    uint64_t bytes_in;          // Bytes of those reports.
+    uint64_t reports_rejected;  // Input reports not matching the report descriptor.
+    uint64_t report_failures;   // Input reports lost to 'handleReport' errors or buffer exhaustion.
+    uint64_t output_reports;    // Output reports received from the HID stack.
+    uint64_t subscriber_drops;  // Output reports dropped by full subscriber queues.
+    uint32_t subscriber_queue_high_water;
+    uint32_t coalesce_high_water;
+    uint32_t schedule_high_water;
+    uint32_t reserved;
+} virthid_device_stats;
+
+inline void virthid_stat_add(uint64_t *counter, uint64_t value = 1) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ *  Raise a high-water mark to 'value' if it is lower.
+ */
+inline void virthid_stat_max(uint32_t *mark, uint32_t value) {
+    uint32_t current = __atomic_load_n(mark, __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(mark, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/**
+ *  Take a snapshot of counters that may be updated concurrently.
+ */
+inline void virthid_stats_copy(const virthid_device_stats *stats, virthid_device_stats *out) {
+    out->reports_in = __atomic_load_n(&stats->reports_in, __ATOMIC_RELAXED);
+    out->bytes_in = __atomic_load_n(&stats->bytes_in, __ATOMIC_RELAXED);
+    out->reports_rejected = __atomic_load_n(&stats->reports_rejected, __ATOMIC_RELAXED);
+    out->report_failures = __atomic_load_n(&stats->report_failures, __ATOMIC_RELAXED);
+    out->output_reports = __atomic_load_n(&stats->output_reports, __ATOMIC_RELAXED);
+    out->subscriber_drops = __atomic_load_n(&stats->subscriber_drops, __ATOMIC_RELAXED);
+    out->subscriber_queue_high_water = __atomic_load_n(&stats->subscriber_queue_high_water, __ATOMIC_RELAXED);
+    out->coalesce_high_water = __atomic_load_n(&stats->coalesce_high_water, __ATOMIC_RELAXED);
+    out->schedule_high_water = __atomic_load_n(&stats->schedule_high_water, __ATOMIC_RELAXED);
+    out->reserved = 0;
+}
+
+#endif
@@ -0,0 +1,81 @@
+//
+//  VirtHID_Subscribers.hpp
+//  VirtHID
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_subscribers_h
+#define virthid_subscribers_h
+
+#include <stdint.h>
+
+/**
+ *  Maximum number of subscribers per device.
+ */
+const uint32_t virthid_max_subscribers = 8;
+
+/**
+ *  Small unordered set of subscriber pointers. It does not retain the
+ *  subscribers and does no locking of its own.
+ */
+template <typename T, uint32_t N = virthid_max_subscribers>
+class virthid_subscriber_set {
+public:
+    virthid_subscriber_set() : m_count(0) {}
+
+    /**
+     *  Add a subscriber.
+     *
+     *  @return False if the set is full. Adding a subscriber twice is a no-op
+     *          and returns true, with 'added' set to false.
+     */
+    bool add(T *subscriber, bool *added = nullptr) {
+        if (added) *added = false;
+        if (contains(subscriber)) return true;
+        if (m_count == N) return false;
+
+        m_subscribers[m_count++] = subscriber;
+        if (added) *added = true;
+        return true;
+    }
+
+    /**
+     *  Remove a subscriber. Order of the remaining subscribers may change.
+     *
+     *  @return False if it was not in the set.
+     */
+    bool remove(T *subscriber) {
+        for (uint32_t i = 0; i < m_count; i++) {
+            if (m_subscribers[i] == subscriber) {
+                m_subscribers[i] = m_subscribers[--m_count];
+                m_subscribers[m_count] = nullptr;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool contains(T *subscriber) const {
+        for (uint32_t i = 0; i < m_count; i++) {
+            if (m_subscribers[i] == subscriber) return true;
+        }
+
+        return false;
+    }
+
+    uint32_t count() const {
+        return m_count;
+    }
+
+    T *at(uint32_t index) const {
+        return m_subscribers[index];
+    }
+
+private:
+    T *m_subscribers[N];
+    uint32_t m_count;
+};
+
+#endif
@@ -8,11 +8,39 @@
 #ifndef virthid_types_h
 #define virthid_types_h
 
-const uint8_t virthid_max_report = 64;
+#include <stdint.h>
+
+/**
+ *  Largest report passed through 'virthid_report' or a ring slot. This is what
+ *  fits in the arguments of a single async notification (kMaxAsyncArgs) next
+ *  to the size. Input reports sent directly are only bounded by the device's
+ *  report descriptor.
+ */
+const uint8_t virthid_max_report = 120;
 
 typedef struct virthid_report {
     uint64_t size;
     uint8_t data[virthid_max_report];
 } virthid_report;
 
+/**
+ *  Reports up to this size should be sent with 'send_inline', which copies
+ *  them along with the call instead of wiring and mapping user memory.
+ *  This matches the largest structure IOKit passes inline.
+ */
+const uint32_t virthid_max_inline_report = 4096;
+
+/**
+ *  Memory types accepted by 'clientMemoryForType'. Clients pass
+ *  '(memory type << virthid_memory_type_shift) | device handle'.
+ *  The output ring belongs to the user client, its handle is ignored.
+ */
+enum {
+    virthid_memory_input_ring = 0,
+    virthid_memory_output_ring = 1,
+    virthid_memory_state = 2,
+};
+
+const uint32_t virthid_memory_type_shift = 28;
+
 #endif
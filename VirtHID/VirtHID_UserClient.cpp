@@ -10,12 +10,31 @@
 
 #include "VirtHID_UserClient.hpp"
 #include "VirtHID_Types.hpp"
+#include "VirtHID_Args.hpp"
+#include "VirtHID_Batch.hpp"
+#include "VirtHID_List.hpp"
+#include "VirtHID_Log.hpp"
+#include "VirtHID_Stats.hpp"
+#include "VirtHID_Histogram.hpp"
+#include "VirtHID_Clock.hpp"
 #include "debug.h"
 #include <string.h>
 
+static_assert(sizeof(virthid_report) <= kMaxAsyncArgs * sizeof(io_user_reference_t),
+              "An output report must fit in a single async notification.");
+
 #define super IOUserClient
 OSDefineMetaClassAndStructors(it_kotleni_virthid_userclient, IOUserClient)
 
+/**
+ *  Fill the optional scalar outputs of the send methods: the pending report
+ *  count of the device, then its 'virthid_flow_state'.
+ */
+static void virthid_return_flow(IOExternalMethodArguments *arguments, UInt32 depth, UInt32 flow) {
+    if (arguments->scalarOutputCount > 0) arguments->scalarOutput[0] = depth;
+    if (arguments->scalarOutputCount > 1) arguments->scalarOutput[1] = flow;
+}
+
 bool it_kotleni_virthid_userclient::initWithTask(task_t owningTask, void *securityToken,
                                               UInt32 type, OSDictionary *properties) {
     LogD("Executing 'it_kotleni_virthid_userclient::initWithTask()'.");
@@ -45,14 +64,94 @@ bool it_kotleni_virthid_userclient::start(IOService *provider) {
         return false;
     }
     
+    m_queue_lock = IOLockAlloc();
+    if (!m_queue_lock) {
+        return false;
+    }
+    
+    // Output reports are delivered from the driver's work loop, so that
+    // 'setReport' never waits on the subscriber. Clients share that thread
+    // rather than each starting one of their own.
+    m_work_loop = provider->getWorkLoop();
+    if (!m_work_loop) {
+        return false;
+    }
+    m_work_loop->retain();
+    
+    m_delivery_source = IOInterruptEventSource::interruptEventSource(this, &it_kotleni_virthid_userclient::sDeliverReports);
+    if (!m_delivery_source) {
+        return false;
+    }
+    
+    if (m_work_loop->addEventSource(m_delivery_source) != kIOReturnSuccess) {
+        m_delivery_source->release();
+        m_delivery_source = nullptr;
+        return false;
+    }
+    
+    m_events_lock = IOLockAlloc();
+    if (!m_events_lock) {
+        return false;
+    }
+    
+    m_event_source = IOInterruptEventSource::interruptEventSource(this, &it_kotleni_virthid_userclient::sDeliverEvents);
+    if (!m_event_source) {
+        return false;
+    }
+    
+    if (m_work_loop->addEventSource(m_event_source) != kIOReturnSuccess) {
+        m_event_source->release();
+        m_event_source = nullptr;
+        return false;
+    }
+    
     return true;
 }
 
 void it_kotleni_virthid_userclient::stop(IOService *provider) {
     LogD("Executing 'it_kotleni_virthid_userclient::stop()'.");
+    
+    m_hid_provider->methodUnsubscribe(this);
+    m_hid_provider->methodUnsubscribeEvents(this);
+    
+    if (m_delivery_source) {
+        m_delivery_source->disable();
+        m_work_loop->removeEventSource(m_delivery_source);
+    }
+    
+    if (m_event_source) {
+        m_event_source->disable();
+        m_work_loop->removeEventSource(m_event_source);
+    }
+    
     super::stop(provider);
 }
 
+void it_kotleni_virthid_userclient::free() {
+    LogD("Executing 'it_kotleni_virthid_userclient::free()'.");
+    
+    if (m_delivery_source) m_delivery_source->release();
+    if (m_output_ring) m_output_ring->release();
+    if (m_event_source) m_event_source->release();
+    if (m_events) IOFree(m_events, sizeof(*m_events));
+    if (m_events_lock) IOLockFree(m_events_lock);
+    if (m_work_loop) m_work_loop->release();
+    if (m_queue_lock) IOLockFree(m_queue_lock);
+    
+    super::free();
+}
+
+IOReturn it_kotleni_virthid_userclient::clientClose() {
+    LogD("Executing 'it_kotleni_virthid_userclient::clientClose()'.");
+    
+    // Devices retain their subscribers, drop those references right away.
+    m_hid_provider->methodUnsubscribe(this);
+    m_hid_provider->methodUnsubscribeEvents(this);
+    terminate();
+    
+    return kIOReturnSuccess;
+}
+
 /**
  * A dispatch table for this User Client interface, used by 'it_kotleni_virthid_userclient::externalMethod()'.
  * The fields of the IOExternalMethodDispatch type follows:
@@ -65,13 +164,65 @@ void it_kotleni_virthid_userclient::stop(IOService *provider) {
  *      uint32_t           checkScalarOutputCount;
  *      uint32_t           checkStructureOutputSize;
  *  };
+ *
+ * 'create' accepts either zero or one scalar output, so that clients which do not
+ * care about the device handle keep working. Likewise 'subscribe' takes an optional
+ * third scalar with the drop policy.
+ *
+ * 'list' and 'list_entries' succeed even when the buffer is too short, MIG would
+ * drop the outputs of a failed call. 'list' then returns the size needed to hold
+ * every name, and 'list_entries' returns zero entries with 'used' set to the size
+ * the next entry needs.
+ *
+ * 'read_events' succeeds even if no record fits in the buffer, the client then sees
+ * zero records with events still pending and retries with a larger buffer.
+ *
+ * 'send_batch' returns the processed and failed record counts, then an optional
+ * third scalar set to 1 if the batch ended with a truncated record. The records
+ * before it have been sent either way, so the call still succeeds.
+ *
+ * 'create_batch' mirrors it: the created and failed device counts, then an optional
+ * truncated flag. Each record carries its own status in its handle field, which
+ * is 'virthid_invalid_handle' if that device could not be created.
+ *
+ * 'send', 'send_handle' and 'send_inline' return up to two optional scalars, the
+ * pending report count of the device and its flow state, see 'VirtHID_Flow.hpp'.
+ * Only coalesced reports are counted, 'set_watermarks' needs coalescing enabled.
+ * 'subscribe_flow' takes a device handle and whether to subscribe; once
+ * subscribed, the client's async reference receives the handle of that device
+ * each time it drains from congested to its low watermark.
+ *
+ * 'clone' takes the name followed by the serial number as its structure input,
+ * the second scalar being the length of the name.
  */
 const IOExternalMethodDispatch it_kotleni_virthid_userclient::s_methods[it_kotleni_virthid_method_count] = {
-    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodCreate, 8, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodCreate, 8, 0, kIOUCVariableStructureSize, 0},
     {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodDestroy, 2, 0, 0, 0},
-    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSend, 4, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSend, 4, 0, kIOUCVariableStructureSize, 0},
     {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodList, 2, 0, 2, 0},
-    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSubscribe, 2, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSubscribe, kIOUCVariableStructureSize, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSendHandle, 3, 0, kIOUCVariableStructureSize, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodDoorbell, 1, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSendBatch, 4, 0, kIOUCVariableStructureSize, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSendInline, 1, kIOUCVariableStructureSize, kIOUCVariableStructureSize, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSetCoalescing, 2, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSchedule, 3, 0, 1, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSetCapture, 2, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodReadCapture, 3, 0, 2, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodReplay, 4, 0, 1, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodStats, 1, 0, 0, sizeof(virthid_device_stats)},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodLatency, 2, 0, 0, sizeof(virthid_histogram_snapshot)},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodListEntries, 3, 0, 4, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSubscribeEvents, 0, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodReadEvents, 2, 0, 3, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodCreateBatch, 3, 0, kIOUCVariableStructureSize, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodClone, 4, kIOUCVariableStructureSize, 1, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSetReportState, 2, kIOUCVariableStructureSize, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSendKeys, 1, kIOUCVariableStructureSize, 1, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSendEvents, 1, kIOUCVariableStructureSize, 1, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSetPolling, 3, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSetWatermarks, 3, 0, 0, 0},
+    {(IOExternalMethodAction)&it_kotleni_virthid_userclient::sMethodSubscribeFlow, 2, 0, 0, 0},
 };
 
 IOReturn it_kotleni_virthid_userclient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
@@ -82,13 +233,44 @@ IOReturn it_kotleni_virthid_userclient::externalMethod(uint32_t selector, IOExte
         return kIOReturnUnsupported;
     }
     
+    // Input latency starts here, the sending methods get it through 'reference'.
+    uint64_t timestamp = virthid_uptime_clock().now();
+    
     dispatch = (IOExternalMethodDispatch *)&s_methods[selector];
     target = this;
-    reference = nullptr;
+    reference = &timestamp;
     
     return super::externalMethod(selector, arguments, dispatch, target, reference);
 }
 
+IOReturn it_kotleni_virthid_userclient::clientMemoryForType(UInt32 type, IOOptionBits *options,
+                                                         IOMemoryDescriptor **memory) {
+    LogD("Executing 'it_kotleni_virthid_userclient::clientMemoryForType()' with type %#x.", type);
+    
+    UInt32 handle = type & virthid_handle_mask;
+    bool ret = false;
+    
+    switch (type >> virthid_memory_type_shift) {
+        case virthid_memory_input_ring:
+            ret = m_hid_provider->methodInputRing(handle, memory);
+            break;
+        case virthid_memory_output_ring:
+            *memory = copyOutputRing();
+            ret = *memory != nullptr;
+            break;
+        case virthid_memory_state:
+            ret = m_hid_provider->methodStateMemory(handle, memory);
+            break;
+        default:
+            return kIOReturnBadArgument;
+    }
+    
+    if (!ret) return kIOReturnNotFound;
+    
+    *options = 0;
+    return kIOReturnSuccess;
+}
+
 IOReturn it_kotleni_virthid_userclient::sMethodCreate(it_kotleni_virthid_userclient *target, void *reference,
                                                   IOExternalMethodArguments *arguments) {
     return target->methodCreate(arguments);
@@ -101,7 +283,7 @@ IOReturn it_kotleni_virthid_userclient::sMethodDestroy(it_kotleni_virthid_usercl
 
 IOReturn it_kotleni_virthid_userclient::sMethodSend(it_kotleni_virthid_userclient *target, void *reference,
                                                 IOExternalMethodArguments *arguments) {
-    return target->methodSend(arguments);
+    return target->methodSend(arguments, *(uint64_t *)reference);
 }
 
 IOReturn it_kotleni_virthid_userclient::sMethodList(it_kotleni_virthid_userclient *target, void *reference,
@@ -114,6 +296,116 @@ IOReturn it_kotleni_virthid_userclient::sMethodSubscribe(it_kotleni_virthid_user
     return target->methodSubscribe(arguments);
 }
 
+IOReturn it_kotleni_virthid_userclient::sMethodSendHandle(it_kotleni_virthid_userclient *target, void *reference,
+                                                      IOExternalMethodArguments *arguments) {
+    return target->methodSendHandle(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodDoorbell(it_kotleni_virthid_userclient *target, void *reference,
+                                                    IOExternalMethodArguments *arguments) {
+    return target->methodDoorbell(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSendBatch(it_kotleni_virthid_userclient *target, void *reference,
+                                                     IOExternalMethodArguments *arguments) {
+    return target->methodSendBatch(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSendInline(it_kotleni_virthid_userclient *target, void *reference,
+                                                      IOExternalMethodArguments *arguments) {
+    return target->methodSendInline(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSetCoalescing(it_kotleni_virthid_userclient *target, void *reference,
+                                                         IOExternalMethodArguments *arguments) {
+    return target->methodSetCoalescing(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSchedule(it_kotleni_virthid_userclient *target, void *reference,
+                                                     IOExternalMethodArguments *arguments) {
+    return target->methodSchedule(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSetCapture(it_kotleni_virthid_userclient *target, void *reference,
+                                                       IOExternalMethodArguments *arguments) {
+    return target->methodSetCapture(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodReadCapture(it_kotleni_virthid_userclient *target, void *reference,
+                                                        IOExternalMethodArguments *arguments) {
+    return target->methodReadCapture(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodReplay(it_kotleni_virthid_userclient *target, void *reference,
+                                                   IOExternalMethodArguments *arguments) {
+    return target->methodReplay(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodStats(it_kotleni_virthid_userclient *target, void *reference,
+                                                  IOExternalMethodArguments *arguments) {
+    return target->methodStats(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodLatency(it_kotleni_virthid_userclient *target, void *reference,
+                                                    IOExternalMethodArguments *arguments) {
+    return target->methodLatency(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodListEntries(it_kotleni_virthid_userclient *target, void *reference,
+                                                        IOExternalMethodArguments *arguments) {
+    return target->methodListEntries(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSubscribeEvents(it_kotleni_virthid_userclient *target, void *reference,
+                                                            IOExternalMethodArguments *arguments) {
+    return target->methodSubscribeEvents(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodReadEvents(it_kotleni_virthid_userclient *target, void *reference,
+                                                       IOExternalMethodArguments *arguments) {
+    return target->methodReadEvents(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodCreateBatch(it_kotleni_virthid_userclient *target, void *reference,
+                                                        IOExternalMethodArguments *arguments) {
+    return target->methodCreateBatch(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodClone(it_kotleni_virthid_userclient *target, void *reference,
+                                                  IOExternalMethodArguments *arguments) {
+    return target->methodClone(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSetReportState(it_kotleni_virthid_userclient *target, void *reference,
+                                                           IOExternalMethodArguments *arguments) {
+    return target->methodSetReportState(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSendKeys(it_kotleni_virthid_userclient *target, void *reference,
+                                                    IOExternalMethodArguments *arguments) {
+    return target->methodSendKeys(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSendEvents(it_kotleni_virthid_userclient *target, void *reference,
+                                                      IOExternalMethodArguments *arguments) {
+    return target->methodSendEvents(arguments, *(uint64_t *)reference);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSetPolling(it_kotleni_virthid_userclient *target, void *reference,
+                                                      IOExternalMethodArguments *arguments) {
+    return target->methodSetPolling(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSetWatermarks(it_kotleni_virthid_userclient *target, void *reference,
+                                                         IOExternalMethodArguments *arguments) {
+    return target->methodSetWatermarks(arguments);
+}
+
+IOReturn it_kotleni_virthid_userclient::sMethodSubscribeFlow(it_kotleni_virthid_userclient *target, void *reference,
+                                                         IOExternalMethodArguments *arguments) {
+    return target->methodSubscribeFlow(arguments);
+}
+
 IOReturn it_kotleni_virthid_userclient::methodCreate(IOExternalMethodArguments *arguments) {
     IOMemoryDescriptor *user_buf = nullptr;
     IOMemoryDescriptor *descriptor_buf = nullptr;
@@ -132,16 +424,25 @@ IOReturn it_kotleni_virthid_userclient::methodCreate(IOExternalMethodArguments *
     char *ptr3 = nullptr;
     
     bool ret = false;
-    
-    UInt8 *name_ptr = (UInt8 *)arguments->scalarInput[0];
-    UInt8 name_len = (UInt8)arguments->scalarInput[1];
-    UInt8 *descriptor_ptr = (UInt8 *)arguments->scalarInput[2];
-    UInt16 descriptor_len = (UInt16)arguments->scalarInput[3];
-    
-    UInt8 *serial_number_ptr = (UInt8 *)arguments->scalarInput[4];
-    UInt8 serial_number_len = (UInt8)arguments->scalarInput[5];
-    UInt32 vendorID = (UInt32)arguments->scalarInput[6];
-    UInt32 productID = (UInt32)arguments->scalarInput[7];
+    UInt32 handle = 0;
+    
+    UInt8 *name_ptr = nullptr;
+    UInt8 name_len = 0;
+    UInt8 *descriptor_ptr = nullptr;
+    UInt16 descriptor_len = 0;
+    
+    UInt8 *serial_number_ptr = nullptr;
+    UInt8 serial_number_len = 0;
+    UInt32 vendorID = 0;
+    UInt32 productID = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&name_ptr, &name_len, 1, UINT8_MAX);
+    in.range(&descriptor_ptr, &descriptor_len, 1, UINT16_MAX);
+    in.range(&serial_number_ptr, &serial_number_len, 0, UINT8_MAX);
+    in.value(&vendorID);
+    in.value(&productID);
+    if (!in.ok()) return kIOReturnBadArgument;
     
     user_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)name_ptr, name_len,
                                                     kIODirectionOut, m_owner);
@@ -182,7 +483,7 @@ IOReturn it_kotleni_virthid_userclient::methodCreate(IOExternalMethodArguments *
     if (!ptr3) goto nomem;
     
     ret = m_hid_provider->methodCreate(ptr, name_len, ptr2, descriptor_len, ptr3,
-                                       serial_number_len, vendorID, productID);
+                                       serial_number_len, vendorID, productID, &handle);
     
     user_buf->complete();
     descriptor_buf->complete();
@@ -197,6 +498,7 @@ IOReturn it_kotleni_virthid_userclient::methodCreate(IOExternalMethodArguments *
     serial_number_buf->release();
     
     if (ret) {
+        if (arguments->scalarOutputCount > 0) arguments->scalarOutput[0] = handle;
         return kIOReturnSuccess;
     }
     
@@ -205,7 +507,7 @@ IOReturn it_kotleni_virthid_userclient::methodCreate(IOExternalMethodArguments *
 nomem:
     if (map) map->release();
     if (map2) map2->release();
-    if (map3) map2->release();
+    if (map3) map3->release();
     if (user_buf_complete) user_buf->complete();
     if (user_buf) user_buf->release();
     if (descriptor_buf_complete) descriptor_buf->complete();
@@ -225,8 +527,12 @@ IOReturn it_kotleni_virthid_userclient::methodDestroy(IOExternalMethodArguments
     
     bool ret = false;
     
-    UInt8 *name_ptr = (UInt8 *)arguments->scalarInput[0];
-    UInt8 name_len = (UInt8)arguments->scalarInput[1];
+    UInt8 *name_ptr = nullptr;
+    UInt8 name_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&name_ptr, &name_len, 1, UINT8_MAX);
+    if (!in.ok()) return kIOReturnBadArgument;
     
     user_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)name_ptr, name_len,
                                                     kIODirectionOut, m_owner);
@@ -258,9 +564,13 @@ nomem:
     return kIOReturnNoMemory;
 }
 
-IOReturn it_kotleni_virthid_userclient::methodSend(IOExternalMethodArguments *arguments) {
+IOReturn it_kotleni_virthid_userclient::methodSend(IOExternalMethodArguments *arguments, uint64_t timestamp) {
     IOMemoryDescriptor *user_buf = nullptr;
     IOMemoryDescriptor *descriptor_buf = nullptr;
+    
+    bool user_buf_complete = false;
+    bool descriptor_buf_complete = false;
+    
     IOMemoryMap *map = nullptr;
     IOMemoryMap *map2 = nullptr;
     
@@ -269,21 +579,31 @@ IOReturn it_kotleni_virthid_userclient::methodSend(IOExternalMethodArguments *ar
     
     bool ret = false;
     
-    UInt8 *name_ptr = (UInt8 *)arguments->scalarInput[0];
-    UInt8 name_len = (UInt8)arguments->scalarInput[1];
-    UInt8 *descriptor_ptr = (UInt8 *)arguments->scalarInput[2];
-    UInt16 descriptor_len = (UInt16)arguments->scalarInput[3];
+    UInt8 *name_ptr = nullptr;
+    UInt8 name_len = 0;
+    UInt8 *descriptor_ptr = nullptr;
+    UInt16 descriptor_len = 0;
+    
+    UInt32 depth = 0;
+    UInt32 flow = virthid_flow_clear;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&name_ptr, &name_len, 1, UINT8_MAX);
+    in.range(&descriptor_ptr, &descriptor_len, 0, UINT16_MAX);
+    if (!in.ok()) return kIOReturnBadArgument;
     
     user_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)name_ptr, name_len,
                                                     kIODirectionOut, m_owner);
     if (!user_buf) goto nomem;
     if (user_buf->prepare() != kIOReturnSuccess) goto nomem;
+    user_buf_complete = true;
     
     descriptor_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)descriptor_ptr, descriptor_len,
                                                           kIODirectionOut, m_owner);
     
     if (!descriptor_buf) goto nomem;
     if (descriptor_buf->prepare() != kIOReturnSuccess) goto nomem;
+    descriptor_buf_complete = true;
     
     map = user_buf->map();
     if (!map) goto nomem;
@@ -297,7 +617,7 @@ IOReturn it_kotleni_virthid_userclient::methodSend(IOExternalMethodArguments *ar
     ptr2 = (unsigned char *)map2->getAddress();
     if (!ptr2) goto nomem;
     
-    ret = m_hid_provider->methodSend(ptr, name_len, ptr2, descriptor_len);
+    ret = m_hid_provider->methodSend(ptr, name_len, ptr2, descriptor_len, timestamp, &depth, &flow);
     
     user_buf->complete();
     descriptor_buf->complete();
@@ -309,6 +629,7 @@ IOReturn it_kotleni_virthid_userclient::methodSend(IOExternalMethodArguments *ar
     descriptor_buf->release();
     
     if (ret) {
+        virthid_return_flow(arguments, depth, flow);
         return kIOReturnSuccess;
     }
     
@@ -317,45 +638,213 @@ IOReturn it_kotleni_virthid_userclient::methodSend(IOExternalMethodArguments *ar
 nomem:
     if (map) map->release();
     if (map2) map2->release();
+    if (user_buf_complete) user_buf->complete();
     if (user_buf) user_buf->release();
+    if (descriptor_buf_complete) descriptor_buf->complete();
     if (descriptor_buf) descriptor_buf->release();
     return kIOReturnNoMemory;
 }
 
-IOReturn it_kotleni_virthid_userclient::methodList(IOExternalMethodArguments *arguments) {
-    IOMemoryDescriptor *user_buf = nullptr;
+IOReturn it_kotleni_virthid_userclient::methodSendHandle(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    IOMemoryDescriptor *report_buf = nullptr;
+    bool report_buf_complete = false;
     
     IOMemoryMap *map = nullptr;
     
-    UInt16 needed = 0, items = 0;
+    unsigned char *ptr = nullptr;
     
-    char *ptr = nullptr;
     bool ret = false;
     
-    UInt8 *name_ptr = (UInt8 *)arguments->scalarInput[0];
-    UInt16 name_len = (UInt16)arguments->scalarInput[1];
+    UInt32 handle = 0;
+    UInt8 *report_ptr = nullptr;
+    UInt16 report_len = 0;
     
-    user_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)name_ptr, name_len,
-                                                    kIODirectionIn, m_owner);
-    if (!user_buf) goto nomem;
-    if (user_buf->prepare() != kIOReturnSuccess) goto nomem;
+    UInt32 depth = 0;
+    UInt32 flow = virthid_flow_clear;
     
-    map = user_buf->map();
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.range(&report_ptr, &report_len, 0, UINT16_MAX);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    report_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)report_ptr, report_len,
+                                                      kIODirectionOut, m_owner);
+    if (!report_buf) goto nomem;
+    if (report_buf->prepare() != kIOReturnSuccess) goto nomem;
+    report_buf_complete = true;
+    
+    map = report_buf->map();
     if (!map) goto nomem;
     
-    ptr = (char *)map->getAddress();
+    ptr = (unsigned char *)map->getAddress();
     if (!ptr) goto nomem;
     
-    ret = m_hid_provider->methodList(ptr, name_len, &needed, &items);
+    ret = m_hid_provider->methodSendHandle(handle, ptr, report_len, timestamp, &depth, &flow);
     
-    user_buf->complete();
+    report_buf->complete();
+    map->release();
+    report_buf->release();
+    
+    if (ret) {
+        virthid_return_flow(arguments, depth, flow);
+        return kIOReturnSuccess;
+    }
+    
+    return kIOReturnDeviceError;
+    
+nomem:
+    if (map) map->release();
+    if (report_buf_complete) report_buf->complete();
+    if (report_buf) report_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodDoorbell(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    UInt32 handle = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    if (m_hid_provider->methodDoorbell(handle, timestamp)) {
+        return kIOReturnSuccess;
+    }
+    
+    return kIOReturnDeviceError;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSendBatch(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    IOMemoryDescriptor *batch_buf = nullptr;
+    IOMemoryDescriptor *status_buf = nullptr;
+    
+    bool batch_buf_complete = false;
+    bool status_buf_complete = false;
+    
+    IOMemoryMap *map = nullptr;
+    IOMemoryMap *map2 = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    SInt32 *ptr2 = nullptr;
     
+    UInt32 processed = 0, failed = 0;
+    bool ret = false;
+    
+    UInt8 *batch_ptr = nullptr;
+    UInt32 batch_len = 0;
+    UInt8 *status_ptr = nullptr;
+    UInt32 status_count = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&batch_ptr, &batch_len, 1, virthid_max_batch);
+    in.range(&status_ptr, &status_count, 0, UINT32_MAX);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    if (status_count > batch_len / sizeof(virthid_batch_record)) return kIOReturnBadArgument;
+    
+    batch_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)batch_ptr, batch_len,
+                                                     kIODirectionOut, m_owner);
+    if (!batch_buf) goto nomem;
+    if (batch_buf->prepare() != kIOReturnSuccess) goto nomem;
+    batch_buf_complete = true;
+    
+    map = batch_buf->map();
+    if (!map) goto nomem;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem;
+    
+    // The per-record status array is optional.
+    if (status_ptr && status_count) {
+        status_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)status_ptr,
+                                                          status_count * sizeof(SInt32),
+                                                          kIODirectionIn, m_owner);
+        if (!status_buf) goto nomem;
+        if (status_buf->prepare() != kIOReturnSuccess) goto nomem;
+        status_buf_complete = true;
+        
+        map2 = status_buf->map();
+        if (!map2) goto nomem;
+        
+        ptr2 = (SInt32 *)map2->getAddress();
+        if (!ptr2) goto nomem;
+    }
+    
+    ret = m_hid_provider->methodSendBatch(ptr, batch_len, timestamp, ptr2, ptr2 ? status_count : 0,
+                                          &processed, &failed);
+    
+    batch_buf->complete();
+    map->release();
+    batch_buf->release();
+    
+    if (status_buf) {
+        status_buf->complete();
+        map2->release();
+        status_buf->release();
+    }
+    
+    if (arguments->scalarOutputCount > 0) arguments->scalarOutput[0] = processed;
+    if (arguments->scalarOutputCount > 1) arguments->scalarOutput[1] = failed;
+    if (arguments->scalarOutputCount > 2) arguments->scalarOutput[2] = ret ? 0 : 1;
+    
+    return kIOReturnSuccess;
+    
+nomem:
+    if (map) map->release();
+    if (map2) map2->release();
+    if (batch_buf_complete) batch_buf->complete();
+    if (batch_buf) batch_buf->release();
+    if (status_buf_complete) status_buf->complete();
+    if (status_buf) status_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSendInline(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    IOMemoryDescriptor *report_buf = arguments->structureInputDescriptor;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    IOByteCount report_len = 0;
+    
+    bool ret = false;
+    
+    UInt32 handle = 0;
+    UInt32 depth = 0;
+    UInt32 flow = virthid_flow_clear;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Small reports arrive inline and need no mapping at all.
+    if (!report_buf) {
+        if (arguments->structureInputSize > UINT16_MAX) return kIOReturnBadArgument;
+        ret = m_hid_provider->methodSendHandle(handle, (unsigned char *)arguments->structureInput,
+                                               (UInt16)arguments->structureInputSize, timestamp, &depth, &flow);
+        if (!ret) return kIOReturnDeviceError;
+        
+        virthid_return_flow(arguments, depth, flow);
+        return kIOReturnSuccess;
+    }
+    
+    // Anything larger than what IOKit passes inline comes as a descriptor.
+    report_len = report_buf->getLength();
+    if (report_len > UINT16_MAX) return kIOReturnBadArgument;
+    
+    if (report_buf->prepare() != kIOReturnSuccess) return kIOReturnNoMemory;
+    
+    map = report_buf->map();
+    if (!map) goto nomem;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem;
+    
+    ret = m_hid_provider->methodSendHandle(handle, ptr, (UInt16)report_len, timestamp, &depth, &flow);
+    
+    report_buf->complete();
     map->release();
     
-    user_buf->release();
     if (ret) {
-        arguments->scalarOutput[0] = needed;
-        arguments->scalarOutput[1] = items;
+        virthid_return_flow(arguments, depth, flow);
         return kIOReturnSuccess;
     }
     
@@ -363,6 +852,698 @@ IOReturn it_kotleni_virthid_userclient::methodList(IOExternalMethodArguments *ar
     
 nomem:
     if (map) map->release();
+    report_buf->complete();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSetCoalescing(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    bool enable = false;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.flag(&enable);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    return m_hid_provider->methodSetCoalescing(handle, enable);
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSetPolling(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    UInt32 interval_us = 0;
+    bool skip_identical = false;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.value(&interval_us);
+    in.flag(&skip_identical);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    return m_hid_provider->methodSetPolling(handle, interval_us, skip_identical);
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSetWatermarks(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    UInt32 high = 0;
+    UInt32 low = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.value(&high);
+    in.value(&low);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    return m_hid_provider->methodSetWatermarks(handle, high, low);
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSubscribeFlow(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    bool enable = false;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.flag(&enable);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    if (enable) {
+        if (!arguments->asyncReference) return kIOReturnBadArgument;
+        
+        // One reference serves every device the client subscribes to, the handle tells them apart.
+        IOLockLock(m_queue_lock);
+        memcpy(m_flow_subscriber, arguments->asyncReference, sizeof(OSAsyncReference64));
+        m_flow_subscribed = true;
+        IOLockUnlock(m_queue_lock);
+    }
+    
+    return m_hid_provider->methodSubscribeFlow(handle, enable, this);
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSchedule(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *records_buf = nullptr;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    
+    UInt32 scheduled = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt8 *records_ptr = nullptr;
+    UInt32 records_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.range(&records_ptr, &records_len, 1, virthid_max_batch);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    
+    records_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)records_ptr, records_len,
+                                                       kIODirectionOut, m_owner);
+    if (!records_buf) return kIOReturnNoMemory;
+    if (records_buf->prepare() != kIOReturnSuccess) goto nomem;
+    
+    map = records_buf->map();
+    if (!map) goto nomem_prepared;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem_prepared;
+    
+    ret = m_hid_provider->methodSchedule(handle, ptr, records_len, &scheduled);
+    
+    records_buf->complete();
+    map->release();
+    records_buf->release();
+    
+    arguments->scalarOutput[0] = scheduled;
+    
+    return ret;
+    
+nomem_prepared:
+    if (map) map->release();
+    records_buf->complete();
+nomem:
+    records_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSetCapture(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    bool enable = false;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.flag(&enable);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    return m_hid_provider->methodSetCapture(handle, enable);
+}
+
+IOReturn it_kotleni_virthid_userclient::methodReadCapture(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *log_buf = nullptr;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    
+    UInt32 copied = 0, dropped = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt8 *log_ptr = nullptr;
+    UInt32 log_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.range(&log_ptr, &log_len, 1, virthid_capture_size);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    
+    log_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)log_ptr, log_len,
+                                                   kIODirectionIn, m_owner);
+    if (!log_buf) return kIOReturnNoMemory;
+    if (log_buf->prepare() != kIOReturnSuccess) goto nomem;
+    
+    map = log_buf->map();
+    if (!map) goto nomem_prepared;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem_prepared;
+    
+    ret = m_hid_provider->methodReadCapture(handle, ptr, log_len, &copied, &dropped);
+    
+    log_buf->complete();
+    map->release();
+    log_buf->release();
+    
+    arguments->scalarOutput[0] = copied;
+    arguments->scalarOutput[1] = dropped;
+    
+    return ret;
+    
+nomem_prepared:
+    if (map) map->release();
+    log_buf->complete();
+nomem:
+    log_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodReplay(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    IOMemoryDescriptor *log_buf = nullptr;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    
+    UInt32 replayed = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt8 *log_ptr = nullptr;
+    UInt32 log_len = 0;
+    UInt32 speed = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.range(&log_ptr, &log_len, 1, virthid_max_batch);
+    in.value(&speed);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    
+    log_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)log_ptr, log_len,
+                                                   kIODirectionOut, m_owner);
+    if (!log_buf) return kIOReturnNoMemory;
+    if (log_buf->prepare() != kIOReturnSuccess) goto nomem;
+    
+    map = log_buf->map();
+    if (!map) goto nomem_prepared;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem_prepared;
+    
+    ret = m_hid_provider->methodReplay(handle, ptr, log_len, speed, timestamp, &replayed);
+    
+    log_buf->complete();
+    map->release();
+    log_buf->release();
+    
+    arguments->scalarOutput[0] = replayed;
+    
+    return ret;
+    
+nomem_prepared:
+    if (map) map->release();
+    log_buf->complete();
+nomem:
+    log_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodStats(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    return m_hid_provider->methodStats(handle, (virthid_device_stats *)arguments->structureOutput);
+}
+
+IOReturn it_kotleni_virthid_userclient::methodLatency(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *snapshot_buf = arguments->structureOutputDescriptor;
+    virthid_histogram_snapshot *snapshot = nullptr;
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt32 direction = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.value(&direction);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Small enough snapshots are returned inline.
+    if (!snapshot_buf) {
+        return m_hid_provider->methodLatency(handle, direction,
+                                             (virthid_histogram_snapshot *)arguments->structureOutput);
+    }
+    
+    // Anything larger than what IOKit passes inline goes through a descriptor.
+    snapshot = (virthid_histogram_snapshot *)IOMalloc(sizeof(virthid_histogram_snapshot));
+    if (!snapshot) return kIOReturnNoMemory;
+    
+    ret = m_hid_provider->methodLatency(handle, direction, snapshot);
+    
+    if (ret == kIOReturnSuccess) {
+        if (snapshot_buf->prepare() == kIOReturnSuccess) {
+            snapshot_buf->writeBytes(0, snapshot, sizeof(virthid_histogram_snapshot));
+            snapshot_buf->complete();
+        } else {
+            ret = kIOReturnNoMemory;
+        }
+    }
+    
+    IOFree(snapshot, sizeof(virthid_histogram_snapshot));
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodListEntries(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *list_buf = nullptr;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    
+    UInt32 count = 0, used = 0, generation = 0;
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 cursor = 0;
+    UInt8 *list_ptr = nullptr;
+    UInt32 list_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&cursor);
+    in.range(&list_ptr, &list_len, 0, virthid_max_batch);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    
+    // Without a buffer only the generation is returned, to check for changes cheaply.
+    if (list_ptr && list_len) {
+        list_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)list_ptr, list_len,
+                                                        kIODirectionIn, m_owner);
+        if (!list_buf) return kIOReturnNoMemory;
+        if (list_buf->prepare() != kIOReturnSuccess) goto nomem;
+        
+        map = list_buf->map();
+        if (!map) goto nomem_prepared;
+        
+        ptr = (unsigned char *)map->getAddress();
+        if (!ptr) goto nomem_prepared;
+    }
+    
+    ret = m_hid_provider->methodListEntries(&cursor, ptr, ptr ? list_len : 0, &count, &used, &generation);
+    
+    if (list_buf) {
+        list_buf->complete();
+        map->release();
+        list_buf->release();
+    }
+    
+    if (ret != kIOReturnSuccess) return ret;
+    
+    arguments->scalarOutput[0] = cursor;
+    arguments->scalarOutput[1] = count;
+    arguments->scalarOutput[2] = used;
+    arguments->scalarOutput[3] = generation;
+    
+    return kIOReturnSuccess;
+    
+nomem_prepared:
+    if (map) map->release();
+    list_buf->complete();
+nomem:
+    list_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSubscribeEvents(IOExternalMethodArguments *arguments) {
+    if (!arguments->asyncReference) return kIOReturnBadArgument;
+    
+    IOLockLock(m_events_lock);
+    
+    if (!m_events) {
+        m_events = (virthid_event_queue<> *)IOMalloc(sizeof(virthid_event_queue<>));
+        if (!m_events) {
+            IOLockUnlock(m_events_lock);
+            return kIOReturnNoMemory;
+        }
+        m_events->reset();
+    }
+    
+    memcpy(m_event_subscriber, arguments->asyncReference, sizeof(OSAsyncReference64));
+    m_events_subscribed = true;
+    
+    IOLockUnlock(m_events_lock);
+    
+    if (!m_hid_provider->methodSubscribeEvents(this)) {
+        return kIOReturnNoResources;
+    }
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodReadEvents(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *events_buf = nullptr;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    
+    UInt32 count = 0, used = 0, pending = 0;
+    
+    UInt8 *events_ptr = nullptr;
+    UInt32 events_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&events_ptr, &events_len, 1, virthid_max_batch);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    
+    events_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)events_ptr, events_len,
+                                                      kIODirectionIn, m_owner);
+    if (!events_buf) return kIOReturnNoMemory;
+    if (events_buf->prepare() != kIOReturnSuccess) goto nomem;
+    
+    map = events_buf->map();
+    if (!map) goto nomem_prepared;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem_prepared;
+    
+    IOLockLock(m_events_lock);
+    if (m_events) {
+        count = m_events->drain(ptr, events_len, &used);
+        pending = m_events->pending();
+    }
+    IOLockUnlock(m_events_lock);
+    
+    events_buf->complete();
+    map->release();
+    events_buf->release();
+    
+    arguments->scalarOutput[0] = count;
+    arguments->scalarOutput[1] = used;
+    arguments->scalarOutput[2] = pending;
+    
+    return kIOReturnSuccess;
+    
+nomem_prepared:
+    if (map) map->release();
+    events_buf->complete();
+nomem:
+    events_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodCreateBatch(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *batch_buf = nullptr;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    
+    UInt32 created = 0, failed = 0;
+    bool truncated = false;
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt8 *batch_ptr = nullptr;
+    UInt32 batch_len = 0;
+    UInt32 descriptor_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&batch_ptr, &batch_len, 1, virthid_max_batch);
+    in.value(&descriptor_len, UINT16_MAX);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    if (descriptor_len == 0) return kIOReturnBadArgument;
+    
+    // One mapping for the whole batch, handles are written back into the records.
+    batch_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)batch_ptr, batch_len,
+                                                     kIODirectionInOut, m_owner);
+    if (!batch_buf) return kIOReturnNoMemory;
+    if (batch_buf->prepare() != kIOReturnSuccess) goto nomem;
+    
+    map = batch_buf->map();
+    if (!map) goto nomem_prepared;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem_prepared;
+    
+    ret = m_hid_provider->methodCreateBatch(ptr, batch_len, (UInt16)descriptor_len,
+                                            &created, &failed, &truncated);
+    
+    batch_buf->complete();
+    map->release();
+    batch_buf->release();
+    
+    if (ret != kIOReturnSuccess) return ret;
+    
+    if (arguments->scalarOutputCount > 0) arguments->scalarOutput[0] = created;
+    if (arguments->scalarOutputCount > 1) arguments->scalarOutput[1] = failed;
+    if (arguments->scalarOutputCount > 2) arguments->scalarOutput[2] = truncated ? 1 : 0;
+    
+    return kIOReturnSuccess;
+    
+nomem_prepared:
+    if (map) map->release();
+    batch_buf->complete();
+nomem:
+    batch_buf->release();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodClone(IOExternalMethodArguments *arguments) {
+    UInt32 handle = 0;
+    
+    UInt32 source = 0;
+    UInt32 name_len = 0;
+    UInt32 vendorID = 0;
+    UInt32 productID = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&source);
+    in.value(&name_len, UINT8_MAX);
+    in.value(&vendorID);
+    in.value(&productID);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Name and serial number are small enough to always arrive inline.
+    char *strings = (char *)arguments->structureInput;
+    UInt32 strings_len = arguments->structureInputSize;
+    
+    if (arguments->structureInputDescriptor || !strings) return kIOReturnBadArgument;
+    if (name_len == 0 || name_len > strings_len) return kIOReturnBadArgument;
+    if (strings_len - name_len > UINT16_MAX) return kIOReturnBadArgument;
+    
+    IOReturn ret = m_hid_provider->methodClone(source, strings, (UInt8)name_len, strings + name_len,
+                                               (UInt16)(strings_len - name_len), vendorID, productID, &handle);
+    
+    arguments->scalarOutput[0] = handle;
+    
+    return ret;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSetReportState(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *report_buf = arguments->structureInputDescriptor;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    IOByteCount report_len = 0;
+    
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt32 type = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    in.value(&type);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Like 'send_inline', small reports need no mapping.
+    if (!report_buf) {
+        return m_hid_provider->methodSetReportState(handle, type, (unsigned char *)arguments->structureInput,
+                                                    arguments->structureInputSize);
+    }
+    
+    report_len = report_buf->getLength();
+    if (report_len > UINT16_MAX) return kIOReturnBadArgument;
+    
+    if (report_buf->prepare() != kIOReturnSuccess) return kIOReturnNoMemory;
+    
+    map = report_buf->map();
+    if (!map) goto nomem;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem;
+    
+    ret = m_hid_provider->methodSetReportState(handle, type, ptr, (UInt32)report_len);
+    
+    report_buf->complete();
+    map->release();
+    
+    return ret;
+    
+nomem:
+    if (map) map->release();
+    report_buf->complete();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSendKeys(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    IOMemoryDescriptor *events_buf = arguments->structureInputDescriptor;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    IOByteCount events_len = 0;
+    
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt32 sent = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Up to a thousand events come inline, more need the structure mapped.
+    if (!events_buf) {
+        ret = m_hid_provider->methodSendKeys(handle, (unsigned char *)arguments->structureInput,
+                                             arguments->structureInputSize, timestamp, &sent);
+        arguments->scalarOutput[0] = sent;
+        return ret;
+    }
+    
+    events_len = events_buf->getLength();
+    if (events_len > virthid_max_batch) return kIOReturnBadArgument;
+    
+    if (events_buf->prepare() != kIOReturnSuccess) return kIOReturnNoMemory;
+    
+    map = events_buf->map();
+    if (!map) goto nomem;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem;
+    
+    ret = m_hid_provider->methodSendKeys(handle, ptr, (UInt32)events_len, timestamp, &sent);
+    arguments->scalarOutput[0] = sent;
+    
+    events_buf->complete();
+    map->release();
+    
+    return ret;
+    
+nomem:
+    if (map) map->release();
+    events_buf->complete();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodSendEvents(IOExternalMethodArguments *arguments, uint64_t timestamp) {
+    IOMemoryDescriptor *events_buf = arguments->structureInputDescriptor;
+    IOMemoryMap *map = nullptr;
+    
+    unsigned char *ptr = nullptr;
+    IOByteCount events_len = 0;
+    
+    IOReturn ret = kIOReturnSuccess;
+    
+    UInt32 handle = 0;
+    UInt32 sent = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.value(&handle);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Up to five hundred events come inline, more need the structure mapped.
+    if (!events_buf) {
+        ret = m_hid_provider->methodSendEvents(handle, (unsigned char *)arguments->structureInput,
+                                             arguments->structureInputSize, timestamp, &sent);
+        arguments->scalarOutput[0] = sent;
+        return ret;
+    }
+    
+    events_len = events_buf->getLength();
+    if (events_len > virthid_max_batch) return kIOReturnBadArgument;
+    
+    if (events_buf->prepare() != kIOReturnSuccess) return kIOReturnNoMemory;
+    
+    map = events_buf->map();
+    if (!map) goto nomem;
+    
+    ptr = (unsigned char *)map->getAddress();
+    if (!ptr) goto nomem;
+    
+    ret = m_hid_provider->methodSendEvents(handle, ptr, (UInt32)events_len, timestamp, &sent);
+    arguments->scalarOutput[0] = sent;
+    
+    events_buf->complete();
+    map->release();
+    
+    return ret;
+    
+nomem:
+    if (map) map->release();
+    events_buf->complete();
+    return kIOReturnNoMemory;
+}
+
+IOReturn it_kotleni_virthid_userclient::methodList(IOExternalMethodArguments *arguments) {
+    IOMemoryDescriptor *user_buf = nullptr;
+    bool user_buf_complete = false;
+    
+    IOMemoryMap *map = nullptr;
+    
+    UInt16 needed = 0, items = 0;
+    
+    char *ptr = nullptr;
+    
+    UInt8 *name_ptr = nullptr;
+    UInt16 name_len = 0;
+    
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&name_ptr, &name_len, 0, UINT16_MAX);
+    if (!in.ok()) return kIOReturnBadArgument;
+    
+    // Without a buffer only the size needed is returned.
+    if (name_ptr && name_len) {
+        user_buf = IOMemoryDescriptor::withAddressRange((vm_address_t)name_ptr, name_len,
+                                                        kIODirectionIn, m_owner);
+        if (!user_buf) goto nomem;
+        if (user_buf->prepare() != kIOReturnSuccess) goto nomem;
+        user_buf_complete = true;
+        
+        map = user_buf->map();
+        if (!map) goto nomem;
+        
+        ptr = (char *)map->getAddress();
+        if (!ptr) goto nomem;
+    }
+    
+    m_hid_provider->methodList(ptr, ptr ? name_len : 0, &needed, &items);
+    
+    if (user_buf) {
+        user_buf->complete();
+        map->release();
+        user_buf->release();
+    }
+    
+    // A short buffer is not an error: MIG drops the outputs of failed calls,
+    // and 'needed' is what the client has to retry with.
+    arguments->scalarOutput[0] = needed;
+    arguments->scalarOutput[1] = items;
+    
+    return kIOReturnSuccess;
+    
+nomem:
+    if (map) map->release();
+    if (user_buf_complete) user_buf->complete();
     if (user_buf) user_buf->release();
     return kIOReturnNoMemory;
 }
@@ -377,8 +1558,16 @@ IOReturn it_kotleni_virthid_userclient::methodSubscribe(IOExternalMethodArgument
 
     bool ret = false;
 
-    UInt8 *name_ptr = (UInt8 *)arguments->scalarInput[0];
-    UInt8 name_len = (UInt8)arguments->scalarInput[1];
+    UInt8 *name_ptr = nullptr;
+    UInt8 name_len = 0;
+
+    UInt32 drop_policy = virthid_drop_newest;
+
+    // The drop policy is optional.
+    virthid_scalars in(arguments->scalarInput, arguments->scalarInputCount);
+    in.range(&name_ptr, &name_len, 1, UINT8_MAX);
+    if (in.remaining() > 0) in.value(&drop_policy, virthid_drop_oldest);
+    if (!in.ok() || in.remaining() > 0) return kIOReturnBadArgument;
 
     if (!arguments->asyncReference) return kIOReturnBadArgument;
 
@@ -394,10 +1583,11 @@ IOReturn it_kotleni_virthid_userclient::methodSubscribe(IOExternalMethodArgument
     ptr = (char *)map->getAddress();
     if (!ptr) goto nomem;
 
-    if (m_subscriber) IOFree(m_subscriber, sizeof(OSAsyncReference64));
-    m_subscriber = (OSAsyncReference64 *)IOMalloc(sizeof(OSAsyncReference64));
-    if (!m_subscriber) goto nomem;
+    IOLockLock(m_queue_lock);
     memcpy(m_subscriber, arguments->asyncReference, sizeof(OSAsyncReference64));
+    m_subscribed = true;
+    m_drop_policy = (virthid_drop_policy)drop_policy;
+    IOLockUnlock(m_queue_lock);
 
     ret = m_hid_provider->methodSubscribe(ptr, name_len, this);
 
@@ -418,27 +1608,161 @@ nomem:
     return kIOReturnNoMemory;
 }
 
-IOReturn it_kotleni_virthid_userclient::notifySubscriber(IOMemoryDescriptor *report) {
-    IOMemoryMap *reportMap;
-    virthid_report userReport;
-    io_user_reference_t *args = (io_user_reference_t *)&userReport;
+IOReturn it_kotleni_virthid_userclient::notifySubscriber(UInt8 type, const unsigned char *report, UInt32 report_len,
+                                                        UInt32 handle, uint64_t timestamp, UInt32 *depth,
+                                                        uint64_t *landed) {
+    virthid_queued_report entry;
+    bool queued = false;
+    bool ring_doorbell = false;
+    bool ring = false;
+    bool oversized = false;
+    
+    IOLockLock(m_queue_lock);
+    if (m_subscribed && m_output_ring) {
+        virthid_output_ring output_ring((virthid_output_ring_shared *)m_output_ring->getBytesNoCopy());
+        virthid_output_record record = {};
+        record.size = report_len;
+        record.handle = handle;
+        record.timestamp = timestamp;
+        record.type = type;
+        
+        ring = true;
+        queued = output_ring.push(&record, report, &ring_doorbell);
+        if (!queued) m_output_ring_drops++;
+        if (ring_doorbell) m_output_ring_wakeup = true;
+        
+        // The ring holds bytes, count its backlog in records of this size.
+        UInt32 record_size = virthid_output_ring::recordSize(report_len);
+        if (depth) *depth = (output_ring.pending() + record_size - 1) / record_size;
+    } else if (m_subscribed && report_len <= virthid_max_report) {
+        entry.report.size = report_len;
+        memcpy(entry.report.data, report, report_len);
+        entry.timestamp = timestamp;
+        entry.handle = handle;
+        
+        queued = m_queue.push(entry, m_drop_policy);
+    } else if (m_subscribed) {
+        // Only the output ring takes reports this large.
+        oversized = true;
+        m_oversized_drops++;
+    }
+    if (depth && !ring) *depth = m_queue.size();
+    IOLockUnlock(m_queue_lock);
+    
+    if (landed) *landed = ring && queued ? virthid_uptime_clock().now() : 0;
+    
+    if (!queued) {
+        LogD("Output report dropped.");
+        if (ring || oversized || m_drop_policy == virthid_drop_newest) return kIOReturnOverrun;
+    }
+    
+    // The ring is drained by the client on its own, one wakeup covers everything pushed until it parks.
+    if (!ring || ring_doorbell) m_delivery_source->interruptOccurred(nullptr, nullptr, 0);
+    
+    return queued ? kIOReturnSuccess : kIOReturnOverrun;
+}
+
+void it_kotleni_virthid_userclient::sDeliverReports(OSObject *owner, IOInterruptEventSource *sender, int count) {
+    it_kotleni_virthid_userclient *target = OSDynamicCast(it_kotleni_virthid_userclient, owner);
+    if (target) target->deliverReports();
+}
+
+void it_kotleni_virthid_userclient::deliverReports() {
+    OSAsyncReference64 subscriber;
+    virthid_queued_report entry;
+    io_user_reference_t *args = (io_user_reference_t *)&entry.report;
     uint32_t numArgs = sizeof(virthid_report) / sizeof(io_user_reference_t);
+    bool ring_wakeup = false;
+    uint64_t dropped = 0;
+    
+    IOLockLock(m_queue_lock);
+    memcpy(subscriber, m_subscriber, sizeof(OSAsyncReference64));
+    ring_wakeup = m_output_ring_wakeup;
+    m_output_ring_wakeup = false;
+    IOLockUnlock(m_queue_lock);
+    
+    // A notification without arguments means the output ring has reports.
+    if (ring_wakeup) sendAsyncResult64(subscriber, kIOReturnSuccess, nullptr, 0);
+    
+    for (;;) {
+        IOLockLock(m_queue_lock);
+        bool popped = m_queue.pop(&entry);
+        IOLockUnlock(m_queue_lock);
+        
+        if (!popped) break;
+        sendAsyncResult64(subscriber, kIOReturnSuccess, args, numArgs);
+        m_hid_provider->methodRecordLatency(entry.handle, virthid_latency_output,
+                                            virthid_uptime_clock().now() - entry.timestamp);
+    }
+    
+    IOLockLock(m_queue_lock);
+    dropped = m_queue.dropped() + m_output_ring_drops + m_oversized_drops;
+    IOLockUnlock(m_queue_lock);
+    
+    if (dropped != m_reported_drops) {
+        LogD("%llu output reports dropped so far.", dropped);
+        m_reported_drops = dropped;
+        setProperty("DroppedOutputReports", dropped, 64);
+    }
+}
 
-    // Max HID report size is 64 bytes. This shouldn't happen.
-    if (report->getLength() > virthid_max_report) return kIOReturnBadArgument;
+IOMemoryDescriptor *it_kotleni_virthid_userclient::copyOutputRing() {
+    IOLockLock(m_queue_lock);
+    
+    if (!m_output_ring) {
+        m_output_ring = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                              sizeof(virthid_output_ring_shared), page_size);
+        if (m_output_ring) {
+            virthid_output_ring((virthid_output_ring_shared *)m_output_ring->getBytesNoCopy()).reset();
+        } else {
+            LogD("Error while allocating the output ring.");
+        }
+    }
+    
+    if (m_output_ring) m_output_ring->retain();
+    
+    IOLockUnlock(m_queue_lock);
+    
+    return m_output_ring;
+}
 
-    report->prepare();
-    reportMap = report->map();
+void it_kotleni_virthid_userclient::notifyRegistryEvent(UInt32 type, UInt32 handle, const char *name, UInt8 name_len) {
+    bool was_empty = false;
 
-    userReport.size = reportMap->getSize();
-    memcpy(userReport.data, (void *)reportMap->getAddress(), userReport.size);
-    sendAsyncResult64(*m_subscriber, kIOReturnSuccess, args, numArgs);
+    IOLockLock(m_events_lock);
+    if (m_events_subscribed) m_events->push(type, handle, name, name_len, &was_empty);
+    IOLockUnlock(m_events_lock);
 
-    report->complete();
-    reportMap->release();
+    // Only the first pending event needs a notification, the client drains the rest.
+    if (was_empty) m_event_source->interruptOccurred(nullptr, nullptr, 0);
+}
 
-    // Sleep for a bit to not freak out clients.
-    IOSleep(1); // 1ms
+void it_kotleni_virthid_userclient::notifyWritable(UInt32 handle) {
+    OSAsyncReference64 subscriber;
+    io_user_reference_t args[1] = {handle};
+    bool subscribed = false;
+    
+    IOLockLock(m_queue_lock);
+    memcpy(subscriber, m_flow_subscriber, sizeof(OSAsyncReference64));
+    subscribed = m_flow_subscribed;
+    IOLockUnlock(m_queue_lock);
+    
+    if (subscribed) sendAsyncResult64(subscriber, kIOReturnSuccess, args, 1);
+}
 
-    return kIOReturnSuccess;
+void it_kotleni_virthid_userclient::sDeliverEvents(OSObject *owner, IOInterruptEventSource *sender, int count) {
+    it_kotleni_virthid_userclient *target = OSDynamicCast(it_kotleni_virthid_userclient, owner);
+    if (target) target->deliverEvents();
+}
+
+void it_kotleni_virthid_userclient::deliverEvents() {
+    OSAsyncReference64 subscriber;
+    io_user_reference_t pending = 0;
+
+    IOLockLock(m_events_lock);
+    memcpy(subscriber, m_event_subscriber, sizeof(OSAsyncReference64));
+    if (m_events) pending = m_events->pending();
+    IOLockUnlock(m_events_lock);
+
+    if (pending > 0) sendAsyncResult64(subscriber, kIOReturnSuccess, &pending, 1);
 }
@@ -10,8 +10,27 @@
 
 #include <IOKit/IOService.h>
 #include <IOKit/IOUserClient.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOInterruptEventSource.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOLocks.h>
 
 #include "VirtHID.hpp"
+#include "VirtHID_Types.hpp"
+#include "VirtHID_Queue.hpp"
+#include "VirtHID_Events.hpp"
+#include "VirtHID_OutputRing.hpp"
+#include "VirtHID_Flow.hpp"
+
+/**
+ *  An output report waiting for delivery, with the device it came from and
+ *  when 'setReport' received it.
+ */
+typedef struct virthid_queued_report {
+    virthid_report report;
+    uint64_t timestamp;
+    UInt32 handle;
+} virthid_queued_report;
 
 /**
  The goal of this User Client is to expose to user space the following selector.
@@ -22,6 +41,28 @@ enum {
     it_kotleni_virthid_method_send,
     it_kotleni_virthid_method_list,
     it_kotleni_virthid_method_subscribe,
+    it_kotleni_virthid_method_send_handle,
+    it_kotleni_virthid_method_doorbell,
+    it_kotleni_virthid_method_send_batch,
+    it_kotleni_virthid_method_send_inline,
+    it_kotleni_virthid_method_set_coalescing,
+    it_kotleni_virthid_method_schedule,
+    it_kotleni_virthid_method_set_capture,
+    it_kotleni_virthid_method_read_capture,
+    it_kotleni_virthid_method_replay,
+    it_kotleni_virthid_method_stats,
+    it_kotleni_virthid_method_latency,
+    it_kotleni_virthid_method_list_entries,
+    it_kotleni_virthid_method_subscribe_events,
+    it_kotleni_virthid_method_read_events,
+    it_kotleni_virthid_method_create_batch,
+    it_kotleni_virthid_method_clone,
+    it_kotleni_virthid_method_set_report_state,
+    it_kotleni_virthid_method_send_keys,
+    it_kotleni_virthid_method_send_events,
+    it_kotleni_virthid_method_set_polling,
+    it_kotleni_virthid_method_set_watermarks,
+    it_kotleni_virthid_method_subscribe_flow,
 
     it_kotleni_virthid_method_count  // Keep track of the length of this enum.
 };
@@ -35,24 +76,98 @@ public:
     
     virtual bool start(IOService *provider) override;
     virtual void stop(IOService *provider) override;
+    virtual void free(void) override;
     
     virtual IOReturn externalMethod(uint32_t selector,
                                     IOExternalMethodArguments *arguments,
                                     IOExternalMethodDispatch *dispatch,
                                     OSObject *target, void *reference) override;
 
-    virtual IOReturn notifySubscriber(IOMemoryDescriptor *report);
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options,
+                                         IOMemoryDescriptor **memory) override;
+
+    virtual IOReturn clientClose(void) override;
+
+    /**
+     *  Queue an output or feature report for the subscriber. Never blocks,
+     *  reports that do not fit in the queue are dropped according to the
+     *  drop policy chosen on subscription and counted.
+     *
+     *  Once the client has mapped its output ring, reports of any length
+     *  go there instead, and the client is only notified when it had
+     *  drained the ring. Until then, reports larger than 'virthid_max_report'
+     *  are dropped, whatever the drop policy, and counted with the others.
+     *
+     *  @param type       The 'IOHIDReportType' of the report.
+     *  @param report     The report bytes.
+     *  @param report_len Length of 'report'.
+     *  @param handle     Handle of the device the report is for.
+     *  @param timestamp  When the device received the report, in uptime nanoseconds.
+     *  @param depth      If not null, receives the number of queued reports. With
+     *                    an output ring, its backlog in records of this size.
+     *  @param landed     If not null, receives when the report landed in the output
+     *                    ring, or 0 if it did not. The client pops the ring on its own,
+     *                    so the device measures its output latency up to there.
+     *
+     *  @return kIOReturnOverrun if a report had to be dropped.
+     */
+    virtual IOReturn notifySubscriber(UInt8 type, const unsigned char *report, UInt32 report_len, UInt32 handle,
+                                      uint64_t timestamp, UInt32 *depth = nullptr, uint64_t *landed = nullptr);
+    
+    /**
+     *  Queue a registry event for the client. Never blocks, the client is
+     *  notified once when events become pending and then reads them in
+     *  batches; if too many pile up it gets an overflow marker instead.
+     *
+     *  @param type     A 'virthid_event_type'.
+     *  @param handle   Handle of the device.
+     *  @param name     Name of the device.
+     *  @param name_len Length of 'name'.
+     */
+    virtual void notifyRegistryEvent(UInt32 type, UInt32 handle, const char *name, UInt8 name_len);
+    
+    /**
+     *  Tell the client that a congested device it subscribed to with
+     *  'subscribe_flow' drained to its low watermark. Never blocks.
+     *
+     *  @param handle Handle of the device.
+     */
+    virtual void notifyWritable(UInt32 handle);
 
 protected:
     /**
      * The following methods unpack/handle the given arguments and
-     * call the related driver method.
+     * call the related driver method. Those sending input reports also
+     * get the time the call entered 'externalMethod', the start of the
+     * input latency.
      */
     virtual IOReturn methodCreate(IOExternalMethodArguments *arguments);
     virtual IOReturn methodDestroy(IOExternalMethodArguments *arguments);
-    virtual IOReturn methodSend(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSend(IOExternalMethodArguments *arguments, uint64_t timestamp);
     virtual IOReturn methodList(IOExternalMethodArguments *arguments);
     virtual IOReturn methodSubscribe(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSendHandle(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodDoorbell(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodSendBatch(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodSendInline(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodSetCoalescing(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSchedule(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSetCapture(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodReadCapture(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodReplay(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodStats(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodLatency(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodListEntries(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSubscribeEvents(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodReadEvents(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodCreateBatch(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodClone(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSetReportState(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSendKeys(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodSendEvents(IOExternalMethodArguments *arguments, uint64_t timestamp);
+    virtual IOReturn methodSetPolling(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSetWatermarks(IOExternalMethodArguments *arguments);
+    virtual IOReturn methodSubscribeFlow(IOExternalMethodArguments *arguments);
 
     /**
      *  The following static methods redirect the call to the 'target' instance.
@@ -72,6 +187,92 @@ protected:
     static IOReturn sMethodSubscribe(it_kotleni_virthid_userclient *target,
                                     void *reference,
                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSendHandle(it_kotleni_virthid_userclient *target,
+                                     void *reference,
+                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodDoorbell(it_kotleni_virthid_userclient *target,
+                                   void *reference,
+                                   IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSendBatch(it_kotleni_virthid_userclient *target,
+                                    void *reference,
+                                    IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSendInline(it_kotleni_virthid_userclient *target,
+                                     void *reference,
+                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSetCoalescing(it_kotleni_virthid_userclient *target,
+                                        void *reference,
+                                        IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSchedule(it_kotleni_virthid_userclient *target,
+                                   void *reference,
+                                   IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSetCapture(it_kotleni_virthid_userclient *target,
+                                     void *reference,
+                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodReadCapture(it_kotleni_virthid_userclient *target,
+                                      void *reference,
+                                      IOExternalMethodArguments *arguments);
+    static IOReturn sMethodReplay(it_kotleni_virthid_userclient *target,
+                                 void *reference,
+                                 IOExternalMethodArguments *arguments);
+    static IOReturn sMethodStats(it_kotleni_virthid_userclient *target,
+                                void *reference,
+                                IOExternalMethodArguments *arguments);
+    static IOReturn sMethodLatency(it_kotleni_virthid_userclient *target,
+                                  void *reference,
+                                  IOExternalMethodArguments *arguments);
+    static IOReturn sMethodListEntries(it_kotleni_virthid_userclient *target,
+                                      void *reference,
+                                      IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSubscribeEvents(it_kotleni_virthid_userclient *target,
+                                          void *reference,
+                                          IOExternalMethodArguments *arguments);
+    static IOReturn sMethodReadEvents(it_kotleni_virthid_userclient *target,
+                                     void *reference,
+                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodCreateBatch(it_kotleni_virthid_userclient *target,
+                                      void *reference,
+                                      IOExternalMethodArguments *arguments);
+    static IOReturn sMethodClone(it_kotleni_virthid_userclient *target,
+                                void *reference,
+                                IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSetReportState(it_kotleni_virthid_userclient *target,
+                                         void *reference,
+                                         IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSendKeys(it_kotleni_virthid_userclient *target,
+                                   void *reference,
+                                   IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSendEvents(it_kotleni_virthid_userclient *target,
+                                     void *reference,
+                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSetPolling(it_kotleni_virthid_userclient *target,
+                                     void *reference,
+                                     IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSetWatermarks(it_kotleni_virthid_userclient *target,
+                                        void *reference,
+                                        IOExternalMethodArguments *arguments);
+    static IOReturn sMethodSubscribeFlow(it_kotleni_virthid_userclient *target,
+                                        void *reference,
+                                        IOExternalMethodArguments *arguments);
+
+    /**
+     *  Deliver the queued output reports to the subscriber, on 'm_work_loop'.
+     */
+    virtual void deliverReports();
+    
+    static void sDeliverReports(OSObject *owner, IOInterruptEventSource *sender, int count);
+    
+    /**
+     *  Return the output ring, allocating it on first use. The caller
+     *  receives a reference.
+     */
+    virtual IOMemoryDescriptor *copyOutputRing();
+    
+    /**
+     *  Tell the client that registry events are pending, on 'm_work_loop'.
+     */
+    virtual void deliverEvents();
+    
+    static void sDeliverEvents(OSObject *owner, IOInterruptEventSource *sender, int count);
 
 private:
     /**
@@ -85,9 +286,51 @@ private:
     it_kotleni_virthid *m_hid_provider;
 
     /**
-     *  Userland subscriber.
+     *  Userland subscriber, valid once 'm_subscribed' is set.
+     *  Both are protected by 'm_queue_lock'.
+     */
+    OSAsyncReference64 m_subscriber;
+    bool m_subscribed = false;
+    virthid_drop_policy m_drop_policy = virthid_drop_newest;
+    
+    /**
+     *  Userland client told when a congested device becomes writable again,
+     *  valid once 'm_flow_subscribed' is set. Protected by 'm_queue_lock'.
+     */
+    OSAsyncReference64 m_flow_subscriber;
+    bool m_flow_subscribed = false;
+    
+    /**
+     *  Pending output reports, and the event source delivering them.
+     *  Producers and the consumer are serialized by 'm_queue_lock', which
+     *  also protects the count of reports too large for the queue.
+     */
+    virthid_queue<virthid_queued_report, virthid_subscriber_queue_size> m_queue;
+    IOLock *m_queue_lock = nullptr;
+    IOWorkLoop *m_work_loop = nullptr;
+    IOInterruptEventSource *m_delivery_source = nullptr;
+    uint64_t m_oversized_drops = 0;
+    uint64_t m_reported_drops = 0;
+    
+    /**
+     *  Output ring, once the client mapped it, and whether the client has to
+     *  be woken up for it. Both protected by 'm_queue_lock'. Reports dropped
+     *  because the ring was full are counted here as well, the shared count
+     *  is writable by the client.
+     */
+    IOBufferMemoryDescriptor *m_output_ring = nullptr;
+    bool m_output_ring_wakeup = false;
+    uint64_t m_output_ring_drops = 0;
+    
+    /**
+     *  Registry events, allocated on subscription, and the client to notify.
+     *  All protected by 'm_events_lock'.
      */
-    OSAsyncReference64 *m_subscriber = nullptr;
+    virthid_event_queue<> *m_events = nullptr;
+    OSAsyncReference64 m_event_subscriber;
+    bool m_events_subscribed = false;
+    IOLock *m_events_lock = nullptr;
+    IOInterruptEventSource *m_event_source = nullptr;
     
     /**
      *  Task owner.
@@ -0,0 +1,13 @@
+//
+//  IOBufferMemoryDescriptor.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iobuffer_memory_descriptor_h
+#define virthid_standin_iobuffer_memory_descriptor_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
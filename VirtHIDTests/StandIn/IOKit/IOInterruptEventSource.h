@@ -0,0 +1,13 @@
+//
+//  IOInterruptEventSource.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iointerrupt_event_source_h
+#define virthid_standin_iointerrupt_event_source_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
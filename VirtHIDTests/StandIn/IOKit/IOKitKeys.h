@@ -0,0 +1,13 @@
+//
+//  IOKitKeys.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iokit_keys_h
+#define virthid_standin_iokit_keys_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
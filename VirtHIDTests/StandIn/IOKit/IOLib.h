@@ -0,0 +1,13 @@
+//
+//  IOLib.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iolib_h
+#define virthid_standin_iolib_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
@@ -0,0 +1,13 @@
+//
+//  IOMemoryDescriptor.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iomemory_descriptor_h
+#define virthid_standin_iomemory_descriptor_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
@@ -0,0 +1,13 @@
+//
+//  IOService.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_ioservice_h
+#define virthid_standin_ioservice_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
@@ -0,0 +1,614 @@
+//
+//  IOStandIn.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_h
+#define virthid_standin_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/**
+ *  A user space stand-in for the parts of IOKit and libkern the driver uses,
+ *  so that it builds and runs on Linux. Types keep their IOKit names and
+ *  behave like the kernel ones as far as the driver can tell: objects are
+ *  reference counted, work loops run their event sources on a thread of
+ *  their own, and 'externalMethod' checks arguments against the dispatch
+ *  table. "User" memory is memory of the test process.
+ *
+ *  The 'standin_' functions at the end are not part of IOKit, tests use
+ *  them to observe what the driver does.
+ */
+
+typedef int32_t kern_return_t;
+typedef kern_return_t IOReturn;
+typedef uint32_t IOOptionBits;
+typedef uint8_t UInt8;
+typedef uint16_t UInt16;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+typedef int32_t SInt32;
+typedef int64_t SInt64;
+typedef uint64_t AbsoluteTime;
+typedef uint64_t io_user_reference_t;
+typedef uintptr_t vm_address_t;
+typedef uint64_t mach_vm_address_t;
+typedef uint64_t mach_vm_size_t;
+typedef uint64_t IOByteCount;
+typedef uintptr_t IOVirtualAddress;
+typedef uint32_t IODirection;
+
+typedef struct standin_task *task_t;
+extern task_t kernel_task;
+
+#define iokit_common_err(return) ((IOReturn)(0xe0000000 | (return)))
+
+enum {
+    kIOReturnSuccess = 0,
+    kIOReturnError = iokit_common_err(0x2bc),
+    kIOReturnNoMemory = iokit_common_err(0x2bd),
+    kIOReturnNoResources = iokit_common_err(0x2be),
+    kIOReturnBadArgument = iokit_common_err(0x2c2),
+    kIOReturnExclusiveAccess = iokit_common_err(0x2c5),
+    kIOReturnUnsupported = iokit_common_err(0x2c7),
+    kIOReturnVMError = iokit_common_err(0x2c8),
+    kIOReturnBusy = iokit_common_err(0x2d5),
+    kIOReturnTimeout = iokit_common_err(0x2d6),
+    kIOReturnNotReady = iokit_common_err(0x2d8),
+    kIOReturnNotAttached = iokit_common_err(0x2d9),
+    kIOReturnNoSpace = iokit_common_err(0x2db),
+    kIOReturnMessageTooLarge = iokit_common_err(0x2e1),
+    kIOReturnNotPermitted = iokit_common_err(0x2e2),
+    kIOReturnUnderrun = iokit_common_err(0x2e7),
+    kIOReturnOverrun = iokit_common_err(0x2e8),
+    kIOReturnDeviceError = iokit_common_err(0x2e9),
+    kIOReturnNoCompletion = iokit_common_err(0x2ea),
+    kIOReturnAborted = iokit_common_err(0x2eb),
+    kIOReturnNotFound = iokit_common_err(0x2f0),
+    kIOReturnInvalid = iokit_common_err(0x1),
+};
+
+enum {
+    kIODirectionNone = 0x0,
+    kIODirectionIn = 0x1,
+    kIODirectionOut = 0x2,
+    kIODirectionInOut = kIODirectionIn | kIODirectionOut,
+};
+
+enum {
+    kIOMemoryKernelUserShared = 0x00000200,
+};
+
+enum {
+    kIOMapAnywhere = 0x00000001,
+    kIOMapDefaultCache = 0x00000000,
+    kIOMapReadOnly = 0x00001000,
+};
+
+const uint32_t page_size = 4096;
+
+/*
+ *  IOLib
+ */
+
+void *IOMalloc(size_t size);
+void *IOMallocZero(size_t size);
+void IOFree(void *address, size_t size);
+void IOLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void IOSleep(unsigned milliseconds);
+
+void clock_get_uptime(uint64_t *result);
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result);
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result);
+
+/*
+ *  IOLocks
+ */
+
+typedef struct IOLock IOLock;
+IOLock *IOLockAlloc(void);
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+bool IOLockTryLock(IOLock *lock);
+
+typedef struct IORWLock IORWLock;
+IORWLock *IORWLockAlloc(void);
+void IORWLockFree(IORWLock *lock);
+void IORWLockRead(IORWLock *lock);
+void IORWLockWrite(IORWLock *lock);
+void IORWLockUnlock(IORWLock *lock);
+
+/*
+ *  libkern
+ */
+
+#define OSDeclareDefaultStructors(className) \
+    public: \
+        className(); \
+    protected: \
+        virtual ~className(); \
+    private:
+
+#define OSDefineMetaClassAndStructors(className, superclassName) \
+    className::className() {} \
+    className::~className() {}
+
+#define OSTypeAlloc(type) (new type)
+#define OSDynamicCast(type, instance) (dynamic_cast<type *>(instance))
+
+class OSMetaClassBase {
+public:
+    virtual ~OSMetaClassBase() {}
+};
+
+class OSObject : public OSMetaClassBase {
+public:
+    OSObject();
+
+    virtual void retain() const;
+    virtual void release() const;
+    int getRetainCount() const;
+
+    virtual bool init();
+    virtual void free();
+
+protected:
+    virtual ~OSObject();
+
+private:
+    mutable int m_retain_count;
+};
+
+class OSString : public OSObject {
+public:
+    static OSString *withCString(const char *cString);
+    static OSString *withCStringNoCopy(const char *cString);
+
+    const char *getCStringNoCopy() const;
+    unsigned int getLength() const;
+    bool isEqualTo(const char *cString) const;
+    bool isEqualTo(const OSString *string) const;
+
+    virtual void free() override;
+
+private:
+    char *m_string = nullptr;
+    unsigned int m_length = 0;
+};
+
+class OSNumber : public OSObject {
+public:
+    static OSNumber *withNumber(unsigned long long value, unsigned int numberOfBits);
+
+    uint32_t unsigned32BitValue() const;
+    uint64_t unsigned64BitValue() const;
+
+private:
+    uint64_t m_value = 0;
+};
+
+class OSCollection : public OSObject {};
+
+class OSDictionary : public OSCollection {
+public:
+    static OSDictionary *withCapacity(unsigned int capacity);
+
+    bool setObject(const char *key, const OSMetaClassBase *object);
+    OSObject *getObject(const char *key) const;
+    void removeObject(const char *key);
+    unsigned int getCount() const;
+
+    virtual void free() override;
+
+private:
+    struct entry {
+        char *key;
+        OSObject *object;
+    };
+
+    entry *m_entries = nullptr;
+    unsigned int m_count = 0;
+    unsigned int m_capacity = 0;
+};
+
+/*
+ *  Memory descriptors
+ */
+
+class IOMemoryDescriptor;
+
+class IOMemoryMap : public OSObject {
+public:
+    IOVirtualAddress getAddress();
+    IOByteCount getLength();
+    IOByteCount getSize();
+
+    virtual void free() override;
+
+private:
+    friend class IOMemoryDescriptor;
+
+    IOMemoryDescriptor *m_memory = nullptr;
+};
+
+class IOMemoryDescriptor : public OSObject {
+public:
+    static IOMemoryDescriptor *withAddressRange(mach_vm_address_t address, mach_vm_size_t length,
+                                                IOOptionBits options, task_t task);
+
+    virtual IOReturn prepare(IODirection forDirection = kIODirectionNone);
+    virtual IOReturn complete(IODirection forDirection = kIODirectionNone);
+
+    IOMemoryMap *map(IOOptionBits options = 0);
+    IOMemoryMap *createMappingInTask(task_t intoTask, mach_vm_address_t atAddress, IOOptionBits options,
+                                     mach_vm_size_t offset = 0, mach_vm_size_t length = 0);
+
+    IOByteCount getLength() const;
+    IOByteCount readBytes(IOByteCount offset, void *bytes, IOByteCount withLength);
+    IOByteCount writeBytes(IOByteCount offset, const void *bytes, IOByteCount withLength);
+
+    virtual void free() override;
+
+protected:
+    friend class IOMemoryMap;
+
+    uint8_t *m_address = nullptr;
+    IOByteCount m_length = 0;
+    IOOptionBits m_options = 0;
+    int m_prepared = 0;
+};
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor {
+public:
+    static IOBufferMemoryDescriptor *withOptions(IOOptionBits options, size_t capacity, size_t alignment = 1);
+    static IOBufferMemoryDescriptor *inTaskWithOptions(task_t inTask, IOOptionBits options,
+                                                       mach_vm_size_t capacity, mach_vm_size_t alignment = 1);
+
+    void *getBytesNoCopy();
+    void setLength(size_t length);
+    size_t getCapacity() const;
+
+    virtual void free() override;
+
+private:
+    size_t m_capacity = 0;
+};
+
+/*
+ *  Registry and services
+ */
+
+class IOWorkLoop;
+
+class IORegistryEntry : public OSObject {
+public:
+    using OSObject::init;
+    virtual bool init(OSDictionary *dictionary);
+    virtual void free() override;
+
+    bool setProperty(const char *aKey, const char *aString);
+    bool setProperty(const char *aKey, OSObject *anObject);
+    bool setProperty(const char *aKey, unsigned long long aValue, unsigned int aNumberOfBits);
+    bool setProperty(const char *aKey, bool aBoolean);
+    void removeProperty(const char *aKey);
+
+    /**
+     *  Return a property with an increased reference count, or null.
+     *  IOKit's 'copyProperty'.
+     */
+    OSObject *copyProperty(const char *aKey) const;
+
+private:
+    OSDictionary *m_properties = nullptr;
+    IOLock *m_properties_lock = nullptr;
+};
+
+class IOService : public IORegistryEntry {
+public:
+    virtual bool start(IOService *provider);
+    virtual void stop(IOService *provider);
+
+    virtual bool attach(IOService *provider);
+    virtual void detach(IOService *provider);
+
+    /**
+     *  Stop and detach right away; IOKit does the same asynchronously.
+     */
+    virtual bool terminate(IOOptionBits options = 0);
+
+    virtual void registerService(IOOptionBits options = 0);
+
+    /**
+     *  The provider's work loop, as in IOKit.
+     */
+    virtual IOWorkLoop *getWorkLoop() const;
+
+    IOService *getProvider() const;
+
+private:
+    IOService *m_provider = nullptr;
+    bool m_started = false;
+    bool m_terminated = false;
+};
+
+/*
+ *  Work loops and event sources
+ */
+
+class IOEventSource : public OSObject {
+public:
+    virtual void enable();
+    virtual void disable();
+    bool isEnabled() const;
+
+protected:
+    friend class IOWorkLoop;
+
+    /**
+     *  Run pending work, on the work loop with its gate held.
+     */
+    virtual void checkForWork() = 0;
+
+    /**
+     *  Uptime in nanoseconds at which 'checkForWork' has to run, or UINT64_MAX.
+     */
+    virtual uint64_t nextDeadline() const;
+
+    /**
+     *  Ask the work loop to call 'checkForWork'.
+     */
+    void signalWorkAvailable();
+
+    bool initWithOwner(OSObject *owner);
+
+    OSObject *m_owner = nullptr;
+    IOWorkLoop *m_work_loop = nullptr;
+    bool m_enabled = true;
+};
+
+class IOWorkLoop : public OSObject {
+public:
+    static IOWorkLoop *workLoop();
+
+    virtual IOReturn addEventSource(IOEventSource *newEvent);
+    virtual IOReturn removeEventSource(IOEventSource *toRemove);
+
+    bool onThread() const;
+
+    virtual void free() override;
+
+private:
+    friend class IOEventSource;
+    friend void standin_drain(IOWorkLoop *workLoop);
+    friend void standin_limit_sources(IOWorkLoop *workLoop, unsigned int count);
+    friend unsigned int standin_source_count(IOWorkLoop *workLoop);
+
+    static void *threadMain(void *context);
+    void run();
+    void signalWorkAvailable();
+
+    // Every device adds a handful of sources to the driver's loop, leave room for as many as the registry takes.
+    enum { max_sources = 8192 };
+
+    pthread_t m_thread;
+    pthread_mutex_t m_gate;
+    pthread_mutex_t m_wake_lock;
+    pthread_cond_t m_wake;
+    pthread_cond_t m_idle_changed;
+
+    IOEventSource *m_sources[max_sources];
+    unsigned int m_source_count = 0;
+    unsigned int m_source_limit = max_sources;
+
+    bool m_work_pending = false;
+    bool m_idle = false;
+    bool m_exit = false;
+};
+
+class IOInterruptEventSource : public IOEventSource {
+public:
+    typedef void (*Action)(OSObject *owner, IOInterruptEventSource *sender, int count);
+
+    static IOInterruptEventSource *interruptEventSource(OSObject *owner, Action action,
+                                                        IOService *provider = nullptr, int intIndex = 0);
+
+    void interruptOccurred(void *nub, IOService *provider, int source);
+
+protected:
+    virtual void checkForWork() override;
+
+private:
+    Action m_action = nullptr;
+    uint32_t m_produced = 0;
+    uint32_t m_consumed = 0;
+};
+
+class IOTimerEventSource : public IOEventSource {
+public:
+    typedef void (*Action)(OSObject *owner, IOTimerEventSource *sender);
+
+    static IOTimerEventSource *timerEventSource(OSObject *owner, Action action = nullptr);
+
+    IOReturn setTimeoutMS(UInt32 ms);
+    IOReturn setTimeoutUS(UInt32 us);
+    IOReturn wakeAtTime(AbsoluteTime abstime);
+    void cancelTimeout();
+
+protected:
+    virtual void checkForWork() override;
+    virtual uint64_t nextDeadline() const override;
+
+private:
+    Action m_action = nullptr;
+    uint64_t m_deadline = UINT64_MAX;
+};
+
+/*
+ *  HID
+ */
+
+enum IOHIDReportType {
+    kIOHIDReportTypeInput = 0,
+    kIOHIDReportTypeOutput,
+    kIOHIDReportTypeFeature,
+    kIOHIDReportTypeCount
+};
+
+class IOHIDDevice : public IOService {
+public:
+    /**
+     *  Reads the report descriptor, like IOHIDDevice does when it starts.
+     */
+    virtual bool start(IOService *provider) override;
+
+    virtual OSString *newProductString() const;
+    virtual OSString *newSerialNumberString() const;
+    virtual OSNumber *newVendorIDNumber() const;
+    virtual OSNumber *newProductIDNumber() const;
+    virtual IOReturn newReportDescriptor(IOMemoryDescriptor **descriptor) const = 0;
+
+    virtual IOReturn setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options = 0);
+    virtual IOReturn getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options = 0);
+
+    /**
+     *  Hands the report to the handler set with 'standin_set_report_handler'.
+     */
+    IOReturn handleReport(IOMemoryDescriptor *report, IOHIDReportType reportType = kIOHIDReportTypeInput,
+                          IOOptionBits options = 0);
+};
+
+/*
+ *  User clients
+ */
+
+enum {
+    kMaxAsyncArgs = 16,
+    kOSAsyncRef64Count = 8,
+    kIOUCVariableStructureSize = 0xffffffff,
+};
+
+typedef io_user_reference_t OSAsyncReference64[kOSAsyncRef64Count];
+
+struct IOExternalMethodArguments {
+    uint32_t version;
+    uint32_t selector;
+
+    void *asyncWakePort;
+    io_user_reference_t *asyncReference;
+    uint32_t asyncReferenceCount;
+
+    const uint64_t *scalarInput;
+    uint32_t scalarInputCount;
+
+    const void *structureInput;
+    uint32_t structureInputSize;
+
+    IOMemoryDescriptor *structureInputDescriptor;
+
+    uint64_t *scalarOutput;
+    uint32_t scalarOutputCount;
+
+    void *structureOutput;
+    uint32_t structureOutputSize;
+
+    IOMemoryDescriptor *structureOutputDescriptor;
+    uint32_t structureOutputDescriptorSize;
+};
+
+typedef IOReturn (*IOExternalMethodAction)(OSObject *target, void *reference, IOExternalMethodArguments *arguments);
+
+struct IOExternalMethodDispatch {
+    IOExternalMethodAction function;
+    uint32_t checkScalarInputCount;
+    uint32_t checkStructureInputSize;
+    uint32_t checkScalarOutputCount;
+    uint32_t checkStructureOutputSize;
+};
+
+class IOUserClient : public IOService {
+public:
+    virtual bool initWithTask(task_t owningTask, void *securityToken, UInt32 type, OSDictionary *properties);
+
+    /**
+     *  Checks the argument counts against 'dispatch' and calls it, as IOKit does.
+     */
+    virtual IOReturn externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
+                                    IOExternalMethodDispatch *dispatch = nullptr, OSObject *target = nullptr,
+                                    void *reference = nullptr);
+
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory);
+    virtual IOReturn clientClose(void);
+
+    /**
+     *  Hands the result to the handler set with 'standin_set_async_handler'.
+     */
+    static IOReturn sendAsyncResult64(OSAsyncReference64 reference, IOReturn result,
+                                      io_user_reference_t args[], UInt32 numArgs);
+};
+
+/*
+ *  Test hooks, not part of IOKit.
+ */
+
+/**
+ *  Bytes currently allocated with 'IOMalloc', and objects currently alive.
+ *  'IOFree' aborts if the size does not match the allocation.
+ */
+int64_t standin_allocated_bytes();
+int64_t standin_live_objects();
+
+/**
+ *  Allocations made so far, with 'IOMalloc', of buffer memory and of objects.
+ */
+uint64_t standin_allocations();
+
+/**
+ *  A task standing for the test process, to pass to 'initWithTask'.
+ */
+extern task_t standin_user_task;
+
+/**
+ *  Receives every 'sendAsyncResult64', on the thread calling it.
+ */
+typedef void (*standin_async_handler)(void *context, const io_user_reference_t *reference, IOReturn result,
+                                      const io_user_reference_t *args, UInt32 count);
+void standin_set_async_handler(standin_async_handler handler, void *context);
+
+/**
+ *  Receives every report passed to 'IOHIDDevice::handleReport', on the
+ *  thread calling it. Returning an error fails 'handleReport'.
+ */
+typedef IOReturn (*standin_report_handler)(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                           const uint8_t *report, uint32_t report_len);
+void standin_set_report_handler(standin_report_handler handler, void *context);
+
+/**
+ *  Return the child attached to 'provider' at 'index' with an increased
+ *  reference count, or null. Children are in the order they attached.
+ */
+IOService *standin_copy_child(IOService *provider, uint32_t index);
+
+/**
+ *  Wait until a work loop ran everything signalled so far and only waits for
+ *  timers. Must not be called from the work loop.
+ */
+void standin_drain(IOWorkLoop *workLoop);
+
+/**
+ *  Let a work loop take only 'count' more event sources, 'addEventSource'
+ *  failing past that. UINT_MAX lifts the limit.
+ */
+void standin_limit_sources(IOWorkLoop *workLoop, unsigned int count);
+
+/**
+ *  Return the number of event sources on a work loop.
+ */
+unsigned int standin_source_count(IOWorkLoop *workLoop);
+
+#endif
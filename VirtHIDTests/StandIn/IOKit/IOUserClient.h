@@ -0,0 +1,13 @@
+//
+//  IOUserClient.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iouser_client_h
+#define virthid_standin_iouser_client_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
@@ -0,0 +1,13 @@
+//
+//  IOWorkLoop.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iowork_loop_h
+#define virthid_standin_iowork_loop_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
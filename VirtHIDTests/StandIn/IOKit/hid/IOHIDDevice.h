@@ -0,0 +1,13 @@
+//
+//  IOHIDDevice.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_iohid_device_h
+#define virthid_standin_iohid_device_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
@@ -0,0 +1,1077 @@
+//
+//  IOStandIn.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include <IOKit/IOStandIn.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static struct standin_task {} s_kernel_task, s_user_task;
+task_t kernel_task = &s_kernel_task;
+task_t standin_user_task = &s_user_task;
+
+static int64_t s_allocated_bytes = 0;
+static int64_t s_live_objects = 0;
+static uint64_t s_allocations = 0;
+
+static standin_async_handler s_async_handler = nullptr;
+static void *s_async_context = nullptr;
+static standin_report_handler s_report_handler = nullptr;
+static void *s_report_context = nullptr;
+
+/**
+ *  Attachments in the order they were made, the stand-in's registry plane.
+ */
+struct standin_attachment {
+    IOService *provider;
+    IOService *child;
+};
+
+static pthread_mutex_t s_attachments_lock = PTHREAD_MUTEX_INITIALIZER;
+static standin_attachment s_attachments[4096];
+static uint32_t s_attachment_count = 0;
+
+static void standin_fatal(const char *message) {
+    fprintf(stderr, "IOStandIn: %s\n", message);
+    abort();
+}
+
+/*
+ *  IOLib
+ */
+
+/**
+ *  Every allocation is prefixed with its size, so that 'IOFree' can check it.
+ */
+struct standin_allocation {
+    size_t size;
+    uint64_t reserved;
+};
+
+void *IOMalloc(size_t size) {
+    standin_allocation *allocation = (standin_allocation *)malloc(sizeof(standin_allocation) + size);
+    if (!allocation) return nullptr;
+
+    allocation->size = size;
+    __atomic_add_fetch(&s_allocated_bytes, (int64_t)size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s_allocations, 1, __ATOMIC_RELAXED);
+
+    // Like the kernel, make no promise about the contents.
+    memset(allocation + 1, 0xa5, size);
+    return allocation + 1;
+}
+
+void *IOMallocZero(size_t size) {
+    void *address = IOMalloc(size);
+    if (address) memset(address, 0, size);
+    return address;
+}
+
+void IOFree(void *address, size_t size) {
+    if (!address) return;
+
+    standin_allocation *allocation = (standin_allocation *)address - 1;
+    if (allocation->size != size) standin_fatal("IOFree size does not match the allocation.");
+
+    __atomic_sub_fetch(&s_allocated_bytes, (int64_t)size, __ATOMIC_RELAXED);
+    free(allocation);
+}
+
+void IOLog(const char *format, ...) {
+    if (!getenv("VIRTHID_LOG")) return;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void IOSleep(unsigned milliseconds) {
+    struct timespec duration = {(time_t)(milliseconds / 1000), (long)(milliseconds % 1000) * 1000000};
+    while (nanosleep(&duration, &duration) != 0 && errno == EINTR) {}
+}
+
+/**
+ *  Absolute time is in nanoseconds here, the conversions are identities.
+ */
+void clock_get_uptime(uint64_t *result) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *result = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+void absolutetime_to_nanoseconds(uint64_t abstime, uint64_t *result) {
+    *result = abstime;
+}
+
+void nanoseconds_to_absolutetime(uint64_t nanoseconds, uint64_t *result) {
+    *result = nanoseconds;
+}
+
+static uint64_t standin_now() {
+    uint64_t now = 0;
+    clock_get_uptime(&now);
+    return now;
+}
+
+/*
+ *  IOLocks
+ */
+
+struct IOLock {
+    pthread_mutex_t mutex;
+};
+
+IOLock *IOLockAlloc(void) {
+    IOLock *lock = (IOLock *)IOMalloc(sizeof(IOLock));
+    if (lock) pthread_mutex_init(&lock->mutex, nullptr);
+    return lock;
+}
+
+void IOLockFree(IOLock *lock) {
+    pthread_mutex_destroy(&lock->mutex);
+    IOFree(lock, sizeof(IOLock));
+}
+
+void IOLockLock(IOLock *lock) {
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void IOLockUnlock(IOLock *lock) {
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+bool IOLockTryLock(IOLock *lock) {
+    return pthread_mutex_trylock(&lock->mutex) == 0;
+}
+
+struct IORWLock {
+    pthread_rwlock_t rwlock;
+};
+
+IORWLock *IORWLockAlloc(void) {
+    IORWLock *lock = (IORWLock *)IOMalloc(sizeof(IORWLock));
+    if (lock) pthread_rwlock_init(&lock->rwlock, nullptr);
+    return lock;
+}
+
+void IORWLockFree(IORWLock *lock) {
+    pthread_rwlock_destroy(&lock->rwlock);
+    IOFree(lock, sizeof(IORWLock));
+}
+
+void IORWLockRead(IORWLock *lock) {
+    pthread_rwlock_rdlock(&lock->rwlock);
+}
+
+void IORWLockWrite(IORWLock *lock) {
+    pthread_rwlock_wrlock(&lock->rwlock);
+}
+
+void IORWLockUnlock(IORWLock *lock) {
+    pthread_rwlock_unlock(&lock->rwlock);
+}
+
+/*
+ *  OSObject
+ */
+
+OSObject::OSObject() : m_retain_count(1) {
+    __atomic_add_fetch(&s_live_objects, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s_allocations, 1, __ATOMIC_RELAXED);
+}
+
+OSObject::~OSObject() {
+    __atomic_sub_fetch(&s_live_objects, 1, __ATOMIC_RELAXED);
+}
+
+void OSObject::retain() const {
+    if (__atomic_fetch_add(&m_retain_count, 1, __ATOMIC_RELAXED) <= 0) standin_fatal("Retaining a freed object.");
+}
+
+void OSObject::release() const {
+    int count = __atomic_sub_fetch(&m_retain_count, 1, __ATOMIC_ACQ_REL);
+    if (count < 0) standin_fatal("Over-released object.");
+    if (count == 0) const_cast<OSObject *>(this)->free();
+}
+
+int OSObject::getRetainCount() const {
+    return __atomic_load_n(&m_retain_count, __ATOMIC_RELAXED);
+}
+
+bool OSObject::init() {
+    return true;
+}
+
+void OSObject::free() {
+    delete this;
+}
+
+/*
+ *  OSString
+ */
+
+OSString *OSString::withCString(const char *cString) {
+    OSString *string = new OSString;
+    string->m_length = (unsigned int)strlen(cString);
+    string->m_string = (char *)IOMalloc(string->m_length + 1);
+    if (!string->m_string) {
+        string->release();
+        return nullptr;
+    }
+    memcpy(string->m_string, cString, string->m_length + 1);
+    return string;
+}
+
+OSString *OSString::withCStringNoCopy(const char *cString) {
+    return withCString(cString);
+}
+
+const char *OSString::getCStringNoCopy() const {
+    return m_string;
+}
+
+unsigned int OSString::getLength() const {
+    return m_length;
+}
+
+bool OSString::isEqualTo(const char *cString) const {
+    return strcmp(m_string, cString) == 0;
+}
+
+bool OSString::isEqualTo(const OSString *string) const {
+    return string && string->m_length == m_length && memcmp(string->m_string, m_string, m_length) == 0;
+}
+
+void OSString::free() {
+    if (m_string) IOFree(m_string, m_length + 1);
+    OSObject::free();
+}
+
+/*
+ *  OSNumber
+ */
+
+OSNumber *OSNumber::withNumber(unsigned long long value, unsigned int numberOfBits) {
+    OSNumber *number = new OSNumber;
+    number->m_value = numberOfBits >= 64 ? value : value & ((1ull << numberOfBits) - 1);
+    return number;
+}
+
+uint32_t OSNumber::unsigned32BitValue() const {
+    return (uint32_t)m_value;
+}
+
+uint64_t OSNumber::unsigned64BitValue() const {
+    return m_value;
+}
+
+/*
+ *  OSDictionary
+ */
+
+OSDictionary *OSDictionary::withCapacity(unsigned int capacity) {
+    OSDictionary *dictionary = new OSDictionary;
+    if (capacity == 0) capacity = 1;
+
+    dictionary->m_entries = (entry *)IOMalloc(capacity * sizeof(entry));
+    if (!dictionary->m_entries) {
+        dictionary->release();
+        return nullptr;
+    }
+    dictionary->m_capacity = capacity;
+    return dictionary;
+}
+
+bool OSDictionary::setObject(const char *key, const OSMetaClassBase *object) {
+    OSObject *value = const_cast<OSObject *>(dynamic_cast<const OSObject *>(object));
+    if (!key || !value) return false;
+
+    value->retain();
+    for (unsigned int i = 0; i < m_count; i++) {
+        if (strcmp(m_entries[i].key, key) == 0) {
+            m_entries[i].object->release();
+            m_entries[i].object = value;
+            return true;
+        }
+    }
+
+    // Grows like an OSDictionary does, by reallocating.
+    if (m_count == m_capacity) {
+        entry *entries = (entry *)IOMalloc(2 * m_capacity * sizeof(entry));
+        if (!entries) {
+            value->release();
+            return false;
+        }
+        memcpy(entries, m_entries, m_count * sizeof(entry));
+        IOFree(m_entries, m_capacity * sizeof(entry));
+        m_entries = entries;
+        m_capacity *= 2;
+    }
+
+    size_t key_len = strlen(key) + 1;
+    m_entries[m_count].key = (char *)IOMalloc(key_len);
+    if (!m_entries[m_count].key) {
+        value->release();
+        return false;
+    }
+    memcpy(m_entries[m_count].key, key, key_len);
+    m_entries[m_count].object = value;
+    m_count++;
+
+    return true;
+}
+
+OSObject *OSDictionary::getObject(const char *key) const {
+    for (unsigned int i = 0; i < m_count; i++) {
+        if (strcmp(m_entries[i].key, key) == 0) return m_entries[i].object;
+    }
+    return nullptr;
+}
+
+void OSDictionary::removeObject(const char *key) {
+    for (unsigned int i = 0; i < m_count; i++) {
+        if (strcmp(m_entries[i].key, key) == 0) {
+            IOFree(m_entries[i].key, strlen(m_entries[i].key) + 1);
+            m_entries[i].object->release();
+            m_entries[i] = m_entries[--m_count];
+            return;
+        }
+    }
+}
+
+unsigned int OSDictionary::getCount() const {
+    return m_count;
+}
+
+void OSDictionary::free() {
+    for (unsigned int i = 0; i < m_count; i++) {
+        IOFree(m_entries[i].key, strlen(m_entries[i].key) + 1);
+        m_entries[i].object->release();
+    }
+    if (m_entries) IOFree(m_entries, m_capacity * sizeof(entry));
+    OSCollection::free();
+}
+
+/*
+ *  Memory descriptors
+ */
+
+IOVirtualAddress IOMemoryMap::getAddress() {
+    return (IOVirtualAddress)m_memory->m_address;
+}
+
+IOByteCount IOMemoryMap::getLength() {
+    return m_memory->m_length;
+}
+
+IOByteCount IOMemoryMap::getSize() {
+    return m_memory->m_length;
+}
+
+void IOMemoryMap::free() {
+    if (m_memory) m_memory->release();
+    OSObject::free();
+}
+
+IOMemoryDescriptor *IOMemoryDescriptor::withAddressRange(mach_vm_address_t address, mach_vm_size_t length,
+                                                         IOOptionBits options, task_t task) {
+    if (!task) return nullptr;
+
+    IOMemoryDescriptor *memory = new IOMemoryDescriptor;
+    memory->m_address = (uint8_t *)(uintptr_t)address;
+    memory->m_length = length;
+    memory->m_options = options;
+    return memory;
+}
+
+IOReturn IOMemoryDescriptor::prepare(IODirection forDirection) {
+    // The kernel would fault on an unmapped range here.
+    if (!m_address && m_length > 0) return kIOReturnVMError;
+
+    m_prepared++;
+    return kIOReturnSuccess;
+}
+
+IOReturn IOMemoryDescriptor::complete(IODirection forDirection) {
+    if (m_prepared == 0) standin_fatal("IOMemoryDescriptor completed more often than prepared.");
+
+    m_prepared--;
+    return kIOReturnSuccess;
+}
+
+IOMemoryMap *IOMemoryDescriptor::map(IOOptionBits options) {
+    return createMappingInTask(kernel_task, 0, options | kIOMapAnywhere);
+}
+
+IOMemoryMap *IOMemoryDescriptor::createMappingInTask(task_t intoTask, mach_vm_address_t atAddress,
+                                                     IOOptionBits options, mach_vm_size_t offset,
+                                                     mach_vm_size_t length) {
+    if (!m_address) return nullptr;
+
+    IOMemoryMap *map = new IOMemoryMap;
+    retain();
+    map->m_memory = this;
+    return map;
+}
+
+IOByteCount IOMemoryDescriptor::getLength() const {
+    return m_length;
+}
+
+IOByteCount IOMemoryDescriptor::readBytes(IOByteCount offset, void *bytes, IOByteCount withLength) {
+    if (offset >= m_length) return 0;
+    if (withLength > m_length - offset) withLength = m_length - offset;
+
+    memcpy(bytes, m_address + offset, withLength);
+    return withLength;
+}
+
+IOByteCount IOMemoryDescriptor::writeBytes(IOByteCount offset, const void *bytes, IOByteCount withLength) {
+    if (offset >= m_length) return 0;
+    if (withLength > m_length - offset) withLength = m_length - offset;
+
+    memcpy(m_address + offset, bytes, withLength);
+    return withLength;
+}
+
+void IOMemoryDescriptor::free() {
+    if (m_prepared != 0) standin_fatal("IOMemoryDescriptor freed while prepared.");
+    OSObject::free();
+}
+
+IOBufferMemoryDescriptor *IOBufferMemoryDescriptor::withOptions(IOOptionBits options, size_t capacity,
+                                                                size_t alignment) {
+    return inTaskWithOptions(kernel_task, options, capacity, alignment);
+}
+
+IOBufferMemoryDescriptor *IOBufferMemoryDescriptor::inTaskWithOptions(task_t inTask, IOOptionBits options,
+                                                                      mach_vm_size_t capacity,
+                                                                      mach_vm_size_t alignment) {
+    void *address = nullptr;
+
+    if (alignment < sizeof(void *)) alignment = sizeof(void *);
+    if (capacity == 0 || posix_memalign(&address, alignment, capacity) != 0) return nullptr;
+
+    // Pages shared with user space come zero filled.
+    memset(address, (options & kIOMemoryKernelUserShared) ? 0 : 0xa5, capacity);
+    __atomic_add_fetch(&s_allocated_bytes, (int64_t)capacity, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s_allocations, 1, __ATOMIC_RELAXED);
+
+    IOBufferMemoryDescriptor *buffer = new IOBufferMemoryDescriptor;
+    buffer->m_address = (uint8_t *)address;
+    buffer->m_length = capacity;
+    buffer->m_capacity = capacity;
+    buffer->m_options = options;
+    return buffer;
+}
+
+void *IOBufferMemoryDescriptor::getBytesNoCopy() {
+    return m_address;
+}
+
+void IOBufferMemoryDescriptor::setLength(size_t length) {
+    if (length > m_capacity) standin_fatal("IOBufferMemoryDescriptor length beyond its capacity.");
+    m_length = length;
+}
+
+size_t IOBufferMemoryDescriptor::getCapacity() const {
+    return m_capacity;
+}
+
+void IOBufferMemoryDescriptor::free() {
+    if (m_address) {
+        ::free(m_address);
+        __atomic_sub_fetch(&s_allocated_bytes, (int64_t)m_capacity, __ATOMIC_RELAXED);
+        m_address = nullptr;
+    }
+    IOMemoryDescriptor::free();
+}
+
+/*
+ *  IORegistryEntry
+ */
+
+bool IORegistryEntry::init(OSDictionary *dictionary) {
+    if (!OSObject::init()) return false;
+
+    m_properties_lock = IOLockAlloc();
+    m_properties = OSDictionary::withCapacity(8);
+    return m_properties_lock && m_properties;
+}
+
+void IORegistryEntry::free() {
+    if (m_properties) m_properties->release();
+    if (m_properties_lock) IOLockFree(m_properties_lock);
+    OSObject::free();
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, OSObject *anObject) {
+    if (!m_properties) return false;
+
+    IOLockLock(m_properties_lock);
+    bool ret = m_properties->setObject(aKey, anObject);
+    IOLockUnlock(m_properties_lock);
+
+    return ret;
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, const char *aString) {
+    OSString *string = OSString::withCString(aString);
+    if (!string) return false;
+
+    bool ret = setProperty(aKey, string);
+    string->release();
+    return ret;
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, unsigned long long aValue, unsigned int aNumberOfBits) {
+    OSNumber *number = OSNumber::withNumber(aValue, aNumberOfBits);
+    bool ret = setProperty(aKey, number);
+    number->release();
+    return ret;
+}
+
+bool IORegistryEntry::setProperty(const char *aKey, bool aBoolean) {
+    return setProperty(aKey, (unsigned long long)aBoolean, 1);
+}
+
+void IORegistryEntry::removeProperty(const char *aKey) {
+    if (!m_properties) return;
+
+    IOLockLock(m_properties_lock);
+    m_properties->removeObject(aKey);
+    IOLockUnlock(m_properties_lock);
+}
+
+OSObject *IORegistryEntry::copyProperty(const char *aKey) const {
+    if (!m_properties) return nullptr;
+
+    IOLockLock(m_properties_lock);
+    OSObject *object = m_properties->getObject(aKey);
+    if (object) object->retain();
+    IOLockUnlock(m_properties_lock);
+
+    return object;
+}
+
+/*
+ *  IOService
+ */
+
+bool IOService::start(IOService *provider) {
+    m_started = true;
+    return true;
+}
+
+void IOService::stop(IOService *provider) {
+    m_started = false;
+}
+
+bool IOService::attach(IOService *provider) {
+    if (m_provider) return false;
+
+    pthread_mutex_lock(&s_attachments_lock);
+    if (s_attachment_count == sizeof(s_attachments) / sizeof(s_attachments[0])) {
+        pthread_mutex_unlock(&s_attachments_lock);
+        return false;
+    }
+    s_attachments[s_attachment_count++] = {provider, this};
+    pthread_mutex_unlock(&s_attachments_lock);
+
+    // The registry holds a reference to both ends of an attachment.
+    retain();
+    if (provider) provider->retain();
+    m_provider = provider;
+    return true;
+}
+
+void IOService::detach(IOService *provider) {
+    if (m_provider != provider) return;
+
+    pthread_mutex_lock(&s_attachments_lock);
+    for (uint32_t i = 0; i < s_attachment_count; i++) {
+        if (s_attachments[i].child == this) {
+            memmove(&s_attachments[i], &s_attachments[i + 1], (s_attachment_count - i - 1) * sizeof(s_attachments[0]));
+            s_attachment_count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_attachments_lock);
+
+    m_provider = nullptr;
+    if (provider) provider->release();
+    release();
+}
+
+bool IOService::terminate(IOOptionBits options) {
+    if (m_terminated) return false;
+    m_terminated = true;
+
+    // Keep this alive until detached, the attachment may hold the last reference.
+    retain();
+    if (m_started) stop(m_provider);
+    if (m_provider) detach(m_provider);
+    release();
+
+    return true;
+}
+
+void IOService::registerService(IOOptionBits options) {}
+
+IOWorkLoop *IOService::getWorkLoop() const {
+    return m_provider ? m_provider->getWorkLoop() : nullptr;
+}
+
+IOService *IOService::getProvider() const {
+    return m_provider;
+}
+
+/*
+ *  IOEventSource
+ */
+
+bool IOEventSource::initWithOwner(OSObject *owner) {
+    m_owner = owner;
+    return OSObject::init();
+}
+
+void IOEventSource::enable() {
+    __atomic_store_n(&m_enabled, true, __ATOMIC_RELEASE);
+    signalWorkAvailable();
+}
+
+void IOEventSource::disable() {
+    __atomic_store_n(&m_enabled, false, __ATOMIC_RELEASE);
+}
+
+bool IOEventSource::isEnabled() const {
+    return __atomic_load_n(&m_enabled, __ATOMIC_ACQUIRE);
+}
+
+uint64_t IOEventSource::nextDeadline() const {
+    return UINT64_MAX;
+}
+
+void IOEventSource::signalWorkAvailable() {
+    IOWorkLoop *work_loop = __atomic_load_n(&m_work_loop, __ATOMIC_ACQUIRE);
+    if (work_loop) work_loop->signalWorkAvailable();
+}
+
+/*
+ *  IOWorkLoop
+ */
+
+IOWorkLoop *IOWorkLoop::workLoop() {
+    IOWorkLoop *work_loop = new IOWorkLoop;
+    pthread_mutexattr_t attributes;
+
+    // Event sources may be added or removed from an action, the gate is recursive as in IOKit.
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&work_loop->m_gate, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    pthread_mutex_init(&work_loop->m_wake_lock, nullptr);
+    pthread_cond_init(&work_loop->m_wake, nullptr);
+    pthread_cond_init(&work_loop->m_idle_changed, nullptr);
+
+    if (pthread_create(&work_loop->m_thread, nullptr, &IOWorkLoop::threadMain, work_loop) != 0) {
+        standin_fatal("Unable to start a work loop thread.");
+    }
+
+    return work_loop;
+}
+
+void *IOWorkLoop::threadMain(void *context) {
+    ((IOWorkLoop *)context)->run();
+    return nullptr;
+}
+
+void IOWorkLoop::run() {
+    for (;;) {
+        uint64_t deadline = UINT64_MAX;
+
+        // Claim the signal before running, anything signalled meanwhile runs again.
+        pthread_mutex_lock(&m_wake_lock);
+        m_work_pending = false;
+        pthread_mutex_unlock(&m_wake_lock);
+
+        pthread_mutex_lock(&m_gate);
+        for (unsigned int i = 0; i < m_source_count; i++) {
+            IOEventSource *source = m_sources[i];
+            if (!source->isEnabled()) continue;
+
+            source->checkForWork();
+
+            // The action may have removed sources, only look at those still there.
+            if (i < m_source_count && m_sources[i] == source) {
+                uint64_t next = source->nextDeadline();
+                if (next < deadline) deadline = next;
+            }
+        }
+        pthread_mutex_unlock(&m_gate);
+
+        pthread_mutex_lock(&m_wake_lock);
+        if (m_exit) {
+            pthread_mutex_unlock(&m_wake_lock);
+            break;
+        }
+
+        if (!m_work_pending) {
+            m_idle = true;
+            pthread_cond_broadcast(&m_idle_changed);
+
+            // Read the clock once, a deadline passing in between must not wrap the delay.
+            uint64_t now = standin_now();
+
+            if (deadline == UINT64_MAX) {
+                pthread_cond_wait(&m_wake, &m_wake_lock);
+            } else if (deadline > now) {
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+
+                uint64_t delay = deadline - now;
+                uint64_t ns = (uint64_t)until.tv_nsec + delay % 1000000000ull;
+                until.tv_sec += (time_t)(delay / 1000000000ull + ns / 1000000000ull);
+                until.tv_nsec = (long)(ns % 1000000000ull);
+
+                pthread_cond_timedwait(&m_wake, &m_wake_lock, &until);
+            }
+
+            m_idle = false;
+        }
+        pthread_mutex_unlock(&m_wake_lock);
+    }
+}
+
+void IOWorkLoop::signalWorkAvailable() {
+    pthread_mutex_lock(&m_wake_lock);
+    m_work_pending = true;
+    m_idle = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_wake_lock);
+}
+
+bool IOWorkLoop::onThread() const {
+    return pthread_equal(pthread_self(), m_thread);
+}
+
+IOReturn IOWorkLoop::addEventSource(IOEventSource *newEvent) {
+    pthread_mutex_lock(&m_gate);
+    if (m_source_count >= m_source_limit || newEvent->m_work_loop) {
+        pthread_mutex_unlock(&m_gate);
+        return kIOReturnNoResources;
+    }
+
+    newEvent->retain();
+    m_sources[m_source_count++] = newEvent;
+    __atomic_store_n(&newEvent->m_work_loop, this, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&m_gate);
+
+    signalWorkAvailable();
+    return kIOReturnSuccess;
+}
+
+IOReturn IOWorkLoop::removeEventSource(IOEventSource *toRemove) {
+    // Holding the gate means the source's action is not running.
+    pthread_mutex_lock(&m_gate);
+    for (unsigned int i = 0; i < m_source_count; i++) {
+        if (m_sources[i] == toRemove) {
+            memmove(&m_sources[i], &m_sources[i + 1], (m_source_count - i - 1) * sizeof(m_sources[0]));
+            m_source_count--;
+
+            __atomic_store_n(&toRemove->m_work_loop, (IOWorkLoop *)nullptr, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&m_gate);
+
+            toRemove->release();
+            return kIOReturnSuccess;
+        }
+    }
+    pthread_mutex_unlock(&m_gate);
+
+    return kIOReturnNotFound;
+}
+
+void IOWorkLoop::free() {
+    pthread_mutex_lock(&m_wake_lock);
+    m_exit = true;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_wake_lock);
+
+    if (onThread()) {
+        pthread_detach(m_thread);
+    } else {
+        pthread_join(m_thread, nullptr);
+    }
+
+    while (m_source_count > 0) removeEventSource(m_sources[m_source_count - 1]);
+
+    pthread_mutex_destroy(&m_gate);
+    pthread_mutex_destroy(&m_wake_lock);
+    pthread_cond_destroy(&m_wake);
+    pthread_cond_destroy(&m_idle_changed);
+
+    OSObject::free();
+}
+
+void standin_drain(IOWorkLoop *workLoop) {
+    if (workLoop->onThread()) standin_fatal("Draining a work loop from its own thread.");
+
+    pthread_mutex_lock(&workLoop->m_wake_lock);
+    while (!workLoop->m_idle || workLoop->m_work_pending) {
+        pthread_cond_wait(&workLoop->m_idle_changed, &workLoop->m_wake_lock);
+    }
+    pthread_mutex_unlock(&workLoop->m_wake_lock);
+}
+
+void standin_limit_sources(IOWorkLoop *workLoop, unsigned int count) {
+    pthread_mutex_lock(&workLoop->m_gate);
+    if (count > IOWorkLoop::max_sources - workLoop->m_source_count) {
+        workLoop->m_source_limit = IOWorkLoop::max_sources;
+    } else {
+        workLoop->m_source_limit = workLoop->m_source_count + count;
+    }
+    pthread_mutex_unlock(&workLoop->m_gate);
+}
+
+unsigned int standin_source_count(IOWorkLoop *workLoop) {
+    pthread_mutex_lock(&workLoop->m_gate);
+    unsigned int count = workLoop->m_source_count;
+    pthread_mutex_unlock(&workLoop->m_gate);
+
+    return count;
+}
+
+/*
+ *  IOInterruptEventSource
+ */
+
+IOInterruptEventSource *IOInterruptEventSource::interruptEventSource(OSObject *owner, Action action,
+                                                                     IOService *provider, int intIndex) {
+    IOInterruptEventSource *source = new IOInterruptEventSource;
+    source->initWithOwner(owner);
+    source->m_action = action;
+    return source;
+}
+
+void IOInterruptEventSource::interruptOccurred(void *nub, IOService *provider, int source) {
+    __atomic_add_fetch(&m_produced, 1, __ATOMIC_RELEASE);
+    signalWorkAvailable();
+}
+
+void IOInterruptEventSource::checkForWork() {
+    uint32_t produced = __atomic_load_n(&m_produced, __ATOMIC_ACQUIRE);
+    if (produced == m_consumed) return;
+
+    int count = (int)(produced - m_consumed);
+    m_consumed = produced;
+
+    if (m_action) m_action(m_owner, this, count);
+}
+
+/*
+ *  IOTimerEventSource
+ */
+
+IOTimerEventSource *IOTimerEventSource::timerEventSource(OSObject *owner, Action action) {
+    IOTimerEventSource *source = new IOTimerEventSource;
+    source->initWithOwner(owner);
+    source->m_action = action;
+    return source;
+}
+
+IOReturn IOTimerEventSource::setTimeoutMS(UInt32 ms) {
+    return wakeAtTime(standin_now() + (uint64_t)ms * 1000000ull);
+}
+
+IOReturn IOTimerEventSource::setTimeoutUS(UInt32 us) {
+    return wakeAtTime(standin_now() + (uint64_t)us * 1000ull);
+}
+
+IOReturn IOTimerEventSource::wakeAtTime(AbsoluteTime abstime) {
+    __atomic_store_n(&m_deadline, abstime, __ATOMIC_RELEASE);
+    signalWorkAvailable();
+    return kIOReturnSuccess;
+}
+
+void IOTimerEventSource::cancelTimeout() {
+    __atomic_store_n(&m_deadline, UINT64_MAX, __ATOMIC_RELEASE);
+}
+
+void IOTimerEventSource::checkForWork() {
+    uint64_t deadline = __atomic_load_n(&m_deadline, __ATOMIC_ACQUIRE);
+    if (deadline == UINT64_MAX || deadline > standin_now()) return;
+
+    // A timer fires once, the action may set it again.
+    __atomic_compare_exchange_n(&m_deadline, &deadline, UINT64_MAX, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+
+    if (m_action) m_action(m_owner, this);
+}
+
+uint64_t IOTimerEventSource::nextDeadline() const {
+    return __atomic_load_n(&m_deadline, __ATOMIC_ACQUIRE);
+}
+
+/*
+ *  IOHIDDevice
+ */
+
+bool IOHIDDevice::start(IOService *provider) {
+    IOMemoryDescriptor *descriptor = nullptr;
+
+    if (newReportDescriptor(&descriptor) != kIOReturnSuccess || !descriptor) return false;
+    descriptor->release();
+
+    return IOService::start(provider);
+}
+
+OSString *IOHIDDevice::newProductString() const {
+    return nullptr;
+}
+
+OSString *IOHIDDevice::newSerialNumberString() const {
+    return nullptr;
+}
+
+OSNumber *IOHIDDevice::newVendorIDNumber() const {
+    return nullptr;
+}
+
+OSNumber *IOHIDDevice::newProductIDNumber() const {
+    return nullptr;
+}
+
+IOReturn IOHIDDevice::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOHIDDevice::getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOHIDDevice::handleReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options) {
+    uint8_t bytes[8192];
+    IOByteCount length = report->getLength();
+
+    if (length > sizeof(bytes)) return kIOReturnBadArgument;
+
+    // Copied out like the HID stack does, so the caller may reuse the buffer right away.
+    report->readBytes(0, bytes, length);
+
+    standin_report_handler handler = __atomic_load_n(&s_report_handler, __ATOMIC_ACQUIRE);
+    if (!handler) return kIOReturnSuccess;
+
+    return handler(s_report_context, this, reportType, bytes, (uint32_t)length);
+}
+
+/*
+ *  IOUserClient
+ */
+
+bool IOUserClient::initWithTask(task_t owningTask, void *securityToken, UInt32 type, OSDictionary *properties) {
+    return owningTask && init(properties);
+}
+
+IOReturn IOUserClient::externalMethod(uint32_t selector, IOExternalMethodArguments *arguments,
+                                      IOExternalMethodDispatch *dispatch, OSObject *target, void *reference) {
+    uint32_t count = 0;
+
+    if (!dispatch) return kIOReturnUnsupported;
+
+    count = dispatch->checkScalarInputCount;
+    if (count != kIOUCVariableStructureSize && count != arguments->scalarInputCount) {
+        return kIOReturnBadArgument;
+    }
+
+    count = dispatch->checkStructureInputSize;
+    if (count != kIOUCVariableStructureSize &&
+        count != (arguments->structureInputDescriptor ? arguments->structureInputDescriptor->getLength()
+                                                      : arguments->structureInputSize)) {
+        return kIOReturnBadArgument;
+    }
+
+    count = dispatch->checkScalarOutputCount;
+    if (count != kIOUCVariableStructureSize && count != arguments->scalarOutputCount) {
+        return kIOReturnBadArgument;
+    }
+
+    count = dispatch->checkStructureOutputSize;
+    if (count != kIOUCVariableStructureSize &&
+        count != (arguments->structureOutputDescriptor ? arguments->structureOutputDescriptor->getLength()
+                                                       : arguments->structureOutputSize)) {
+        return kIOReturnBadArgument;
+    }
+
+    if (!dispatch->function) return kIOReturnNoCompletion;
+
+    return dispatch->function(target, reference, arguments);
+}
+
+IOReturn IOUserClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOUserClient::clientClose(void) {
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOUserClient::sendAsyncResult64(OSAsyncReference64 reference, IOReturn result,
+                                         io_user_reference_t args[], UInt32 numArgs) {
+    if (numArgs > kMaxAsyncArgs) return kIOReturnMessageTooLarge;
+
+    standin_async_handler handler = __atomic_load_n(&s_async_handler, __ATOMIC_ACQUIRE);
+    if (handler) handler(s_async_context, reference, result, args, numArgs);
+
+    return kIOReturnSuccess;
+}
+
+/*
+ *  Test hooks
+ */
+
+int64_t standin_allocated_bytes() {
+    return __atomic_load_n(&s_allocated_bytes, __ATOMIC_RELAXED);
+}
+
+int64_t standin_live_objects() {
+    return __atomic_load_n(&s_live_objects, __ATOMIC_RELAXED);
+}
+
+uint64_t standin_allocations() {
+    return __atomic_load_n(&s_allocations, __ATOMIC_RELAXED);
+}
+
+IOService *standin_copy_child(IOService *provider, uint32_t index) {
+    IOService *child = nullptr;
+
+    pthread_mutex_lock(&s_attachments_lock);
+    for (uint32_t i = 0; i < s_attachment_count; i++) {
+        if (s_attachments[i].provider != provider) continue;
+        if (index-- == 0) {
+            child = s_attachments[i].child;
+            child->retain();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_attachments_lock);
+
+    return child;
+}
+
+void standin_set_async_handler(standin_async_handler handler, void *context) {
+    s_async_context = context;
+    __atomic_store_n(&s_async_handler, handler, __ATOMIC_RELEASE);
+}
+
+void standin_set_report_handler(standin_report_handler handler, void *context) {
+    s_report_context = context;
+    __atomic_store_n(&s_report_handler, handler, __ATOMIC_RELEASE);
+}
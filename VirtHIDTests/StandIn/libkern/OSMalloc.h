@@ -0,0 +1,13 @@
+//
+//  OSMalloc.h
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_standin_osmalloc_h
+#define virthid_standin_osmalloc_h
+
+#include <IOKit/IOStandIn.h>
+
+#endif
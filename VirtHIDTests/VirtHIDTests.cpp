@@ -0,0 +1,291 @@
+//
+//  VirtHIDTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+static virthid_test_case *s_tests = nullptr;
+static const char *s_running = nullptr;
+static int s_failures = 0;
+static uint32_t s_iterations = 0;
+
+virthid_test_case::virthid_test_case(const char *name, function run) : m_name(name), m_run(run), m_next(s_tests) {
+    s_tests = this;
+}
+
+int virthid_test_case::runAll(const char *filter) {
+    virthid_test_case *tests[1024];
+    uint32_t count = 0;
+    int failed = 0;
+
+    // Registered last to first, run them in source order.
+    for (virthid_test_case *test = s_tests; test && count < 1024; test = test->m_next) {
+        tests[count++] = test;
+    }
+
+    while (count-- > 0) {
+        virthid_test_case *test = tests[count];
+        if (filter && !strstr(test->m_name, filter)) continue;
+
+        int64_t objects = standin_live_objects();
+        int64_t bytes = standin_allocated_bytes();
+
+        s_running = test->m_name;
+        s_failures = 0;
+        test->m_run();
+
+        // Everything a test allocates is released by its end.
+        if (standin_live_objects() != objects) {
+            fprintf(stderr, "%s: %lld objects leaked\n", test->m_name,
+                    (long long)(standin_live_objects() - objects));
+            s_failures++;
+        }
+        if (standin_allocated_bytes() != bytes) {
+            fprintf(stderr, "%s: %lld bytes leaked\n", test->m_name,
+                    (long long)(standin_allocated_bytes() - bytes));
+            s_failures++;
+        }
+
+        printf("%s %s\n", s_failures ? "FAIL" : "ok  ", test->m_name);
+        if (s_failures) failed++;
+    }
+
+    return failed;
+}
+
+void virthid_test_fail(const char *file, int line, const char *expression) {
+    fprintf(stderr, "%s:%d: %s: check failed: %s\n", file, line, s_running, expression);
+    s_failures++;
+}
+
+uint64_t virthid_test_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+uint32_t virthid_test_iterations(uint32_t fallback) {
+    return s_iterations ? s_iterations : fallback;
+}
+
+void virthid_bench_report(const char *name, uint64_t operations, uint64_t elapsed_ns) {
+    printf("    %-32s %10llu ops %12.1f ns/op\n", name, (unsigned long long)operations,
+           operations ? (double)elapsed_ns / (double)operations : 0.0);
+}
+
+void virthid_bench_report_latency(const char *name, uint64_t *samples, uint32_t count) {
+    if (count == 0) return;
+
+    std::sort(samples, samples + count);
+    printf("    %-32s %10u samples p50 %llu ns p99 %llu ns max %llu ns\n", name, count,
+           (unsigned long long)samples[count / 2], (unsigned long long)samples[(uint64_t)count * 99 / 100],
+           (unsigned long long)samples[count - 1]);
+}
+
+IOReturn virthid_test_call(IOUserClient *client, uint32_t selector, std::initializer_list<uint64_t> scalars,
+                           uint64_t *outputs, uint32_t output_count,
+                           const void *input, uint32_t input_len,
+                           void *output, uint32_t output_len,
+                           io_user_reference_t *async) {
+    IOExternalMethodArguments arguments;
+    IOReturn ret = kIOReturnSuccess;
+    uint64_t scalar_outputs[16] = {};
+    static int s_wake_port;
+
+    memset(&arguments, 0, sizeof(arguments));
+    arguments.version = 2;
+    arguments.selector = selector;
+
+    arguments.scalarInput = scalars.begin();
+    arguments.scalarInputCount = (uint32_t)scalars.size();
+
+    arguments.scalarOutput = scalar_outputs;
+    arguments.scalarOutputCount = output_count;
+
+    if (async) {
+        arguments.asyncWakePort = &s_wake_port;
+        arguments.asyncReference = async;
+        arguments.asyncReferenceCount = kOSAsyncRef64Count;
+    }
+
+    // Larger structures are wired from the caller's memory instead of copied.
+    if (input_len > virthid_test_max_inline) {
+        arguments.structureInputDescriptor = IOMemoryDescriptor::withAddressRange(
+            virthid_test_ptr(input), input_len, kIODirectionOut, standin_user_task);
+    } else {
+        arguments.structureInput = input;
+        arguments.structureInputSize = input_len;
+    }
+
+    if (output_len > virthid_test_max_inline) {
+        arguments.structureOutputDescriptor = IOMemoryDescriptor::withAddressRange(
+            virthid_test_ptr(output), output_len, kIODirectionIn, standin_user_task);
+        arguments.structureOutputDescriptorSize = output_len;
+    } else {
+        arguments.structureOutput = output;
+        arguments.structureOutputSize = output_len;
+    }
+
+    ret = client->externalMethod(selector, &arguments);
+
+    if (arguments.structureInputDescriptor) arguments.structureInputDescriptor->release();
+    if (arguments.structureOutputDescriptor) arguments.structureOutputDescriptor->release();
+
+    // MIG drops the outputs of a failed call.
+    if (ret == kIOReturnSuccess && outputs) {
+        memcpy(outputs, scalar_outputs, output_count * sizeof(uint64_t));
+    }
+
+    return ret;
+}
+
+const uint8_t virthid_test_keyboard[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01,
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+    0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xc0,
+};
+const uint16_t virthid_test_keyboard_len = sizeof(virthid_test_keyboard);
+
+const uint8_t virthid_test_mouse[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x09, 0x01, 0xa1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03,
+    0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08, 0x95, 0x03,
+    0x81, 0x06, 0xc0, 0xc0,
+};
+const uint16_t virthid_test_mouse_len = sizeof(virthid_test_mouse);
+
+static uint64_t s_reports = 0;
+static uint64_t s_async_results = 0;
+
+static IOReturn virthid_test_count_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                          const uint8_t *report, uint32_t report_len) {
+    __atomic_add_fetch(&s_reports, 1, __ATOMIC_RELAXED);
+    return kIOReturnSuccess;
+}
+
+static void virthid_test_count_async(void *context, const io_user_reference_t *reference, IOReturn result,
+                                     const io_user_reference_t *args, UInt32 count) {
+    __atomic_add_fetch(&s_async_results, 1, __ATOMIC_RELAXED);
+}
+
+virthid_test_driver::virthid_test_driver() {
+    __atomic_store_n(&s_reports, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_async_results, 0, __ATOMIC_RELAXED);
+    standin_set_report_handler(&virthid_test_count_report, nullptr);
+    standin_set_async_handler(&virthid_test_count_async, nullptr);
+
+    m_driver = OSTypeAlloc(it_kotleni_virthid);
+    if (!m_driver->init(nullptr) || !m_driver->start(nullptr)) {
+        m_driver->release();
+        m_driver = nullptr;
+        return;
+    }
+
+    m_client = openClient();
+}
+
+virthid_test_driver::~virthid_test_driver() {
+    if (m_client) closeClient(m_client);
+    if (!m_driver) return;
+
+    m_driver->stop(nullptr);
+    m_driver->release();
+
+    standin_set_report_handler(nullptr, nullptr);
+    standin_set_async_handler(nullptr, nullptr);
+}
+
+it_kotleni_virthid_userclient *virthid_test_driver::openClient() {
+    it_kotleni_virthid_userclient *client = OSTypeAlloc(it_kotleni_virthid_userclient);
+
+    if (!client->initWithTask(standin_user_task, nullptr, 0, nullptr)) {
+        client->release();
+        return nullptr;
+    }
+
+    // Attached by IOKit when the client opens its connection.
+    if (!client->attach(m_driver)) {
+        client->release();
+        return nullptr;
+    }
+
+    if (!client->start(m_driver)) {
+        client->detach(m_driver);
+        client->release();
+        return nullptr;
+    }
+
+    return client;
+}
+
+void virthid_test_driver::closeClient(it_kotleni_virthid_userclient *client) {
+    client->clientClose();
+    client->release();
+}
+
+UInt32 virthid_test_driver::create(const char *name, const uint8_t *descriptor, uint16_t descriptor_len) {
+    uint64_t handle = virthid_invalid_handle;
+    static const char s_serial_number[] = "";
+
+    IOReturn ret = virthid_test_call(m_client, it_kotleni_virthid_method_create,
+                                     {virthid_test_ptr(name), strlen(name),
+                                      virthid_test_ptr(descriptor), descriptor_len,
+                                      virthid_test_ptr(s_serial_number), 0, 0, 0},
+                                     &handle, 1);
+
+    return ret == kIOReturnSuccess ? (UInt32)handle : virthid_invalid_handle;
+}
+
+it_kotleni_virthid_device *virthid_test_driver::device(UInt32 handle) const {
+    IOService *child = nullptr;
+
+    for (uint32_t i = 0; (child = standin_copy_child(m_driver, i)); i++) {
+        it_kotleni_virthid_device *device = OSDynamicCast(it_kotleni_virthid_device, child);
+        child->release();
+
+        // The driver keeps its own reference for as long as the device exists.
+        if (device && device->handle == handle) return device;
+    }
+
+    return nullptr;
+}
+
+void virthid_test_driver::drain() const {
+    standin_drain(m_driver->getWorkLoop());
+}
+
+IOWorkLoop *virthid_test_driver::workLoop() const {
+    return m_driver->getWorkLoop();
+}
+
+uint64_t virthid_test_driver::reports() const {
+    return __atomic_load_n(&s_reports, __ATOMIC_RELAXED);
+}
+
+uint64_t virthid_test_driver::asyncResults() const {
+    return __atomic_load_n(&s_async_results, __ATOMIC_RELAXED);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            s_iterations = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    return virthid_test_case::runAll(filter) ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+//
+//  VirtHIDTests.hpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#ifndef virthid_tests_h
+#define virthid_tests_h
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOUserClient.h>
+#include <IOKit/hid/IOHIDDevice.h>
+
+#include <stdint.h>
+#include <initializer_list>
+
+#include "VirtHID.hpp"
+#include "VirtHID_Device.hpp"
+#include "VirtHID_UserClient.hpp"
+
+/**
+ *  A test, registered by 'VIRTHID_TEST' and run by 'main' in VirtHIDTests.cpp.
+ */
+class virthid_test_case {
+public:
+    typedef void (*function)();
+
+    virthid_test_case(const char *name, function run);
+
+    /**
+     *  Run every registered test whose name contains 'filter', or all of them.
+     *
+     *  @return The number of failed tests.
+     */
+    static int runAll(const char *filter);
+
+private:
+    const char *m_name;
+    function m_run;
+    virthid_test_case *m_next;
+};
+
+#define VIRTHID_TEST(name) \
+    static void name(); \
+    static virthid_test_case name##_case(#name, &name); \
+    static void name()
+
+/**
+ *  Record a failed check of the running test.
+ */
+void virthid_test_fail(const char *file, int line, const char *expression);
+
+#define VIRTHID_CHECK(condition) \
+    do { if (!(condition)) virthid_test_fail(__FILE__, __LINE__, #condition); } while (0)
+
+/**
+ *  Like 'VIRTHID_CHECK', but leaves the test on failure.
+ */
+#define VIRTHID_REQUIRE(condition) \
+    do { if (!(condition)) { virthid_test_fail(__FILE__, __LINE__, #condition); return; } } while (0)
+
+/**
+ *  Uptime in nanoseconds.
+ */
+uint64_t virthid_test_now();
+
+/**
+ *  Iteration count of benchmarks, 'fallback' unless given with '--iterations'.
+ */
+uint32_t virthid_test_iterations(uint32_t fallback);
+
+/**
+ *  Print one benchmark result, in nanoseconds per operation.
+ */
+void virthid_bench_report(const char *name, uint64_t operations, uint64_t elapsed_ns);
+
+/**
+ *  Print the 50th, 99th and largest of 'count' latency samples, which get sorted.
+ */
+void virthid_bench_report_latency(const char *name, uint64_t *samples, uint32_t count);
+
+/**
+ *  Time 'iterations' calls of 'operation(i)', which returns false on failure,
+ *  and print the result.
+ *
+ *  @return The number of failed calls.
+ */
+template <typename Operation>
+uint32_t virthid_bench(const char *name, uint32_t iterations, Operation operation) {
+    uint32_t failed = 0;
+    uint64_t start = virthid_test_now();
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (!operation(i)) failed++;
+    }
+
+    virthid_bench_report(name, iterations, virthid_test_now() - start);
+    return failed;
+}
+
+/**
+ *  Largest structure IOKit passes inline.
+ */
+const uint32_t virthid_test_max_inline = 4096;
+
+/**
+ *  Call 'externalMethod' the way IOKit does for a user space client. Structures
+ *  larger than 'virthid_test_max_inline' are passed through memory descriptors.
+ *
+ *  @param outputs Receives 'output_count' scalar outputs.
+ *  @param async An async reference for the subscribing selectors, or null.
+ */
+IOReturn virthid_test_call(IOUserClient *client, uint32_t selector, std::initializer_list<uint64_t> scalars,
+                           uint64_t *outputs = nullptr, uint32_t output_count = 0,
+                           const void *input = nullptr, uint32_t input_len = 0,
+                           void *output = nullptr, uint32_t output_len = 0,
+                           io_user_reference_t *async = nullptr);
+
+/**
+ *  Scalar for a pointer argument.
+ */
+inline uint64_t virthid_test_ptr(const void *pointer) {
+    return (uint64_t)(uintptr_t)pointer;
+}
+
+/**
+ *  Report descriptors of a boot keyboard (8 byte input, 1 byte output report)
+ *  and a three button mouse with a wheel (4 byte input report).
+ */
+extern const uint8_t virthid_test_keyboard[];
+extern const uint16_t virthid_test_keyboard_len;
+extern const uint8_t virthid_test_mouse[];
+extern const uint16_t virthid_test_mouse_len;
+
+/**
+ *  A started driver with one open user client, torn down on destruction.
+ *  Reports handed to the HID stack and async results are counted, a test
+ *  may install its own handlers instead.
+ */
+class virthid_test_driver {
+public:
+    virthid_test_driver();
+    ~virthid_test_driver();
+
+    bool ok() const { return m_driver && m_client; }
+
+    it_kotleni_virthid *driver() const { return m_driver; }
+    it_kotleni_virthid_userclient *client() const { return m_client; }
+
+    /**
+     *  Open another user client, closed with 'closeClient'.
+     */
+    it_kotleni_virthid_userclient *openClient();
+    void closeClient(it_kotleni_virthid_userclient *client);
+
+    /**
+     *  Create a device through the 'create' selector.
+     *
+     *  @return Its handle, or 'virthid_invalid_handle'.
+     */
+    UInt32 create(const char *name, const uint8_t *descriptor = virthid_test_keyboard,
+                  uint16_t descriptor_len = virthid_test_keyboard_len);
+
+    /**
+     *  Return the device with this handle, WITHOUT increasing the reference count.
+     */
+    it_kotleni_virthid_device *device(UInt32 handle) const;
+
+    /**
+     *  Wait until the driver's work loop ran everything signalled so far.
+     */
+    void drain() const;
+
+    /**
+     *  Return the driver's work loop, shared by every device.
+     */
+    IOWorkLoop *workLoop() const;
+
+    uint64_t reports() const;
+    uint64_t asyncResults() const;
+
+private:
+    it_kotleni_virthid *m_driver = nullptr;
+    it_kotleni_virthid_userclient *m_client = nullptr;
+};
+
+#endif
@@ -0,0 +1,157 @@
+//
+//  VirtHID_BatchTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_Batch.hpp"
+
+/**
+ *  Append a record to 'batch' and return the new length.
+ */
+static uint32_t virthid_batch_append(uint8_t *batch, uint32_t batch_len, uint32_t handle,
+                                     const uint8_t *report, uint16_t report_len) {
+    virthid_batch_record record = {handle, report_len, 0};
+
+    memcpy(batch + batch_len, &record, sizeof(record));
+    memcpy(batch + batch_len + sizeof(record), report, report_len);
+
+    return batch_len + virthid_batch_record_size(report_len);
+}
+
+static const uint8_t s_report[8] = {0, 0, 0x04};
+
+VIRTHID_TEST(batch_reader_walks_records) {
+    uint8_t batch[256] = {};
+    uint32_t batch_len = 0;
+
+    batch_len = virthid_batch_append(batch, batch_len, 1, s_report, 8);
+    batch_len = virthid_batch_append(batch, batch_len, 2, s_report, 3);
+    batch_len = virthid_batch_append(batch, batch_len, 3, s_report, 0);
+    VIRTHID_CHECK(batch_len == 16 + 12 + 8);
+
+    virthid_batch_reader reader(batch, batch_len);
+    uint32_t handle = 0;
+    const uint8_t *report = nullptr;
+    uint16_t report_len = 0;
+
+    VIRTHID_CHECK(reader.next(&handle, &report, &report_len) == virthid_batch_next);
+    VIRTHID_CHECK(handle == 1 && report_len == 8 && report == batch + sizeof(virthid_batch_record));
+    VIRTHID_CHECK(reader.next(&handle, &report, &report_len) == virthid_batch_next);
+    VIRTHID_CHECK(handle == 2 && report_len == 3);
+    VIRTHID_CHECK(reader.next(&handle, &report, &report_len) == virthid_batch_next);
+    VIRTHID_CHECK(handle == 3 && report_len == 0);
+    VIRTHID_CHECK(reader.next(&handle, &report, &report_len) == virthid_batch_end);
+}
+
+VIRTHID_TEST(batch_reader_stops_at_truncated_records) {
+    uint8_t batch[256] = {};
+    const uint8_t *report = nullptr;
+    uint32_t handle = 0;
+    uint16_t report_len = 0;
+
+    // The last record may go without its padding.
+    uint32_t batch_len = virthid_batch_append(batch, 0, 1, s_report, 3);
+    virthid_batch_reader unpadded(batch, batch_len - 1);
+    VIRTHID_CHECK(unpadded.next(&handle, &report, &report_len) == virthid_batch_next);
+    VIRTHID_CHECK(unpadded.next(&handle, &report, &report_len) == virthid_batch_end);
+
+    // Part of a header after a full record.
+    batch_len = virthid_batch_append(batch, 0, 1, s_report, 8);
+    virthid_batch_reader header(batch, batch_len + 4);
+    VIRTHID_CHECK(header.next(&handle, &report, &report_len) == virthid_batch_next);
+    VIRTHID_CHECK(header.next(&handle, &report, &report_len) == virthid_batch_truncated);
+
+    // A header announcing more bytes than there are.
+    virthid_batch_reader body(batch, batch_len - 5);
+    VIRTHID_CHECK(body.next(&handle, &report, &report_len) == virthid_batch_truncated);
+}
+
+VIRTHID_TEST(send_batch_reports_each_record) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint8_t batch[256] = {};
+    uint32_t batch_len = 0;
+    batch_len = virthid_batch_append(batch, batch_len, handle, s_report, 8);
+    batch_len = virthid_batch_append(batch, batch_len, handle + 1, s_report, 8);
+    batch_len = virthid_batch_append(batch, batch_len, handle, s_report, 3);
+    batch_len = virthid_batch_append(batch, batch_len, handle, s_report, 8);
+
+    SInt32 status[4] = {-1, -1, -1, -1};
+    uint64_t outputs[3] = {};
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_send_batch,
+                                      {virthid_test_ptr(batch), batch_len, virthid_test_ptr(status), 4},
+                                      outputs, 3) == kIOReturnSuccess);
+
+    // An unknown handle and a report not matching the descriptor fail on their own.
+    VIRTHID_CHECK(outputs[0] == 4 && outputs[1] == 2 && outputs[2] == 0);
+    VIRTHID_CHECK(status[0] == kIOReturnSuccess);
+    VIRTHID_CHECK(status[1] == kIOReturnNotFound);
+    VIRTHID_CHECK(status[2] == kIOReturnDeviceError);
+    VIRTHID_CHECK(status[3] == kIOReturnSuccess);
+    VIRTHID_CHECK(test.reports() == 2);
+
+    // The records before a truncated one are sent, and the call still succeeds.
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_send_batch,
+                                      {virthid_test_ptr(batch), sizeof(virthid_batch_record) + 16 + 4, 0, 0},
+                                      outputs, 3) == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == 1 && outputs[1] == 0 && outputs[2] == 1);
+    VIRTHID_CHECK(test.reports() == 3);
+
+    // A status array longer than the batch could fill is refused.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_batch,
+                                    {virthid_test_ptr(batch), 16, virthid_test_ptr(status), 4},
+                                    outputs, 3) == kIOReturnBadArgument);
+}
+
+VIRTHID_TEST(bench_send_batch_sizes) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static uint8_t s_batch[1024 * 16];
+    uint32_t reports = virthid_test_iterations(100000);
+    uint32_t failed = 0;
+
+    failed += virthid_bench("send_handle (1 report per call)", reports, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                 {handle, virthid_test_ptr(s_report), sizeof(s_report)}) == kIOReturnSuccess;
+    });
+
+    // Reports per second at growing batch sizes, the cost per call spread over the records.
+    for (uint32_t records = 1; records <= 1024; records *= 8) {
+        uint32_t batch_len = 0;
+        for (uint32_t i = 0; i < records; i++) {
+            batch_len = virthid_batch_append(s_batch, batch_len, handle, s_report, sizeof(s_report));
+        }
+
+        char name[64];
+        uint32_t calls = (reports + records - 1) / records;
+        uint64_t outputs[3];
+        uint64_t start = virthid_test_now();
+
+        for (uint32_t i = 0; i < calls; i++) {
+            if (virthid_test_call(test.client(), it_kotleni_virthid_method_send_batch,
+                                  {virthid_test_ptr(s_batch), batch_len, 0, 0}, outputs, 3) != kIOReturnSuccess ||
+                outputs[1] != 0) {
+                failed++;
+            }
+        }
+
+        snprintf(name, sizeof(name), "send_batch (%u records per call)", records);
+        virthid_bench_report(name, (uint64_t)calls * records, virthid_test_now() - start);
+    }
+
+    VIRTHID_CHECK(failed == 0);
+}
@@ -0,0 +1,282 @@
+//
+//  VirtHID_CoalesceTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "VirtHID_Coalesce.hpp"
+
+/**
+ *  Mouse report of 'virthid_test_mouse': buttons, X, Y and wheel.
+ */
+static void virthid_mouse_report(uint8_t *report, uint8_t buttons, int8_t x, int8_t y, int8_t wheel) {
+    report[0] = buttons;
+    report[1] = (uint8_t)x;
+    report[2] = (uint8_t)y;
+    report[3] = (uint8_t)wheel;
+}
+
+VIRTHID_TEST(motion_merges_deltas) {
+    static virthid_report_layout s_layout;
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+    VIRTHID_CHECK(virthid_has_relative_input(&s_layout));
+
+    uint8_t pending[4], report[4];
+    virthid_mouse_report(pending, 0x01, 10, -20, 1);
+    virthid_mouse_report(report, 0x01, 5, -7, -1);
+
+    VIRTHID_CHECK(virthid_motion_merge(&s_layout, pending, report, 4));
+    VIRTHID_CHECK(pending[0] == 0x01 && (int8_t)pending[1] == 15 && (int8_t)pending[2] == -27 && pending[3] == 0);
+
+    // A button change ends the merge, and so does a sum out of range.
+    virthid_mouse_report(report, 0x00, 1, 1, 0);
+    VIRTHID_CHECK(!virthid_motion_merge(&s_layout, pending, report, 4));
+    virthid_mouse_report(report, 0x01, 120, 0, 0);
+    VIRTHID_CHECK(!virthid_motion_merge(&s_layout, pending, report, 4));
+    virthid_mouse_report(report, 0x01, 0, -120, 0);
+    VIRTHID_CHECK(!virthid_motion_merge(&s_layout, pending, report, 4));
+    VIRTHID_CHECK((int8_t)pending[1] == 15 && (int8_t)pending[2] == -27);
+
+    // Nothing relative in a keyboard report.
+    static virthid_report_layout s_keyboard;
+    VIRTHID_REQUIRE(s_keyboard.parse(virthid_test_keyboard, virthid_test_keyboard_len) == virthid_parse_ok);
+    VIRTHID_CHECK(!virthid_has_relative_input(&s_keyboard));
+
+    uint8_t keys[8] = {};
+    VIRTHID_CHECK(!virthid_motion_merge(&s_keyboard, keys, keys, 8));
+}
+
+VIRTHID_TEST(coalesce_queue_is_bounded) {
+    static virthid_report_layout s_layout;
+    static uint8_t s_storage[virthid_coalesce_depth * 4];
+    virthid_coalesce_queue queue;
+    uint8_t report[4];
+    uint32_t report_len = 0;
+    bool was_empty = false;
+
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+
+    // Nothing is accepted before storage is attached.
+    virthid_mouse_report(report, 0, 1, 0, 0);
+    VIRTHID_CHECK(!queue.submit(&s_layout, report, 4, &was_empty) && was_empty);
+
+    // A merged report keeps the oldest timestamp, latency covers the whole wait.
+    queue.init(s_storage, 4);
+    VIRTHID_CHECK(queue.submit(&s_layout, report, 4, &was_empty, 10) && was_empty);
+    VIRTHID_CHECK(queue.submit(&s_layout, report, 4, &was_empty, 20) && !was_empty);
+    VIRTHID_CHECK(queue.size() == 1);
+
+    // Alternating buttons never merge, the queue fills up.
+    for (uint32_t i = 1; i < virthid_coalesce_depth; i++) {
+        virthid_mouse_report(report, (uint8_t)(i & 1), 1, 0, 0);
+        VIRTHID_CHECK(queue.submit(&s_layout, report, 4, &was_empty));
+    }
+    virthid_mouse_report(report, 0, 1, 0, 0);
+    VIRTHID_CHECK(!queue.submit(&s_layout, report, 4, &was_empty));
+    VIRTHID_CHECK(queue.size() == virthid_coalesce_depth);
+
+    // The last one still takes motion that merges.
+    virthid_mouse_report(report, 1, 1, 0, 0);
+    VIRTHID_CHECK(queue.submit(&s_layout, report, 4, &was_empty));
+
+    uint64_t timestamp = 0;
+    VIRTHID_CHECK(queue.pop(report, &report_len, &timestamp) && report_len == 4 && report[0] == 0 && report[1] == 2);
+    VIRTHID_CHECK(timestamp == 10);
+    for (uint32_t i = 1; i < virthid_coalesce_depth; i++) VIRTHID_CHECK(queue.pop(report, &report_len));
+    VIRTHID_CHECK(report[0] == 1 && report[1] == 2);
+    VIRTHID_CHECK(!queue.pop(report, &report_len));
+}
+
+/**
+ *  Totals of a report stream, which coalescing must preserve.
+ */
+struct virthid_motion_totals {
+    int64_t x;
+    int64_t y;
+    int64_t wheel;
+    uint32_t button_changes;
+    uint8_t buttons;
+    uint32_t reports;
+};
+
+static void virthid_motion_add(virthid_motion_totals *totals, const uint8_t *report) {
+    totals->x += (int8_t)report[1];
+    totals->y += (int8_t)report[2];
+    totals->wheel += (int8_t)report[3];
+    if (report[0] != totals->buttons) totals->button_changes++;
+    totals->buttons = report[0];
+    totals->reports++;
+}
+
+static bool virthid_motion_equal(const virthid_motion_totals *a, const virthid_motion_totals *b) {
+    return a->x == b->x && a->y == b->y && a->wheel == b->wheel &&
+           a->button_changes == b->button_changes && a->buttons == b->buttons;
+}
+
+/**
+ *  A random mouse report, pressing or releasing the first button now and then.
+ */
+static void virthid_random_motion(uint8_t *report, uint8_t *buttons) {
+    if (rand() % 32 == 0) *buttons ^= 0x01;
+    virthid_mouse_report(report, *buttons, (int8_t)(rand() % 31 - 15), (int8_t)(rand() % 31 - 15),
+                         (int8_t)(rand() % 3 - 1));
+}
+
+VIRTHID_TEST(coalescing_loses_no_motion) {
+    static virthid_report_layout s_layout;
+    static uint8_t s_storage[virthid_coalesce_depth * 4];
+    virthid_coalesce_queue queue;
+    virthid_motion_totals submitted = {}, emitted = {};
+    uint8_t report[4];
+    uint32_t report_len = 0;
+    uint8_t buttons = 0;
+    bool was_empty = false;
+
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+    queue.init(s_storage, 4);
+    srand(9);
+
+    // The consumer drains at random, and only when the queue is full otherwise.
+    for (uint32_t i = 0; i < 100000; i++) {
+        virthid_random_motion(report, &buttons);
+
+        while (!queue.submit(&s_layout, report, 4, &was_empty)) {
+            uint8_t popped[4];
+            VIRTHID_REQUIRE(queue.pop(popped, &report_len));
+            virthid_motion_add(&emitted, popped);
+        }
+        virthid_motion_add(&submitted, report);
+
+        if (rand() % 8 == 0) {
+            while (queue.pop(report, &report_len)) virthid_motion_add(&emitted, report);
+        }
+    }
+    while (queue.pop(report, &report_len)) virthid_motion_add(&emitted, report);
+
+    VIRTHID_CHECK(virthid_motion_equal(&submitted, &emitted));
+    VIRTHID_CHECK(emitted.reports < submitted.reports);
+}
+
+static IOReturn virthid_motion_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                      const uint8_t *report, uint32_t report_len) {
+    virthid_motion_totals *totals = (virthid_motion_totals *)context;
+    if (report_len == 4) virthid_motion_add(totals, report);
+    return kIOReturnSuccess;
+}
+
+VIRTHID_TEST(driver_coalesces_relative_devices) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 keyboard = test.create("keyboard");
+    UInt32 mouse = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(keyboard != virthid_invalid_handle && mouse != virthid_invalid_handle);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing, {keyboard, 1})
+                  == kIOReturnUnsupported);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing, {mouse, 1})
+                    == kIOReturnSuccess);
+
+    static virthid_motion_totals s_emitted;
+    virthid_motion_totals submitted = {};
+    s_emitted = {};
+    standin_set_report_handler(&virthid_motion_report, &s_emitted);
+
+    uint8_t report[4];
+    uint8_t buttons = 0;
+    uint32_t rejected = 0;
+    srand(9);
+
+    // Sends race the work loop delivering them; a full queue rejects the report.
+    for (uint32_t i = 0; i < 20000; i++) {
+        virthid_random_motion(report, &buttons);
+        if (virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {mouse},
+                              nullptr, 0, report, sizeof(report)) == kIOReturnSuccess) {
+            virthid_motion_add(&submitted, report);
+        } else {
+            buttons = submitted.buttons;
+            rejected++;
+        }
+    }
+    test.drain();
+
+    VIRTHID_CHECK(virthid_motion_equal(&submitted, &s_emitted));
+    VIRTHID_CHECK(s_emitted.reports <= submitted.reports);
+    printf("    %u reports sent, %u handed to the HID stack, %u rejected\n", submitted.reports,
+           s_emitted.reports, rejected);
+
+    // Disabling delivers what is still pending and returns to direct sends.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing, {mouse, 0})
+                  == kIOReturnSuccess);
+    virthid_mouse_report(report, 0, 1, 1, 0);
+    uint32_t before = s_emitted.reports;
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {mouse},
+                                    nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+    VIRTHID_CHECK(s_emitted.reports == before + 1);
+}
+
+VIRTHID_TEST(unstarted_device_does_not_coalesce) {
+    virthid_parse_result result;
+    it_kotleni_virthid_report_descriptor *descriptor =
+        it_kotleni_virthid_report_descriptor::withBytes(virthid_test_mouse, virthid_test_mouse_len, &result);
+    VIRTHID_REQUIRE(descriptor);
+
+    // Without the work loop source nothing would deliver the queue.
+    it_kotleni_virthid_device *device = OSTypeAlloc(it_kotleni_virthid_device);
+    device->setReportDescriptor(descriptor);
+    VIRTHID_REQUIRE(device->init(nullptr));
+    VIRTHID_CHECK(device->setCoalescing(true) == kIOReturnNotReady);
+
+    device->release();
+    descriptor->release();
+}
+
+VIRTHID_TEST(bench_coalescing_rates) {
+    static virthid_report_layout s_layout;
+    static uint8_t s_storage[virthid_coalesce_depth * 4];
+    virthid_coalesce_queue queue;
+    uint32_t count = virthid_test_iterations(1000000);
+
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+
+    // The consumer takes one report for every 'ratio' submitted, as if the
+    // injector ran that many times faster than the HID event system.
+    for (uint32_t ratio = 1; ratio <= 64; ratio *= 4) {
+        virthid_motion_totals submitted = {}, emitted = {};
+        uint8_t report[4];
+        uint32_t report_len = 0;
+        uint8_t buttons = 0;
+        bool was_empty = false;
+
+        queue.init(s_storage, 4);
+        srand(9);
+
+        uint64_t start = virthid_test_now();
+        for (uint32_t i = 0; i < count; i++) {
+            virthid_random_motion(report, &buttons);
+            while (!queue.submit(&s_layout, report, 4, &was_empty)) {
+                uint8_t popped[4];
+                queue.pop(popped, &report_len);
+                virthid_motion_add(&emitted, popped);
+            }
+            virthid_motion_add(&submitted, report);
+
+            if (i % ratio == 0 && queue.pop(report, &report_len)) virthid_motion_add(&emitted, report);
+        }
+        while (queue.pop(report, &report_len)) virthid_motion_add(&emitted, report);
+
+        char name[64];
+        snprintf(name, sizeof(name), "coalesce (consumer 1/%u)", ratio);
+        virthid_bench_report(name, count, virthid_test_now() - start);
+        printf("    %u submitted, %u emitted (%.1f%%)\n", submitted.reports, emitted.reports,
+               100.0 * emitted.reports / submitted.reports);
+
+        VIRTHID_CHECK(virthid_motion_equal(&submitted, &emitted));
+    }
+}
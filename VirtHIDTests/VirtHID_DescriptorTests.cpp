@@ -0,0 +1,352 @@
+//
+//  VirtHID_DescriptorTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "VirtHID_Descriptor.hpp"
+
+/**
+ *  Keyboard (report 1), consumer control (report 2) and mouse (report 3)
+ *  in one device.
+ */
+static const uint8_t s_composite[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01,                         // Keyboard
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x08, 0x81, 0x02,                                                 //   Modifiers
+    0x95, 0x06, 0x75, 0x08, 0x26, 0xff, 0x00, 0x19, 0x00, 0x2a, 0xff, 0x00,
+    0x81, 0x00,                                                             //   Keys
+    0xc0,
+    0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x02,                         // Consumer control
+    0x15, 0x00, 0x26, 0xff, 0x03, 0x19, 0x00, 0x2a, 0xff, 0x03, 0x75, 0x10,
+    0x95, 0x01, 0x81, 0x00,                                                 //   Usage
+    0xc0,
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x03, 0x09, 0x01, 0xa1, 0x00, // Mouse
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x03, 0x81, 0x02,                                                 //   Buttons
+    0x75, 0x05, 0x95, 0x01, 0x81, 0x03,                                     //   Padding
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08,
+    0x95, 0x02, 0x81, 0x06,                                                 //   X, Y
+    0xc0, 0xc0,
+};
+
+/**
+ *  Gamepad with 16 buttons and two unsigned axes.
+ */
+static const uint8_t s_gamepad[] = {
+    0x05, 0x01, 0x09, 0x05, 0xa1, 0x01,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x10, 0x81, 0x02,                                                 // Buttons
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75,
+    0x08, 0x95, 0x02, 0x81, 0x02,                                           // X, Y
+    0xc0,
+};
+
+/**
+ *  Vendor device with output and feature reports larger than any input report.
+ */
+static const uint8_t s_vendor[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01,
+    0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x95, 0x40, 0x09, 0x01, 0x81, 0x02,                                     // 64 byte input
+    0x96, 0xc8, 0x00, 0x09, 0x02, 0x91, 0x02,                               // 200 byte output
+    0x96, 0x2c, 0x01, 0x09, 0x03, 0xb1, 0x02,                               // 300 byte feature
+    0xc0,
+};
+
+/**
+ *  Globals saved and restored around an item, and a long item to skip.
+ */
+static const uint8_t s_push_pop[] = {
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x75, 0x08,
+    0xa4, 0x75, 0x10, 0x95, 0x01, 0x09, 0x30, 0x81, 0x02, 0xb4,             // 16 bit X
+    0x95, 0x01, 0x09, 0x31, 0x81, 0x02,                                     // 8 bit Y
+    0xfe, 0x02, 0x10, 0xaa, 0xbb,
+    0xc0,
+};
+
+static const uint8_t s_truncated_item[] = {0x05};
+static const uint8_t s_unbalanced[] = {0xc0};
+static const uint8_t s_unclosed[] = {0xa1, 0x01};
+static const uint8_t s_report_size_zero[] = {0x75, 0x00};
+static const uint8_t s_report_size_large[] = {0x75, 0x21};
+static const uint8_t s_report_id_zero[] = {0x85, 0x00};
+static const uint8_t s_report_id_late[] = {0x75, 0x08, 0x95, 0x01, 0x81, 0x02, 0x85, 0x01};
+static const uint8_t s_pop_empty[] = {0xb4};
+static const uint8_t s_push_deep[] = {0xa4, 0xa4, 0xa4, 0xa4, 0xa4};
+static const uint8_t s_reserved_type[] = {0x0c};
+static const uint8_t s_unknown_main[] = {0x00};
+static const uint8_t s_report_too_long[] = {0x75, 0x20, 0x96, 0xff, 0xff, 0x81, 0x02};
+static const uint8_t s_long_item_truncated[] = {0xfe, 0x04, 0x10, 0xaa};
+
+struct virthid_corpus_entry {
+    const char *name;
+    const uint8_t *descriptor;
+    uint32_t descriptor_len;
+
+    virthid_parse_result result;
+    virthid_device_class device_class;
+    uint32_t report_count;
+    bool uses_ids;
+    uint32_t max_length[virthid_report_type_count];
+};
+
+#define VIRTHID_CORPUS(name) #name, s_##name, sizeof(s_##name)
+
+static const virthid_corpus_entry s_corpus[] = {
+    {"keyboard", virthid_test_keyboard, virthid_test_keyboard_len,
+     virthid_parse_ok, virthid_class_keyboard, 2, false, {8, 1, 0}},
+    {"mouse", virthid_test_mouse, virthid_test_mouse_len,
+     virthid_parse_ok, virthid_class_mouse, 1, false, {4, 0, 0}},
+    {VIRTHID_CORPUS(composite), virthid_parse_ok, virthid_class_keyboard, 3, true, {8, 0, 0}},
+    {VIRTHID_CORPUS(gamepad), virthid_parse_ok, virthid_class_gamepad, 1, false, {4, 0, 0}},
+    {VIRTHID_CORPUS(vendor), virthid_parse_ok, virthid_class_other, 3, false, {64, 200, 300}},
+    {VIRTHID_CORPUS(push_pop), virthid_parse_ok, virthid_class_mouse, 1, false, {3, 0, 0}},
+    {VIRTHID_CORPUS(truncated_item), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(unbalanced), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(unclosed), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(report_size_zero), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(report_size_large), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(report_id_zero), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(report_id_late), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(pop_empty), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(push_deep), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(reserved_type), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(unknown_main), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(report_too_long), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+    {VIRTHID_CORPUS(long_item_truncated), virthid_parse_malformed, virthid_class_other, 0, false, {}},
+};
+
+static const uint32_t s_corpus_count = sizeof(s_corpus) / sizeof(s_corpus[0]);
+
+VIRTHID_TEST(parser_corpus) {
+    static virthid_report_layout s_layout;
+
+    for (uint32_t i = 0; i < s_corpus_count; i++) {
+        const virthid_corpus_entry *entry = &s_corpus[i];
+        virthid_parse_result result = s_layout.parse(entry->descriptor, entry->descriptor_len);
+
+        if (result != entry->result) {
+            printf("    %s: parsed as %d, expected %d\n", entry->name, result, entry->result);
+            VIRTHID_CHECK(result == entry->result);
+            continue;
+        }
+
+        if (result != virthid_parse_ok) {
+            VIRTHID_CHECK(!s_layout.isValid());
+            continue;
+        }
+
+        VIRTHID_CHECK(s_layout.isValid() && s_layout.hasAllFields());
+        VIRTHID_CHECK(s_layout.deviceClass() == entry->device_class);
+        VIRTHID_CHECK(s_layout.reportCount() == entry->report_count);
+        VIRTHID_CHECK(s_layout.usesReportIds() == entry->uses_ids);
+        for (uint8_t type = 0; type < virthid_report_type_count; type++) {
+            VIRTHID_CHECK(s_layout.maxReportLength(type) == entry->max_length[type]);
+        }
+    }
+}
+
+VIRTHID_TEST(parser_lays_out_report_ids) {
+    static virthid_report_layout s_layout;
+    VIRTHID_REQUIRE(s_layout.parse(s_composite, sizeof(s_composite)) == virthid_parse_ok);
+
+    const virthid_report_info *keyboard = s_layout.find(virthid_report_input, 1);
+    const virthid_report_info *consumer = s_layout.find(virthid_report_input, 2);
+    const virthid_report_info *mouse = s_layout.find(virthid_report_input, 3);
+    VIRTHID_REQUIRE(keyboard && consumer && mouse);
+    VIRTHID_CHECK(keyboard->length == 8 && consumer->length == 3 && mouse->length == 4);
+    VIRTHID_CHECK(s_layout.find(virthid_report_input, 4) == nullptr);
+    VIRTHID_CHECK(s_layout.find(virthid_report_output, 1) == nullptr);
+
+    // Offsets count the report ID, padding gets no field.
+    uint32_t element = 0;
+    const virthid_field *y = s_layout.findField(mouse, 0x01, 0x31, &element);
+    VIRTHID_REQUIRE(y);
+    VIRTHID_CHECK(element == 1 && y->bit_offset == 16 && y->bit_size == 8);
+    VIRTHID_CHECK(y->flags == (virthid_field_variable | virthid_field_relative));
+    VIRTHID_CHECK(mouse->field_count == 2);
+
+    const virthid_field *button = s_layout.findField(mouse, 0x09, 3, &element);
+    VIRTHID_REQUIRE(button);
+    VIRTHID_CHECK(element == 2 && button->bit_offset == 8 && button->count == 3);
+
+    const virthid_field *keys = s_layout.findField(keyboard, 0x07, 0x04, &element);
+    VIRTHID_REQUIRE(keys);
+    VIRTHID_CHECK(element == 0 && !(keys->flags & virthid_field_variable) && keys->count == 6);
+
+    // Reports are checked by ID and exact length.
+    uint8_t report[8] = {3, 0x01, 0xff, 0x01};
+    VIRTHID_CHECK(s_layout.validate(virthid_report_input, report, 4));
+    VIRTHID_CHECK(!s_layout.validate(virthid_report_input, report, 3));
+    report[0] = 2;
+    VIRTHID_CHECK(s_layout.validate(virthid_report_input, report, 3));
+    report[0] = 4;
+    VIRTHID_CHECK(!s_layout.validate(virthid_report_input, report, 4));
+    VIRTHID_CHECK(!s_layout.validate(virthid_report_input, report, 0));
+}
+
+VIRTHID_TEST(parser_reads_and_writes_fields) {
+    static virthid_report_layout s_layout;
+    VIRTHID_REQUIRE(s_layout.parse(s_composite, sizeof(s_composite)) == virthid_parse_ok);
+
+    uint8_t report[8] = {3};
+    uint32_t element = 0;
+
+    // Signed relative axes.
+    const virthid_field *y = s_layout.findField(s_layout.find(virthid_report_input, 3), 0x01, 0x31, &element);
+    VIRTHID_REQUIRE(y);
+    virthid_field_set(y, report, -5, element);
+    VIRTHID_CHECK(report[3] == 0xfb);
+    VIRTHID_CHECK(virthid_field_get(y, report, element) == -5);
+
+    // Single bits leave their neighbours alone.
+    const virthid_field *button = s_layout.findField(s_layout.find(virthid_report_input, 3), 0x09, 2, &element);
+    VIRTHID_REQUIRE(button);
+    virthid_field_set(button, report, 1, element);
+    VIRTHID_CHECK(report[1] == 0x02 && report[3] == 0xfb);
+    virthid_field_set(button, report, 0, element);
+    VIRTHID_CHECK(report[1] == 0x00);
+
+    // A 10 bit range in 16 bits stays unsigned.
+    const virthid_field *usage = s_layout.findField(s_layout.find(virthid_report_input, 2), 0x0c, 0xe9, &element);
+    VIRTHID_REQUIRE(usage);
+    memset(report, 0, sizeof(report));
+    virthid_field_set(usage, report, 0x3ff, element);
+    VIRTHID_CHECK(report[1] == 0xff && report[2] == 0x03);
+    VIRTHID_CHECK(virthid_field_get(usage, report, element) == 0x3ff);
+}
+
+VIRTHID_TEST(parser_enforces_limits) {
+    static virthid_report_layout s_layout;
+    static uint8_t s_descriptor[1024];
+    uint32_t length = 0;
+
+    // One report ID more than a layout holds.
+    for (uint32_t id = 1; id <= virthid_max_reports + 1; id++) {
+        const uint8_t item[] = {0x85, (uint8_t)id, 0x75, 0x08, 0x95, 0x01, 0x81, 0x02};
+        memcpy(s_descriptor + length, item, sizeof(item));
+        length += sizeof(item);
+    }
+    VIRTHID_CHECK(s_layout.parse(s_descriptor, length) == virthid_parse_too_complex);
+    VIRTHID_CHECK(!s_layout.isValid());
+
+    // Fields past the limit are dropped, the reports still validate.
+    const uint8_t globals[] = {0x75, 0x01, 0x95, 0x01};
+    memcpy(s_descriptor, globals, sizeof(globals));
+    length = sizeof(globals);
+    for (uint32_t i = 0; i < virthid_max_fields + 1; i++) {
+        const uint8_t item[] = {0x09, 0x01, 0x81, 0x02};
+        memcpy(s_descriptor + length, item, sizeof(item));
+        length += sizeof(item);
+    }
+    VIRTHID_CHECK(s_layout.parse(s_descriptor, length) == virthid_parse_ok);
+    VIRTHID_CHECK(!s_layout.hasAllFields() && s_layout.fieldCount() == virthid_max_fields);
+    VIRTHID_CHECK(s_layout.maxReportLength(virthid_report_input) == (virthid_max_fields + 1 + 7) / 8);
+}
+
+VIRTHID_TEST(parser_survives_mutations) {
+    static virthid_report_layout s_layout;
+    static uint8_t s_descriptor[256];
+    uint32_t rounds = virthid_test_iterations(20000);
+    uint32_t inconsistent = 0;
+
+    srand(1);
+
+    // Random bytes flipped in, or cut from, every valid corpus entry. Run
+    // under AddressSanitizer to catch reads past the descriptor.
+    for (uint32_t round = 0; round < rounds; round++) {
+        const virthid_corpus_entry *entry = &s_corpus[round % s_corpus_count];
+        if (entry->result != virthid_parse_ok) continue;
+
+        uint32_t length = entry->descriptor_len;
+        memcpy(s_descriptor, entry->descriptor, length);
+
+        for (int flips = rand() % 4; flips >= 0; flips--) s_descriptor[rand() % length] = (uint8_t)rand();
+        if (rand() & 1) length = rand() % length;
+
+        uint8_t *descriptor = (uint8_t *)malloc(length ? length : 1);
+        memcpy(descriptor, s_descriptor, length);
+        virthid_parse_result result = s_layout.parse(descriptor, length);
+        free(descriptor);
+
+        if (result != virthid_parse_ok) continue;
+
+        for (uint32_t i = 0; i < s_layout.reportCount(); i++) {
+            const virthid_report_info *info = s_layout.report(i);
+            if (info->length > s_layout.maxReportLength(info->type) ||
+                s_layout.find(info->type, info->id) != info) {
+                inconsistent++;
+            }
+        }
+    }
+
+    VIRTHID_CHECK(inconsistent == 0);
+}
+
+VIRTHID_TEST(driver_classifies_devices) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 composite = test.create("composite", s_composite, sizeof(s_composite));
+    UInt32 mouse = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    UInt32 gamepad = test.create("gamepad", s_gamepad, sizeof(s_gamepad));
+    VIRTHID_REQUIRE(composite && mouse && gamepad);
+
+    const char *expected[] = {"Keyboard", "Mouse", nullptr};
+    UInt32 handles[] = {composite, mouse, gamepad};
+    for (uint32_t i = 0; i < 3; i++) {
+        OSObject *property = test.device(handles[i])->copyProperty("HIDDefaultBehavior");
+        OSString *behavior = OSDynamicCast(OSString, property);
+
+        if (expected[i]) {
+            VIRTHID_CHECK(behavior && behavior->isEqualTo(expected[i]));
+        } else {
+            VIRTHID_CHECK(property == nullptr);
+        }
+        if (property) property->release();
+    }
+
+    // Every report ID of a composite device goes through, at its own length.
+    const uint8_t consumer[3] = {2, 0xe9, 0x00};
+    const uint8_t pointer[4] = {3, 0x01, 0x05, 0xfb};
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {composite},
+                                    nullptr, 0, consumer, sizeof(consumer)) == kIOReturnSuccess);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {composite},
+                                    nullptr, 0, pointer, sizeof(pointer)) == kIOReturnSuccess);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {composite},
+                                    nullptr, 0, pointer, sizeof(consumer)) == kIOReturnDeviceError);
+    VIRTHID_CHECK(test.reports() == 2);
+}
+
+VIRTHID_TEST(bench_parse) {
+    static virthid_report_layout s_layout;
+    uint32_t iterations = virthid_test_iterations(100000);
+    uint32_t failed = 0;
+
+    for (uint32_t i = 0; i < s_corpus_count; i++) {
+        const virthid_corpus_entry *entry = &s_corpus[i];
+        if (entry->result != virthid_parse_ok) continue;
+
+        char name[64];
+        snprintf(name, sizeof(name), "parse %s (%u bytes)", entry->name, entry->descriptor_len);
+        failed += virthid_bench(name, iterations, [&](uint32_t i) {
+            return s_layout.parse(entry->descriptor, entry->descriptor_len) == virthid_parse_ok;
+        });
+    }
+
+    // What every send pays for it.
+    VIRTHID_REQUIRE(s_layout.parse(s_composite, sizeof(s_composite)) == virthid_parse_ok);
+    const uint8_t report[4] = {3, 0x01, 0x05, 0xfb};
+    failed += virthid_bench("validate", iterations, [&](uint32_t i) {
+        return s_layout.validate(virthid_report_input, report, sizeof(report));
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
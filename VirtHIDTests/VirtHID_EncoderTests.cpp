@@ -0,0 +1,332 @@
+//
+//  VirtHID_EncoderTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "VirtHID_Encoder.hpp"
+
+/**
+ *  Gamepad with 16 buttons and two unsigned axes.
+ */
+static const uint8_t s_gamepad[] = {
+    0x05, 0x01, 0x09, 0x05, 0xa1, 0x01,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x10, 0x81, 0x02,                                                 // Buttons
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75,
+    0x08, 0x95, 0x02, 0x81, 0x02,                                           // X, Y
+    0xc0,
+};
+
+/**
+ *  Keyboard and mouse behind report IDs 1 and 2, the mouse with 16-bit axes.
+ */
+static const uint8_t s_composite[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01,                         // Keyboard
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x08, 0x81, 0x02,                                                 //   Modifiers
+    0x95, 0x06, 0x75, 0x08, 0x26, 0xff, 0x00, 0x19, 0x00, 0x2a, 0xff, 0x00,
+    0x81, 0x00,                                                             //   Keys
+    0xc0,
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xa1, 0x00, // Mouse
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x05, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x05, 0x81, 0x02,                                                 //   Buttons
+    0x75, 0x03, 0x95, 0x01, 0x81, 0x03,                                     //   Padding
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xff, 0x7f,
+    0x75, 0x10, 0x95, 0x02, 0x81, 0x06,                                     //   X, Y
+    0xc0, 0xc0,
+};
+
+/**
+ *  Collects what an encoder delivers.
+ */
+struct virthid_test_sink {
+    uint8_t reports[64][virthid_max_report];
+    uint32_t lengths[64];
+    uint32_t count = 0;
+
+    bool send(const uint8_t *report, uint32_t report_len) {
+        if (count == 64) return false;
+        memcpy(reports[count], report, report_len);
+        lengths[count++] = report_len;
+        return true;
+    }
+
+    bool matches(uint32_t index, const uint8_t *expected, uint32_t expected_len) const {
+        return index < count && lengths[index] == expected_len && memcmp(reports[index], expected, expected_len) == 0;
+    }
+};
+
+VIRTHID_TEST(encoder_packs_boot_mouse) {
+    static virthid_report_layout s_layout;
+    static virthid_encoder s_encoder;
+    static virthid_test_sink s_sink;
+
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_encoder.init(&s_layout));
+    VIRTHID_CHECK(s_encoder.kind() == virthid_encoder_boot_mouse);
+
+    // Motion adds up to the sync and is clamped, buttons hold.
+    const virthid_input_event events[] = {
+        {virthid_input_move, 0, 0, 3, -2},
+        {virthid_input_button, 0, 1, 1, 0},
+        {virthid_input_move, 0, 0, 100, -100},
+        {virthid_input_move, 0, 0, 100, 0},
+        {virthid_input_sync, 0, 0, 0, 0},
+        {virthid_input_scroll, 0, 0, -1, 0},
+        {virthid_input_button, 0, 4, 1, 0},
+    };
+    VIRTHID_CHECK(s_encoder.encode(events, 7, s_sink) == 2);
+    const uint8_t moved[4] = {0x01, 127, (uint8_t)-102, 0};
+    const uint8_t scrolled[4] = {0x01, 0, 0, 0xff};
+    VIRTHID_CHECK(s_sink.matches(0, moved, 4) && s_sink.matches(1, scrolled, 4));
+
+    // A button change is delivered, the same change again is not.
+    const virthid_input_event release[] = {{virthid_input_button, 0, 1, 0, 0}};
+    VIRTHID_CHECK(s_encoder.encode(release, 1, s_sink) == 1);
+    VIRTHID_CHECK(s_encoder.encode(release, 1, s_sink) == 0);
+    const uint8_t rest[4] = {};
+    VIRTHID_CHECK(s_sink.matches(2, rest, 4));
+
+    // Split across calls, the sync comes with the last one.
+    const virthid_input_event half[] = {{virthid_input_move, 0, 0, 5, 5}};
+    VIRTHID_CHECK(s_encoder.encode(half, 1, s_sink, false) == 0);
+    VIRTHID_CHECK(s_encoder.encode(half, 1, s_sink) == 1);
+    const uint8_t ten[4] = {0, 10, 10, 0};
+    VIRTHID_CHECK(s_sink.matches(3, ten, 4));
+}
+
+VIRTHID_TEST(encoder_packs_through_fields) {
+    static virthid_report_layout s_layout;
+    static virthid_encoder s_encoder;
+    static virthid_test_sink s_sink;
+
+    // Absolute axes and more buttons than a boot mouse has.
+    VIRTHID_REQUIRE(s_layout.parse(s_gamepad, sizeof(s_gamepad)) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_encoder.init(&s_layout));
+    VIRTHID_CHECK(s_encoder.kind() == virthid_encoder_generic);
+
+    const virthid_input_event pad[] = {
+        {virthid_input_button, 0, 16, 1, 0},
+        {virthid_input_axis, 0, virthid_usage_x, 200, 0},
+        {virthid_input_axis, 0, virthid_usage_y, 300, 0},
+        {virthid_input_sync, 0, 0, 0, 0},
+        {virthid_input_axis, 0, virthid_usage_x, 200, 0},
+    };
+    VIRTHID_CHECK(s_encoder.encode(pad, 5, s_sink) == 1);
+    const uint8_t state[4] = {0x00, 0x80, 200, 255};
+    VIRTHID_CHECK(s_sink.matches(0, state, 4));
+
+    // Keys and motion land in the report with their ID.
+    s_sink.count = 0;
+    VIRTHID_REQUIRE(s_layout.parse(s_composite, sizeof(s_composite)) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_encoder.init(&s_layout));
+    VIRTHID_CHECK(s_encoder.kind() == virthid_encoder_generic);
+
+    const virthid_input_event mixed[] = {
+        {virthid_input_key, 0, 0xe0, 1, 0},
+        {virthid_input_key, 0, 0x06, 1, 0},
+        {virthid_input_move, 0, 0, 1000, -20000},
+        {virthid_input_button, 0, 5, 1, 0},
+    };
+    VIRTHID_CHECK(s_encoder.encode(mixed, 4, s_sink) == 2);
+    const uint8_t mouse[6] = {2, 0x10, 0xe8, 0x03, 0xe0, 0xb1};
+    const uint8_t keys[8] = {1, 0x01, 0x06};
+    VIRTHID_CHECK(s_sink.matches(0, mouse, 6) && s_sink.matches(1, keys, 8));
+
+    // A layout nothing maps to.
+    static const uint8_t s_vendor[] = {
+        0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+        0x95, 0x08, 0x09, 0x01, 0x81, 0x02, 0xc0,
+    };
+    VIRTHID_REQUIRE(s_layout.parse(s_vendor, sizeof(s_vendor)) == virthid_parse_ok);
+    VIRTHID_CHECK(!s_encoder.init(&s_layout) && s_encoder.kind() == virthid_encoder_none);
+    VIRTHID_CHECK(s_encoder.encode(mixed, 4, s_sink) == 0);
+}
+
+/**
+ *  Random events of the kinds a layout handles.
+ */
+static void virthid_encoder_random(virthid_input_event *events, uint32_t count, bool keyboard) {
+    for (uint32_t i = 0; i < count; i++) {
+        virthid_input_event &e = events[i];
+        e = {};
+
+        if (rand() % 4 == 0) {
+            e.type = virthid_input_sync;
+        } else if (keyboard) {
+            e.type = virthid_input_key;
+            e.code = (uint16_t)(rand() % 2 ? 0xe0 + rand() % 8 : 0x04 + rand() % 12);
+            e.value = (int16_t)(rand() % 2);
+        } else {
+            e.type = (uint8_t)(virthid_input_move + rand() % 3);
+            e.code = (uint16_t)(1 + rand() % 5);
+            e.value = (int16_t)(rand() % 301 - 150);
+            e.value2 = (int16_t)(rand() % 301 - 150);
+            if (e.type == virthid_input_button) e.value = (int16_t)(rand() % 2);
+        }
+    }
+}
+
+VIRTHID_TEST(encoder_specialized_matches_generic) {
+    static virthid_report_layout s_layout;
+    static virthid_encoder s_fast, s_generic;
+    static virthid_test_sink s_fast_sink, s_generic_sink;
+    virthid_input_event events[32];
+    uint32_t differ = 0;
+
+    const struct {
+        const uint8_t *descriptor;
+        uint16_t descriptor_len;
+        virthid_encoder_kind kind;
+    } devices[] = {
+        {virthid_test_mouse, virthid_test_mouse_len, virthid_encoder_boot_mouse},
+        {virthid_test_keyboard, virthid_test_keyboard_len, virthid_encoder_boot_keyboard},
+    };
+
+    // The fast paths are only a shortcut: the same events, the same reports.
+    srand(23);
+    for (const auto &device : devices) {
+        VIRTHID_REQUIRE(s_layout.parse(device.descriptor, device.descriptor_len) == virthid_parse_ok);
+        VIRTHID_REQUIRE(s_fast.init(&s_layout) && s_fast.kind() == device.kind);
+        VIRTHID_REQUIRE(s_generic.init(&s_layout, false) && s_generic.kind() == virthid_encoder_generic);
+
+        for (uint32_t round = 0; round < 2000; round++) {
+            virthid_encoder_random(events, 32, device.kind == virthid_encoder_boot_keyboard);
+            s_fast_sink.count = 0;
+            s_generic_sink.count = 0;
+
+            uint32_t fast = s_fast.encode(events, 32, s_fast_sink);
+            uint32_t generic = s_generic.encode(events, 32, s_generic_sink);
+            if (fast != generic) {
+                differ++;
+                continue;
+            }
+            for (uint32_t r = 0; r < fast; r++) {
+                if (!s_fast_sink.matches(r, s_generic_sink.reports[r], s_generic_sink.lengths[r])) differ++;
+            }
+        }
+    }
+
+    VIRTHID_CHECK(differ == 0);
+}
+
+/**
+ *  Last report the HID stack got, and how many.
+ */
+struct virthid_encoder_reports {
+    uint8_t last[virthid_max_report];
+    uint32_t count;
+};
+
+static IOReturn virthid_encoder_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                       const uint8_t *report, uint32_t report_len) {
+    virthid_encoder_reports *reports = (virthid_encoder_reports *)context;
+
+    memcpy(reports->last, report, report_len < virthid_max_report ? report_len : virthid_max_report);
+    reports->count++;
+    return kIOReturnSuccess;
+}
+
+VIRTHID_TEST(driver_encodes_event_stream) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 mouse = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    UInt32 gamepad = test.create("gamepad", s_gamepad, sizeof(s_gamepad));
+    VIRTHID_REQUIRE(mouse != virthid_invalid_handle && gamepad != virthid_invalid_handle);
+
+    virthid_encoder_reports reports = {};
+    standin_set_report_handler(&virthid_encoder_report, &reports);
+
+    const virthid_input_event events[] = {
+        {virthid_input_move, 0, 0, 3, -2},
+        {virthid_input_button, 0, 1, 1, 0},
+        {virthid_input_sync, 0, 0, 0, 0},
+        {virthid_input_button, 0, 1, 0, 0},
+    };
+    uint64_t sent = 0;
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_events, {mouse}, &sent, 1,
+                                    events, sizeof(events)) == kIOReturnSuccess);
+    test.drain();
+    VIRTHID_CHECK(sent == 2 && reports.count == 2);
+    const uint8_t released[4] = {};
+    VIRTHID_CHECK(memcmp(reports.last, released, 4) == 0);
+
+    const virthid_input_event axis[] = {{virthid_input_axis, 0, virthid_usage_y, 77, 0}};
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_events, {gamepad}, &sent, 1,
+                                    axis, sizeof(axis)) == kIOReturnSuccess);
+    test.drain();
+    VIRTHID_CHECK(sent == 1 && reports.last[3] == 77);
+
+    // Only whole events, and only to devices that exist.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_events, {mouse}, &sent, 1,
+                                    events, sizeof(events) - 1) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_events, {gamepad + 1}, &sent, 1,
+                                    events, sizeof(events)) == kIOReturnNotFound);
+}
+
+/**
+ *  Counts reports without keeping them.
+ */
+struct virthid_count_sink {
+    uint32_t count = 0;
+
+    bool send(const uint8_t *report, uint32_t report_len) {
+        count++;
+        return true;
+    }
+};
+
+VIRTHID_TEST(bench_encoders) {
+    static virthid_report_layout s_layout;
+    static virthid_encoder s_encoder;
+    static virthid_input_event s_mouse[64], s_keys[64];
+    uint32_t count = virthid_test_iterations(100000);
+    uint32_t failed = 0;
+
+    // Motion synced every three moves, and sixteen keystrokes: 64 events per call.
+    for (uint32_t i = 0; i < 64; i++) {
+        s_mouse[i] = i % 4 == 3 ? virthid_input_event{virthid_input_sync, 0, 0, 0, 0}
+                                : virthid_input_event{virthid_input_move, 0, 0, (int16_t)(i % 7 - 3), 1};
+        s_keys[i] = i % 2 ? virthid_input_event{virthid_input_sync, 0, 0, 0, 0}
+                          : virthid_input_event{virthid_input_key, 0, (uint16_t)(0x04 + i / 4), (int16_t)(i % 4 == 0), 0};
+    }
+
+    const struct {
+        const char *name;
+        const uint8_t *descriptor;
+        uint16_t descriptor_len;
+        const virthid_input_event *events;
+    } devices[] = {
+        {"mouse", virthid_test_mouse, virthid_test_mouse_len, s_mouse},
+        {"keyboard", virthid_test_keyboard, virthid_test_keyboard_len, s_keys},
+    };
+
+    for (const auto &device : devices) {
+        VIRTHID_REQUIRE(s_layout.parse(device.descriptor, device.descriptor_len) == virthid_parse_ok);
+
+        for (bool fast : {true, false}) {
+            char name[64];
+            virthid_count_sink sink;
+
+            VIRTHID_REQUIRE(s_encoder.init(&s_layout, fast));
+            snprintf(name, sizeof(name), "encode 64 events (%s, %s)", device.name, fast ? "specialized" : "generic");
+
+            uint64_t start = virthid_test_now();
+            failed += virthid_bench(name, count, [&](uint32_t i) {
+                return s_encoder.encode(device.events, 64, sink) > 0;
+            });
+            uint64_t elapsed = virthid_test_now() - start;
+            printf("    %.1f million events per second\n", 64.0 * count * 1000.0 / (double)elapsed);
+        }
+    }
+
+    VIRTHID_CHECK(failed == 0);
+}
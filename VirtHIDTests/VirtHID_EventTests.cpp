@@ -0,0 +1,237 @@
+//
+//  VirtHID_EventTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_Events.hpp"
+
+typedef virthid_event_queue<8> virthid_test_event_queue;
+
+/**
+ *  Push an event named after its handle.
+ */
+static bool virthid_event_push(virthid_test_event_queue *queue, uint32_t type, uint32_t handle, bool *was_empty) {
+    char name[16];
+    int name_len = snprintf(name, sizeof(name), "device %u", handle);
+    return queue->push(type, handle, name, (uint8_t)name_len, was_empty);
+}
+
+/**
+ *  Check the records of a batch against the events expected next.
+ *
+ *  @return The number of records matching, counting on from 'next'.
+ */
+static uint32_t virthid_event_check(const uint8_t *buf, uint32_t used, uint32_t type, uint32_t *next) {
+    virthid_event_reader reader(buf, used);
+    virthid_event_record record;
+    const char *name = nullptr;
+    uint32_t matched = 0;
+
+    while (reader.next(&record, &name) > 0) {
+        char expected[16];
+        int expected_len = snprintf(expected, sizeof(expected), "device %u", *next);
+        if (record.type != type || record.handle != *next || record.name_len != expected_len ||
+            memcmp(name, expected, expected_len) != 0) {
+            break;
+        }
+        (*next)++;
+        matched++;
+    }
+
+    return matched;
+}
+
+VIRTHID_TEST(event_queue_keeps_order) {
+    static virthid_test_event_queue s_queue;
+    uint8_t buf[256];
+    uint32_t used = 0, next = 0;
+    bool was_empty = false;
+
+    s_queue.reset();
+    VIRTHID_CHECK(s_queue.drain(buf, sizeof(buf), &used) == 0 && used == 0);
+
+    // Only the first pending event calls for a notification.
+    for (uint32_t i = 0; i < 6; i++) {
+        VIRTHID_CHECK(virthid_event_push(&s_queue, virthid_event_created, i, &was_empty));
+        VIRTHID_CHECK(was_empty == (i == 0));
+    }
+    VIRTHID_CHECK(s_queue.pending() == 6);
+
+    // Batches as large as the buffer allows, a record never split.
+    uint32_t count = s_queue.drain(buf, 2 * virthid_event_record_size(8) + 4, &used);
+    VIRTHID_CHECK(count == 2 && used == 2 * virthid_event_record_size(8));
+    VIRTHID_CHECK(virthid_event_check(buf, used, virthid_event_created, &next) == 2);
+
+    // Pushed while others are still pending, so no notification.
+    VIRTHID_CHECK(virthid_event_push(&s_queue, virthid_event_created, 6, &was_empty) && !was_empty);
+
+    count = s_queue.drain(buf, sizeof(buf), &used);
+    VIRTHID_CHECK(count == 5 && virthid_event_check(buf, used, virthid_event_created, &next) == 5);
+    VIRTHID_CHECK(s_queue.pending() == 0 && next == 7);
+
+    VIRTHID_CHECK(virthid_event_push(&s_queue, virthid_event_destroyed, 7, &was_empty) && was_empty);
+    VIRTHID_CHECK(s_queue.drain(buf, sizeof(buf), &used) == 1);
+    VIRTHID_CHECK(virthid_event_check(buf, used, virthid_event_destroyed, &next) == 1);
+}
+
+VIRTHID_TEST(event_queue_overflows_to_a_marker) {
+    static virthid_test_event_queue s_queue;
+    uint8_t buf[512];
+    uint32_t used = 0;
+    bool was_empty = false;
+
+    s_queue.reset();
+    for (uint32_t i = 0; i < 8; i++) VIRTHID_CHECK(virthid_event_push(&s_queue, virthid_event_created, i, &was_empty));
+
+    // The ninth event replaces everything pending with the marker, later ones queue behind it.
+    VIRTHID_CHECK(!virthid_event_push(&s_queue, virthid_event_created, 8, &was_empty) && !was_empty);
+    VIRTHID_CHECK(s_queue.pending() == 1);
+    VIRTHID_CHECK(virthid_event_push(&s_queue, virthid_event_destroyed, 9, &was_empty) && !was_empty);
+    VIRTHID_CHECK(virthid_event_push(&s_queue, virthid_event_destroyed, 10, &was_empty));
+    VIRTHID_CHECK(s_queue.pending() == 3);
+
+    // Not even the marker fits, nothing is lost.
+    VIRTHID_CHECK(s_queue.drain(buf, sizeof(virthid_event_record) - 1, &used) == 0 && used == 0);
+    VIRTHID_CHECK(s_queue.pending() == 3);
+
+    virthid_event_record record;
+    const char *name = nullptr;
+    uint32_t next = 9;
+
+    VIRTHID_CHECK(s_queue.drain(buf, sizeof(buf), &used) == 3);
+    virthid_event_reader reader(buf, used);
+    VIRTHID_CHECK(reader.next(&record, &name) == 1 && record.type == virthid_event_overflow && record.name_len == 0);
+    VIRTHID_CHECK(virthid_event_check(buf + sizeof(record), used - sizeof(record), virthid_event_destroyed, &next) == 2);
+    VIRTHID_CHECK(s_queue.pending() == 0);
+
+    // A queue that overflows again only ever holds one marker: 24 events
+    // overflow at the 9th and the 18th, leaving the marker and 6 events.
+    for (uint32_t i = 0; i < 3 * 8; i++) virthid_event_push(&s_queue, virthid_event_created, i, &was_empty);
+    VIRTHID_CHECK(s_queue.drain(buf, sizeof(buf), &used) == 1 + 6);
+
+    virthid_event_reader truncated(buf, sizeof(record) + 3);
+    VIRTHID_CHECK(truncated.next(&record, &name) == 1 && truncated.next(&record, &name) == -1);
+}
+
+/**
+ *  Read every pending registry event of a client.
+ *
+ *  @return The number of records read, with the batch in 'buf'.
+ */
+static uint32_t virthid_event_read(it_kotleni_virthid_userclient *client, uint8_t *buf, uint32_t buf_len,
+                                   uint32_t *used, uint32_t *pending) {
+    uint64_t outputs[3] = {};
+
+    if (virthid_test_call(client, it_kotleni_virthid_method_read_events, {virthid_test_ptr(buf), buf_len},
+                          outputs, 3) != kIOReturnSuccess) {
+        return 0;
+    }
+
+    *used = (uint32_t)outputs[1];
+    *pending = (uint32_t)outputs[2];
+    return (uint32_t)outputs[0];
+}
+
+VIRTHID_TEST(driver_pushes_registry_events) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    it_kotleni_virthid_userclient *monitor = test.openClient();
+    VIRTHID_REQUIRE(monitor);
+
+    OSAsyncReference64 async = {};
+    VIRTHID_REQUIRE(virthid_test_call(monitor, it_kotleni_virthid_method_subscribe_events, {},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess);
+
+    static uint8_t s_events[virthid_event_queue_size * virthid_event_max_record];
+    UInt32 handles[3];
+    uint32_t used = 0, pending = 0;
+
+    handles[0] = test.create("keyboard");
+    handles[1] = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    handles[2] = test.create("keyboard 2");
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy,
+                                    {virthid_test_ptr("mouse"), 5}) == kIOReturnSuccess);
+    test.drain();
+
+    // One notification for the whole batch.
+    VIRTHID_CHECK(test.asyncResults() == 1);
+
+    VIRTHID_REQUIRE(virthid_event_read(monitor, s_events, sizeof(s_events), &used, &pending) == 4);
+    VIRTHID_CHECK(pending == 0);
+
+    const struct {
+        uint32_t type;
+        UInt32 handle;
+        const char *name;
+    } expected[] = {
+        {virthid_event_created, handles[0], "keyboard"},
+        {virthid_event_created, handles[1], "mouse"},
+        {virthid_event_created, handles[2], "keyboard 2"},
+        {virthid_event_destroyed, handles[1], "mouse"},
+    };
+
+    virthid_event_reader reader(s_events, used);
+    virthid_event_record record;
+    const char *name = nullptr;
+    for (const auto &e : expected) {
+        VIRTHID_REQUIRE(reader.next(&record, &name) == 1);
+        VIRTHID_CHECK(record.type == e.type && record.handle == e.handle);
+        VIRTHID_CHECK(record.name_len == strlen(e.name) && memcmp(name, e.name, record.name_len) == 0);
+    }
+    VIRTHID_CHECK(reader.next(&record, &name) == 0);
+
+    // Nobody reading: past the queue size the client is told to resync.
+    for (uint32_t i = 0; i < virthid_event_queue_size + 4; i++) {
+        char device[16];
+        snprintf(device, sizeof(device), "device %u", i);
+        VIRTHID_REQUIRE(test.create(device) != virthid_invalid_handle);
+    }
+    test.drain();
+    VIRTHID_CHECK(test.asyncResults() == 2);
+
+    // The 65th event overflowed, what follows comes after the marker. Read
+    // in two goes, room for the marker and one event first.
+    uint32_t count = virthid_event_read(monitor, s_events, sizeof(record) + virthid_event_record_size(9),
+                                        &used, &pending);
+    VIRTHID_CHECK(count == 2 && pending == 2);
+
+    virthid_event_reader overflow(s_events, used);
+    VIRTHID_CHECK(overflow.next(&record, &name) == 1 && record.type == virthid_event_overflow);
+    VIRTHID_CHECK(overflow.next(&record, &name) == 1 && record.type == virthid_event_created);
+    VIRTHID_CHECK(record.name_len == 9 && memcmp(name, "device 65", 9) == 0);
+
+    count += virthid_event_read(monitor, s_events, sizeof(s_events), &used, &pending);
+    VIRTHID_CHECK(count == 1 + 3 && pending == 0);
+
+    test.closeClient(monitor);
+}
+
+VIRTHID_TEST(bench_event_queue) {
+    static virthid_event_queue<> s_queue;
+    static uint8_t s_events[virthid_event_queue_size * virthid_event_max_record];
+    uint32_t count = virthid_test_iterations(1000000);
+    uint32_t used = 0;
+    bool was_empty = false;
+
+    s_queue.reset();
+
+    // A monitor that drains a batch after every 'batch' registry changes.
+    for (uint32_t batch = 1; batch <= virthid_event_queue_size; batch *= 8) {
+        char name[64];
+        snprintf(name, sizeof(name), "event push and drain (batch %u)", batch);
+        uint32_t failed = virthid_bench(name, count, [&](uint32_t i) {
+            bool pushed = s_queue.push(virthid_event_created, i, "keyboard", 8, &was_empty);
+            if ((i + 1) % batch == 0) s_queue.drain(s_events, sizeof(s_events), &used);
+            return pushed;
+        });
+        s_queue.drain(s_events, sizeof(s_events), &used);
+        VIRTHID_CHECK(failed == 0);
+    }
+}
@@ -0,0 +1,356 @@
+//
+//  VirtHID_FlowTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "VirtHID_Flow.hpp"
+#include "VirtHID_Histogram.hpp"
+
+VIRTHID_TEST(flow_has_hysteresis) {
+    virthid_flow flow;
+    uint32_t state = virthid_flow_clear;
+
+    flow.reset();
+    VIRTHID_CHECK(flow.setWatermarks(4, 1));
+
+    for (uint32_t i = 1; i < 4; i++) {
+        VIRTHID_CHECK(flow.enter(&state) == i && state == virthid_flow_clear);
+    }
+    VIRTHID_CHECK(flow.enter(&state) == 4 && state == virthid_flow_congested);
+    VIRTHID_CHECK(flow.enter(&state) == 5 && state == virthid_flow_congested);
+
+    // Below the high watermark is not enough, only the low one clears it, once.
+    VIRTHID_CHECK(!flow.leave() && !flow.leave() && !flow.leave());
+    VIRTHID_CHECK(flow.depth() == 2 && flow.state() == virthid_flow_congested);
+    VIRTHID_CHECK(flow.enter(&state) == 3 && state == virthid_flow_congested);
+    VIRTHID_CHECK(!flow.leave());
+    VIRTHID_CHECK(flow.leave() && flow.state() == virthid_flow_clear);
+    VIRTHID_CHECK(!flow.leave() && flow.depth() == 0);
+
+    VIRTHID_CHECK(!flow.setWatermarks(0, 0));
+    VIRTHID_CHECK(!flow.setWatermarks(4, 4));
+    VIRTHID_CHECK(!flow.setWatermarks(virthid_flow_max_watermark + 1, 1));
+    VIRTHID_CHECK(flow.setWatermarks(virthid_flow_max_watermark, 0));
+
+    flow.reset();
+    VIRTHID_CHECK(flow.depth() == 0 && flow.state() == virthid_flow_clear);
+}
+
+const uint32_t virthid_flow_model_capacity = 4096;
+
+/**
+ *  A backlog drained at a fixed service time, with a producer that either
+ *  honours the flow state or keeps pushing until the queue is full.
+ */
+struct virthid_flow_model {
+    virthid_flow flow;
+    virthid_histogram latency;
+
+    uint64_t stamps[virthid_flow_model_capacity];
+    uint32_t head;
+    uint32_t tail;
+
+    uint64_t service;
+    uint32_t count;
+    uint32_t writable;
+};
+
+static void *virthid_flow_model_consumer(void *context) {
+    virthid_flow_model *model = (virthid_flow_model *)context;
+
+    for (uint32_t received = 0; received < model->count;) {
+        uint32_t tail = model->tail;
+        if (tail == __atomic_load_n(&model->head, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+            continue;
+        }
+
+        // A slow event system, busy for 'service' per report.
+        uint64_t stamp = model->stamps[tail % virthid_flow_model_capacity];
+        uint64_t until = virthid_test_now() + model->service;
+        while (virthid_test_now() < until) {}
+
+        model->latency.record(virthid_test_now() - stamp);
+        __atomic_store_n(&model->tail, tail + 1, __ATOMIC_RELEASE);
+        received++;
+
+        if (model->flow.leave()) __atomic_add_fetch(&model->writable, 1, __ATOMIC_RELEASE);
+    }
+
+    return nullptr;
+}
+
+/**
+ *  Push 'count' reports as fast as allowed and return the deepest backlog
+ *  seen, 'lost' counting congestions never followed by a notification.
+ */
+static uint32_t virthid_flow_model_run(virthid_flow_model *model, bool adaptive, uint32_t *lost) {
+    uint32_t deepest = 0;
+
+    pthread_t consumer;
+    pthread_create(&consumer, nullptr, &virthid_flow_model_consumer, model);
+
+    for (uint32_t i = 0; i < model->count; i++) {
+        uint32_t writable = __atomic_load_n(&model->writable, __ATOMIC_ACQUIRE);
+        while (model->head - __atomic_load_n(&model->tail, __ATOMIC_ACQUIRE) == virthid_flow_model_capacity) {
+            sched_yield();
+        }
+
+        // Counted before it is visible, so the consumer never leaves first.
+        uint32_t state = virthid_flow_clear;
+        uint32_t depth = model->flow.enter(&state);
+        if (depth > deepest) deepest = depth;
+
+        model->stamps[model->head % virthid_flow_model_capacity] = virthid_test_now();
+        __atomic_store_n(&model->head, model->head + 1, __ATOMIC_RELEASE);
+
+        if (!adaptive || state != virthid_flow_congested) continue;
+
+        uint64_t timeout = virthid_test_now() + 5000000000ull;
+        while (__atomic_load_n(&model->writable, __ATOMIC_ACQUIRE) == writable) {
+            if (virthid_test_now() > timeout) {
+                (*lost)++;
+                break;
+            }
+            sched_yield();
+        }
+    }
+
+    pthread_join(consumer, nullptr);
+    return deepest;
+}
+
+VIRTHID_TEST(flow_bounds_latency_under_overload) {
+    static virthid_flow_model s_models[2];
+    virthid_histogram_snapshot *snapshots = new virthid_histogram_snapshot[2];
+    uint32_t deepest[2] = {};
+    uint32_t lost[2] = {};
+
+    // The producer offers far more than a 20 us consumer takes.
+    for (uint32_t adaptive = 0; adaptive < 2; adaptive++) {
+        virthid_flow_model *model = &s_models[adaptive];
+        model->flow.reset();
+        model->service = 20000;
+        model->count = (uint32_t)virthid_test_iterations(20000);
+
+        deepest[adaptive] = virthid_flow_model_run(model, adaptive, &lost[adaptive]);
+        model->latency.snapshot(&snapshots[adaptive]);
+
+        VIRTHID_CHECK(model->flow.depth() == 0 && model->flow.state() == virthid_flow_clear);
+    }
+
+    // Honouring the flow state keeps the backlog at the high watermark, and
+    // its latency at a few service times; ignoring it fills the queue.
+    VIRTHID_CHECK(lost[1] == 0);
+    VIRTHID_CHECK(deepest[1] <= virthid_flow_default_high);
+    VIRTHID_CHECK(deepest[0] > virthid_flow_default_high);
+    VIRTHID_CHECK(virthid_histogram_percentile(&snapshots[1], 990) < 5000000);
+    VIRTHID_CHECK(virthid_histogram_percentile(&snapshots[1], 500) <
+                  virthid_histogram_percentile(&snapshots[0], 500));
+
+    for (uint32_t adaptive = 0; adaptive < 2; adaptive++) {
+        printf("    %s producer: backlog %u, latency p50 %llu us, p99 %llu us\n",
+               adaptive ? "adaptive" : "greedy", deepest[adaptive],
+               (unsigned long long)virthid_histogram_percentile(&snapshots[adaptive], 500) / 1000,
+               (unsigned long long)virthid_histogram_percentile(&snapshots[adaptive], 990) / 1000);
+    }
+
+    delete[] snapshots;
+}
+
+/**
+ *  Mouse reports numbered through their motion. The wheel is at its maximum,
+ *  so coalescing never merges two of them.
+ */
+const uint32_t virthid_flow_max_sequence = 127 * 127;
+
+static void virthid_flow_report(uint8_t *report, uint32_t sequence) {
+    report[0] = 0;
+    report[1] = (uint8_t)(sequence % 127);
+    report[2] = (uint8_t)(sequence / 127);
+    report[3] = 127;
+}
+
+/**
+ *  A device whose reports are slow to handle, timing each from its send.
+ */
+struct virthid_flow_driver {
+    UInt32 handle;
+    uint64_t service;
+
+    uint64_t stamps[virthid_flow_max_sequence];
+    virthid_histogram latency;
+    uint32_t received;
+    uint32_t writable;
+};
+
+static IOReturn virthid_flow_slow_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                         const uint8_t *report, uint32_t report_len) {
+    virthid_flow_driver *flow = (virthid_flow_driver *)context;
+    uint32_t sequence = report[1] + report[2] * 127u;
+
+    uint64_t until = virthid_test_now() + flow->service;
+    while (virthid_test_now() < until) {}
+
+    flow->latency.record(virthid_test_now() - flow->stamps[sequence]);
+    __atomic_add_fetch(&flow->received, 1, __ATOMIC_RELEASE);
+    return kIOReturnSuccess;
+}
+
+static void virthid_flow_count_writable(void *context, const io_user_reference_t *reference, IOReturn result,
+                                        const io_user_reference_t *args, UInt32 count) {
+    virthid_flow_driver *flow = (virthid_flow_driver *)context;
+    if (count == 1 && args[0] == flow->handle) __atomic_add_fetch(&flow->writable, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Send 'count' reports through 'send_handle', waiting for the device to be
+ *  writable again whenever it reports congestion if 'adaptive'.
+ */
+static void virthid_flow_send(virthid_test_driver *test, virthid_flow_driver *flow, uint32_t count,
+                              bool adaptive, uint32_t *deepest, uint32_t *rejected, uint32_t *lost) {
+    uint8_t report[4];
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t sequence = i % virthid_flow_max_sequence;
+        uint32_t writable = __atomic_load_n(&flow->writable, __ATOMIC_ACQUIRE);
+        uint64_t outputs[2] = {};
+
+        virthid_flow_report(report, sequence);
+        flow->stamps[sequence] = virthid_test_now();
+
+        if (virthid_test_call(test->client(), it_kotleni_virthid_method_send_handle,
+                              {flow->handle, virthid_test_ptr(report), sizeof(report)}, outputs, 2)
+            != kIOReturnSuccess) {
+            (*rejected)++;
+            continue;
+        }
+        if (outputs[0] > *deepest) *deepest = (uint32_t)outputs[0];
+
+        if (!adaptive || outputs[1] != virthid_flow_congested) continue;
+
+        uint64_t timeout = virthid_test_now() + 5000000000ull;
+        while (__atomic_load_n(&flow->writable, __ATOMIC_ACQUIRE) == writable) {
+            if (virthid_test_now() > timeout) {
+                (*lost)++;
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+static OSAsyncReference64 s_async;
+
+VIRTHID_TEST(driver_signals_backpressure) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    virthid_flow_driver *flow = new virthid_flow_driver();
+    flow->handle = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(flow->handle != virthid_invalid_handle);
+    flow->service = 50000;
+
+    // Without coalescing nothing is ever pending, so there are no watermarks.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_watermarks,
+                                    {flow->handle, 6, 2}) == kIOReturnUnsupported);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing,
+                                      {flow->handle, 1}) == kIOReturnSuccess);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_watermarks,
+                                    {flow->handle, 4, 4}) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_watermarks,
+                                    {flow->handle, 6, 2}) == kIOReturnSuccess);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe_flow,
+                                    {flow->handle, 1}) == kIOReturnBadArgument);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe_flow, {flow->handle, 1},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, s_async) == kIOReturnSuccess);
+
+    standin_set_report_handler(&virthid_flow_slow_report, flow);
+    standin_set_async_handler(&virthid_flow_count_writable, flow);
+
+    // Sending far faster than the 50 us the event system takes per report.
+    uint32_t count = (uint32_t)virthid_test_iterations(20000) / 10;
+    uint32_t deepest = 0, rejected = 0, lost = 0;
+    virthid_flow_send(&test, flow, count, true, &deepest, &rejected, &lost);
+    test.drain();
+
+    virthid_histogram_snapshot *snapshot = new virthid_histogram_snapshot;
+    flow->latency.snapshot(snapshot);
+
+    // Nothing rejected, the backlog never past the high watermark, and every
+    // congestion followed by a notification.
+    VIRTHID_CHECK(rejected == 0 && lost == 0);
+    VIRTHID_CHECK(flow->received == count);
+    VIRTHID_CHECK(deepest <= 6);
+    VIRTHID_CHECK(flow->writable > 0);
+    VIRTHID_CHECK(virthid_histogram_percentile(snapshot, 990) < 10000000);
+
+    uint64_t outputs[2] = {};
+    uint8_t report[4];
+    virthid_flow_report(report, 0);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                    {flow->handle, virthid_test_ptr(report), sizeof(report)}, outputs, 2)
+                  == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[1] == virthid_flow_clear);
+
+    test.drain();
+    standin_set_report_handler(nullptr, nullptr);
+    standin_set_async_handler(nullptr, nullptr);
+    delete snapshot;
+    delete flow;
+}
+
+VIRTHID_TEST(bench_overload_latency) {
+    const uint32_t count = (uint32_t)virthid_test_iterations(20000) / 10;
+
+    // The same overload with a producer honouring the flow state and one ignoring it.
+    for (bool adaptive : {true, false}) {
+        virthid_test_driver test;
+        VIRTHID_REQUIRE(test.ok());
+
+        virthid_flow_driver *flow = new virthid_flow_driver();
+        flow->handle = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+        VIRTHID_REQUIRE(flow->handle != virthid_invalid_handle);
+        flow->service = 50000;
+
+        VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing,
+                                          {flow->handle, 1}) == kIOReturnSuccess);
+        VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe_flow,
+                                          {flow->handle, 1}, nullptr, 0, nullptr, 0, nullptr, 0, s_async)
+                        == kIOReturnSuccess);
+
+        standin_set_report_handler(&virthid_flow_slow_report, flow);
+        standin_set_async_handler(&virthid_flow_count_writable, flow);
+
+        uint32_t deepest = 0, rejected = 0, lost = 0;
+        uint64_t start = virthid_test_now();
+        virthid_flow_send(&test, flow, count, adaptive, &deepest, &rejected, &lost);
+        test.drain();
+        uint64_t elapsed = virthid_test_now() - start;
+
+        virthid_histogram_snapshot *snapshot = new virthid_histogram_snapshot;
+        flow->latency.snapshot(snapshot);
+
+        virthid_bench_report(adaptive ? "send_handle (adaptive producer)" : "send_handle (greedy producer)",
+                             flow->received, elapsed);
+        printf("    %u rejected, backlog %u, latency p50 %llu us, p99 %llu us\n", rejected, deepest,
+               (unsigned long long)virthid_histogram_percentile(snapshot, 500) / 1000,
+               (unsigned long long)virthid_histogram_percentile(snapshot, 990) / 1000);
+
+        VIRTHID_CHECK(lost == 0);
+        VIRTHID_CHECK(flow->received + rejected == count);
+
+        standin_set_report_handler(nullptr, nullptr);
+        standin_set_async_handler(nullptr, nullptr);
+        delete snapshot;
+        delete flow;
+    }
+}
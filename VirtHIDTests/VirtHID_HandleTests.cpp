@@ -0,0 +1,123 @@
+//
+//  VirtHID_HandleTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_HandleTable.hpp"
+
+static const uint8_t s_report[8] = {0, 0, 0x04};
+
+VIRTHID_TEST(handle_table_resolves) {
+    static virthid_handle_table<int, 4> s_table;
+    int objects[4];
+
+    virthid_handle handles[4];
+    for (int i = 0; i < 4; i++) {
+        handles[i] = s_table.insert(&objects[i]);
+        VIRTHID_CHECK(handles[i] != virthid_invalid_handle);
+        VIRTHID_CHECK((handles[i] & ~virthid_handle_mask) == 0);
+    }
+
+    VIRTHID_CHECK(s_table.insert(&objects[0]) == virthid_invalid_handle);
+    VIRTHID_CHECK(s_table.count() == 4);
+
+    for (int i = 0; i < 4; i++) VIRTHID_CHECK(s_table.lookup(handles[i]) == &objects[i]);
+    VIRTHID_CHECK(s_table.lookup(virthid_invalid_handle) == nullptr);
+    VIRTHID_CHECK(s_table.lookup(handles[0] | virthid_handle_index_mask) == nullptr);
+
+    VIRTHID_CHECK(s_table.remove(handles[1]) == &objects[1]);
+    VIRTHID_CHECK(s_table.remove(handles[1]) == nullptr);
+    VIRTHID_CHECK(s_table.count() == 3);
+
+    for (int i = 0; i < 4; i++) {
+        if (i != 1) VIRTHID_CHECK(s_table.remove(handles[i]) == &objects[i]);
+    }
+}
+
+VIRTHID_TEST(handle_table_rejects_stale_handles) {
+    static virthid_handle_table<int, 1> s_table;
+    int first = 0;
+    int second = 0;
+
+    virthid_handle stale = s_table.insert(&first);
+    s_table.remove(stale);
+
+    // The slot is reused under a new generation.
+    virthid_handle handle = s_table.insert(&second);
+    VIRTHID_CHECK(handle != stale);
+    VIRTHID_CHECK((handle & virthid_handle_index_mask) == (stale & virthid_handle_index_mask));
+    VIRTHID_CHECK(s_table.lookup(stale) == nullptr);
+    VIRTHID_CHECK(s_table.remove(stale) == nullptr);
+    VIRTHID_CHECK(s_table.lookup(handle) == &second);
+    s_table.remove(handle);
+
+    // Generations wrap around without ever producing the invalid handle.
+    for (uint32_t i = 0; i < 2 * virthid_handle_generation_mask; i++) {
+        handle = s_table.insert(&first);
+        VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+        VIRTHID_REQUIRE(s_table.lookup(handle) == &first);
+        s_table.remove(handle);
+    }
+}
+
+VIRTHID_TEST(send_handle_rejects_destroyed_devices) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static const char s_name[] = "keyboard";
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy,
+                                      {virthid_test_ptr(s_name), sizeof(s_name) - 1}) == kIOReturnSuccess);
+
+    // A device created in the freed slot does not answer to the old handle.
+    UInt32 other = test.create("keyboard");
+    VIRTHID_REQUIRE(other != virthid_invalid_handle);
+    VIRTHID_CHECK(other != handle);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                    {handle, virthid_test_ptr(s_report), sizeof(s_report)})
+                  == kIOReturnDeviceError);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                    {other, virthid_test_ptr(s_report), sizeof(s_report)})
+                  == kIOReturnSuccess);
+    VIRTHID_CHECK(test.reports() == 1);
+}
+
+VIRTHID_TEST(bench_send_by_name_and_handle) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    const uint32_t devices = 512;
+    uint32_t iterations = virthid_test_iterations(100000);
+    UInt32 handle = virthid_invalid_handle;
+    char name[32];
+
+    for (uint32_t i = 0; i < devices; i++) {
+        snprintf(name, sizeof(name), "keyboard-%u", i);
+        handle = test.create(name);
+        VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+    }
+
+    // The last device created, the far end of a by-name search.
+    uint32_t failed = virthid_bench("send by name (512 devices)", iterations, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send,
+                                 {virthid_test_ptr(name), strlen(name), virthid_test_ptr(s_report), sizeof(s_report)})
+               == kIOReturnSuccess;
+    });
+
+    failed += virthid_bench("send by handle (512 devices)", iterations, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                 {handle, virthid_test_ptr(s_report), sizeof(s_report)}) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == 2ull * iterations);
+}
@@ -0,0 +1,262 @@
+//
+//  VirtHID_HistogramTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "VirtHID_Histogram.hpp"
+#include "VirtHID_Keyboard.hpp"
+#include "VirtHID_Schedule.hpp"
+
+static const char s_name[] = "keyboard";
+static const uint32_t s_threads = 8;
+
+VIRTHID_TEST(histogram_buckets_are_contiguous) {
+    // Every bucket starts right after the previous one and holds its lowest value.
+    for (uint32_t i = 0; i < virthid_histogram_buckets; i++) {
+        uint64_t lowest = virthid_histogram_bucket_lowest(i);
+        VIRTHID_CHECK(virthid_histogram_bucket(lowest) == i);
+        if (i > 0) VIRTHID_CHECK(virthid_histogram_bucket(lowest - 1) == i - 1);
+    }
+
+    uint64_t last = virthid_histogram_bucket_lowest(virthid_histogram_buckets - 1);
+    VIRTHID_CHECK(virthid_histogram_bucket(UINT64_MAX) == virthid_histogram_buckets - 1);
+    VIRTHID_CHECK(virthid_histogram_bucket(1ull << virthid_histogram_max_bits) == virthid_histogram_buckets - 1);
+    VIRTHID_CHECK(last < 1ull << virthid_histogram_max_bits);
+}
+
+VIRTHID_TEST(histogram_error_is_bounded) {
+    srand(13);
+
+    // Exact below 16, within 1/16 of the value above, all the way up to the last bucket.
+    for (uint32_t i = 0; i < 1000000; i++) {
+        uint64_t value = i < (1u << 16) ? i : ((uint64_t)rand() << 31 | rand()) >> (rand() % 28);
+        if (value >> virthid_histogram_max_bits) continue;
+
+        uint64_t lowest = virthid_histogram_bucket_lowest(virthid_histogram_bucket(value));
+        VIRTHID_REQUIRE(lowest <= value);
+        VIRTHID_REQUIRE(value < 16 ? lowest == value : (value - lowest) * 16 <= lowest);
+    }
+}
+
+VIRTHID_TEST(histogram_percentiles) {
+    static virthid_histogram s_histogram;
+    static virthid_histogram_snapshot s_snapshot;
+
+    s_histogram.snapshot(&s_snapshot);
+    VIRTHID_CHECK(s_snapshot.count == 0 && virthid_histogram_percentile(&s_snapshot, 500) == 0);
+
+    for (uint64_t value = 1; value <= 10000; value++) s_histogram.record(value * 1000);
+    s_histogram.snapshot(&s_snapshot);
+
+    VIRTHID_CHECK(s_snapshot.count == 10000);
+    VIRTHID_CHECK(s_snapshot.sum == 1000ull * 10000 * 10001 / 2);
+    VIRTHID_CHECK(s_snapshot.max == 10000000);
+
+    const uint32_t permilles[] = {1, 100, 500, 900, 990, 999, 1000};
+    for (uint32_t permille : permilles) {
+        uint64_t exact = 10000ull * permille;
+        uint64_t value = virthid_histogram_percentile(&s_snapshot, permille);
+        VIRTHID_CHECK(value <= exact && (exact - value) * 16 <= value);
+    }
+}
+
+/**
+ *  Threads recording into one histogram while another takes snapshots.
+ */
+struct virthid_histogram_worker {
+    virthid_histogram *histogram;
+    uint32_t count;
+};
+
+static void *virthid_histogram_work(void *context) {
+    virthid_histogram_worker *worker = (virthid_histogram_worker *)context;
+    for (uint32_t i = 0; i < worker->count; i++) worker->histogram->record(i);
+    return nullptr;
+}
+
+static uint64_t virthid_histogram_run(virthid_histogram *histogram, uint32_t threads, uint32_t count,
+                                      uint32_t *snapshots, uint32_t *regressions) {
+    static virthid_histogram_snapshot s_snapshot;
+    pthread_t workers[s_threads];
+    virthid_histogram_worker context = {histogram, count};
+    uint64_t last = 0;
+
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < threads; i++) pthread_create(&workers[i], nullptr, &virthid_histogram_work, &context);
+
+    // Counts seen by the reader only ever go up.
+    if (snapshots) {
+        for (uint32_t i = 0; i < 1000; i++) {
+            histogram->snapshot(&s_snapshot);
+            if (s_snapshot.count < last) (*regressions)++;
+            last = s_snapshot.count;
+            (*snapshots)++;
+        }
+    }
+
+    for (uint32_t i = 0; i < threads; i++) pthread_join(workers[i], nullptr);
+
+    return virthid_test_now() - start;
+}
+
+VIRTHID_TEST(histogram_snapshots_while_recording) {
+    static virthid_histogram s_histogram;
+    static virthid_histogram_snapshot s_snapshot;
+    uint32_t count = virthid_test_iterations(100000);
+    uint32_t snapshots = 0, regressions = 0;
+
+    s_histogram = virthid_histogram();
+    virthid_histogram_run(&s_histogram, s_threads, count, &snapshots, &regressions);
+
+    VIRTHID_CHECK(snapshots == 1000 && regressions == 0);
+
+    s_histogram.snapshot(&s_snapshot);
+    VIRTHID_CHECK(s_snapshot.count == (uint64_t)s_threads * count);
+    VIRTHID_CHECK(s_snapshot.sum == (uint64_t)s_threads * count * (count - 1) / 2);
+    VIRTHID_CHECK(s_snapshot.max == count - 1);
+    VIRTHID_CHECK(s_snapshot.buckets[0] == s_threads);
+}
+
+VIRTHID_TEST(driver_records_both_directions) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    OSAsyncReference64 async = {};
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe,
+                                      {virthid_test_ptr(s_name), sizeof(s_name) - 1},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess);
+
+    uint8_t report[8] = {};
+    for (uint32_t i = 0; i < 100; i++) {
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                        nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+    }
+
+    IOBufferMemoryDescriptor *led = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, 1);
+    VIRTHID_REQUIRE(led);
+    *(uint8_t *)led->getBytesNoCopy() = 0x02;
+    for (uint32_t i = 0; i < 10; i++) {
+        VIRTHID_CHECK(test.device(handle)->setReport(led, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess);
+    }
+    test.drain();
+    led->release();
+
+    // Larger than an inline structure, so the snapshot goes through a descriptor.
+    static virthid_histogram_snapshot s_snapshot;
+    VIRTHID_CHECK(sizeof(s_snapshot) > virthid_test_max_inline);
+
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_latency,
+                                      {handle, virthid_latency_input},
+                                      nullptr, 0, nullptr, 0, &s_snapshot, sizeof(s_snapshot)) == kIOReturnSuccess);
+    VIRTHID_CHECK(s_snapshot.count == 100 && s_snapshot.sum >= s_snapshot.max);
+
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_latency,
+                                      {handle, virthid_latency_output},
+                                      nullptr, 0, nullptr, 0, &s_snapshot, sizeof(s_snapshot)) == kIOReturnSuccess);
+    VIRTHID_CHECK(s_snapshot.count == test.asyncResults() && s_snapshot.count == 10);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_latency,
+                                    {handle, virthid_latency_direction_count},
+                                    nullptr, 0, nullptr, 0, &s_snapshot, sizeof(s_snapshot)) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_latency,
+                                    {virthid_invalid_handle, virthid_latency_input},
+                                    nullptr, 0, nullptr, 0, &s_snapshot, sizeof(s_snapshot)) == kIOReturnNotFound);
+}
+
+VIRTHID_TEST(driver_records_input_on_every_path) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 keyboard = test.create(s_name);
+    UInt32 mouse = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(keyboard != virthid_invalid_handle && mouse != virthid_invalid_handle);
+    uint64_t before = test.reports();
+
+    // Encoded key events.
+    static const virthid_key_event s_keys[2] = {{0x04, 1, 0}, {0x04, 0, 0}};
+    uint64_t sent = 0;
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_keys, {keyboard}, &sent, 1,
+                                    s_keys, sizeof(s_keys)) == kIOReturnSuccess && sent == 2);
+
+    // Scheduled reports, due right away.
+    uint8_t records[4 * (sizeof(virthid_schedule_record) + 8)] = {};
+    uint32_t records_len = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        virthid_schedule_record record = {};
+        record.deadline = virthid_uptime_clock().now();
+        record.length = 8;
+        memcpy(records + records_len, &record, sizeof(record));
+        records_len += virthid_schedule_record_size(8);
+    }
+    uint64_t scheduled = 0;
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_schedule,
+                                    {keyboard, virthid_test_ptr(records), records_len}, &scheduled, 1)
+                  == kIOReturnSuccess && scheduled == 4);
+
+    // Coalesced motion, whatever number of reports it merges into.
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing, {mouse, 1})
+                    == kIOReturnSuccess);
+    for (uint32_t i = 0; i < 10; i++) {
+        uint8_t report[4] = {0, 1, 0, 0};
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {mouse},
+                                        nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+    }
+
+    uint64_t timeout = virthid_test_now() + 5000000000ull;
+    while (test.reports() < before + 2 + 4 + 1 && virthid_test_now() < timeout) usleep(1000);
+    test.drain();
+
+    // Each report handed to the HID stack has its latency recorded once.
+    static virthid_histogram_snapshot s_snapshot;
+    uint64_t recorded = 0;
+    for (UInt32 handle : {keyboard, mouse}) {
+        VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_latency,
+                                          {handle, virthid_latency_input},
+                                          nullptr, 0, nullptr, 0, &s_snapshot, sizeof(s_snapshot))
+                        == kIOReturnSuccess);
+        recorded += s_snapshot.count;
+    }
+    VIRTHID_CHECK(recorded == test.reports() - before);
+    VIRTHID_CHECK(recorded >= 2 + 4 + 1);
+}
+
+VIRTHID_TEST(bench_histogram_record) {
+    static virthid_histogram s_histogram;
+    static virthid_histogram_snapshot s_snapshot;
+    uint32_t count = virthid_test_iterations(1000000);
+
+    // Values spread over many buckets, as real latencies are.
+    s_histogram = virthid_histogram();
+    uint32_t failed = virthid_bench("histogram record", count, [&](uint32_t i) {
+        s_histogram.record((uint64_t)i * 2654435761u >> 12);
+        return true;
+    });
+
+    // All threads on one device's histogram.
+    for (uint32_t threads = 2; threads <= s_threads; threads *= 2) {
+        s_histogram = virthid_histogram();
+        uint64_t elapsed = virthid_histogram_run(&s_histogram, threads, count, nullptr, nullptr);
+
+        char name[64];
+        snprintf(name, sizeof(name), "histogram record (%u threads)", threads);
+        virthid_bench_report(name, (uint64_t)threads * count, elapsed);
+    }
+
+    failed += virthid_bench("histogram snapshot", count / 100, [&](uint32_t i) {
+        s_histogram.snapshot(&s_snapshot);
+        return s_snapshot.count == (uint64_t)s_threads * count;
+    });
+    VIRTHID_CHECK(failed == 0);
+}
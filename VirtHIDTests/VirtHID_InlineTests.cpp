@@ -0,0 +1,122 @@
+//
+//  VirtHID_InlineTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+/**
+ *  Report descriptor of a vendor device with a single input report of
+ *  'report_len' bytes, written to 'descriptor'.
+ *
+ *  @return The descriptor length.
+ */
+static uint16_t virthid_vendor_descriptor(uint8_t *descriptor, uint16_t report_len) {
+    const uint8_t items[] = {
+        0x06, 0x00, 0xFF,                                       // Usage Page (Vendor Defined)
+        0x09, 0x01,                                             // Usage (1)
+        0xA1, 0x01,                                             // Collection (Application)
+        0x15, 0x00,                                             //   Logical Minimum (0)
+        0x26, 0xFF, 0x00,                                       //   Logical Maximum (255)
+        0x75, 0x08,                                             //   Report Size (8)
+        0x96, (uint8_t)report_len, (uint8_t)(report_len >> 8),  //   Report Count (report_len)
+        0x09, 0x01,                                             //   Usage (1)
+        0x81, 0x02,                                             //   Input (Data, Variable, Absolute)
+        0xC0,                                                   // End Collection
+    };
+
+    memcpy(descriptor, items, sizeof(items));
+    return sizeof(items);
+}
+
+struct virthid_inline_capture {
+    uint8_t report[8192];
+    uint32_t report_len;
+};
+
+static IOReturn virthid_inline_capture_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                              const uint8_t *report, uint32_t report_len) {
+    virthid_inline_capture *capture = (virthid_inline_capture *)context;
+
+    capture->report_len = report_len;
+    if (report_len <= sizeof(capture->report)) memcpy(capture->report, report, report_len);
+
+    return kIOReturnSuccess;
+}
+
+VIRTHID_TEST(send_inline_delivers_small_and_large_reports) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    static virthid_inline_capture s_capture;
+    static uint8_t s_report[8192];
+    uint8_t descriptor[32];
+
+    standin_set_report_handler(&virthid_inline_capture_report, &s_capture);
+
+    // Both sides of the inline limit, the larger one arrives as a descriptor.
+    const uint16_t sizes[] = {8, virthid_test_max_inline, virthid_test_max_inline + 1, sizeof(s_report)};
+    for (uint16_t report_len : sizes) {
+        char name[32];
+        snprintf(name, sizeof(name), "vendor-%u", report_len);
+
+        UInt32 handle = test.create(name, descriptor, virthid_vendor_descriptor(descriptor, report_len));
+        VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+        for (uint32_t i = 0; i < report_len; i++) s_report[i] = (uint8_t)(i * 7 + report_len);
+
+        s_capture.report_len = 0;
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                        nullptr, 0, s_report, report_len) == kIOReturnSuccess);
+        VIRTHID_CHECK(s_capture.report_len == report_len);
+        VIRTHID_CHECK(memcmp(s_capture.report, s_report, report_len) == 0);
+
+        // A report not matching the descriptor, and a device that does not exist.
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                        nullptr, 0, s_report, report_len - 1) == kIOReturnDeviceError);
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle + 1},
+                                        nullptr, 0, s_report, report_len) == kIOReturnDeviceError);
+    }
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {},
+                                    nullptr, 0, s_report, 8) == kIOReturnBadArgument);
+}
+
+VIRTHID_TEST(bench_send_inline_and_mapped) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    static uint8_t s_report[8192];
+    uint32_t iterations = virthid_test_iterations(100000);
+    uint32_t failed = 0;
+    uint8_t descriptor[32];
+
+    // The inline copy against wiring and mapping the caller's buffer, up to
+    // and past 'virthid_max_inline_report'.
+    const uint16_t sizes[] = {8, 64, 512, virthid_test_max_inline, sizeof(s_report)};
+    for (uint16_t report_len : sizes) {
+        char name[64];
+        snprintf(name, sizeof(name), "vendor-%u", report_len);
+
+        UInt32 handle = test.create(name, descriptor, virthid_vendor_descriptor(descriptor, report_len));
+        VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+        snprintf(name, sizeof(name), "send_inline (%u bytes)", report_len);
+        failed += virthid_bench(name, iterations, [&](uint32_t i) {
+            return virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                     nullptr, 0, s_report, report_len) == kIOReturnSuccess;
+        });
+
+        snprintf(name, sizeof(name), "send_handle (%u bytes)", report_len);
+        failed += virthid_bench(name, iterations, [&](uint32_t i) {
+            return virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                     {handle, virthid_test_ptr(s_report), report_len}) == kIOReturnSuccess;
+        });
+    }
+
+    VIRTHID_CHECK(failed == 0);
+}
@@ -0,0 +1,190 @@
+//
+//  VirtHID_InternTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "VirtHID_Intern.hpp"
+
+/**
+ *  Content of an interned test object, with a hash that can be forced to collide.
+ */
+struct virthid_test_content {
+    uint8_t bytes[4];
+    uint32_t forced_hash;
+
+    uint32_t hash() const { return forced_hash; }
+
+    bool equals(const uint8_t *other, uint32_t len) const {
+        return len == sizeof(bytes) && memcmp(other, bytes, len) == 0;
+    }
+};
+
+VIRTHID_TEST(intern_table_dedups) {
+    static virthid_intern_table<virthid_test_content, 8> s_table;
+    virthid_test_content a = {{1, 2, 3, 4}, virthid_hash_bytes(a.bytes, 4)};
+    virthid_test_content b = {{1, 2, 3, 5}, virthid_hash_bytes(b.bytes, 4)};
+
+    VIRTHID_CHECK(a.hash() != b.hash());
+    VIRTHID_CHECK(!s_table.acquire(a.bytes, 4, a.hash()));
+
+    VIRTHID_REQUIRE(s_table.insert(&a));
+    VIRTHID_CHECK(s_table.acquire(a.bytes, 4, a.hash()) == &a);
+    VIRTHID_CHECK(s_table.retain(&a) && s_table.users(&a) == 3);
+    VIRTHID_CHECK(!s_table.acquire(b.bytes, 4, b.hash()) && !s_table.retain(&b));
+
+    // Same hash, other content.
+    VIRTHID_CHECK(!s_table.acquire(b.bytes, 4, a.hash()));
+
+    VIRTHID_REQUIRE(s_table.insert(&b));
+    VIRTHID_CHECK(s_table.count() == 2);
+
+    // An object leaves with its last user only.
+    VIRTHID_CHECK(!s_table.release(&a) && !s_table.release(&a));
+    VIRTHID_CHECK(s_table.release(&a) && s_table.users(&a) == 0);
+    VIRTHID_CHECK(!s_table.release(&a));
+    VIRTHID_CHECK(!s_table.acquire(a.bytes, 4, a.hash()));
+    VIRTHID_CHECK(s_table.acquire(b.bytes, 4, b.hash()) == &b);
+    VIRTHID_CHECK(s_table.count() == 1);
+}
+
+VIRTHID_TEST(intern_table_survives_collisions) {
+    static virthid_intern_table<virthid_test_content, 64> s_table;
+    static virthid_test_content s_objects[64];
+    uint32_t users[64] = {};
+    uint32_t wrong = 0;
+
+    // Few distinct hashes, so that probe runs are long and removals move
+    // entries back; the model counts users per object.
+    srand(18);
+    for (uint32_t i = 0; i < 64; i++) {
+        s_objects[i] = {{(uint8_t)i, (uint8_t)(i >> 8), 0xAA, 0x55}, (uint32_t)(rand() % 4) * 37};
+    }
+
+    for (uint32_t n = 0; n < 200000; n++) {
+        uint32_t i = rand() % 64;
+        virthid_test_content *object = &s_objects[i];
+
+        if (rand() % 2) {
+            virthid_test_content *found = s_table.acquire(object->bytes, 4, object->hash());
+            if (found != (users[i] ? object : nullptr)) wrong++;
+            if (!found && !s_table.insert(object)) wrong++;
+            users[i]++;
+        } else if (users[i]) {
+            if (s_table.release(object) != (users[i] == 1)) wrong++;
+            users[i]--;
+        }
+
+        if (n % 1000 == 0) {
+            uint32_t stored = 0;
+            for (uint32_t j = 0; j < 64; j++) {
+                if (s_table.users(&s_objects[j]) != users[j]) wrong++;
+                if (users[j]) stored++;
+            }
+            if (s_table.count() != stored) wrong++;
+        }
+    }
+
+    VIRTHID_CHECK(wrong == 0);
+}
+
+/**
+ *  A vendor defined descriptor whose content depends on 'usage'.
+ */
+static uint16_t virthid_usage_descriptor(uint8_t *descriptor, uint16_t usage) {
+    const uint8_t items[] = {
+        0x06, 0x00, 0xFF,                              // Usage Page (Vendor Defined)
+        0x0A, (uint8_t)usage, (uint8_t)(usage >> 8),   // Usage (usage)
+        0xA1, 0x01,                                    // Collection (Application)
+        0x15, 0x00,                                    //   Logical Minimum (0)
+        0x26, 0xFF, 0x00,                              //   Logical Maximum (255)
+        0x75, 0x08,                                    //   Report Size (8)
+        0x95, 0x08,                                    //   Report Count (8)
+        0x09, 0x01,                                    //   Usage (1)
+        0x81, 0x02,                                    //   Input (Data, Variable, Absolute)
+        0xC0,                                          // End Collection
+    };
+
+    memcpy(descriptor, items, sizeof(items));
+    return sizeof(items);
+}
+
+VIRTHID_TEST(driver_shares_descriptors) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 keyboards[2] = {test.create("keyboard"), test.create("keyboard 2")};
+    UInt32 mouse = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(keyboards[0] != virthid_invalid_handle && keyboards[1] != virthid_invalid_handle);
+    VIRTHID_REQUIRE(mouse != virthid_invalid_handle);
+
+    it_kotleni_virthid_device *first = test.device(keyboards[0]);
+    it_kotleni_virthid_device *second = test.device(keyboards[1]);
+    VIRTHID_CHECK(first->reportDescriptor == second->reportDescriptor);
+    VIRTHID_CHECK(first->reportDescriptor != test.device(mouse)->reportDescriptor);
+
+    // The HID stack gets the same buffer from both, without anything allocated.
+    IOMemoryDescriptor *buffers[2] = {};
+    uint64_t allocations = standin_allocations();
+    VIRTHID_CHECK(first->newReportDescriptor(&buffers[0]) == kIOReturnSuccess);
+    VIRTHID_CHECK(second->newReportDescriptor(&buffers[1]) == kIOReturnSuccess);
+    VIRTHID_CHECK(standin_allocations() == allocations);
+    VIRTHID_REQUIRE(buffers[0] && buffers[0] == buffers[1]);
+
+    uint8_t bytes[virthid_test_keyboard_len] = {};
+    VIRTHID_CHECK(buffers[0]->getLength() == virthid_test_keyboard_len);
+    VIRTHID_CHECK(buffers[0]->readBytes(0, bytes, sizeof(bytes)) == sizeof(bytes));
+    VIRTHID_CHECK(memcmp(bytes, virthid_test_keyboard, sizeof(bytes)) == 0);
+    buffers[0]->release();
+    buffers[1]->release();
+
+    // The descriptor outlives the device it was created for.
+    static const char s_name[] = "keyboard";
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy,
+                                    {virthid_test_ptr(s_name), sizeof(s_name) - 1}) == kIOReturnSuccess);
+    VIRTHID_CHECK(second->reportDescriptor->equals(virthid_test_keyboard, virthid_test_keyboard_len));
+
+    UInt32 again = test.create("keyboard 3");
+    VIRTHID_REQUIRE(again != virthid_invalid_handle);
+    VIRTHID_CHECK(test.device(again)->reportDescriptor == second->reportDescriptor);
+}
+
+VIRTHID_TEST(bench_memory_per_device) {
+    const uint32_t count = 1000;
+    int64_t shared_bytes = 0, distinct_bytes = 0;
+    uint32_t failed = 0;
+
+    // Bytes the stand-in allocated for 1,000 devices, with one descriptor for
+    // all of them and with a descriptor each.
+    for (uint32_t distinct = 0; distinct < 2; distinct++) {
+        virthid_test_driver test;
+        VIRTHID_REQUIRE(test.ok());
+
+        int64_t before = standin_allocated_bytes();
+        uint64_t start = virthid_test_now();
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t descriptor[64];
+            char name[32];
+            snprintf(name, sizeof(name), "device %u", i);
+            uint16_t descriptor_len = virthid_usage_descriptor(descriptor, (uint16_t)(distinct ? i + 1 : 1));
+            if (test.create(name, descriptor, descriptor_len) == virthid_invalid_handle) failed++;
+        }
+        uint64_t elapsed = virthid_test_now() - start;
+        int64_t bytes = standin_allocated_bytes() - before;
+
+        virthid_bench_report(distinct ? "create (distinct descriptors)" : "create (shared descriptor)", count, elapsed);
+        (distinct ? distinct_bytes : shared_bytes) = bytes;
+    }
+
+    printf("    %lld bytes per device with a shared descriptor, %lld with a descriptor each\n",
+           (long long)(shared_bytes / count), (long long)(distinct_bytes / count));
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(shared_bytes < distinct_bytes);
+}
@@ -0,0 +1,241 @@
+//
+//  VirtHID_KeyboardTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_Keyboard.hpp"
+
+/**
+ *  Modifiers, a bitmap for usages 0x04 to 0x73 and one array byte for the rest.
+ */
+static const uint8_t s_nkro[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01,
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x08, 0x81, 0x02,                                                 // Modifiers
+    0x19, 0x04, 0x29, 0x73, 0x95, 0x70, 0x81, 0x02,                         // Bitmap
+    0x95, 0x01, 0x75, 0x08, 0x15, 0x00, 0x26, 0xff, 0x00, 0x19, 0x00, 0x2a,
+    0xff, 0x00, 0x81, 0x00,                                                 // Array
+    0xc0,
+};
+
+const uint32_t virthid_nkro_len = 1 + 14 + 1;
+
+VIRTHID_TEST(keyboard_fills_boot_report) {
+    static virthid_report_layout s_layout;
+    static virthid_keyboard s_keyboard;
+    uint8_t report[virthid_max_report];
+
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_keyboard, virthid_test_keyboard_len) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_keyboard.init(&s_layout));
+    VIRTHID_CHECK(s_keyboard.reportLength() == 8);
+
+    const uint8_t a[8] = {0, 0, 0x04};
+    VIRTHID_CHECK(s_keyboard.apply(0x04, true, report) && memcmp(report, a, 8) == 0);
+
+    // Nothing changed, nothing to send.
+    VIRTHID_CHECK(!s_keyboard.apply(0x04, true, report));
+    VIRTHID_CHECK(!s_keyboard.apply(0x05, false, report));
+    VIRTHID_CHECK(!s_keyboard.apply(virthid_keyboard_usages, true, report));
+
+    // Modifiers have their own bits, keys are listed by usage rather than by press order.
+    const uint8_t shifted[8] = {0x02, 0, 0x04, 0x07, 0x10};
+    VIRTHID_CHECK(s_keyboard.apply(0xe1, true, report) && report[0] == 0x02);
+    VIRTHID_CHECK(s_keyboard.apply(0x10, true, report));
+    VIRTHID_CHECK(s_keyboard.apply(0x07, true, report) && memcmp(report, shifted, 8) == 0);
+
+    // A seventh key rolls every array element over, modifiers still count.
+    for (uint16_t usage = 0x11; usage < 0x14; usage++) VIRTHID_CHECK(s_keyboard.apply(usage, true, report));
+    VIRTHID_CHECK(report[7] == 0x13);
+    const uint8_t rollover[8] = {0x02, 0, 1, 1, 1, 1, 1, 1};
+    VIRTHID_CHECK(s_keyboard.apply(0x20, true, report) && memcmp(report, rollover, 8) == 0);
+    VIRTHID_CHECK(s_keyboard.pressedCount() == 8);
+
+    // Still rolled over while more than six are down.
+    VIRTHID_CHECK(!s_keyboard.apply(0x21, true, report));
+    VIRTHID_CHECK(!s_keyboard.apply(0x21, false, report));
+    const uint8_t six[8] = {0x02, 0, 0x04, 0x07, 0x10, 0x11, 0x12, 0x13};
+    VIRTHID_CHECK(s_keyboard.apply(0x20, false, report) && memcmp(report, six, 8) == 0);
+
+    // Everything up at once.
+    const uint8_t released[8] = {};
+    VIRTHID_CHECK(s_keyboard.reset(report) && memcmp(report, released, 8) == 0);
+    VIRTHID_CHECK(!s_keyboard.reset(report) && s_keyboard.pressedCount() == 0);
+    VIRTHID_CHECK(!s_keyboard.isPressed(0x04));
+}
+
+VIRTHID_TEST(keyboard_fills_nkro_bitmap) {
+    static virthid_report_layout s_layout;
+    static virthid_keyboard s_keyboard;
+    uint8_t report[virthid_max_report];
+
+    VIRTHID_REQUIRE(s_layout.parse(s_nkro, sizeof(s_nkro)) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_keyboard.init(&s_layout));
+    VIRTHID_CHECK(s_keyboard.reportLength() == virthid_nkro_len);
+
+    // Every bitmap key at once, no rollover.
+    for (uint16_t usage = 0x04; usage <= 0x73; usage++) VIRTHID_CHECK(s_keyboard.apply(usage, true, report));
+    uint32_t set = 0;
+    for (uint32_t i = 1; i < 15; i++) set += __builtin_popcount(report[i]);
+    VIRTHID_CHECK(set == 0x70 && report[15] == 0);
+
+    VIRTHID_CHECK(s_keyboard.apply(0x04, false, report) && report[1] == 0xfe);
+    VIRTHID_CHECK(s_keyboard.apply(0x73, false, report) && report[14] == 0x7f);
+    VIRTHID_CHECK(s_keyboard.apply(0xe7, true, report) && report[0] == 0x80);
+
+    // Usages past the bitmap go into the array, which holds one.
+    VIRTHID_CHECK(s_keyboard.apply(0x80, true, report) && report[15] == 0x80);
+    VIRTHID_CHECK(s_keyboard.apply(0x81, true, report) && report[15] == virthid_usage_error_rollover);
+    VIRTHID_CHECK(report[0] == 0x80 && report[2] == 0xff);
+    VIRTHID_CHECK(s_keyboard.apply(0x80, false, report) && report[15] == 0x81);
+
+    // A layout without keyboard fields has no keyboard report.
+    static virthid_keyboard s_mouse;
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+    VIRTHID_CHECK(!s_mouse.init(&s_layout) && s_mouse.reportLength() == 0);
+    VIRTHID_CHECK(!s_mouse.apply(0x04, true, report));
+}
+
+/**
+ *  Last report the HID stack got, and how many.
+ */
+struct virthid_keyboard_reports {
+    uint8_t last[virthid_max_report];
+    uint32_t last_len;
+    uint32_t count;
+};
+
+static IOReturn virthid_keyboard_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                        const uint8_t *report, uint32_t report_len) {
+    virthid_keyboard_reports *reports = (virthid_keyboard_reports *)context;
+
+    memcpy(reports->last, report, report_len < virthid_max_report ? report_len : virthid_max_report);
+    reports->last_len = report_len;
+    reports->count++;
+    return kIOReturnSuccess;
+}
+
+/**
+ *  Send key events.
+ *
+ *  @return The number of reports the driver emitted, or ~0u if the call failed.
+ */
+static uint32_t virthid_keyboard_send(virthid_test_driver *test, UInt32 handle, const virthid_key_event *events,
+                                      uint32_t count) {
+    uint64_t sent = 0;
+
+    if (virthid_test_call(test->client(), it_kotleni_virthid_method_send_keys, {handle}, &sent, 1,
+                          events, count * sizeof(virthid_key_event)) != kIOReturnSuccess) {
+        return ~0u;
+    }
+    return (uint32_t)sent;
+}
+
+VIRTHID_TEST(driver_synthesizes_key_reports) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    UInt32 nkro = test.create("nkro", s_nkro, sizeof(s_nkro));
+    UInt32 mouse = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle && nkro != virthid_invalid_handle);
+    VIRTHID_REQUIRE(mouse != virthid_invalid_handle);
+
+    virthid_keyboard_reports reports = {};
+    standin_set_report_handler(&virthid_keyboard_report, &reports);
+
+    // Shift-A typed in one call: only transitions that change the report are sent.
+    const virthid_key_event typed[] = {
+        {0xe1, 1, 0}, {0x04, 1, 0}, {0x04, 1, 0}, {0x04, 0, 0}, {0xe1, 0, 0}, {0xe1, 0, 0},
+    };
+    VIRTHID_CHECK(virthid_keyboard_send(&test, handle, typed, 6) == 4);
+    test.drain();
+    VIRTHID_CHECK(reports.count == 4);
+    const uint8_t released[8] = {};
+    VIRTHID_CHECK(reports.last_len == 8 && memcmp(reports.last, released, 8) == 0);
+
+    // State is kept between calls.
+    const virthid_key_event held[] = {{0x16, 1, 0}};
+    const virthid_key_event more[] = {{0x17, 1, 0}};
+    VIRTHID_CHECK(virthid_keyboard_send(&test, handle, held, 1) == 1);
+    VIRTHID_CHECK(virthid_keyboard_send(&test, handle, more, 1) == 1);
+    test.drain();
+    const uint8_t both[8] = {0, 0, 0x16, 0x17};
+    VIRTHID_CHECK(memcmp(reports.last, both, 8) == 0);
+
+    // Twenty keys down on the NKRO keyboard are all reported.
+    virthid_key_event chord[20];
+    for (uint16_t i = 0; i < 20; i++) chord[i] = {(uint16_t)(0x04 + i), 1, 0};
+    VIRTHID_CHECK(virthid_keyboard_send(&test, nkro, chord, 20) == 20);
+    test.drain();
+    VIRTHID_CHECK(reports.last_len == virthid_nkro_len);
+    VIRTHID_CHECK(reports.last[1] == 0xff && reports.last[2] == 0xff && reports.last[3] == 0x0f);
+
+    // Only keyboards take key events, and only whole ones.
+    VIRTHID_CHECK(virthid_keyboard_send(&test, mouse, held, 1) == ~0u);
+    uint64_t sent = 0;
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_keys, {handle}, &sent, 1,
+                                    held, sizeof(held) - 1) == kIOReturnBadArgument);
+}
+
+VIRTHID_TEST(bench_key_events) {
+    static virthid_report_layout s_layout;
+    static virthid_keyboard s_keyboard;
+    uint32_t count = virthid_test_iterations(1000000);
+    uint8_t report[virthid_max_report];
+
+    VIRTHID_REQUIRE(s_layout.parse(virthid_test_keyboard, virthid_test_keyboard_len) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_keyboard.init(&s_layout));
+
+    // The state machine alone: a key pressed and released among three held ones.
+    for (uint16_t usage = 0x04; usage < 0x07; usage++) s_keyboard.apply(usage, true, report);
+    uint32_t failed = virthid_bench("keyboard apply (6KRO)", count, [&](uint32_t i) {
+        return s_keyboard.apply(0x10, i % 2 == 0, report);
+    });
+
+    VIRTHID_REQUIRE(s_layout.parse(s_nkro, sizeof(s_nkro)) == virthid_parse_ok);
+    VIRTHID_REQUIRE(s_keyboard.init(&s_layout));
+    failed += virthid_bench("keyboard apply (NKRO)", count, [&](uint32_t i) {
+        return s_keyboard.apply(0x10, i % 2 == 0, report);
+    });
+
+    // Typing a 64 key text through the driver: one call of key events
+    // against a full boot report per state change.
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    virthid_key_event text[128];
+    uint8_t reports[128][8] = {};
+    for (uint32_t i = 0; i < 64; i++) {
+        uint16_t usage = (uint16_t)(0x04 + i % 26);
+        text[2 * i] = {usage, 1, 0};
+        text[2 * i + 1] = {usage, 0, 0};
+        reports[2 * i][2] = (uint8_t)usage;
+    }
+
+    uint32_t passes = count / 1000 + 1;
+    failed += virthid_bench("send_keys (64 keystrokes per call)", passes, [&](uint32_t i) {
+        return virthid_keyboard_send(&test, handle, text, 128) == 128;
+    });
+    failed += virthid_bench("send_inline (64 keystrokes, 128 calls)", passes, [&](uint32_t i) {
+        uint64_t outputs[2];
+        for (uint32_t r = 0; r < 128; r++) {
+            if (virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle}, outputs, 2,
+                                  reports[r], 8) != kIOReturnSuccess) {
+                return false;
+            }
+        }
+        return true;
+    });
+    printf("    %zu bytes per keystroke with key events, %u with reports\n",
+           2 * sizeof(virthid_key_event), 2 * 8);
+
+    VIRTHID_CHECK(failed == 0);
+}
@@ -0,0 +1,229 @@
+//
+//  VirtHID_ListTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_List.hpp"
+
+VIRTHID_TEST(list_entries_round_trip) {
+    uint8_t buf[128];
+    virthid_list_writer writer(buf, sizeof(buf));
+    virthid_list_entry entry = {};
+    const char *name = nullptr;
+
+    // 16 + 5 bytes padded to 24, 16 + 8 bytes need no padding.
+    entry.handle = 1;
+    entry.name_len = 5;
+    VIRTHID_CHECK(writer.append(&entry, "mouse"));
+    entry.handle = 2;
+    entry.vendor_id = 0x05ac;
+    entry.name_len = 8;
+    VIRTHID_CHECK(writer.append(&entry, "keyboard"));
+    VIRTHID_CHECK(writer.count() == 2 && writer.used() == 24 + 24);
+
+    // An entry that does not fit leaves the buffer as it was.
+    entry.name_len = 255;
+    static const char s_long[255] = {};
+    VIRTHID_CHECK(!writer.append(&entry, s_long));
+    VIRTHID_CHECK(writer.count() == 2 && writer.used() == 48);
+    VIRTHID_CHECK(virthid_list_entry_size(255) == virthid_list_max_entry);
+
+    virthid_list_reader reader(buf, writer.used());
+    VIRTHID_CHECK(reader.next(&entry, &name) == 1 && entry.handle == 1 && memcmp(name, "mouse", 5) == 0);
+    VIRTHID_CHECK(reader.next(&entry, &name) == 1 && entry.handle == 2 && entry.vendor_id == 0x05ac);
+    VIRTHID_CHECK(reader.next(&entry, &name) == 0);
+
+    // Padding may be left out of the last entry, but not name bytes.
+    virthid_list_reader unpadded(buf, 24 + 16 + 8);
+    VIRTHID_CHECK(unpadded.next(&entry, &name) == 1 && unpadded.next(&entry, &name) == 1);
+    virthid_list_reader truncated(buf, 24 + 16 + 7);
+    VIRTHID_CHECK(truncated.next(&entry, &name) == 1 && truncated.next(&entry, &name) == -1);
+    virthid_list_reader short_header(buf, 24 + 15);
+    VIRTHID_CHECK(short_header.next(&entry, &name) == 1 && short_header.next(&entry, &name) == -1);
+}
+
+/**
+ *  Create 'count' devices named "device <i>", with vendor ID i and product ID 2i.
+ */
+static bool virthid_list_populate(virthid_test_driver *test, uint32_t first, uint32_t count) {
+    static const char s_serial_number[] = "";
+
+    for (uint32_t i = first; i < first + count; i++) {
+        char name[32];
+        int name_len = snprintf(name, sizeof(name), "device %u", i);
+        uint64_t handle = virthid_invalid_handle;
+
+        if (virthid_test_call(test->client(), it_kotleni_virthid_method_create,
+                              {virthid_test_ptr(name), (uint64_t)name_len,
+                               virthid_test_ptr(virthid_test_keyboard), virthid_test_keyboard_len,
+                               virthid_test_ptr(s_serial_number), 0, i, 2 * i},
+                              &handle, 1) != kIOReturnSuccess) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ *  One call of the listing selector.
+ *
+ *  @return The cursor of the next page.
+ */
+static uint32_t virthid_list_page(virthid_test_driver *test, uint32_t cursor, uint8_t *buf, uint32_t buf_len,
+                                  uint32_t *count, uint32_t *used, uint32_t *generation) {
+    uint64_t outputs[4] = {};
+
+    if (virthid_test_call(test->client(), it_kotleni_virthid_method_list_entries,
+                          {cursor, virthid_test_ptr(buf), buf_len}, outputs, 4) != kIOReturnSuccess) {
+        return 0;
+    }
+
+    *count = (uint32_t)outputs[1];
+    *used = (uint32_t)outputs[2];
+    *generation = (uint32_t)outputs[3];
+    return (uint32_t)outputs[0];
+}
+
+VIRTHID_TEST(driver_lists_in_pages) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    const uint32_t devices = 300;
+    VIRTHID_REQUIRE(virthid_list_populate(&test, 0, devices));
+
+    static bool s_seen[devices];
+    uint8_t page[1024];
+    uint32_t cursor = 0, count = 0, used = 0, generation = 0, first_generation = 0;
+    uint32_t pages = 0, listed = 0, wrong = 0;
+
+    virthid_list_page(&test, 0, nullptr, 0, &count, &used, &first_generation);
+
+    // Every device exactly once, page after page, with its IDs.
+    memset(s_seen, 0, sizeof(s_seen));
+    while (cursor != virthid_list_end) {
+        cursor = virthid_list_page(&test, cursor, page, sizeof(page), &count, &used, &generation);
+        VIRTHID_REQUIRE(count > 0 && used <= sizeof(page));
+        VIRTHID_CHECK(generation == first_generation);
+        pages++;
+
+        virthid_list_reader reader(page, used);
+        virthid_list_entry entry;
+        const char *name = nullptr;
+        while (reader.next(&entry, &name) > 0) {
+            uint32_t i = entry.vendor_id;
+            char expected[32];
+            int expected_len = snprintf(expected, sizeof(expected), "device %u", i);
+
+            if (i >= devices || s_seen[i] || entry.product_id != 2 * i || entry.name_len != expected_len ||
+                memcmp(name, expected, expected_len) != 0 || entry.handle == virthid_invalid_handle) {
+                wrong++;
+                continue;
+            }
+            s_seen[i] = true;
+            listed++;
+        }
+    }
+    VIRTHID_CHECK(wrong == 0 && listed == devices);
+    VIRTHID_CHECK(pages > 1);
+
+    // A page too small for the next entry says how much room it needs.
+    cursor = virthid_list_page(&test, 0, page, 8, &count, &used, &generation);
+    VIRTHID_CHECK(cursor == 0 && count == 0 && used == virthid_list_entry_size(8));
+
+    // Creating or destroying a device moves the generation on.
+    VIRTHID_REQUIRE(virthid_list_populate(&test, devices, 1));
+    virthid_list_page(&test, 0, nullptr, 0, &count, &used, &generation);
+    VIRTHID_CHECK(generation != first_generation);
+    first_generation = generation;
+
+    static const char s_name[] = "device 0";
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy,
+                                    {virthid_test_ptr(s_name), sizeof(s_name) - 1}) == kIOReturnSuccess);
+    virthid_list_page(&test, 0, nullptr, 0, &count, &used, &generation);
+    VIRTHID_CHECK(generation != first_generation);
+}
+
+VIRTHID_TEST(driver_name_list_reports_needed_size) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    VIRTHID_REQUIRE(virthid_list_populate(&test, 0, 20));
+
+    // "device 0" to "device 9" take 9 bytes each, the others 10.
+    const uint32_t total = 10 * 9 + 10 * 10;
+    char names[256];
+    uint64_t outputs[2] = {};
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_list, {0, 0}, outputs, 2)
+                  == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == total && outputs[1] == 0);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_list,
+                                    {virthid_test_ptr(names), 50}, outputs, 2) == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == total && outputs[1] == 5);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_list,
+                                    {virthid_test_ptr(names), total}, outputs, 2) == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == 0 && outputs[1] == 20);
+}
+
+VIRTHID_TEST(bench_list_at_scale) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    uint32_t count = virthid_test_iterations(10000);
+    static uint8_t s_page[4096];
+    static uint8_t s_full[virthid_max_devices * virthid_list_max_entry];
+    static char s_names[UINT16_MAX];
+    uint32_t failed = 0;
+    uint32_t populated = 0;
+
+    // What a monitor polling the device list pays, as devices are added.
+    for (uint32_t devices = 16; devices <= virthid_max_devices; devices *= 4) {
+        VIRTHID_REQUIRE(virthid_list_populate(&test, populated, devices - populated));
+        populated = devices;
+        uint32_t passes = count * 16 / devices + 1;
+
+        char name[64];
+        snprintf(name, sizeof(name), "generation poll (%u devices)", devices);
+        failed += virthid_bench(name, count, [&](uint32_t i) {
+            uint32_t listed = 0, used = 0, generation = 0;
+            virthid_list_page(&test, 0, nullptr, 0, &listed, &used, &generation);
+            return generation != 0;
+        });
+
+        snprintf(name, sizeof(name), "list in 4 KiB pages (%u devices)", devices);
+        failed += virthid_bench(name, passes, [&](uint32_t i) {
+            uint32_t cursor = 0, listed = 0, total = 0, used = 0, generation = 0;
+            while (cursor != virthid_list_end) {
+                cursor = virthid_list_page(&test, cursor, s_page, sizeof(s_page), &listed, &used, &generation);
+                if (listed == 0) return false;
+                total += listed;
+            }
+            return total == devices;
+        });
+
+        snprintf(name, sizeof(name), "list in one call (%u devices)", devices);
+        failed += virthid_bench(name, passes, [&](uint32_t i) {
+            uint32_t listed = 0, used = 0, generation = 0;
+            uint32_t cursor = virthid_list_page(&test, 0, s_full, sizeof(s_full), &listed, &used, &generation);
+            return cursor == virthid_list_end && listed == devices;
+        });
+
+        snprintf(name, sizeof(name), "list names (%u devices)", devices);
+        failed += virthid_bench(name, passes, [&](uint32_t i) {
+            uint64_t outputs[2] = {};
+            return virthid_test_call(test.client(), it_kotleni_virthid_method_list,
+                                     {virthid_test_ptr(s_names), sizeof(s_names)}, outputs, 2) == kIOReturnSuccess &&
+                   outputs[1] == devices;
+        });
+    }
+
+    VIRTHID_CHECK(failed == 0);
+}
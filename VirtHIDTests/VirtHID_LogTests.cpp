@@ -0,0 +1,321 @@
+//
+//  VirtHID_LogTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "VirtHID_Log.hpp"
+#include "VirtHID_Schedule.hpp"
+
+VIRTHID_TEST(varint_round_trips) {
+    const uint64_t values[] = {0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 1000000, UINT32_MAX, UINT64_MAX};
+    uint8_t buf[16];
+    uint64_t value = 0;
+
+    for (uint64_t expected : values) {
+        uint32_t len = virthid_varint_put(buf, expected);
+        VIRTHID_CHECK(len >= 1 && len <= 10);
+        VIRTHID_CHECK(virthid_varint_get(buf, len, &value) == len && value == expected);
+
+        // Any shorter input is truncated.
+        VIRTHID_CHECK(len == 1 || virthid_varint_get(buf, len - 1, &value) == 0);
+    }
+
+    // Eleven continuation bytes are too long to be a 64-bit value.
+    memset(buf, 0x80, sizeof(buf));
+    VIRTHID_CHECK(virthid_varint_get(buf, sizeof(buf), &value) == 0);
+}
+
+VIRTHID_TEST(log_round_trips_reports) {
+    static uint8_t s_log[4096];
+    virthid_log_writer writer;
+    uint8_t report[8] = {};
+    uint64_t timestamp = 0;
+    const uint8_t *read = nullptr;
+    uint32_t read_len = 0;
+
+    VIRTHID_CHECK(!writer.begin(s_log, sizeof(virthid_log_header) - 1, 0));
+    VIRTHID_CHECK(!writer.append(0, report, sizeof(report)));
+
+    VIRTHID_REQUIRE(writer.begin(s_log, sizeof(s_log), 1000));
+    for (uint32_t i = 0; i < 16; i++) {
+        report[0] = (uint8_t)i;
+        VIRTHID_REQUIRE(writer.append(1000 + i * 1000000ull, report, 1 + i % 8));
+    }
+
+    // A timestamp going backwards is kept at the previous one.
+    VIRTHID_REQUIRE(writer.append(0, report, 0));
+
+    virthid_log_reader reader(writer.data(), writer.size());
+    VIRTHID_REQUIRE(reader.begin());
+    for (uint32_t i = 0; i < 16; i++) {
+        VIRTHID_REQUIRE(reader.next(&timestamp, &read, &read_len) == 1);
+        VIRTHID_CHECK(timestamp == 1000 + i * 1000000ull);
+        VIRTHID_CHECK(read_len == 1 + i % 8 && read[0] == i);
+    }
+    VIRTHID_CHECK(reader.next(&timestamp, &read, &read_len) == 1);
+    VIRTHID_CHECK(timestamp == 1000 + 15 * 1000000ull && read_len == 0);
+    VIRTHID_CHECK(reader.next(&timestamp, &read, &read_len) == 0);
+
+    // The header and the delta of a report fit in a few bytes.
+    VIRTHID_CHECK(writer.size() < sizeof(virthid_log_header) + 16 * (8 + 5) + 2);
+}
+
+VIRTHID_TEST(log_writer_stops_when_full) {
+    static uint8_t s_log[sizeof(virthid_log_header) + 10 * 10];
+    virthid_log_writer writer;
+    uint8_t report[8] = {};
+    uint32_t appended = 0;
+
+    VIRTHID_REQUIRE(writer.begin(s_log, sizeof(s_log), 0));
+    while (writer.append(appended, report, sizeof(report))) appended++;
+
+    // Each record takes two one-byte varints and the report.
+    VIRTHID_CHECK(appended == 10);
+    VIRTHID_CHECK(writer.size() == sizeof(s_log));
+    VIRTHID_CHECK(!writer.append(appended, report, 0));
+}
+
+VIRTHID_TEST(log_reads_back_in_chunks) {
+    static uint8_t s_log[4096];
+    static uint8_t s_copy[4096];
+    virthid_log_writer writer;
+    uint8_t report[8] = {};
+    uint32_t copy_len = 0;
+
+    srand(11);
+    VIRTHID_REQUIRE(writer.begin(s_log, sizeof(s_log), 0));
+
+    // Read out in chunks of whatever fits while still writing, as a capture is.
+    uint64_t timestamp = 0;
+    for (uint32_t i = 0; i < 200; i++) {
+        timestamp += rand() % 100000;
+        report[0] = (uint8_t)i;
+        VIRTHID_REQUIRE(writer.append(timestamp, report, 1 + rand() % 8));
+
+        if (rand() % 16 == 0) {
+            uint32_t len = writer.prefix(rand() % 64);
+            VIRTHID_REQUIRE(copy_len + len <= sizeof(s_copy));
+            memcpy(s_copy + copy_len, writer.data(), len);
+            copy_len += len;
+            writer.consume(len);
+        }
+    }
+    uint32_t len = writer.prefix(UINT32_MAX);
+    VIRTHID_CHECK(len == writer.size());
+    memcpy(s_copy + copy_len, writer.data(), len);
+    copy_len += len;
+
+    virthid_log_reader reader(s_copy, copy_len);
+    const uint8_t *read = nullptr;
+    uint32_t read_len = 0, count = 0;
+    uint64_t last = 0;
+    int next;
+
+    VIRTHID_REQUIRE(reader.begin());
+    while ((next = reader.next(&timestamp, &read, &read_len)) > 0) {
+        VIRTHID_CHECK(read[0] == (uint8_t)count && timestamp >= last);
+        last = timestamp;
+        count++;
+    }
+    VIRTHID_CHECK(next == 0 && count == 200);
+}
+
+VIRTHID_TEST(log_reader_rejects_bad_logs) {
+    static uint8_t s_log[256];
+    virthid_log_writer writer;
+    uint8_t report[8] = {};
+    uint64_t timestamp = 0;
+    const uint8_t *read = nullptr;
+    uint32_t read_len = 0;
+
+    VIRTHID_REQUIRE(writer.begin(s_log, sizeof(s_log), 0));
+    VIRTHID_REQUIRE(writer.append(300, report, sizeof(report)));
+
+    virthid_log_reader short_header(s_log, sizeof(virthid_log_header) - 1);
+    VIRTHID_CHECK(!short_header.begin());
+
+    // Every cut inside the record is caught.
+    for (uint32_t len = sizeof(virthid_log_header) + 1; len < writer.size(); len++) {
+        virthid_log_reader truncated(s_log, len);
+        VIRTHID_REQUIRE(truncated.begin());
+        VIRTHID_CHECK(truncated.next(&timestamp, &read, &read_len) == -1);
+    }
+
+    s_log[sizeof(virthid_log_header) + 2] = 0xff;
+    virthid_log_reader oversized(s_log, writer.size());
+    VIRTHID_REQUIRE(oversized.begin());
+    VIRTHID_CHECK(oversized.next(&timestamp, &read, &read_len) == -1);
+
+    s_log[0] ^= 1;
+    virthid_log_reader bad_magic(s_log, writer.size());
+    VIRTHID_CHECK(!bad_magic.begin());
+}
+
+/**
+ *  Counts keyboard reports handed to the HID stack, and checks they come in order.
+ */
+struct virthid_log_capture {
+    uint32_t received;
+    uint32_t out_of_order;
+};
+
+static IOReturn virthid_log_capture_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                           const uint8_t *report, uint32_t report_len) {
+    virthid_log_capture *capture = (virthid_log_capture *)context;
+    uint32_t index = report[2] | (uint32_t)report[3] << 8;
+
+    if (report_len != 8 || index != capture->received) capture->out_of_order++;
+    capture->received++;
+
+    return kIOReturnSuccess;
+}
+
+VIRTHID_TEST(driver_captures_and_replays) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 source = test.create("keyboard");
+    UInt32 target = test.create("keyboard 2");
+    VIRTHID_REQUIRE(source != virthid_invalid_handle && target != virthid_invalid_handle);
+
+    static uint8_t s_log[virthid_capture_size];
+    uint64_t outputs[2] = {};
+    const uint32_t count = 1000;
+
+    // Nothing to read before a capture was started.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_read_capture,
+                                    {source, virthid_test_ptr(s_log), sizeof(s_log)}, outputs, 2)
+                  == kIOReturnNotReady);
+
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_capture, {source, 1})
+                    == kIOReturnSuccess);
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t report[8] = {0, 0, (uint8_t)i, (uint8_t)(i >> 8)};
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {source},
+                                        nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+    }
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_capture, {source, 0})
+                    == kIOReturnSuccess);
+
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_read_capture,
+                                      {source, virthid_test_ptr(s_log), sizeof(s_log)}, outputs, 2)
+                    == kIOReturnSuccess);
+    uint32_t log_len = (uint32_t)outputs[0];
+    VIRTHID_CHECK(outputs[1] == 0);
+
+    // Records carry their deltas, so the log is far smaller than fixed-size records would be.
+    VIRTHID_CHECK(log_len > sizeof(virthid_log_header) + count * 10);
+    VIRTHID_CHECK(log_len < sizeof(virthid_log_header) + count * (8 + 8 + 8));
+
+    static virthid_log_capture s_capture;
+    s_capture = {};
+    standin_set_report_handler(&virthid_log_capture_report, &s_capture);
+
+    uint64_t replayed = 0;
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_replay,
+                                      {target, virthid_test_ptr(s_log), log_len, 0}, &replayed, 1)
+                    == kIOReturnSuccess);
+    VIRTHID_CHECK(replayed == count);
+    VIRTHID_CHECK(s_capture.received == count && s_capture.out_of_order == 0);
+
+    // A damaged log is refused before anything is sent.
+    s_log[0] ^= 1;
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_replay,
+                                    {target, virthid_test_ptr(s_log), log_len, 0}, &replayed, 1)
+                  == kIOReturnBadArgument);
+    VIRTHID_CHECK(s_capture.received == count);
+}
+
+VIRTHID_TEST(driver_streams_replay_larger_than_schedule) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    // Three schedules' worth of reports, 200 us apart.
+    static uint8_t s_log[virthid_capture_size];
+    const uint32_t count = 3 * virthid_schedule_capacity;
+    virthid_log_writer writer;
+    VIRTHID_REQUIRE(writer.begin(s_log, sizeof(s_log), 0));
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t report[8] = {0, 0, (uint8_t)i, (uint8_t)(i >> 8)};
+        VIRTHID_REQUIRE(writer.append(i * 200000ull, report, sizeof(report)));
+    }
+
+    static virthid_log_capture s_capture;
+    s_capture = {};
+    standin_set_report_handler(&virthid_log_capture_report, &s_capture);
+
+    uint64_t replayed = 0;
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_replay,
+                                      {handle, virthid_test_ptr(s_log), writer.size(), 1}, &replayed, 1)
+                    == kIOReturnSuccess);
+    VIRTHID_CHECK(replayed == count);
+
+    // One stream plays at a time, from a copy of the caller's log.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_replay,
+                                    {handle, virthid_test_ptr(s_log), writer.size(), 1}, &replayed, 1)
+                  == kIOReturnBusy);
+    memset(s_log, 0, sizeof(s_log));
+
+    uint64_t timeout = virthid_test_now() + 10000000000ull;
+    while (__atomic_load_n(&s_capture.received, __ATOMIC_ACQUIRE) < count && virthid_test_now() < timeout) {
+        usleep(1000);
+    }
+    test.drain();
+
+    VIRTHID_CHECK(s_capture.received == count && s_capture.out_of_order == 0);
+}
+
+VIRTHID_TEST(bench_log_encode_decode) {
+    uint32_t count = virthid_test_iterations(1000000);
+    uint32_t capacity = sizeof(virthid_log_header) + count * (virthid_log_max_record_header + 8);
+    uint8_t *log = new uint8_t[capacity];
+    virthid_log_writer writer;
+    uint8_t report[8] = {};
+    uint32_t failed = 0;
+
+    srand(11);
+
+    // Keyboard reports at around 1 kHz with some jitter, as a capture records them.
+    VIRTHID_REQUIRE(writer.begin(log, capacity, 0));
+    uint64_t timestamp = 0;
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < count; i++) {
+        timestamp += 900000 + rand() % 200000;
+        report[2] = (uint8_t)i;
+        if (!writer.append(timestamp, report, sizeof(report))) failed++;
+    }
+    virthid_bench_report("log encode", count, virthid_test_now() - start);
+
+    virthid_log_reader reader(log, writer.size());
+    const uint8_t *read = nullptr;
+    uint32_t read_len = 0, decoded = 0;
+    uint64_t bytes = 0;
+
+    VIRTHID_REQUIRE(reader.begin());
+    start = virthid_test_now();
+    while (reader.next(&timestamp, &read, &read_len) > 0) {
+        bytes += read_len;
+        decoded++;
+    }
+    virthid_bench_report("log decode", count, virthid_test_now() - start);
+
+    uint64_t raw = (uint64_t)count * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(report));
+    printf("    %.2f MB per million reports, %.1f%% of fixed-size records\n",
+           (double)writer.size() / count, 100.0 * writer.size() / raw);
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(decoded == count && bytes == (uint64_t)count * sizeof(report));
+
+    delete[] log;
+}
@@ -0,0 +1,391 @@
+//
+//  VirtHID_OutputRingTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "VirtHID_OutputRing.hpp"
+
+static virthid_output_ring_shared s_shared;
+
+/**
+ *  Fill a report with bytes derived from its sequence number.
+ */
+static void virthid_output_fill(uint8_t *report, uint32_t report_len, uint32_t sequence) {
+    for (uint32_t i = 0; i < report_len; i++) report[i] = (uint8_t)(sequence * 7 + i);
+}
+
+static bool virthid_output_matches(const uint8_t *report, uint32_t report_len, uint32_t sequence) {
+    for (uint32_t i = 0; i < report_len; i++) {
+        if (report[i] != (uint8_t)(sequence * 7 + i)) return false;
+    }
+    return true;
+}
+
+VIRTHID_TEST(output_ring_keeps_order) {
+    virthid_output_ring ring(&s_shared);
+    static uint8_t s_report[virthid_max_output_report];
+    const uint32_t sizes[] = {1, 200, 5000, 8};
+    virthid_output_record record = {};
+    bool ring_doorbell = false;
+
+    ring.reset();
+    VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_empty);
+
+    // Reports of any length, and only the first one while armed wakes the consumer.
+    for (uint32_t i = 0; i < 4; i++) {
+        record.size = sizes[i];
+        record.handle = i;
+        record.type = (uint8_t)(i % 3);
+        virthid_output_fill(s_report, sizes[i], i);
+        VIRTHID_CHECK(ring.push(&record, s_report, &ring_doorbell));
+        VIRTHID_CHECK(ring_doorbell == (i == 0));
+    }
+    VIRTHID_CHECK(ring.pending() == ring.recordSize(1) + ring.recordSize(200) + ring.recordSize(5000) + ring.recordSize(8));
+
+    // Reports too long for the caller's buffer are truncated, the record is still consumed.
+    VIRTHID_CHECK(ring.pop(&record, s_report, 4) == virthid_output_ring_popped);
+    VIRTHID_CHECK(record.size == 1 && record.handle == 0 && virthid_output_matches(s_report, 1, 0));
+    for (uint32_t i = 1; i < 4; i++) {
+        memset(s_report, 0, sizeof(s_report));
+        VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_popped);
+        VIRTHID_CHECK(record.size == sizes[i] && record.handle == i && record.type == i % 3);
+        VIRTHID_CHECK(virthid_output_matches(s_report, sizes[i], i));
+    }
+    VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_empty);
+
+    // Still disarmed: the consumer has not parked.
+    record.size = 8;
+    VIRTHID_CHECK(ring.push(&record, s_report, &ring_doorbell) && !ring_doorbell);
+    VIRTHID_CHECK(!ring.park());
+    VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_popped);
+    VIRTHID_CHECK(ring.park());
+    VIRTHID_CHECK(ring.push(&record, s_report, &ring_doorbell) && ring_doorbell);
+}
+
+VIRTHID_TEST(output_ring_wraps_and_drops) {
+    virthid_output_ring ring(&s_shared);
+    static uint8_t s_report[virthid_max_output_report];
+    virthid_output_record record = {};
+    bool ring_doorbell = false;
+    uint32_t pushed = 0, popped = 0;
+
+    ring.reset();
+
+    // Reports that never line up with the end of the ring, so that the
+    // producer keeps leaving wrap records behind.
+    record.size = 3000;
+    for (uint32_t round = 0; round < 8; round++) {
+        while (ring.push(&record, s_report, &ring_doorbell)) {
+            record.handle = ++pushed;
+        }
+        VIRTHID_CHECK(ring.dropped() == round + 1);
+
+        while (ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_popped) {
+            if (record.handle == popped) popped++;
+        }
+        record.handle = pushed;
+    }
+    VIRTHID_CHECK(pushed > 8 * (virthid_output_ring_capacity / ring.recordSize(3000) - 1));
+    VIRTHID_CHECK(popped == pushed);
+
+    // Too large for a record, counted as dropped.
+    record.size = virthid_max_output_report + 1;
+    VIRTHID_CHECK(!ring.push(&record, s_report, &ring_doorbell) && ring.dropped() == 9);
+
+    // A consumer index past the producer's is refused by both sides.
+    record.size = 8;
+    VIRTHID_REQUIRE(ring.push(&record, s_report, &ring_doorbell));
+    s_shared.tail = s_shared.head + 16;
+    VIRTHID_CHECK(!ring.push(&record, s_report, &ring_doorbell));
+    VIRTHID_CHECK(ring.pending() == virthid_output_ring_capacity);
+    VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_malformed);
+    VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_empty);
+
+    // So is a record whose size runs past what was pushed.
+    VIRTHID_REQUIRE(ring.push(&record, s_report, &ring_doorbell));
+    uint32_t corrupt = 4000;
+    memcpy(s_shared.data + (s_shared.tail & (virthid_output_ring_capacity - 1)), &corrupt, sizeof(corrupt));
+    VIRTHID_CHECK(ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_malformed);
+    VIRTHID_CHECK(ring.pending() == 0);
+}
+
+/**
+ *  A producer and a consumer thread sharing one output ring, the consumer
+ *  parking whenever it runs dry and waiting for the producer's wakeup.
+ */
+struct virthid_output_stress {
+    virthid_output_ring *ring;
+    uint32_t count;
+    uint32_t wakeups;
+    uint32_t parks;
+    uint32_t received;
+    uint32_t wrong;
+    uint32_t lost_wakeups;
+};
+
+/**
+ *  Wait for the wakeup counter to move past 'seen'.
+ *
+ *  @return False if nothing came within ten seconds.
+ */
+static bool virthid_output_wait(const uint32_t *wakeups, uint32_t seen) {
+    uint64_t start = virthid_test_now();
+
+    while (__atomic_load_n(wakeups, __ATOMIC_ACQUIRE) == seen) {
+        if (virthid_test_now() - start > 10000000000ull) return false;
+        sched_yield();
+    }
+    return true;
+}
+
+/**
+ *  Sizes that cross the ring's end at many different offsets.
+ */
+static uint32_t virthid_output_stress_size(uint32_t sequence) {
+    return 4 + (sequence * 2654435761u) % 3000;
+}
+
+static void *virthid_output_stress_consumer(void *context) {
+    virthid_output_stress *stress = (virthid_output_stress *)context;
+    static uint8_t s_report[virthid_max_output_report];
+    virthid_output_record record;
+
+    while (stress->received < stress->count) {
+        uint32_t seen = __atomic_load_n(&stress->wakeups, __ATOMIC_ACQUIRE);
+        virthid_output_ring_result result = stress->ring->pop(&record, s_report, sizeof(s_report));
+
+        if (result == virthid_output_ring_popped) {
+            uint32_t sequence = stress->received++;
+            if (record.handle != sequence || record.size != virthid_output_stress_size(sequence) ||
+                !virthid_output_matches(s_report, record.size, sequence)) {
+                stress->wrong++;
+            }
+            continue;
+        }
+        if (result == virthid_output_ring_malformed) {
+            stress->wrong++;
+            break;
+        }
+
+        // Parking can race with a push, the ring says whether to go idle.
+        stress->parks++;
+        if (!stress->ring->park()) continue;
+        if (!virthid_output_wait(&stress->wakeups, seen)) {
+            stress->lost_wakeups++;
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(output_ring_stress_producer_and_consumer) {
+    virthid_output_ring ring(&s_shared);
+    static uint8_t s_report[virthid_max_output_report];
+    virthid_output_stress stress = {};
+    uint32_t full = 0;
+
+    ring.reset();
+    stress.ring = &ring;
+    stress.count = virthid_test_iterations(200000);
+
+    pthread_t consumer;
+    pthread_create(&consumer, nullptr, &virthid_output_stress_consumer, &stress);
+
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < stress.count; i++) {
+        virthid_output_record record = {};
+        bool ring_doorbell = false;
+
+        record.size = virthid_output_stress_size(i);
+        record.handle = i;
+        virthid_output_fill(s_report, record.size, i);
+
+        // A full ring drops the report, the test's producer retries it.
+        while (!ring.push(&record, s_report, &ring_doorbell)) {
+            full++;
+            sched_yield();
+        }
+        if (ring_doorbell) __atomic_add_fetch(&stress.wakeups, 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_join(consumer, nullptr);
+    uint64_t elapsed = virthid_test_now() - start;
+
+    VIRTHID_CHECK(stress.received == stress.count);
+    VIRTHID_CHECK(stress.wrong == 0 && stress.lost_wakeups == 0);
+    VIRTHID_CHECK(ring.dropped() == full);
+    VIRTHID_CHECK(stress.wakeups <= stress.parks + 1);
+
+    virthid_bench_report("output ring producer to consumer", stress.count, elapsed);
+    printf("    %u wakeups for %u reports, ring full %u times\n", stress.wakeups, stress.count, full);
+}
+
+/**
+ *  Vendor device with a 200 byte output and a 300 byte feature report, both
+ *  longer than a notification could carry.
+ */
+static const uint8_t s_vendor[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01,
+    0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x95, 0x40, 0x09, 0x01, 0x81, 0x02,                                     // 64 byte input
+    0x96, 0xc8, 0x00, 0x09, 0x02, 0x91, 0x02,                               // 200 byte output
+    0x96, 0x2c, 0x01, 0x09, 0x03, 0xb1, 0x02,                               // 300 byte feature
+    0xc0,
+};
+
+static void virthid_output_count_wakeup(void *context, const io_user_reference_t *reference, IOReturn result,
+                                        const io_user_reference_t *args, UInt32 count) {
+    virthid_output_stress *stress = (virthid_output_stress *)context;
+
+    // Reports queued for notifications would carry arguments.
+    if (count != 0) __atomic_add_fetch(&stress->wrong, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->wakeups, 1, __ATOMIC_RELEASE);
+}
+
+static void *virthid_output_driver_consumer(void *context) {
+    virthid_output_stress *stress = (virthid_output_stress *)context;
+    static uint8_t s_report[virthid_max_output_report];
+    virthid_output_record record;
+
+    while (stress->received < stress->count) {
+        uint32_t seen = __atomic_load_n(&stress->wakeups, __ATOMIC_ACQUIRE);
+        virthid_output_ring_result result = stress->ring->pop(&record, s_report, sizeof(s_report));
+
+        if (result == virthid_output_ring_popped) {
+            uint32_t sequence = stress->received++;
+            uint32_t expected_size = sequence % 2 ? 300 : 200;
+            uint32_t expected_type = sequence % 2 ? kIOHIDReportTypeFeature : kIOHIDReportTypeOutput;
+            if (record.size != expected_size || record.type != expected_type ||
+                !virthid_output_matches(s_report, record.size, sequence)) {
+                stress->wrong++;
+            }
+            continue;
+        }
+        if (result == virthid_output_ring_malformed) {
+            stress->wrong++;
+            break;
+        }
+
+        stress->parks++;
+        if (!stress->ring->park()) continue;
+        if (!virthid_output_wait(&stress->wakeups, seen)) {
+            stress->lost_wakeups++;
+            break;
+        }
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(driver_streams_output_through_ring) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    static const char s_name[] = "vendor";
+    UInt32 handle = test.create(s_name, s_vendor, sizeof(s_vendor));
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    it_kotleni_virthid_userclient *client = test.openClient();
+    VIRTHID_REQUIRE(client);
+
+    IOMemoryDescriptor *memory = nullptr;
+    IOOptionBits options = 0;
+    VIRTHID_REQUIRE(client->clientMemoryForType(virthid_memory_output_ring << virthid_memory_type_shift,
+                                                &options, &memory) == kIOReturnSuccess);
+    IOMemoryMap *map = memory->map();
+    VIRTHID_REQUIRE(map);
+    virthid_output_ring ring((virthid_output_ring_shared *)map->getAddress());
+
+    OSAsyncReference64 async = {};
+    VIRTHID_REQUIRE(virthid_test_call(client, it_kotleni_virthid_method_subscribe,
+                                      {virthid_test_ptr(s_name), sizeof(s_name) - 1},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess);
+
+    virthid_output_stress stress = {};
+    stress.ring = &ring;
+    stress.count = virthid_test_iterations(200000) / 10;
+    standin_set_async_handler(&virthid_output_count_wakeup, &stress);
+
+    IOBufferMemoryDescriptor *output = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, 200);
+    IOBufferMemoryDescriptor *feature = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, 300);
+    VIRTHID_REQUIRE(output && feature);
+
+    pthread_t consumer;
+    pthread_create(&consumer, nullptr, &virthid_output_driver_consumer, &stress);
+
+    // The host writes output and feature reports as fast as it can; it
+    // only backs off while the ring is half full, so nothing is dropped.
+    uint32_t failed = 0;
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < stress.count; i++) {
+        IOBufferMemoryDescriptor *report = i % 2 ? feature : output;
+        IOHIDReportType type = i % 2 ? kIOHIDReportTypeFeature : kIOHIDReportTypeOutput;
+
+        while (ring.pending() > virthid_output_ring_capacity / 2) sched_yield();
+        virthid_output_fill((uint8_t *)report->getBytesNoCopy(), (uint32_t)report->getLength(), i);
+        if (test.device(handle)->setReport(report, type, 0) != kIOReturnSuccess) failed++;
+    }
+
+    pthread_join(consumer, nullptr);
+    uint64_t elapsed = virthid_test_now() - start;
+    test.drain();
+    standin_set_async_handler(nullptr, nullptr);
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(stress.received == stress.count);
+    VIRTHID_CHECK(stress.wrong == 0 && stress.lost_wakeups == 0);
+    VIRTHID_CHECK(ring.dropped() == 0);
+
+    // At most one wakeup per time the consumer parked, not one per report.
+    VIRTHID_CHECK(stress.wakeups <= stress.parks + 1);
+    VIRTHID_CHECK(stress.wakeups < stress.count);
+
+    // Every report landing in the ring has its latency recorded by the device.
+    static virthid_histogram_snapshot s_snapshot;
+    VIRTHID_CHECK(test.device(handle)->copyLatency(virthid_latency_output, &s_snapshot) == kIOReturnSuccess);
+    VIRTHID_CHECK(s_snapshot.count == stress.count);
+
+    virthid_bench_report("setReport to ring consumer", stress.count, elapsed);
+    printf("    %u wakeups for %u reports\n", stress.wakeups, stress.count);
+
+    output->release();
+    feature->release();
+    map->release();
+    memory->release();
+    test.closeClient(client);
+}
+
+VIRTHID_TEST(bench_output_ring) {
+    virthid_output_ring ring(&s_shared);
+    static uint8_t s_report[virthid_max_output_report];
+    uint32_t count = virthid_test_iterations(1000000);
+    uint32_t failed = 0;
+
+    ring.reset();
+
+    // Push and pop on one thread, the cost of the ring itself.
+    for (uint32_t size = 8; size <= 8192; size *= 8) {
+        char name[64];
+        snprintf(name, sizeof(name), "output ring push and pop (%u bytes)", size);
+        failed += virthid_bench(name, count, [&](uint32_t i) {
+            virthid_output_record record = {};
+            bool ring_doorbell = false;
+
+            record.size = size;
+            record.handle = i;
+            return ring.push(&record, s_report, &ring_doorbell) &&
+                   ring.pop(&record, s_report, sizeof(s_report)) == virthid_output_ring_popped &&
+                   record.handle == i;
+        });
+    }
+
+    VIRTHID_CHECK(failed == 0);
+}
@@ -0,0 +1,234 @@
+//
+//  VirtHID_OutputTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "VirtHID_Queue.hpp"
+
+static const char s_name[] = "keyboard";
+
+VIRTHID_TEST(queue_keeps_order) {
+    static virthid_queue<uint32_t, 4> s_queue;
+    uint32_t item = 0;
+
+    // Enough rounds for the indices to wrap past the slots.
+    for (uint32_t i = 0; i < 10; i++) {
+        VIRTHID_REQUIRE(s_queue.push(2 * i) && s_queue.push(2 * i + 1));
+        VIRTHID_CHECK(s_queue.size() == 2);
+        VIRTHID_CHECK(s_queue.pop(&item) && item == 2 * i);
+        VIRTHID_CHECK(s_queue.pop(&item) && item == 2 * i + 1);
+    }
+
+    VIRTHID_CHECK(!s_queue.pop(&item));
+    VIRTHID_CHECK(s_queue.dropped() == 0);
+}
+
+VIRTHID_TEST(queue_drops_by_policy) {
+    static virthid_queue<uint32_t, 4> s_newest;
+    static virthid_queue<uint32_t, 4> s_oldest;
+    uint32_t item = 0;
+
+    for (uint32_t i = 0; i < 6; i++) {
+        VIRTHID_CHECK(s_newest.push(i, virthid_drop_newest) == (i < 4));
+        VIRTHID_CHECK(s_oldest.push(i, virthid_drop_oldest) == (i < 4));
+    }
+
+    // A full queue keeps its first or its last four items.
+    for (uint32_t i = 0; i < 4; i++) {
+        VIRTHID_CHECK(s_newest.pop(&item) && item == i);
+        VIRTHID_CHECK(s_oldest.pop(&item) && item == i + 2);
+    }
+
+    VIRTHID_CHECK(s_newest.dropped() == 2);
+    VIRTHID_CHECK(s_oldest.dropped() == 2);
+}
+
+/**
+ *  Holds back delivery of output reports, and checks what gets delivered.
+ */
+struct virthid_output_gate {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool closed;
+    bool waiting;
+
+    uint32_t delivered;
+    uint32_t malformed;
+};
+
+static virthid_output_gate s_gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, false, 0, 0};
+
+static void virthid_output_gate_async(void *context, const io_user_reference_t *reference, IOReturn result,
+                                      const io_user_reference_t *args, UInt32 count) {
+    virthid_output_gate *gate = (virthid_output_gate *)context;
+    const virthid_report *report = (const virthid_report *)args;
+
+    pthread_mutex_lock(&gate->lock);
+    gate->waiting = true;
+    pthread_cond_broadcast(&gate->changed);
+    while (gate->closed) pthread_cond_wait(&gate->changed, &gate->lock);
+    gate->waiting = false;
+
+    if (count * sizeof(io_user_reference_t) != sizeof(virthid_report) || report->size != 1 ||
+        report->data[0] != 0x02) {
+        gate->malformed++;
+    }
+    gate->delivered++;
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void virthid_output_gate_set(virthid_output_gate *gate, bool closed) {
+    pthread_mutex_lock(&gate->lock);
+    gate->closed = closed;
+    pthread_cond_broadcast(&gate->changed);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+/**
+ *  An LED report as the HID stack would set it.
+ */
+static IOBufferMemoryDescriptor *virthid_led_report() {
+    IOBufferMemoryDescriptor *report = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, 1);
+    if (report) *(uint8_t *)report->getBytesNoCopy() = 0x02;
+    return report;
+}
+
+VIRTHID_TEST(set_report_does_not_wait_for_delivery) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    OSAsyncReference64 async = {};
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe,
+                                      {virthid_test_ptr(s_name), sizeof(s_name) - 1},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess);
+
+    IOBufferMemoryDescriptor *report = virthid_led_report();
+    VIRTHID_REQUIRE(report);
+
+    s_gate.delivered = 0;
+    s_gate.malformed = 0;
+    virthid_output_gate_set(&s_gate, true);
+    standin_set_async_handler(&virthid_output_gate_async, &s_gate);
+
+    // The first report holds up the delivery, wait until it does.
+    VIRTHID_CHECK(test.device(handle)->setReport(report, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess);
+    pthread_mutex_lock(&s_gate.lock);
+    while (!s_gate.waiting) pthread_cond_wait(&s_gate.changed, &s_gate.lock);
+    pthread_mutex_unlock(&s_gate.lock);
+
+    // With nothing delivered, the queue fills up and the rest is dropped, all without blocking.
+    const uint32_t total = 4 * virthid_subscriber_queue_size;
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < total; i++) {
+        VIRTHID_CHECK(test.device(handle)->setReport(report, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess);
+    }
+    uint64_t elapsed = virthid_test_now() - start;
+
+    virthid_device_stats stats;
+    test.device(handle)->copyStats(&stats);
+    VIRTHID_CHECK(stats.subscriber_drops == total - virthid_subscriber_queue_size);
+    VIRTHID_CHECK(stats.subscriber_queue_high_water == virthid_subscriber_queue_size);
+    VIRTHID_CHECK(elapsed < 1000000ull * total);
+
+    virthid_output_gate_set(&s_gate, false);
+    test.drain();
+
+    VIRTHID_CHECK(s_gate.delivered == 1 + virthid_subscriber_queue_size);
+    VIRTHID_CHECK(s_gate.malformed == 0);
+
+    report->release();
+}
+
+VIRTHID_TEST(oversized_report_is_a_drop) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    // Dropping the oldest report still queues the new one, but an oversized
+    // report is not queued at all.
+    OSAsyncReference64 async = {};
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe,
+                                      {virthid_test_ptr(s_name), sizeof(s_name) - 1, virthid_drop_oldest},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess);
+
+    IOBufferMemoryDescriptor *large = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, virthid_max_report + 1);
+    VIRTHID_REQUIRE(large);
+    uint64_t before = test.asyncResults();
+
+    VIRTHID_CHECK(test.device(handle)->setReport(large, kIOHIDReportTypeFeature, 0) == kIOReturnSuccess);
+    test.drain();
+
+    virthid_device_stats stats;
+    test.device(handle)->copyStats(&stats);
+    VIRTHID_CHECK(stats.subscriber_drops == 1);
+    VIRTHID_CHECK(test.asyncResults() == before);
+
+    // The next delivery publishes the drop with the others.
+    IOBufferMemoryDescriptor *led = virthid_led_report();
+    VIRTHID_REQUIRE(led);
+    VIRTHID_CHECK(test.device(handle)->setReport(led, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess);
+    test.drain();
+    VIRTHID_CHECK(test.asyncResults() == before + 1);
+
+    OSObject *property = test.client()->copyProperty("DroppedOutputReports");
+    OSNumber *dropped = OSDynamicCast(OSNumber, property);
+    VIRTHID_CHECK(dropped && dropped->unsigned64BitValue() == 1);
+    if (property) property->release();
+
+    led->release();
+    large->release();
+}
+
+VIRTHID_TEST(bench_set_report) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    OSAsyncReference64 async = {};
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe,
+                                      {virthid_test_ptr(s_name), sizeof(s_name) - 1},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess);
+
+    IOBufferMemoryDescriptor *report = virthid_led_report();
+    VIRTHID_REQUIRE(report);
+
+    uint32_t count = virthid_test_iterations(100000);
+    uint64_t *samples = new uint64_t[count];
+    uint32_t failed = 0;
+
+    // What the HID stack waits for per LED report, while the work loop delivers.
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t before = virthid_test_now();
+        if (test.device(handle)->setReport(report, kIOHIDReportTypeOutput, 0) != kIOReturnSuccess) failed++;
+        samples[i] = virthid_test_now() - before;
+    }
+    virthid_bench_report("setReport with a subscriber", count, virthid_test_now() - start);
+    virthid_bench_report_latency("setReport with a subscriber", samples, count);
+
+    test.drain();
+
+    virthid_device_stats stats;
+    test.device(handle)->copyStats(&stats);
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.asyncResults() + stats.subscriber_drops == count);
+    printf("    %llu delivered, %llu dropped\n", (unsigned long long)test.asyncResults(),
+           (unsigned long long)stats.subscriber_drops);
+
+    delete[] samples;
+    report->release();
+}
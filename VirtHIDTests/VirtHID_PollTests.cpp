@@ -0,0 +1,335 @@
+//
+//  VirtHID_PollTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "VirtHID_Poll.hpp"
+
+/**
+ *  A clock the test moves by hand.
+ */
+struct virthid_manual_clock {
+    uint64_t time = 0;
+
+    uint64_t now() const {
+        return time;
+    }
+};
+
+VIRTHID_TEST(pacer_keeps_to_its_grid) {
+    virthid_pacer<virthid_manual_clock> pacer;
+    virthid_manual_clock clock;
+    const uint64_t interval = 1000000;
+
+    clock.time = 5;
+    pacer.start(clock, interval);
+    VIRTHID_CHECK(pacer.nextDeadline() == 5 + interval);
+
+    clock.time = 4 + interval;
+    VIRTHID_CHECK(!pacer.tick(clock));
+    clock.time = 5 + interval;
+    VIRTHID_CHECK(pacer.tick(clock) && pacer.nextDeadline() == 5 + 2 * interval);
+    VIRTHID_CHECK(!pacer.tick(clock));
+
+    // Three and a half intervals late: one frame, three missed, back on the grid.
+    clock.time = 5 + 2 * interval + 3 * interval + interval / 2;
+    VIRTHID_CHECK(pacer.tick(clock));
+    VIRTHID_CHECK(pacer.frames() == 2 && pacer.missed() == 3);
+    VIRTHID_CHECK(pacer.nextDeadline() == 5 + 6 * interval);
+}
+
+VIRTHID_TEST(pacer_does_not_drift) {
+    virthid_pacer<virthid_manual_clock> pacer;
+    virthid_manual_clock clock;
+    const uint64_t interval = 1000000;
+    const uint64_t seconds = 60;
+
+    // A timer at 1 kHz that always fires up to 0.9 ms late.
+    srand(24);
+    pacer.start(clock, interval);
+    while (clock.time < seconds * 1000000000ull) {
+        clock.time = pacer.nextDeadline() + (uint64_t)(rand() % 900) * 1000;
+        pacer.tick(clock);
+    }
+
+    // Late firing never adds up, every interval gets its frame.
+    VIRTHID_CHECK(pacer.missed() == 0);
+    VIRTHID_CHECK(pacer.frames() == seconds * 1000 || pacer.frames() == seconds * 1000 + 1);
+}
+
+/**
+ *  A state block with room for 'capacity' report bytes.
+ */
+struct virthid_test_state {
+    virthid_state_shared header;
+    uint8_t report[64];
+};
+
+VIRTHID_TEST(state_block_reads_what_was_written) {
+    static virthid_test_state s_state;
+    uint8_t report[64];
+    uint32_t report_len = 0;
+
+    memset(&s_state, 0, sizeof(s_state));
+    s_state.header.capacity = sizeof(s_state.report);
+
+    // Nothing published yet.
+    VIRTHID_CHECK(!virthid_state_read(&s_state.header, sizeof(s_state.report), report, &report_len));
+
+    const uint8_t moved[4] = {0x01, 0x10, 0xf0, 0x00};
+    VIRTHID_CHECK(virthid_state_write(&s_state.header, moved, sizeof(moved)));
+    VIRTHID_CHECK(virthid_state_read(&s_state.header, sizeof(s_state.report), report, &report_len));
+    VIRTHID_CHECK(report_len == 4 && memcmp(report, moved, 4) == 0);
+    VIRTHID_CHECK(s_state.header.sequence == 2);
+
+    // Too large for the block.
+    static const uint8_t s_large[65] = {};
+    VIRTHID_CHECK(!virthid_state_write(&s_state.header, s_large, sizeof(s_large)));
+
+    // The reader trusts neither the length nor a writer that never finishes.
+    s_state.header.length = sizeof(s_state.report) + 1;
+    VIRTHID_CHECK(!virthid_state_read(&s_state.header, sizeof(s_state.report), report, &report_len));
+    s_state.header.length = 4;
+    s_state.header.sequence = 3;
+    VIRTHID_CHECK(!virthid_state_read(&s_state.header, sizeof(s_state.report), report, &report_len));
+}
+
+VIRTHID_TEST(poller_repeats_or_skips_frames) {
+    static virthid_test_state s_state;
+    static uint8_t s_last[64];
+    virthid_poller poller;
+    uint8_t report[64];
+    uint32_t report_len = 0;
+
+    memset(&s_state, 0, sizeof(s_state));
+    s_state.header.capacity = sizeof(s_state.report);
+    poller.init(s_last, sizeof(s_state.report));
+
+    // Nothing to repeat before the first state.
+    VIRTHID_CHECK(!poller.frame(&s_state.header, report, &report_len));
+
+    const uint8_t held[4] = {0x01, 0, 0, 0};
+    virthid_state_write(&s_state.header, held, sizeof(held));
+    for (uint32_t i = 0; i < 3; i++) {
+        VIRTHID_CHECK(poller.frame(&s_state.header, report, &report_len));
+        VIRTHID_CHECK(report_len == 4 && memcmp(report, held, 4) == 0);
+    }
+
+    // A client caught mid-write gets the last frame repeated.
+    s_state.header.sequence++;
+    VIRTHID_CHECK(poller.frame(&s_state.header, report, &report_len) && memcmp(report, held, 4) == 0);
+    s_state.header.sequence++;
+
+    // Skipping identical frames, only changes are delivered.
+    poller.reset(true);
+    VIRTHID_CHECK(poller.frame(&s_state.header, report, &report_len));
+    VIRTHID_CHECK(!poller.frame(&s_state.header, report, &report_len));
+    VIRTHID_CHECK(!poller.frame(&s_state.header, report, &report_len));
+    const uint8_t released[4] = {};
+    virthid_state_write(&s_state.header, released, sizeof(released));
+    VIRTHID_CHECK(poller.frame(&s_state.header, report, &report_len) && memcmp(report, released, 4) == 0);
+    VIRTHID_CHECK(poller.skipped() == 2);
+}
+
+/**
+ *  A client publishing states while the device reads them.
+ */
+struct virthid_state_race {
+    virthid_test_state state;
+    bool done;
+    uint32_t torn;
+    uint32_t reads;
+};
+
+static void *virthid_state_writer(void *context) {
+    virthid_state_race *race = (virthid_state_race *)context;
+    uint32_t writes = (uint32_t)virthid_test_iterations(200000);
+    uint8_t report[64];
+
+    // Every byte of a state is the same, its length depends on the value.
+    for (uint32_t i = 0; i < writes; i++) {
+        uint32_t length = 1 + i % sizeof(report);
+        memset(report, (uint8_t)length, length);
+        virthid_state_write(&race->state.header, report, length);
+        if (i % 256 == 0) sched_yield();
+    }
+
+    __atomic_store_n(&race->done, true, __ATOMIC_RELEASE);
+    return nullptr;
+}
+
+VIRTHID_TEST(state_block_never_tears) {
+    static virthid_state_race s_race;
+    uint8_t report[64];
+
+    memset(&s_race, 0, sizeof(s_race));
+    s_race.state.header.capacity = sizeof(s_race.state.report);
+
+    pthread_t writer;
+    pthread_create(&writer, nullptr, &virthid_state_writer, &s_race);
+
+    while (!__atomic_load_n(&s_race.done, __ATOMIC_ACQUIRE)) {
+        uint32_t report_len = 0;
+        if (!virthid_state_read(&s_race.state.header, sizeof(s_race.state.report), report, &report_len)) continue;
+
+        s_race.reads++;
+        for (uint32_t i = 0; i < report_len; i++) {
+            if (report[i] != (uint8_t)report_len) {
+                s_race.torn++;
+                break;
+            }
+        }
+    }
+    pthread_join(writer, nullptr);
+
+    VIRTHID_CHECK(s_race.torn == 0);
+    VIRTHID_CHECK(s_race.reads > 0);
+}
+
+/**
+ *  Map the state block of a device.
+ */
+static virthid_state_shared *virthid_state_map(virthid_test_driver *test, UInt32 handle,
+                                               IOMemoryDescriptor **memory, IOMemoryMap **map) {
+    IOOptionBits options = 0;
+
+    if (test->client()->clientMemoryForType(virthid_memory_state << virthid_memory_type_shift | handle,
+                                            &options, memory) != kIOReturnSuccess) {
+        return nullptr;
+    }
+    *map = (*memory)->map();
+    return *map ? (virthid_state_shared *)(*map)->getAddress() : nullptr;
+}
+
+/**
+ *  Return the reports delivered over 'ms' milliseconds.
+ */
+static uint64_t virthid_poll_count(virthid_test_driver *test, uint32_t ms) {
+    test->drain();
+    uint64_t before = test->reports();
+    IOSleep(ms);
+    test->drain();
+    return test->reports() - before;
+}
+
+VIRTHID_TEST(driver_polls_at_fixed_rate) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("mouse", virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    IOMemoryDescriptor *memory = nullptr;
+    IOMemoryMap *map = nullptr;
+    virthid_state_shared *state = virthid_state_map(&test, handle, &memory, &map);
+    VIRTHID_REQUIRE(state);
+    VIRTHID_CHECK(state->capacity >= 4);
+
+    const uint8_t held[4] = {0x01, 0, 0, 0};
+    VIRTHID_REQUIRE(virthid_state_write(state, held, sizeof(held)));
+
+    // 500 Hz for 200 ms: about 100 frames, the same one each time. A busy
+    // machine may deliver fewer, never more.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                                    {handle, 2000, 0}) == kIOReturnSuccess);
+    uint64_t frames = virthid_poll_count(&test, 200);
+    VIRTHID_CHECK(frames >= 50 && frames <= 102);
+
+    // Skipping identical frames, an unchanged state delivers nothing.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                                    {handle, 2000, 1}) == kIOReturnSuccess);
+    IOSleep(20);
+    VIRTHID_CHECK(virthid_poll_count(&test, 50) == 0);
+    const uint8_t released[4] = {};
+    virthid_state_write(state, released, sizeof(released));
+    VIRTHID_CHECK(virthid_poll_count(&test, 50) == 1);
+
+    // Stopped, and intervals out of range.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                                    {handle, 0, 0}) == kIOReturnSuccess);
+    virthid_state_write(state, held, sizeof(held));
+    VIRTHID_CHECK(virthid_poll_count(&test, 20) == 0);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                                    {handle, virthid_poll_min_interval_us - 1, 0}) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                                    {handle, virthid_poll_max_interval_us + 1, 0}) == kIOReturnBadArgument);
+
+    map->release();
+    memory->release();
+}
+
+/**
+ *  Return the CPU time of the process in nanoseconds.
+ */
+static uint64_t virthid_cpu_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+VIRTHID_TEST(bench_polling_farm) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    // A farm of 100 devices at 1 kHz, each publishing a state once.
+    const uint32_t devices = 100;
+    const uint32_t ms = 1000;
+    static IOMemoryDescriptor *s_memory[devices];
+    static IOMemoryMap *s_maps[devices];
+    static UInt32 s_handles[devices];
+    uint32_t failed = 0;
+
+    for (uint32_t i = 0; i < devices; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "device %u", i);
+        s_handles[i] = test.create(name, virthid_test_mouse, virthid_test_mouse_len);
+        VIRTHID_REQUIRE(s_handles[i] != virthid_invalid_handle);
+
+        virthid_state_shared *state = virthid_state_map(&test, s_handles[i], &s_memory[i], &s_maps[i]);
+        VIRTHID_REQUIRE(state);
+        const uint8_t report[4] = {(uint8_t)(i & 1), 0, 0, 0};
+        virthid_state_write(state, report, sizeof(report));
+
+        if (virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                              {s_handles[i], 1000, 0}) != kIOReturnSuccess) {
+            failed++;
+        }
+    }
+
+    // Not drained, a loop that cannot keep up would never go idle.
+    uint64_t cpu = virthid_cpu_time();
+    uint64_t start = virthid_test_now();
+    uint64_t frames = test.reports();
+    IOSleep(ms);
+    frames = test.reports() - frames;
+    uint64_t elapsed = virthid_test_now() - start;
+    cpu = virthid_cpu_time() - cpu;
+
+    for (uint32_t i = 0; i < devices; i++) {
+        virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling, {s_handles[i], 0, 0});
+    }
+    test.drain();
+
+    for (uint32_t i = 0; i < devices; i++) {
+        s_maps[i]->release();
+        s_memory[i]->release();
+    }
+
+    double expected = (double)devices * 1000.0 * (double)elapsed / 1e9;
+    virthid_bench_report("polled frame (100 devices at 1 kHz)", frames, cpu);
+    printf("    %llu of %.0f frames delivered (%.1f%%), %.1f%% of a CPU\n", (unsigned long long)frames, expected,
+           100.0 * (double)frames / expected, 100.0 * (double)cpu / (double)elapsed);
+
+    // Never faster than asked; on a loaded machine, slower.
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(frames > 0 && (double)frames <= expected * 1.02 + devices);
+}
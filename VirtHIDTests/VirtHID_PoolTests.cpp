@@ -0,0 +1,148 @@
+//
+//  VirtHID_PoolTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "VirtHID_Pool.hpp"
+
+static const uint8_t s_report[8] = {0, 0, 0x04};
+
+VIRTHID_TEST(index_pool_hands_out_each_index_once) {
+    static virthid_index_pool<4> s_pool;
+    bool taken[4] = {};
+
+    // Empty until filled.
+    VIRTHID_CHECK(s_pool.take() == -1);
+
+    s_pool.fill(3);
+    for (int i = 0; i < 3; i++) {
+        int32_t index = s_pool.take();
+        VIRTHID_REQUIRE(index >= 0 && index < 3 && !taken[index]);
+        taken[index] = true;
+    }
+    VIRTHID_CHECK(s_pool.take() == -1);
+
+    s_pool.give(1);
+    VIRTHID_CHECK(s_pool.take() == 1);
+    VIRTHID_CHECK(s_pool.take() == -1);
+}
+
+/**
+ *  Threads taking and giving back indices, each checking that no other
+ *  thread holds the index it got.
+ */
+struct virthid_pool_stress {
+    virthid_index_pool<virthid_report_pool_size> pool;
+    uint32_t held[virthid_report_pool_size];
+    uint32_t rounds;
+    uint32_t shared;
+    uint32_t exhausted;
+};
+
+static void *virthid_pool_stress_thread(void *context) {
+    virthid_pool_stress *stress = (virthid_pool_stress *)context;
+
+    for (uint32_t i = 0; i < stress->rounds; i++) {
+        int32_t index = stress->pool.take();
+        if (index < 0) {
+            __atomic_add_fetch(&stress->exhausted, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        uint32_t expected = 0;
+        if (!__atomic_compare_exchange_n(&stress->held[index], &expected, 1, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_add_fetch(&stress->shared, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        __atomic_store_n(&stress->held[index], 0, __ATOMIC_RELEASE);
+        stress->pool.give((uint32_t)index);
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(index_pool_survives_contention) {
+    static virthid_pool_stress s_stress;
+    const uint32_t threads = 8;
+
+    s_stress.pool.fill(virthid_report_pool_size);
+    s_stress.rounds = virthid_test_iterations(200000);
+
+    // Twice as many threads as indices, so that the pool may also run dry.
+    pthread_t thread[threads];
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_create(&thread[i], nullptr, &virthid_pool_stress_thread, &s_stress);
+    }
+    for (uint32_t i = 0; i < threads; i++) pthread_join(thread[i], nullptr);
+    uint64_t elapsed = virthid_test_now() - start;
+
+    VIRTHID_CHECK(s_stress.shared == 0);
+    virthid_bench_report("index pool take/give (8 threads)", (uint64_t)threads * s_stress.rounds, elapsed);
+    printf("    %u of %u takes found the pool exhausted\n", s_stress.exhausted, threads * s_stress.rounds);
+
+    // Every index made it back.
+    for (uint32_t i = 0; i < virthid_report_pool_size; i++) VIRTHID_CHECK(s_stress.pool.take() >= 0);
+    VIRTHID_CHECK(s_stress.pool.take() == -1);
+}
+
+VIRTHID_TEST(send_allocates_nothing_in_steady_state) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint32_t reports = virthid_test_iterations(100000);
+    uint32_t failed = 0;
+
+    // The first report may still set things up.
+    virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle}, nullptr, 0, s_report, 8);
+
+    uint64_t allocations = standin_allocations();
+    for (uint32_t i = 0; i < reports; i++) {
+        if (virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                              nullptr, 0, s_report, sizeof(s_report)) != kIOReturnSuccess) {
+            failed++;
+        }
+    }
+    allocations = standin_allocations() - allocations;
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(allocations == 0);
+    printf("    %.3f allocations per report\n", (double)allocations / reports);
+}
+
+VIRTHID_TEST(bench_report_buffer_pool) {
+    static virthid_index_pool<virthid_report_pool_size> s_pool;
+    uint32_t iterations = virthid_test_iterations(1000000);
+
+    s_pool.fill(virthid_report_pool_size);
+
+    // What 'dispatchInputReport' does per report, against what it did before.
+    uint32_t failed = virthid_bench("pooled report buffer", iterations, [&](uint32_t i) {
+        int32_t slot = s_pool.take();
+        if (slot < 0) return false;
+        s_pool.give((uint32_t)slot);
+        return true;
+    });
+
+    failed += virthid_bench("allocated report buffer", iterations, [&](uint32_t i) {
+        IOBufferMemoryDescriptor *buffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0,
+                                                                                       sizeof(s_report));
+        if (!buffer) return false;
+        buffer->release();
+        return true;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
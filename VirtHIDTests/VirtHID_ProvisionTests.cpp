@@ -0,0 +1,292 @@
+//
+//  VirtHID_ProvisionTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_Provision.hpp"
+
+/**
+ *  Build a provisioning batch of 'count' devices named "device <i>", with
+ *  serial number "serial <i>", vendor ID i and product ID 2i.
+ *
+ *  @return The batch length, 0 if 'buf' is too short.
+ */
+static uint32_t virthid_provision_build(uint8_t *buf, uint32_t buf_len, const uint8_t *descriptor,
+                                        uint16_t descriptor_len, uint32_t first, uint32_t count) {
+    uint32_t len = virthid_provision_records_offset(descriptor_len);
+    if (len > buf_len) return 0;
+
+    memset(buf, 0, len);
+    memcpy(buf, descriptor, descriptor_len);
+
+    for (uint32_t i = first; i < first + count; i++) {
+        char name[32], serial_number[32];
+        int name_len = snprintf(name, sizeof(name), "device %u", i);
+        int serial_number_len = snprintf(serial_number, sizeof(serial_number), "serial %u", i);
+
+        virthid_provision_record record = {};
+        record.handle = virthid_invalid_handle;
+        record.vendor_id = i;
+        record.product_id = 2 * i;
+        record.name_len = (uint8_t)name_len;
+        record.serial_number_len = (uint16_t)serial_number_len;
+
+        uint32_t size = virthid_provision_record_size(record.name_len, record.serial_number_len);
+        if (size > buf_len - len) return 0;
+
+        memset(buf + len, 0, size);
+        memcpy(buf + len, &record, sizeof(record));
+        memcpy(buf + len + sizeof(record), name, name_len);
+        memcpy(buf + len + sizeof(record) + name_len, serial_number, serial_number_len);
+        len += size;
+    }
+
+    return len;
+}
+
+/**
+ *  Return the handle written back into the nth record of a batch.
+ */
+static uint32_t virthid_provision_handle(const uint8_t *batch, uint32_t batch_len, uint16_t descriptor_len,
+                                         uint32_t index) {
+    virthid_provision_reader reader((uint8_t *)batch, batch_len, descriptor_len);
+    virthid_provision_record record;
+    const char *name = nullptr, *serial_number = nullptr;
+
+    for (uint32_t i = 0; reader.next(&record, &name, &serial_number) == virthid_batch_next; i++) {
+        if (i == index) return record.handle;
+    }
+
+    return virthid_invalid_handle;
+}
+
+VIRTHID_TEST(provision_reader_walks_records) {
+    static uint8_t s_batch[1024];
+    virthid_provision_record record;
+    const char *name = nullptr, *serial_number = nullptr;
+
+    // The descriptor is padded to four bytes before the first record.
+    VIRTHID_CHECK(virthid_provision_records_offset(virthid_test_mouse_len) % 4 == 0);
+    VIRTHID_CHECK(virthid_provision_record_size(8, 8) == 16 + 16);
+    VIRTHID_CHECK(virthid_provision_record_size(8, 9) == 16 + 20);
+
+    uint32_t batch_len = virthid_provision_build(s_batch, sizeof(s_batch), virthid_test_mouse,
+                                                 virthid_test_mouse_len, 8, 3);
+    VIRTHID_REQUIRE(batch_len > 0);
+
+    virthid_provision_reader reader(s_batch, batch_len, virthid_test_mouse_len);
+    VIRTHID_CHECK(reader.valid() && reader.descriptorLength() == virthid_test_mouse_len);
+    VIRTHID_CHECK(memcmp(reader.descriptor(), virthid_test_mouse, virthid_test_mouse_len) == 0);
+
+    for (uint32_t i = 8; i < 11; i++) {
+        VIRTHID_REQUIRE(reader.next(&record, &name, &serial_number) == virthid_batch_next);
+        VIRTHID_CHECK(record.vendor_id == i && record.product_id == 2 * i);
+        VIRTHID_CHECK(record.name_len == (i < 10 ? 8 : 9) && memcmp(name, "device ", 7) == 0);
+        VIRTHID_CHECK(record.serial_number_len == (i < 10 ? 8 : 9) && memcmp(serial_number, "serial ", 7) == 0);
+        reader.setHandle(100 + i);
+    }
+    VIRTHID_CHECK(reader.next(&record, &name, &serial_number) == virthid_batch_end);
+    VIRTHID_CHECK(virthid_provision_handle(s_batch, batch_len, virthid_test_mouse_len, 2) == 110);
+
+    // A cut anywhere in the last record.
+    for (uint32_t len = batch_len - virthid_provision_record_size(9, 9) + 1; len < batch_len - 2; len++) {
+        virthid_provision_reader truncated(s_batch, len, virthid_test_mouse_len);
+        VIRTHID_CHECK(truncated.next(&record, &name, &serial_number) == virthid_batch_next);
+        VIRTHID_CHECK(truncated.next(&record, &name, &serial_number) == virthid_batch_next);
+        VIRTHID_CHECK(truncated.next(&record, &name, &serial_number) == virthid_batch_truncated);
+    }
+
+    virthid_provision_reader short_batch(s_batch, virthid_test_mouse_len - 1, virthid_test_mouse_len);
+    VIRTHID_CHECK(!short_batch.valid());
+    VIRTHID_CHECK(short_batch.next(&record, &name, &serial_number) == virthid_batch_end);
+}
+
+VIRTHID_TEST(driver_creates_in_bulk) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    static uint8_t s_batch[64 * 1024];
+    uint64_t outputs[3] = {};
+    const uint32_t count = 200;
+
+    // The device named "device 5" already exists, its record fails alone.
+    VIRTHID_REQUIRE(test.create("device 5") != virthid_invalid_handle);
+
+    uint32_t batch_len = virthid_provision_build(s_batch, sizeof(s_batch), virthid_test_mouse,
+                                                 virthid_test_mouse_len, 0, count);
+    VIRTHID_REQUIRE(batch_len > 0);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_create_batch,
+                                      {virthid_test_ptr(s_batch), batch_len, virthid_test_mouse_len}, outputs, 3)
+                    == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == count - 1 && outputs[1] == 1 && outputs[2] == 0);
+
+    uint32_t wrong = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t handle = virthid_provision_handle(s_batch, batch_len, virthid_test_mouse_len, i);
+        if (i == 5) {
+            if (handle != virthid_invalid_handle) wrong++;
+            continue;
+        }
+
+        it_kotleni_virthid_device *device = test.device(handle);
+        if (!device || device->vendorID() != i || device->productID() != 2 * i ||
+            !device->reportDescriptor->equals(virthid_test_mouse, virthid_test_mouse_len)) {
+            wrong++;
+        }
+    }
+    VIRTHID_CHECK(wrong == 0);
+
+    // A truncated record at the end keeps what was created before it.
+    batch_len = virthid_provision_build(s_batch, sizeof(s_batch), virthid_test_keyboard,
+                                        virthid_test_keyboard_len, count, 2);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_create_batch,
+                                      {virthid_test_ptr(s_batch), batch_len - 4, virthid_test_keyboard_len},
+                                      outputs, 3) == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == 1 && outputs[1] == 0 && outputs[2] == 1);
+
+    // A descriptor that does not parse creates nothing.
+    static const uint8_t s_bad[] = {0x05, 0x01, 0x09};
+    batch_len = virthid_provision_build(s_batch, sizeof(s_batch), s_bad, sizeof(s_bad), count + 2, 1);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_create_batch,
+                                    {virthid_test_ptr(s_batch), batch_len, sizeof(s_bad)}, outputs, 3)
+                  == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_provision_handle(s_batch, batch_len, sizeof(s_bad), 0) == virthid_invalid_handle);
+}
+
+/**
+ *  Clone a device, 'strings' holding the name followed by the serial number.
+ */
+static IOReturn virthid_clone(virthid_test_driver *test, UInt32 source, const char *strings, uint32_t name_len,
+                              uint32_t vendor_id, uint32_t product_id, UInt32 *handle) {
+    uint64_t output = virthid_invalid_handle;
+
+    IOReturn ret = virthid_test_call(test->client(), it_kotleni_virthid_method_clone,
+                                     {source, name_len, vendor_id, product_id}, &output, 1,
+                                     strings, (uint32_t)strlen(strings));
+    *handle = (UInt32)output;
+    return ret;
+}
+
+VIRTHID_TEST(driver_clones_devices) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    static const char s_serial_number[] = "source serial";
+    uint64_t output = virthid_invalid_handle;
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_create,
+                                      {virthid_test_ptr("mouse"), 5,
+                                       virthid_test_ptr(virthid_test_mouse), virthid_test_mouse_len,
+                                       virthid_test_ptr(s_serial_number), sizeof(s_serial_number) - 1, 0x05ac, 0x0301},
+                                      &output, 1) == kIOReturnSuccess);
+    UInt32 source = (UInt32)output;
+    UInt32 handle = virthid_invalid_handle;
+
+    // Everything left out comes from the source.
+    VIRTHID_REQUIRE(virthid_clone(&test, source, "mouse 2", 7, 0, 0, &handle) == kIOReturnSuccess);
+    it_kotleni_virthid_device *clone = test.device(handle);
+    VIRTHID_REQUIRE(clone);
+    VIRTHID_CHECK(clone->vendorID() == 0x05ac && clone->productID() == 0x0301);
+    VIRTHID_CHECK(clone->reportDescriptor == test.device(source)->reportDescriptor);
+
+    OSString *serial_number = clone->newSerialNumberString();
+    VIRTHID_CHECK(serial_number && serial_number->isEqualTo(s_serial_number));
+    if (serial_number) serial_number->release();
+
+    // Or is given.
+    VIRTHID_REQUIRE(virthid_clone(&test, source, "mouse 3other serial", 7, 0x1234, 0x5678, &handle)
+                    == kIOReturnSuccess);
+    clone = test.device(handle);
+    VIRTHID_REQUIRE(clone);
+    VIRTHID_CHECK(clone->vendorID() == 0x1234 && clone->productID() == 0x5678);
+    serial_number = clone->newSerialNumberString();
+    VIRTHID_CHECK(serial_number && serial_number->isEqualTo("other serial"));
+    if (serial_number) serial_number->release();
+
+    // The clone works on its own.
+    uint8_t report[4] = {0, 1, 1, 0};
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                    nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+
+    VIRTHID_CHECK(virthid_clone(&test, source, "mouse 2", 7, 0, 0, &handle) != kIOReturnSuccess);
+    VIRTHID_CHECK(virthid_clone(&test, virthid_invalid_handle, "mouse 4", 7, 0, 0, &handle) == kIOReturnNotFound);
+    VIRTHID_CHECK(virthid_clone(&test, source, "mouse 4", 8, 0, 0, &handle) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_clone(&test, source, "mouse 4", 0, 0, 0, &handle) == kIOReturnBadArgument);
+}
+
+VIRTHID_TEST(bench_provisioning) {
+    static uint8_t s_batch[64 * 1024];
+    static const char s_serial_number[] = "serial";
+    const uint32_t count = 200;
+    uint32_t rounds = virthid_test_iterations(100) / 20 + 1;
+    uint64_t singles = 0, batches = 0, clones = 0;
+    uint32_t failed = 0;
+
+    uint32_t batch_len = virthid_provision_build(s_batch, sizeof(s_batch), virthid_test_keyboard,
+                                                 virthid_test_keyboard_len, 0, count);
+    VIRTHID_REQUIRE(batch_len > 0);
+
+    // Each round provisions a fresh driver with 200 keyboards, three ways.
+    for (uint32_t round = 0; round < rounds; round++) {
+        {
+            virthid_test_driver test;
+            VIRTHID_REQUIRE(test.ok());
+
+            uint64_t start = virthid_test_now();
+            for (uint32_t i = 0; i < count; i++) {
+                char name[32];
+                int name_len = snprintf(name, sizeof(name), "device %u", i);
+                uint64_t handle = 0;
+                if (virthid_test_call(test.client(), it_kotleni_virthid_method_create,
+                                      {virthid_test_ptr(name), (uint64_t)name_len,
+                                       virthid_test_ptr(virthid_test_keyboard), virthid_test_keyboard_len,
+                                       virthid_test_ptr(s_serial_number), sizeof(s_serial_number) - 1, i, 2 * i},
+                                      &handle, 1) != kIOReturnSuccess) {
+                    failed++;
+                }
+            }
+            singles += virthid_test_now() - start;
+        }
+
+        {
+            virthid_test_driver test;
+            VIRTHID_REQUIRE(test.ok());
+
+            uint64_t outputs[3] = {};
+            uint64_t start = virthid_test_now();
+            if (virthid_test_call(test.client(), it_kotleni_virthid_method_create_batch,
+                                  {virthid_test_ptr(s_batch), batch_len, virthid_test_keyboard_len}, outputs, 3)
+                != kIOReturnSuccess || outputs[0] != count) {
+                failed++;
+            }
+            batches += virthid_test_now() - start;
+        }
+
+        {
+            virthid_test_driver test;
+            VIRTHID_REQUIRE(test.ok());
+
+            UInt32 source = test.create("device 0");
+            uint64_t start = virthid_test_now();
+            for (uint32_t i = 1; i < count; i++) {
+                char name[32];
+                int name_len = snprintf(name, sizeof(name), "device %u", i);
+                UInt32 handle = 0;
+                if (virthid_clone(&test, source, name, name_len, i, 2 * i, &handle) != kIOReturnSuccess) failed++;
+            }
+            clones += virthid_test_now() - start;
+        }
+    }
+
+    virthid_bench_report("create (200 devices, one call each)", (uint64_t)rounds * count, singles);
+    virthid_bench_report("create_batch (200 devices per call)", (uint64_t)rounds * count, batches);
+    virthid_bench_report("clone (199 devices, one call each)", (uint64_t)rounds * (count - 1), clones);
+    printf("    batch provisioning %.1fx faster than single creates\n", (double)singles / batches);
+
+    VIRTHID_CHECK(failed == 0);
+}
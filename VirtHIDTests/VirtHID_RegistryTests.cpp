@@ -0,0 +1,418 @@
+//
+//  VirtHID_RegistryTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "VirtHID_Registry.hpp"
+
+static const uint32_t s_threads = 8;
+
+/**
+ *  pthread based lock for 'virthid_registry'. Writers go first, as with
+ *  kernel read-write locks, or busy readers would starve them.
+ */
+struct virthid_test_rw_lock {
+    pthread_rwlock_t lock;
+
+    bool init() {
+        pthread_rwlockattr_t attr;
+        pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+        pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        bool ret = pthread_rwlock_init(&lock, &attr) == 0;
+        pthread_rwlockattr_destroy(&attr);
+        return ret;
+    }
+
+    void free() { pthread_rwlock_destroy(&lock); }
+
+    void lockShared() { pthread_rwlock_rdlock(&lock); }
+    void unlockShared() { pthread_rwlock_unlock(&lock); }
+    void lockExclusive() { pthread_rwlock_wrlock(&lock); }
+    void unlockExclusive() { pthread_rwlock_unlock(&lock); }
+};
+
+/**
+ *  A reference counted object that remembers being used after its last release.
+ */
+struct virthid_test_object {
+    uint32_t refs;
+    uint32_t id;
+    uint32_t misuse;
+
+    void retain() {
+        if (__atomic_fetch_add(&refs, 1, __ATOMIC_RELAXED) == 0) __atomic_add_fetch(&misuse, 1, __ATOMIC_RELAXED);
+    }
+
+    void release() {
+        if (__atomic_fetch_sub(&refs, 1, __ATOMIC_ACQ_REL) == 0) __atomic_add_fetch(&misuse, 1, __ATOMIC_RELAXED);
+    }
+};
+
+typedef virthid_registry<virthid_test_object, virthid_test_rw_lock, 16> virthid_test_registry;
+
+struct virthid_test_same_id {
+    uint32_t id;
+
+    bool operator()(const virthid_test_object *object) const {
+        return object->id == id;
+    }
+};
+
+VIRTHID_TEST(registry_hands_out_references) {
+    static virthid_test_registry s_registry;
+    virthid_test_object objects[3] = {{1, 10, 0}, {1, 11, 0}, {1, 10, 0}};
+
+    VIRTHID_REQUIRE(s_registry.init());
+    uint32_t generation = s_registry.generation();
+
+    virthid_handle first = s_registry.insert(&objects[0], virthid_test_same_id{10});
+    virthid_handle second = s_registry.insert(&objects[1], virthid_test_same_id{11});
+    VIRTHID_REQUIRE(first != virthid_invalid_handle && second != virthid_invalid_handle);
+    VIRTHID_CHECK(objects[0].refs == 2 && s_registry.count() == 2);
+    VIRTHID_CHECK(s_registry.generation() == generation + 2);
+
+    // A conflicting insert changes nothing.
+    VIRTHID_CHECK(s_registry.insert(&objects[2], virthid_test_same_id{10}) == virthid_invalid_handle);
+    VIRTHID_CHECK(objects[2].refs == 1 && s_registry.generation() == generation + 2);
+
+    virthid_test_object *object = s_registry.copy(second);
+    VIRTHID_CHECK(object == &objects[1] && objects[1].refs == 3);
+    object->release();
+
+    object = s_registry.copyMatching(virthid_test_same_id{10});
+    VIRTHID_CHECK(object == &objects[0] && objects[0].refs == 3);
+    object->release();
+    VIRTHID_CHECK(!s_registry.copyMatching(virthid_test_same_id{12}));
+
+    uint32_t cursor = 0, seen = 0;
+    virthid_handle handle = virthid_invalid_handle;
+    while ((object = s_registry.copyNext(&cursor, &handle))) {
+        VIRTHID_CHECK(handle == (object == &objects[0] ? first : second));
+        object->release();
+        seen++;
+    }
+    VIRTHID_CHECK(seen == 2);
+
+    // Only one remove gets the registry's reference.
+    VIRTHID_CHECK(s_registry.remove(first) == &objects[0]);
+    VIRTHID_CHECK(!s_registry.remove(first) && !s_registry.copy(first));
+    objects[0].release();
+    VIRTHID_CHECK(s_registry.remove(second) == &objects[1]);
+    objects[1].release();
+
+    VIRTHID_CHECK(s_registry.count() == 0 && s_registry.generation() == generation + 4);
+    for (uint32_t i = 0; i < 3; i++) VIRTHID_CHECK(objects[i].refs == 1 && objects[i].misuse == 0);
+
+    s_registry.free();
+}
+
+/**
+ *  Readers resolving handles while writers replace the objects behind them.
+ */
+struct virthid_registry_stress {
+    virthid_test_registry registry;
+    virthid_test_object objects[2][8];
+    virthid_handle handles[2][8];
+    uint32_t count;
+    uint32_t running;
+
+    uint64_t lookups;
+    uint64_t found;
+    uint32_t wrong;
+};
+
+struct virthid_registry_writer {
+    virthid_registry_stress *stress;
+    uint32_t writer;
+};
+
+static void *virthid_registry_stress_read(void *context) {
+    virthid_registry_stress *stress = (virthid_registry_stress *)context;
+    uint64_t lookups = 0, found = 0;
+    uint32_t wrong = 0;
+
+    while (__atomic_load_n(&stress->running, __ATOMIC_ACQUIRE)) {
+        for (uint32_t writer = 0; writer < 2; writer++) {
+            for (uint32_t i = 0; i < 8; i++) {
+                virthid_handle handle = __atomic_load_n(&stress->handles[writer][i], __ATOMIC_ACQUIRE);
+                virthid_test_object *object = stress->registry.copy(handle);
+                lookups++;
+                if (!object) continue;
+
+                // A stale handle never resolves to whatever took its slot.
+                if (object != &stress->objects[writer][i]) wrong++;
+                object->release();
+                found++;
+            }
+        }
+
+        // Let the writers in, even on a single CPU.
+        sched_yield();
+    }
+
+    __atomic_add_fetch(&stress->lookups, lookups, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->found, found, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stress->wrong, wrong, __ATOMIC_RELAXED);
+    return nullptr;
+}
+
+static void *virthid_registry_stress_write(void *context) {
+    virthid_registry_stress *stress = ((virthid_registry_writer *)context)->stress;
+    uint32_t writer = ((virthid_registry_writer *)context)->writer;
+
+    for (uint32_t n = 0; n < stress->count; n++) {
+        uint32_t i = n % 8;
+        virthid_test_object *object = &stress->objects[writer][i];
+
+        if (n / 8 % 2 == 0) {
+            virthid_handle handle = stress->registry.insert(object, virthid_test_same_id{object->id});
+            __atomic_store_n(&stress->handles[writer][i], handle, __ATOMIC_RELEASE);
+        } else {
+            virthid_test_object *removed = stress->registry.remove(stress->handles[writer][i]);
+            if (removed != object) __atomic_add_fetch(&stress->wrong, 1, __ATOMIC_RELAXED);
+            if (removed) removed->release();
+        }
+        if (i == 7) sched_yield();
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(registry_survives_churn) {
+    static virthid_registry_stress s_stress;
+    pthread_t readers[s_threads - 2], writers[2];
+    virthid_registry_writer contexts[2] = {{&s_stress, 0}, {&s_stress, 1}};
+
+    s_stress = {};
+    VIRTHID_REQUIRE(s_stress.registry.init());
+    s_stress.count = 16 * virthid_test_iterations(10000);
+    s_stress.running = 1;
+    for (uint32_t writer = 0; writer < 2; writer++) {
+        for (uint32_t i = 0; i < 8; i++) {
+            s_stress.objects[writer][i] = {1, writer * 8 + i, 0};
+            s_stress.handles[writer][i] = virthid_invalid_handle;
+        }
+    }
+
+    for (uint32_t i = 0; i < s_threads - 2; i++) {
+        pthread_create(&readers[i], nullptr, &virthid_registry_stress_read, &s_stress);
+    }
+    for (uint32_t i = 0; i < 2; i++) pthread_create(&writers[i], nullptr, &virthid_registry_stress_write, &contexts[i]);
+    for (uint32_t i = 0; i < 2; i++) pthread_join(writers[i], nullptr);
+
+    __atomic_store_n(&s_stress.running, 0, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < s_threads - 2; i++) pthread_join(readers[i], nullptr);
+
+    VIRTHID_CHECK(s_stress.wrong == 0);
+    VIRTHID_CHECK(s_stress.found > 0 && s_stress.found < s_stress.lookups);
+    VIRTHID_CHECK(s_stress.registry.count() == 0);
+    for (uint32_t writer = 0; writer < 2; writer++) {
+        for (uint32_t i = 0; i < 8; i++) {
+            VIRTHID_CHECK(s_stress.objects[writer][i].refs == 1 && s_stress.objects[writer][i].misuse == 0);
+        }
+    }
+
+    s_stress.registry.free();
+}
+
+/**
+ *  A user client of its own per thread, creating, sending to and destroying
+ *  devices while others do the same.
+ */
+struct virthid_driver_worker {
+    it_kotleni_virthid_userclient *client;
+    uint32_t index;
+    UInt32 handle;
+    uint32_t count;
+    uint64_t sent;
+    uint32_t failed;
+};
+
+static void *virthid_driver_churn(void *context) {
+    virthid_driver_worker *worker = (virthid_driver_worker *)context;
+    static const char s_serial_number[] = "";
+    uint8_t report[8] = {};
+    char name[16];
+    int name_len = snprintf(name, sizeof(name), "worker %u", worker->index);
+
+    for (uint32_t n = 0; n < worker->count; n++) {
+        uint64_t handle = virthid_invalid_handle;
+        if (virthid_test_call(worker->client, it_kotleni_virthid_method_create,
+                              {virthid_test_ptr(name), (uint64_t)name_len,
+                               virthid_test_ptr(virthid_test_keyboard), virthid_test_keyboard_len,
+                               virthid_test_ptr(s_serial_number), 0, 0, 0},
+                              &handle, 1) != kIOReturnSuccess) {
+            worker->failed++;
+            continue;
+        }
+
+        for (uint32_t i = 0; i < 16; i++) {
+            if (virthid_test_call(worker->client, it_kotleni_virthid_method_send_handle,
+                                  {handle, virthid_test_ptr(report), sizeof(report)}) == kIOReturnSuccess) {
+                worker->sent++;
+            } else {
+                worker->failed++;
+            }
+        }
+
+        if (virthid_test_call(worker->client, it_kotleni_virthid_method_destroy,
+                              {virthid_test_ptr(name), (uint64_t)name_len}) != kIOReturnSuccess) {
+            worker->failed++;
+        }
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(driver_creates_and_sends_concurrently) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    // A device everyone sends to by name, while the registry keeps changing.
+    UInt32 shared = test.create("shared");
+    VIRTHID_REQUIRE(shared != virthid_invalid_handle);
+
+    virthid_driver_worker workers[s_threads];
+    pthread_t threads[s_threads];
+    uint32_t count = virthid_test_iterations(1000) / 10;
+
+    for (uint32_t i = 0; i < s_threads; i++) {
+        workers[i] = {test.openClient(), i, virthid_invalid_handle, count, 0, 0};
+        VIRTHID_REQUIRE(workers[i].client);
+    }
+    for (uint32_t i = 0; i < s_threads; i++) pthread_create(&threads[i], nullptr, &virthid_driver_churn, &workers[i]);
+
+    uint8_t report[8] = {};
+    uint32_t shared_sent = 0;
+    for (uint32_t i = 0; i < 100 * count; i++) {
+        if (virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {shared},
+                              nullptr, 0, report, sizeof(report)) == kIOReturnSuccess) {
+            shared_sent++;
+        }
+    }
+
+    uint64_t sent = shared_sent;
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < s_threads; i++) {
+        pthread_join(threads[i], nullptr);
+        sent += workers[i].sent;
+        failed += workers[i].failed;
+        test.closeClient(workers[i].client);
+    }
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(shared_sent == 100 * count);
+    VIRTHID_CHECK(test.reports() == sent);
+
+    // Only the shared device is left.
+    uint64_t outputs[4] = {};
+    uint8_t entries[256];
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_list_entries,
+                                    {0, virthid_test_ptr(entries), sizeof(entries)}, outputs, 4)
+                  == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == virthid_list_end && outputs[1] == 1);
+}
+
+VIRTHID_TEST(driver_publishes_only_started_devices) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 first = test.create("first");
+    VIRTHID_REQUIRE(first != virthid_invalid_handle);
+
+    // Out of room for the event sources of another device, 'start' fails
+    // and takes off the work loop what it added.
+    unsigned int sources = standin_source_count(test.workLoop());
+    standin_limit_sources(test.workLoop(), 1);
+    VIRTHID_CHECK(test.create("second") == virthid_invalid_handle);
+    standin_limit_sources(test.workLoop(), UINT_MAX);
+    VIRTHID_CHECK(standin_source_count(test.workLoop()) == sources);
+
+    // The device that failed to start was never registered.
+    static const char s_second[] = "second";
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy,
+                                    {virthid_test_ptr(s_second), strlen(s_second)}) != kIOReturnSuccess);
+
+    uint64_t outputs[4] = {};
+    uint8_t entries[256];
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_list_entries,
+                                    {0, virthid_test_ptr(entries), sizeof(entries)}, outputs, 4)
+                  == kIOReturnSuccess);
+    VIRTHID_CHECK(outputs[0] == virthid_list_end && outputs[1] == 1);
+
+    // The name is free again.
+    UInt32 second = test.create(s_second);
+    VIRTHID_CHECK(second != virthid_invalid_handle);
+
+    uint8_t report[8] = {};
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {second},
+                                    nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+    test.drain();
+    VIRTHID_CHECK(test.reports() == 1);
+}
+
+/**
+ *  Sends to a device of the thread's own through a client of its own.
+ */
+static void *virthid_driver_send(void *context) {
+    virthid_driver_worker *worker = (virthid_driver_worker *)context;
+    uint8_t report[8] = {};
+
+    for (uint32_t n = 0; n < worker->count; n++) {
+        if (virthid_test_call(worker->client, it_kotleni_virthid_method_send_inline, {worker->handle},
+                              nullptr, 0, report, sizeof(report)) == kIOReturnSuccess) {
+            worker->sent++;
+        } else {
+            worker->failed++;
+        }
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(bench_send_scaling) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    virthid_driver_worker workers[s_threads];
+    pthread_t threads[s_threads];
+    uint32_t count = virthid_test_iterations(100000);
+    uint32_t failed = 0;
+
+    for (uint32_t i = 0; i < s_threads; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "device %u", i);
+        workers[i] = {test.openClient(), i, test.create(name), count, 0, 0};
+        VIRTHID_REQUIRE(workers[i].client && workers[i].handle != virthid_invalid_handle);
+    }
+
+    // Sends to different devices should not serialize on the registry.
+    for (uint32_t active = 1; active <= s_threads; active *= 2) {
+        uint64_t start = virthid_test_now();
+        for (uint32_t i = 0; i < active; i++) pthread_create(&threads[i], nullptr, &virthid_driver_send, &workers[i]);
+        for (uint32_t i = 0; i < active; i++) pthread_join(threads[i], nullptr);
+        uint64_t elapsed = virthid_test_now() - start;
+
+        char name[64];
+        snprintf(name, sizeof(name), "send_inline (%u threads)", active);
+        virthid_bench_report(name, (uint64_t)active * count, elapsed);
+        printf("    %.0f sends/s\n", 1e9 * active * count / elapsed);
+    }
+
+    for (uint32_t i = 0; i < s_threads; i++) {
+        failed += workers[i].failed;
+        test.closeClient(workers[i].client);
+    }
+    VIRTHID_CHECK(failed == 0);
+}
@@ -0,0 +1,282 @@
+//
+//  VirtHID_ReportCacheTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+
+#include "VirtHID_ReportCache.hpp"
+
+/**
+ *  Keyboard, consumer control and mouse, as report IDs 1 to 3.
+ */
+static const uint8_t s_composite[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01,                         // Keyboard
+    0x05, 0x07, 0x19, 0xe0, 0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x08, 0x81, 0x02,                                                 //   Modifiers
+    0x95, 0x06, 0x75, 0x08, 0x26, 0xff, 0x00, 0x19, 0x00, 0x2a, 0xff, 0x00,
+    0x81, 0x00,                                                             //   Keys
+    0xc0,
+    0x05, 0x0c, 0x09, 0x01, 0xa1, 0x01, 0x85, 0x02,                         // Consumer control
+    0x15, 0x00, 0x26, 0xff, 0x03, 0x19, 0x00, 0x2a, 0xff, 0x03, 0x75, 0x10,
+    0x95, 0x01, 0x81, 0x00,                                                 //   Usage
+    0xc0,
+    0x05, 0x01, 0x09, 0x02, 0xa1, 0x01, 0x85, 0x03, 0x09, 0x01, 0xa1, 0x00, // Mouse
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01,
+    0x95, 0x03, 0x81, 0x02,                                                 //   Buttons
+    0x75, 0x05, 0x95, 0x01, 0x81, 0x03,                                     //   Padding
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7f, 0x75, 0x08,
+    0x95, 0x02, 0x81, 0x06,                                                 //   X, Y
+    0xc0, 0xc0,
+};
+
+/**
+ *  Vendor device with a 64 byte input, 200 byte output and 300 byte feature report.
+ */
+static const uint8_t s_vendor[] = {
+    0x06, 0x00, 0xff, 0x09, 0x01, 0xa1, 0x01,
+    0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08,
+    0x95, 0x40, 0x09, 0x01, 0x81, 0x02,                                     // 64 byte input
+    0x96, 0xc8, 0x00, 0x09, 0x02, 0x91, 0x02,                               // 200 byte output
+    0x96, 0x2c, 0x01, 0x09, 0x03, 0xb1, 0x02,                               // 300 byte feature
+    0xc0,
+};
+
+VIRTHID_TEST(report_cache_keeps_last_report_per_id) {
+    static virthid_report_layout s_layout;
+    static virthid_report_cache s_cache;
+    static uint8_t s_storage[256];
+    uint8_t out[16];
+
+    VIRTHID_REQUIRE(s_layout.parse(s_composite, sizeof(s_composite)) == virthid_parse_ok);
+
+    // Every report rounded up to words: 8, 3 and 4 bytes.
+    uint32_t size = virthid_report_cache::storageSize(&s_layout);
+    VIRTHID_REQUIRE(size == 8 + 8 + 8 && size <= sizeof(s_storage));
+    s_cache.init(&s_layout, s_storage);
+
+    // Nothing stored yet reads as zeros after the ID.
+    const uint8_t empty[8] = {1};
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 1, out, sizeof(out)) == 8);
+    VIRTHID_CHECK(memcmp(out, empty, sizeof(empty)) == 0);
+
+    const uint8_t keys[8] = {1, 0x02, 0, 0x04, 0x05};
+    const uint8_t consumer[3] = {2, 0xe9, 0x00};
+    const uint8_t mouse[4] = {3, 0x01, 0x10, 0xf0};
+    VIRTHID_CHECK(s_cache.store(virthid_report_input, keys, sizeof(keys)));
+    VIRTHID_CHECK(s_cache.store(virthid_report_input, consumer, sizeof(consumer)));
+    VIRTHID_CHECK(s_cache.store(virthid_report_input, mouse, sizeof(mouse)));
+
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 1, out, sizeof(out)) == 8 && memcmp(out, keys, 8) == 0);
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 2, out, sizeof(out)) == 3 && memcmp(out, consumer, 3) == 0);
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 3, out, sizeof(out)) == 4 && memcmp(out, mouse, 4) == 0);
+
+    // A later report replaces the earlier one of its ID only.
+    const uint8_t released[8] = {1};
+    VIRTHID_CHECK(s_cache.store(virthid_report_input, released, sizeof(released)));
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 1, out, sizeof(out)) == 8 && memcmp(out, released, 8) == 0);
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 3, out, sizeof(out)) == 4 && memcmp(out, mouse, 4) == 0);
+
+    // Short buffers get the start of the report.
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 3, out, 2) == 2 && memcmp(out, mouse, 2) == 0);
+
+    // Reports the layout does not define.
+    const uint8_t unknown[4] = {4, 0, 0, 0};
+    VIRTHID_CHECK(!s_cache.store(virthid_report_input, unknown, sizeof(unknown)));
+    VIRTHID_CHECK(!s_cache.store(virthid_report_input, mouse, sizeof(mouse) - 1));
+    VIRTHID_CHECK(!s_cache.store(virthid_report_feature, mouse, sizeof(mouse)));
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 4, out, sizeof(out)) == 0);
+    VIRTHID_CHECK(s_cache.load(virthid_report_feature, 1, out, sizeof(out)) == 0);
+
+    // Nothing is cached for a layout that failed to parse.
+    static const uint8_t s_unclosed[] = {0x05, 0x01, 0x09, 0x06, 0xa1, 0x01};
+    VIRTHID_CHECK(s_layout.parse(s_unclosed, sizeof(s_unclosed)) != virthid_parse_ok);
+    VIRTHID_CHECK(virthid_report_cache::storageSize(&s_layout) == 0);
+    s_cache.init(&s_layout, nullptr);
+    VIRTHID_CHECK(!s_cache.store(virthid_report_input, keys, sizeof(keys)));
+    VIRTHID_CHECK(s_cache.load(virthid_report_input, 0, out, sizeof(out)) == 0);
+}
+
+/**
+ *  A cache shared between threads storing and loading one report.
+ */
+struct virthid_report_cache_race {
+    virthid_report_cache cache;
+    bool done;
+    uint32_t torn;
+    uint32_t loads;
+};
+
+static void *virthid_report_cache_reader(void *arg) {
+    virthid_report_cache_race *race = (virthid_report_cache_race *)arg;
+    uint8_t report[300];
+    uint32_t torn = 0, loads = 0;
+
+    // Every byte of a stored report is the same, a mix means a torn copy.
+    while (!__atomic_load_n(&race->done, __ATOMIC_ACQUIRE) || loads == 0) {
+        if (race->cache.load(virthid_report_feature, 0, report, sizeof(report)) != sizeof(report)) torn++;
+        for (uint32_t i = 1; i < sizeof(report); i++) {
+            if (report[i] != report[0]) {
+                torn++;
+                break;
+            }
+        }
+        loads++;
+    }
+
+    __atomic_add_fetch(&race->torn, torn, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&race->loads, loads, __ATOMIC_RELAXED);
+    return nullptr;
+}
+
+static void *virthid_report_cache_writer(void *arg) {
+    virthid_report_cache_race *race = (virthid_report_cache_race *)arg;
+    uint8_t report[300];
+
+    for (uint32_t i = 0; i < 20000; i++) {
+        memset(report, (uint8_t)i, sizeof(report));
+        if (!race->cache.store(virthid_report_feature, report, sizeof(report))) {
+            __atomic_add_fetch(&race->torn, 1, __ATOMIC_RELAXED);
+        }
+        if (i % 64 == 0) sched_yield();
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(report_cache_never_tears) {
+    static virthid_report_layout s_layout;
+    static virthid_report_cache_race s_race;
+    static uint8_t s_storage[1024];
+
+    VIRTHID_REQUIRE(s_layout.parse(s_vendor, sizeof(s_vendor)) == virthid_parse_ok);
+    VIRTHID_REQUIRE(virthid_report_cache::storageSize(&s_layout) <= sizeof(s_storage));
+    s_race.cache.init(&s_layout, s_storage);
+    s_race.done = false;
+    s_race.torn = 0;
+    s_race.loads = 0;
+
+    // Two writers, so that stores also contend with each other.
+    pthread_t readers[4], writers[2];
+    for (pthread_t &reader : readers) pthread_create(&reader, nullptr, virthid_report_cache_reader, &s_race);
+    for (pthread_t &writer : writers) pthread_create(&writer, nullptr, virthid_report_cache_writer, &s_race);
+    for (pthread_t writer : writers) pthread_join(writer, nullptr);
+    __atomic_store_n(&s_race.done, true, __ATOMIC_RELEASE);
+    for (pthread_t reader : readers) pthread_join(reader, nullptr);
+
+    VIRTHID_CHECK(s_race.torn == 0);
+    VIRTHID_CHECK(s_race.loads >= 4);
+}
+
+/**
+ *  Ask a device for a report, the way the HID stack's GET_REPORT does.
+ */
+static IOReturn virthid_get_report(it_kotleni_virthid_device *device, IOHIDReportType type, uint8_t id,
+                                   uint8_t *report, uint32_t report_len) {
+    IOMemoryDescriptor *buffer = IOMemoryDescriptor::withAddressRange((mach_vm_address_t)report, report_len,
+                                                                      kIODirectionIn, kernel_task);
+    if (!buffer) return kIOReturnNoMemory;
+
+    IOReturn ret = device->getReport(buffer, type, id);
+    buffer->release();
+    return ret;
+}
+
+VIRTHID_TEST(driver_answers_get_report_from_cache) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("vendor", s_vendor, sizeof(s_vendor));
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+    it_kotleni_virthid_device *device = test.device(handle);
+
+    static uint8_t s_feature[300], s_output[200], s_read[300];
+    uint8_t input[64];
+
+    // Before anything is set the host reads zeros.
+    memset(s_read, 0xff, sizeof(s_read));
+    VIRTHID_CHECK(virthid_get_report(device, kIOHIDReportTypeFeature, 0, s_read, sizeof(s_feature)) == kIOReturnSuccess);
+    VIRTHID_CHECK(s_read[0] == 0 && memcmp(s_read, s_read + 1, sizeof(s_feature) - 1) == 0);
+
+    // Feature state set from userspace, answered without it.
+    for (uint32_t i = 0; i < sizeof(s_feature); i++) s_feature[i] = (uint8_t)(i * 7);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_report_state,
+                                    {handle, virthid_report_feature}, nullptr, 0,
+                                    s_feature, sizeof(s_feature)) == kIOReturnSuccess);
+    uint32_t reports = test.reports();
+    VIRTHID_CHECK(virthid_get_report(device, kIOHIDReportTypeFeature, 0, s_read, sizeof(s_feature)) == kIOReturnSuccess);
+    VIRTHID_CHECK(memcmp(s_read, s_feature, sizeof(s_feature)) == 0);
+    VIRTHID_CHECK(test.reports() == reports);
+
+    // The last input report sent.
+    for (uint32_t i = 0; i < sizeof(input); i++) input[i] = (uint8_t)(0x80 + i);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                    {handle, virthid_test_ptr(input), sizeof(input)}) == kIOReturnSuccess);
+    test.drain();
+    VIRTHID_CHECK(virthid_get_report(device, kIOHIDReportTypeInput, 0, s_read, sizeof(input)) == kIOReturnSuccess);
+    VIRTHID_CHECK(memcmp(s_read, input, sizeof(input)) == 0);
+
+    // What the host sets, it reads back.
+    memset(s_output, 0x3c, sizeof(s_output));
+    IOMemoryDescriptor *output = IOMemoryDescriptor::withAddressRange((mach_vm_address_t)s_output, sizeof(s_output),
+                                                                      kIODirectionOut, kernel_task);
+    VIRTHID_REQUIRE(output);
+    VIRTHID_CHECK(device->setReport(output, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess);
+    output->release();
+    VIRTHID_CHECK(virthid_get_report(device, kIOHIDReportTypeOutput, 0, s_read, sizeof(s_output)) == kIOReturnSuccess);
+    VIRTHID_CHECK(memcmp(s_read, s_output, sizeof(s_output)) == 0);
+
+    // Reports the descriptor does not define, and bad requests.
+    VIRTHID_CHECK(virthid_get_report(device, kIOHIDReportTypeFeature, 5, s_read, sizeof(s_read)) == kIOReturnUnsupported);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_report_state,
+                                    {handle, virthid_report_feature}, nullptr, 0,
+                                    s_feature, sizeof(s_feature) - 1) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_report_state,
+                                    {handle, virthid_report_type_count}, nullptr, 0,
+                                    s_feature, sizeof(s_feature)) == kIOReturnBadArgument);
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_set_report_state,
+                                    {handle + 1, virthid_report_feature}, nullptr, 0,
+                                    s_feature, sizeof(s_feature)) == kIOReturnNotFound);
+}
+
+VIRTHID_TEST(bench_report_cache) {
+    static virthid_report_layout s_layout;
+    static virthid_report_cache s_cache;
+    static uint8_t s_storage[256];
+    uint32_t count = virthid_test_iterations(1000000);
+    uint8_t out[16];
+
+    VIRTHID_REQUIRE(s_layout.parse(s_composite, sizeof(s_composite)) == virthid_parse_ok);
+    s_cache.init(&s_layout, s_storage);
+
+    const uint8_t mouse[4] = {3, 0x01, 0x10, 0xf0};
+    uint32_t failed = virthid_bench("report cache store", count, [&](uint32_t i) {
+        return s_cache.store(virthid_report_input, mouse, sizeof(mouse));
+    });
+    failed += virthid_bench("report cache load", count, [&](uint32_t i) {
+        return s_cache.load(virthid_report_input, (uint8_t)(1 + i % 3), out, sizeof(out)) > 0;
+    });
+
+    // The whole GET_REPORT, and setting state from userspace.
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    UInt32 handle = test.create("vendor", s_vendor, sizeof(s_vendor));
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+    it_kotleni_virthid_device *device = test.device(handle);
+    static uint8_t s_feature[300];
+
+    failed += virthid_bench("get_report (300 byte feature)", count / 10, [&](uint32_t i) {
+        return virthid_get_report(device, kIOHIDReportTypeFeature, 0, s_feature, sizeof(s_feature)) == kIOReturnSuccess;
+    });
+    failed += virthid_bench("set_report_state (300 byte feature)", count / 10, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_set_report_state,
+                                 {handle, virthid_report_feature}, nullptr, 0,
+                                 s_feature, sizeof(s_feature)) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
@@ -0,0 +1,179 @@
+//
+//  VirtHID_RingTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#include "VirtHID_Ring.hpp"
+
+static virthid_ring_shared s_shared;
+
+VIRTHID_TEST(ring_keeps_order) {
+    virthid_ring ring(&s_shared);
+    uint8_t report[virthid_max_report];
+    uint32_t report_len = 0;
+    bool ring_doorbell = false;
+
+    ring.reset();
+
+    // Fill the ring twice over, so that the indices wrap past the slots.
+    for (uint32_t round = 0; round < 2; round++) {
+        for (uint32_t i = 0; i < virthid_ring_slot_count; i++) {
+            uint8_t value = (uint8_t)i;
+            VIRTHID_REQUIRE(ring.push(&value, 1, &ring_doorbell));
+        }
+        VIRTHID_CHECK(!ring.push(report, 1, &ring_doorbell));
+
+        for (uint32_t i = 0; i < virthid_ring_slot_count; i++) {
+            VIRTHID_REQUIRE(ring.pop(report, &report_len) == virthid_ring_popped);
+            VIRTHID_CHECK(report_len == 1 && report[0] == (uint8_t)i);
+        }
+        VIRTHID_CHECK(ring.pop(report, &report_len) == virthid_ring_empty);
+    }
+
+    VIRTHID_CHECK(!ring.push(report, virthid_max_report + 1, &ring_doorbell));
+}
+
+VIRTHID_TEST(ring_rings_doorbell_once) {
+    virthid_ring ring(&s_shared);
+    uint8_t report[virthid_max_report] = {};
+    uint32_t report_len = 0;
+    bool ring_doorbell = false;
+
+    ring.reset();
+
+    // Only the report that makes a parked ring non-empty rings the doorbell.
+    VIRTHID_CHECK(ring.push(report, 8, &ring_doorbell) && ring_doorbell);
+    VIRTHID_CHECK(ring.push(report, 8, &ring_doorbell) && !ring_doorbell);
+
+    // Parking with reports pending tells the consumer to go on.
+    VIRTHID_CHECK(!ring.park());
+    while (ring.pop(report, &report_len) == virthid_ring_popped) {}
+    VIRTHID_CHECK(ring.park());
+
+    VIRTHID_CHECK(ring.push(report, 8, &ring_doorbell) && ring_doorbell);
+}
+
+VIRTHID_TEST(ring_survives_corruption) {
+    virthid_ring ring(&s_shared);
+    uint8_t report[virthid_max_report] = {};
+    uint32_t report_len = 0;
+    bool ring_doorbell = false;
+
+    ring.reset();
+
+    // A slot with an impossible size is skipped, the next one still pops.
+    ring.push(report, 8, &ring_doorbell);
+    ring.push(report, 4, &ring_doorbell);
+    s_shared.slots[0].size = virthid_max_report + 1;
+    VIRTHID_CHECK(ring.pop(report, &report_len) == virthid_ring_malformed);
+    VIRTHID_CHECK(ring.pop(report, &report_len) == virthid_ring_popped && report_len == 4);
+
+    // A head further ahead than the ring holds drops everything pending.
+    s_shared.head = s_shared.tail + virthid_ring_slot_count + 1;
+    VIRTHID_CHECK(ring.pop(report, &report_len) == virthid_ring_malformed);
+    VIRTHID_CHECK(ring.pop(report, &report_len) == virthid_ring_empty);
+}
+
+/**
+ *  Reports carry a sequence number in their reserved byte.
+ */
+struct virthid_ring_stress {
+    virthid_test_driver *test;
+    UInt32 handle;
+    uint32_t count;
+
+    uint32_t doorbells;
+    uint32_t doorbells_rung;
+    bool done;
+
+    uint32_t delivered;
+    uint32_t out_of_order;
+};
+
+static IOReturn virthid_ring_stress_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                           const uint8_t *report, uint32_t report_len) {
+    virthid_ring_stress *stress = (virthid_ring_stress *)context;
+
+    // Delivered from the doorbell thread only.
+    if (report_len != 8 || report[1] != (uint8_t)stress->delivered) stress->out_of_order++;
+    __atomic_store_n(&stress->delivered, stress->delivered + 1, __ATOMIC_RELEASE);
+
+    return kIOReturnSuccess;
+}
+
+static void *virthid_ring_stress_doorbell(void *context) {
+    virthid_ring_stress *stress = (virthid_ring_stress *)context;
+
+    for (;;) {
+        uint32_t requested = __atomic_load_n(&stress->doorbells, __ATOMIC_ACQUIRE);
+        if (requested == stress->doorbells_rung) {
+            if (__atomic_load_n(&stress->done, __ATOMIC_ACQUIRE)) break;
+            sched_yield();
+            continue;
+        }
+
+        stress->doorbells_rung = requested;
+        virthid_test_call(stress->test->client(), it_kotleni_virthid_method_doorbell, {stress->handle});
+    }
+
+    return nullptr;
+}
+
+VIRTHID_TEST(ring_delivers_under_contention) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    virthid_ring_stress stress = {};
+    stress.test = &test;
+    stress.handle = test.create("keyboard");
+    stress.count = virthid_test_iterations(200000);
+    VIRTHID_REQUIRE(stress.handle != virthid_invalid_handle);
+
+    IOMemoryDescriptor *memory = nullptr;
+    IOOptionBits options = 0;
+    VIRTHID_REQUIRE(test.client()->clientMemoryForType(virthid_memory_input_ring << virthid_memory_type_shift |
+                                                       stress.handle, &options, &memory) == kIOReturnSuccess);
+    IOMemoryMap *map = memory->map();
+    virthid_ring ring((virthid_ring_shared *)map->getAddress());
+
+    standin_set_report_handler(&virthid_ring_stress_report, &stress);
+
+    pthread_t doorbell;
+    pthread_create(&doorbell, nullptr, &virthid_ring_stress_doorbell, &stress);
+
+    // The producer only asks for the doorbell when the ring says so.
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < stress.count; i++) {
+        uint8_t report[8] = {0, (uint8_t)i};
+        bool ring_doorbell = false;
+
+        while (!ring.push(report, sizeof(report), &ring_doorbell)) sched_yield();
+        if (ring_doorbell) __atomic_add_fetch(&stress.doorbells, 1, __ATOMIC_RELEASE);
+    }
+
+    // Every report gets delivered without another doorbell.
+    while (__atomic_load_n(&stress.delivered, __ATOMIC_ACQUIRE) < stress.count &&
+           virthid_test_now() - start < 10000000000ull) {
+        sched_yield();
+    }
+    uint64_t elapsed = virthid_test_now() - start;
+
+    __atomic_store_n(&stress.done, true, __ATOMIC_RELEASE);
+    pthread_join(doorbell, nullptr);
+
+    VIRTHID_CHECK(stress.delivered == stress.count);
+    VIRTHID_CHECK(stress.out_of_order == 0);
+    virthid_bench_report("ring producer to HID stack", stress.count, elapsed);
+    printf("    %u doorbells for %u reports\n", stress.doorbells, stress.count);
+
+    map->release();
+    memory->release();
+}
@@ -0,0 +1,240 @@
+//
+//  VirtHID_ScheduleTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "VirtHID_Clock.hpp"
+#include "VirtHID_Schedule.hpp"
+
+/**
+ *  A clock that only moves when told to.
+ */
+struct virthid_manual_clock {
+    uint64_t time;
+
+    uint64_t now() const {
+        return time;
+    }
+};
+
+typedef virthid_schedule<virthid_manual_clock, 64> virthid_test_schedule;
+
+VIRTHID_TEST(schedule_orders_by_deadline) {
+    static virthid_test_schedule s_schedule;
+    static uint8_t s_storage[64 * 8];
+    virthid_manual_clock clock = {0};
+    uint8_t report[8] = {};
+    uint32_t report_len = 0;
+    uint64_t deadline = 0;
+
+    s_schedule.reset(s_storage, 8);
+    VIRTHID_CHECK(s_schedule.capacity() == 64);
+    VIRTHID_CHECK(!s_schedule.nextDeadline(&deadline));
+    srand(10);
+
+    // Few distinct deadlines, so that many of them tie. The report carries
+    // its deadline and submission order.
+    for (uint32_t i = 0; i < 64; i++) {
+        uint8_t entry[8] = {(uint8_t)(rand() % 8), (uint8_t)i};
+        VIRTHID_REQUIRE(s_schedule.push(1000 + entry[0], entry, sizeof(entry)));
+    }
+    VIRTHID_CHECK(!s_schedule.push(0, report, sizeof(report)));
+    VIRTHID_CHECK(s_schedule.nextDeadline(&deadline) && deadline >= 1000 && deadline < 1008);
+
+    // Nothing is due before its deadline.
+    clock.time = 999;
+    VIRTHID_CHECK(!s_schedule.popDue(clock, report, &report_len));
+
+    clock.time = 2000;
+    uint8_t last_deadline = 0, last_order = 0;
+    uint64_t lateness = 0;
+    for (uint32_t i = 0; i < 64; i++) {
+        VIRTHID_REQUIRE(s_schedule.popDue(clock, report, &report_len, &lateness));
+        VIRTHID_CHECK(report_len == 8 && lateness == clock.time - 1000 - report[0]);
+        VIRTHID_CHECK(report[0] > last_deadline ||
+                      (report[0] == last_deadline && (i == 0 || report[1] > last_order)));
+        last_deadline = report[0];
+        last_order = report[1];
+    }
+    VIRTHID_CHECK(!s_schedule.popDue(clock, report, &report_len));
+    VIRTHID_CHECK(s_schedule.size() == 0);
+}
+
+VIRTHID_TEST(schedule_sizes_slots_by_stride) {
+    static virthid_schedule<virthid_manual_clock> s_schedule;
+
+    // Large reports get fewer slots, never none.
+    VIRTHID_CHECK(s_schedule.capacityFor(8) == virthid_schedule_capacity);
+    VIRTHID_CHECK(s_schedule.capacityFor(virthid_max_report) == virthid_schedule_capacity);
+    VIRTHID_CHECK(s_schedule.capacityFor(4 * virthid_max_report) == virthid_schedule_capacity / 4);
+    VIRTHID_CHECK(s_schedule.capacityFor(virthid_schedule_budget + 1) == 1);
+
+    static uint8_t s_storage[2 * 4096];
+    virthid_manual_clock clock = {0};
+    uint8_t report[4096] = {};
+    uint32_t report_len = 0;
+
+    s_schedule.reset(s_storage, 4096);
+    VIRTHID_CHECK(s_schedule.storageSize(4096) == s_schedule.capacity() * 4096);
+    VIRTHID_CHECK(!s_schedule.push(0, report, 4097));
+    VIRTHID_CHECK(s_schedule.push(0, report, 4096));
+    VIRTHID_CHECK(s_schedule.popDue(clock, report, &report_len) && report_len == 4096);
+}
+
+VIRTHID_TEST(schedule_reader_walks_records) {
+    uint8_t records[64] = {};
+    virthid_schedule_record record = {};
+    record.deadline = 5;
+    record.length = 3;
+    memcpy(records, &record, sizeof(record));
+    record.deadline = 6;
+    record.length = 8;
+    memcpy(records + virthid_schedule_record_size(3), &record, sizeof(record));
+
+    uint32_t records_len = virthid_schedule_record_size(3) + virthid_schedule_record_size(8);
+    VIRTHID_CHECK(records_len == 24 + 24);
+
+    uint64_t deadline = 0;
+    const uint8_t *report = nullptr;
+    uint16_t report_len = 0;
+
+    virthid_schedule_reader reader(records, records_len);
+    VIRTHID_CHECK(reader.next(&deadline, &report, &report_len) == 1 && deadline == 5 && report_len == 3);
+    VIRTHID_CHECK(reader.next(&deadline, &report, &report_len) == 1 && deadline == 6 && report_len == 8);
+    VIRTHID_CHECK(reader.next(&deadline, &report, &report_len) == 0);
+
+    virthid_schedule_reader truncated(records, records_len - 1);
+    VIRTHID_CHECK(truncated.next(&deadline, &report, &report_len) == 1);
+    VIRTHID_CHECK(truncated.next(&deadline, &report, &report_len) == -1);
+}
+
+VIRTHID_TEST(bench_schedule_simulated_timer) {
+    static virthid_schedule<virthid_manual_clock> s_schedule;
+    static uint8_t s_storage[virthid_schedule_capacity * 8];
+    virthid_manual_clock clock = {0};
+    uint32_t count = virthid_test_iterations(1000000);
+    uint64_t *samples = new uint64_t[virthid_schedule_capacity];
+    uint32_t sampled = 0;
+    uint8_t report[8] = {};
+    uint32_t report_len = 0;
+    uint32_t out_of_order = 0;
+
+    s_schedule.reset(s_storage, 8);
+    srand(10);
+
+    // Reports 1 ms apart, submitted in shuffled batches. A simulated timer
+    // fires up to 50 us after the earliest deadline and releases what is due.
+    uint64_t start = virthid_test_now();
+    uint64_t released = 0, next = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t deadline = (i ^ (rand() % 16)) * 1000000ull;
+        while (!s_schedule.push(deadline, report, sizeof(report))) {
+            uint64_t earliest = 0;
+            s_schedule.nextDeadline(&earliest);
+            if (clock.time < earliest) clock.time = earliest + rand() % 50000;
+
+            uint64_t lateness = 0;
+            while (s_schedule.popDue(clock, report, &report_len, &lateness)) {
+                if (clock.time - lateness < next) out_of_order++;
+                next = clock.time - lateness;
+                if (sampled < virthid_schedule_capacity) samples[sampled++] = lateness;
+                released++;
+            }
+        }
+    }
+    virthid_bench_report("schedule push and release", count, virthid_test_now() - start);
+    virthid_bench_report_latency("simulated dispatch lateness", samples, sampled);
+
+    VIRTHID_CHECK(out_of_order == 0);
+    VIRTHID_CHECK(released + s_schedule.size() == count);
+
+    delete[] samples;
+}
+
+/**
+ *  Receives scheduled keyboard reports carrying their index, and how late
+ *  each one arrived.
+ */
+struct virthid_schedule_capture {
+    uint64_t start;
+    uint64_t interval;
+    uint32_t count;
+    uint32_t received;
+    uint32_t out_of_order;
+    uint64_t *lateness;
+};
+
+static IOReturn virthid_schedule_capture_report(void *context, IOHIDDevice *device, IOHIDReportType type,
+                                                const uint8_t *report, uint32_t report_len) {
+    virthid_schedule_capture *capture = (virthid_schedule_capture *)context;
+    uint64_t now = virthid_uptime_clock().now();
+    uint32_t index = report[2] | (uint32_t)report[3] << 8;
+
+    if (index != capture->received || index >= capture->count) {
+        capture->out_of_order++;
+    } else {
+        uint64_t deadline = capture->start + index * capture->interval;
+        capture->lateness[index] = now > deadline ? now - deadline : 0;
+    }
+    __atomic_store_n(&capture->received, capture->received + 1, __ATOMIC_RELEASE);
+
+    return kIOReturnSuccess;
+}
+
+VIRTHID_TEST(bench_schedule_dispatch_jitter) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static virthid_schedule_capture s_capture;
+    static uint8_t s_records[256 * 24];
+    s_capture = {};
+    s_capture.count = 256;
+    s_capture.interval = 500000;
+    s_capture.lateness = new uint64_t[s_capture.count];
+    s_capture.start = virthid_uptime_clock().now() + 10000000;
+
+    // A single submission covering the next 128 ms, in reverse order.
+    uint32_t records_len = 0;
+    for (uint32_t i = s_capture.count; i-- > 0;) {
+        virthid_schedule_record record = {};
+        record.deadline = s_capture.start + i * s_capture.interval;
+        record.length = 8;
+        uint8_t report[8] = {0, 0, (uint8_t)i, (uint8_t)(i >> 8)};
+        memcpy(s_records + records_len, &record, sizeof(record));
+        memcpy(s_records + records_len + sizeof(record), report, sizeof(report));
+        records_len += virthid_schedule_record_size(sizeof(report));
+    }
+
+    standin_set_report_handler(&virthid_schedule_capture_report, &s_capture);
+
+    uint64_t scheduled = 0;
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_schedule,
+                                      {handle, virthid_test_ptr(s_records), records_len}, &scheduled, 1)
+                    == kIOReturnSuccess);
+    VIRTHID_CHECK(scheduled == s_capture.count);
+
+    uint64_t timeout = virthid_test_now() + 5000000000ull;
+    while (__atomic_load_n(&s_capture.received, __ATOMIC_ACQUIRE) < s_capture.count &&
+           virthid_test_now() < timeout) {
+        usleep(1000);
+    }
+
+    VIRTHID_CHECK(s_capture.received == s_capture.count);
+    VIRTHID_CHECK(s_capture.out_of_order == 0);
+    if (s_capture.out_of_order == 0) {
+        virthid_bench_report_latency("timer dispatch lateness", s_capture.lateness, s_capture.received);
+    }
+
+    delete[] s_capture.lateness;
+}
@@ -0,0 +1,642 @@
+//
+//  VirtHID_SelectorBench.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "VirtHID_Batch.hpp"
+#include "VirtHID_Clock.hpp"
+#include "VirtHID_Encoder.hpp"
+#include "VirtHID_Events.hpp"
+#include "VirtHID_Histogram.hpp"
+#include "VirtHID_Keyboard.hpp"
+#include "VirtHID_List.hpp"
+#include "VirtHID_Log.hpp"
+#include "VirtHID_Provision.hpp"
+#include "VirtHID_Ring.hpp"
+#include "VirtHID_Schedule.hpp"
+#include "VirtHID_Stats.hpp"
+
+/**
+ *  One benchmark per 'externalMethod' selector, each timing the whole call
+ *  the way a client makes it: argument checks, wiring and mapping user
+ *  memory, and the driver's work.
+ */
+
+static const char s_name[] = "bench";
+static const uint8_t s_key_down[8] = {0, 0, 0x04};
+static const uint8_t s_key_up[8] = {};
+
+static uint32_t virthid_bench_iterations() {
+    return virthid_test_iterations(100000);
+}
+
+/**
+ *  Devices at once in the create, clone and listing benchmarks, well below
+ *  'virthid_max_devices'.
+ */
+static const uint32_t s_devices = 256;
+
+static OSAsyncReference64 s_async;
+
+static const uint8_t *virthid_bench_key(uint32_t i) {
+    return (i & 1) ? s_key_up : s_key_down;
+}
+
+static void virthid_bench_name(char *name, size_t name_size, const char *prefix, uint32_t i) {
+    snprintf(name, name_size, "%s-%u", prefix, i);
+}
+
+static bool virthid_bench_destroy(virthid_test_driver *test, const char *name) {
+    return virthid_test_call(test->client(), it_kotleni_virthid_method_destroy,
+                             {virthid_test_ptr(name), strlen(name)}) == kIOReturnSuccess;
+}
+
+/**
+ *  Create 'count' keyboards named 'prefix-<i>'.
+ */
+static bool virthid_bench_populate(virthid_test_driver *test, const char *prefix, uint32_t count) {
+    char name[32];
+
+    for (uint32_t i = 0; i < count; i++) {
+        virthid_bench_name(name, sizeof(name), prefix, i);
+        if (test->create(name) == virthid_invalid_handle) return false;
+    }
+
+    return true;
+}
+
+VIRTHID_TEST(bench_create_destroy) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    uint32_t count = virthid_bench_iterations() < s_devices ? virthid_bench_iterations() : s_devices;
+    uint32_t failed = 0;
+    char name[32];
+
+    for (uint32_t done = 0; done < virthid_bench_iterations(); done += count) {
+        failed += virthid_bench("create", count, [&](uint32_t i) {
+            virthid_bench_name(name, sizeof(name), "bench", i);
+            return test.create(name) != virthid_invalid_handle;
+        });
+
+        failed += virthid_bench("destroy", count, [&](uint32_t i) {
+            virthid_bench_name(name, sizeof(name), "bench", i);
+            return virthid_bench_destroy(&test, name);
+        });
+
+        // Device churn dominates, a few rounds tell enough.
+        if (done >= 4 * count) break;
+    }
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_send) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    VIRTHID_REQUIRE(test.create(s_name) != virthid_invalid_handle);
+
+    uint64_t outputs[2];
+    uint32_t failed = virthid_bench("send", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send,
+                                 {virthid_test_ptr(s_name), sizeof(s_name) - 1,
+                                  virthid_test_ptr(virthid_bench_key(i)), 8}, outputs, 2) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == virthid_bench_iterations());
+}
+
+VIRTHID_TEST(bench_list) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    VIRTHID_REQUIRE(virthid_bench_populate(&test, "bench", 64));
+
+    static char s_buf[4096];
+    uint64_t outputs[2];
+    uint32_t failed = virthid_bench("list (64 devices)", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_list,
+                                 {virthid_test_ptr(s_buf), sizeof(s_buf)}, outputs, 2) == kIOReturnSuccess &&
+               outputs[1] == 64;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_subscribe) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    VIRTHID_REQUIRE(test.create(s_name) != virthid_invalid_handle);
+
+    // Subscribing again only updates the async reference.
+    uint32_t failed = virthid_bench("subscribe", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe,
+                                 {virthid_test_ptr(s_name), sizeof(s_name) - 1},
+                                 nullptr, 0, nullptr, 0, nullptr, 0, s_async) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_send_handle) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint64_t outputs[2];
+    uint32_t failed = virthid_bench("send_handle", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                 {handle, virthid_test_ptr(virthid_bench_key(i)), 8}, outputs, 2) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == virthid_bench_iterations());
+}
+
+VIRTHID_TEST(bench_doorbell) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    IOMemoryDescriptor *memory = nullptr;
+    IOOptionBits options = 0;
+    VIRTHID_REQUIRE(test.client()->clientMemoryForType(virthid_memory_input_ring << virthid_memory_type_shift | handle,
+                                                       &options, &memory) == kIOReturnSuccess);
+
+    IOMemoryMap *map = memory->map();
+    VIRTHID_REQUIRE(map);
+    virthid_ring ring((virthid_ring_shared *)map->getAddress());
+
+    // One report per doorbell, the worst case for a ring.
+    uint32_t failed = virthid_bench("doorbell (1 report)", virthid_bench_iterations(), [&](uint32_t i) {
+        bool ring_doorbell = false;
+        while (!ring.push(virthid_bench_key(i), 8, &ring_doorbell)) test.drain();
+
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_doorbell, {handle}) == kIOReturnSuccess;
+    });
+
+    test.drain();
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == virthid_bench_iterations());
+
+    map->release();
+    memory->release();
+}
+
+VIRTHID_TEST(bench_send_batch) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    const uint32_t records = 64;
+    static uint8_t s_batch[64 * 16];
+    uint32_t batch_len = 0;
+
+    for (uint32_t i = 0; i < records; i++) {
+        virthid_batch_record record = {handle, 8, 0};
+        memcpy(s_batch + batch_len, &record, sizeof(record));
+        memcpy(s_batch + batch_len + sizeof(record), virthid_bench_key(i), 8);
+        batch_len += virthid_batch_record_size(8);
+    }
+
+    uint64_t outputs[3];
+    uint32_t calls = (virthid_bench_iterations() + records - 1) / records;
+    uint32_t failed = virthid_bench("send_batch (64 records)", calls, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_batch,
+                                 {virthid_test_ptr(s_batch), batch_len, 0, 0}, outputs, 3) == kIOReturnSuccess &&
+               outputs[0] == records && outputs[1] == 0;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == (uint64_t)calls * records);
+}
+
+VIRTHID_TEST(bench_send_inline) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint64_t outputs[2];
+    uint32_t failed = virthid_bench("send_inline", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle}, outputs, 2,
+                                 virthid_bench_key(i), 8) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == virthid_bench_iterations());
+}
+
+VIRTHID_TEST(bench_set_coalescing) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    // Only devices with relative input coalesce.
+    UInt32 handle = test.create(s_name, virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint32_t failed = virthid_bench("set_coalescing", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing,
+                                 {handle, i & 1}) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_schedule) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    const uint32_t records = 16;
+    static uint8_t s_records[16 * 32];
+    uint32_t records_len = 0;
+    uint64_t scheduled = 0;
+
+    // Deadlines in the past are due right away, the schedule drains as it fills.
+    for (uint32_t i = 0; i < records; i++) {
+        virthid_schedule_record record = {};
+        record.deadline = virthid_uptime_clock().now();
+        record.length = 8;
+        memcpy(s_records + records_len, &record, sizeof(record));
+        memcpy(s_records + records_len + sizeof(record), virthid_bench_key(i), 8);
+        records_len += virthid_schedule_record_size(8);
+    }
+
+    uint32_t calls = (virthid_bench_iterations() + records - 1) / records;
+    uint32_t failed = virthid_bench("schedule (16 records)", calls, [&](uint32_t i) {
+        uint64_t outputs[1] = {};
+        IOReturn ret = virthid_test_call(test.client(), it_kotleni_virthid_method_schedule,
+                                         {handle, virthid_test_ptr(s_records), records_len}, outputs, 1);
+        if (ret == kIOReturnNoSpace) test.drain();
+
+        scheduled += outputs[0];
+        return ret == kIOReturnSuccess || ret == kIOReturnNoSpace;
+    });
+
+    test.drain();
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(test.reports() == scheduled);
+}
+
+VIRTHID_TEST(bench_set_capture) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint32_t failed = virthid_bench("set_capture", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_set_capture,
+                                 {handle, (i & 1) ^ 1}) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+/**
+ *  Capture 'count' reports of 'handle' into 'log'.
+ *
+ *  @return The log length, zero on failure.
+ */
+static uint32_t virthid_bench_capture(virthid_test_driver *test, UInt32 handle, uint32_t count,
+                                      uint8_t *log, uint32_t log_len) {
+    uint64_t outputs[2] = {};
+
+    if (virthid_test_call(test->client(), it_kotleni_virthid_method_set_capture, {handle, 1}) != kIOReturnSuccess) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        virthid_test_call(test->client(), it_kotleni_virthid_method_send_handle,
+                          {handle, virthid_test_ptr(virthid_bench_key(i)), 8});
+    }
+
+    if (virthid_test_call(test->client(), it_kotleni_virthid_method_read_capture,
+                          {handle, virthid_test_ptr(log), log_len}, outputs, 2) != kIOReturnSuccess) {
+        return 0;
+    }
+
+    virthid_test_call(test->client(), it_kotleni_virthid_method_set_capture, {handle, 0});
+    return (uint32_t)outputs[0];
+}
+
+VIRTHID_TEST(bench_read_capture) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_capture,
+                                      {handle, 1}) == kIOReturnSuccess);
+
+    static uint8_t s_log[64 * 1024];
+    uint64_t outputs[2];
+
+    // Each read takes what the reports sent since the previous one left.
+    uint32_t failed = virthid_bench("read_capture (16 reports)", virthid_bench_iterations() / 16, [&](uint32_t i) {
+        for (uint32_t j = 0; j < 16; j++) {
+            virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                              {handle, virthid_test_ptr(virthid_bench_key(j)), 8});
+        }
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_read_capture,
+                                 {handle, virthid_test_ptr(s_log), sizeof(s_log)}, outputs, 2) == kIOReturnSuccess &&
+               outputs[0] > 0;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_replay) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static uint8_t s_log[64 * 1024];
+    uint32_t log_len = virthid_bench_capture(&test, handle, 64, s_log, sizeof(s_log));
+    VIRTHID_REQUIRE(log_len > 0);
+
+    uint64_t outputs[1];
+    uint32_t calls = (virthid_bench_iterations() + 63) / 64;
+    uint32_t failed = virthid_bench("replay (64 reports)", calls, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_replay,
+                                 {handle, virthid_test_ptr(s_log), log_len, 0}, outputs, 1) == kIOReturnSuccess &&
+               outputs[0] == 64;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_stats) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    virthid_device_stats stats;
+    uint32_t failed = virthid_bench("stats", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_stats, {handle}, nullptr, 0,
+                                 nullptr, 0, &stats, sizeof(stats)) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_latency) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    // Larger than an inline structure, returned through a descriptor.
+    static virthid_histogram_snapshot s_snapshot;
+    uint32_t failed = virthid_bench("latency", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_latency, {handle, virthid_latency_input},
+                                 nullptr, 0, nullptr, 0, &s_snapshot, sizeof(s_snapshot)) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_list_entries) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    VIRTHID_REQUIRE(virthid_bench_populate(&test, "bench", 64));
+
+    static uint8_t s_buf[4096];
+    uint64_t outputs[4];
+
+    // A buffer of 4096 bytes takes all 64 entries in one call.
+    uint32_t failed = virthid_bench("list_entries (64 devices)", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_list_entries,
+                                 {0, virthid_test_ptr(s_buf), sizeof(s_buf)}, outputs, 4) == kIOReturnSuccess &&
+               outputs[1] == 64;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_subscribe_events) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    uint32_t failed = virthid_bench("subscribe_events", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe_events, {},
+                                 nullptr, 0, nullptr, 0, nullptr, 0, s_async) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_read_events) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe_events, {},
+                                      nullptr, 0, nullptr, 0, nullptr, 0, s_async) == kIOReturnSuccess);
+
+    static uint8_t s_buf[virthid_event_queue_size * virthid_event_max_record];
+    uint64_t outputs[3];
+    char name[32];
+
+    // Every round queues a created and a destroyed event.
+    uint32_t failed = virthid_bench("read_events (2 events)", virthid_bench_iterations() / 16, [&](uint32_t i) {
+        virthid_bench_name(name, sizeof(name), "bench", i);
+        if (test.create(name) == virthid_invalid_handle || !virthid_bench_destroy(&test, name)) return false;
+
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_read_events,
+                                 {virthid_test_ptr(s_buf), sizeof(s_buf)}, outputs, 3) == kIOReturnSuccess &&
+               outputs[0] == 2;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_create_batch) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    const uint32_t records = 64;
+    static uint8_t s_batch[8192];
+    uint32_t round = 0;
+    uint32_t failed = 0;
+
+    uint32_t calls = virthid_bench_iterations() / records;
+    if (calls > 8) calls = 8;
+    if (calls == 0) calls = 1;
+
+    uint64_t elapsed = 0;
+    for (; round < calls; round++) {
+        uint32_t batch_len = virthid_provision_records_offset(virthid_test_keyboard_len);
+        char name[32];
+
+        memcpy(s_batch, virthid_test_keyboard, virthid_test_keyboard_len);
+        for (uint32_t i = 0; i < records; i++) {
+            virthid_provision_record record = {};
+            virthid_bench_name(name, sizeof(name), "batch", round * records + i);
+            record.name_len = (uint8_t)strlen(name);
+            memcpy(s_batch + batch_len, &record, sizeof(record));
+            memcpy(s_batch + batch_len + sizeof(record), name, record.name_len);
+            batch_len += virthid_provision_record_size(record.name_len, 0);
+        }
+
+        uint64_t outputs[3] = {};
+        uint64_t start = virthid_test_now();
+        IOReturn ret = virthid_test_call(test.client(), it_kotleni_virthid_method_create_batch,
+                                         {virthid_test_ptr(s_batch), batch_len, virthid_test_keyboard_len},
+                                         outputs, 3);
+        elapsed += virthid_test_now() - start;
+
+        if (ret != kIOReturnSuccess || outputs[0] != records) failed++;
+    }
+
+    virthid_bench_report("create_batch (64 devices)", calls, elapsed);
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_clone) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 source = test.create(s_name);
+    VIRTHID_REQUIRE(source != virthid_invalid_handle);
+
+    uint32_t count = virthid_bench_iterations() < s_devices ? virthid_bench_iterations() : s_devices;
+    char name[32];
+    uint64_t outputs[1];
+
+    uint32_t failed = virthid_bench("clone", count, [&](uint32_t i) {
+        virthid_bench_name(name, sizeof(name), "clone", i);
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_clone,
+                                 {source, strlen(name), 0, 0}, outputs, 1, name, (uint32_t)strlen(name))
+               == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_set_report_state) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint32_t failed = virthid_bench("set_report_state", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_set_report_state,
+                                 {handle, kIOHIDReportTypeInput}, nullptr, 0, virthid_bench_key(i), 8)
+               == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_send_keys) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static const virthid_key_event s_keys[2] = {{0x04, 1, 0}, {0x04, 0, 0}};
+    uint64_t outputs[1];
+
+    uint32_t failed = virthid_bench("send_keys (press and release)", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_keys, {handle}, outputs, 1,
+                                 s_keys, sizeof(s_keys)) == kIOReturnSuccess &&
+               outputs[0] == 2;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_send_events) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name, virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static const virthid_input_event s_events[4] = {
+        {virthid_input_move, 0, 0, 3, -2, },
+        {virthid_input_button, 0, 1, 1, 0},
+        {virthid_input_sync, 0, 0, 0, 0},
+        {virthid_input_button, 0, 1, 0, 0},
+    };
+    uint64_t outputs[1];
+
+    uint32_t failed = virthid_bench("send_events (4 events)", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_send_events, {handle}, outputs, 1,
+                                 s_events, sizeof(s_events)) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_set_polling) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    // Alternately start polling and stop it.
+    uint32_t failed = virthid_bench("set_polling", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_set_polling,
+                                 {handle, (i & 1) ? 0u : 100000u, 1}) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_set_watermarks) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    // Only coalescing devices have watermarks.
+    UInt32 handle = test.create(s_name, virthid_test_mouse, virthid_test_mouse_len);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_set_coalescing, {handle, 1})
+                    == kIOReturnSuccess);
+
+    uint32_t failed = virthid_bench("set_watermarks", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_set_watermarks,
+                                 {handle, 8 + (i & 1), 2}) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
+
+VIRTHID_TEST(bench_subscribe_flow) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint32_t failed = virthid_bench("subscribe_flow", virthid_bench_iterations(), [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_subscribe_flow, {handle, (i & 1) ^ 1},
+                                 nullptr, 0, nullptr, 0, nullptr, 0, s_async) == kIOReturnSuccess;
+    });
+
+    VIRTHID_CHECK(failed == 0);
+}
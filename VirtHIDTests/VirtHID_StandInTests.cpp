@@ -0,0 +1,181 @@
+//
+//  VirtHID_StandInTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <IOKit/IOInterruptEventSource.h>
+#include <IOKit/IOTimerEventSource.h>
+
+#include "VirtHID_Descriptor.hpp"
+
+VIRTHID_TEST(retain_release) {
+    OSString *string = OSString::withCString("VirtHID");
+    VIRTHID_REQUIRE(string);
+
+    string->retain();
+    VIRTHID_CHECK(string->getRetainCount() == 2);
+    string->release();
+    VIRTHID_CHECK(string->isEqualTo("VirtHID"));
+    string->release();
+}
+
+VIRTHID_TEST(dictionary_replaces) {
+    OSDictionary *dictionary = OSDictionary::withCapacity(1);
+    OSNumber *one = OSNumber::withNumber(1, 32);
+    OSNumber *two = OSNumber::withNumber(2, 32);
+
+    VIRTHID_CHECK(dictionary->setObject("a", one));
+    VIRTHID_CHECK(dictionary->setObject("b", one));
+    VIRTHID_CHECK(dictionary->setObject("a", two));
+    VIRTHID_CHECK(dictionary->getCount() == 2);
+    VIRTHID_CHECK(dictionary->getObject("a") == two);
+    VIRTHID_CHECK(one->getRetainCount() == 2);
+
+    dictionary->release();
+    one->release();
+    two->release();
+}
+
+static void virthid_count_interrupts(OSObject *owner, IOInterruptEventSource *sender, int count) {
+    __atomic_add_fetch((int *)(void *)owner, count, __ATOMIC_RELAXED);
+}
+
+VIRTHID_TEST(work_loop_runs_interrupts) {
+    IOWorkLoop *work_loop = IOWorkLoop::workLoop();
+    int delivered = 0;
+
+    // The owner is only passed through, any pointer does.
+    IOInterruptEventSource *source = IOInterruptEventSource::interruptEventSource(
+        (OSObject *)(void *)&delivered, &virthid_count_interrupts);
+    VIRTHID_REQUIRE(work_loop->addEventSource(source) == kIOReturnSuccess);
+
+    for (int i = 0; i < 1000; i++) source->interruptOccurred(nullptr, nullptr, 0);
+    standin_drain(work_loop);
+    VIRTHID_CHECK(__atomic_load_n(&delivered, __ATOMIC_RELAXED) == 1000);
+
+    VIRTHID_CHECK(work_loop->removeEventSource(source) == kIOReturnSuccess);
+    source->release();
+    work_loop->release();
+}
+
+static void virthid_count_timeouts(OSObject *owner, IOTimerEventSource *sender) {
+    __atomic_add_fetch((int *)(void *)owner, 1, __ATOMIC_RELAXED);
+}
+
+VIRTHID_TEST(work_loop_runs_timers) {
+    IOWorkLoop *work_loop = IOWorkLoop::workLoop();
+    int fired = 0;
+
+    IOTimerEventSource *timer = IOTimerEventSource::timerEventSource((OSObject *)(void *)&fired,
+                                                                     &virthid_count_timeouts);
+    VIRTHID_REQUIRE(work_loop->addEventSource(timer) == kIOReturnSuccess);
+
+    uint64_t start = virthid_test_now();
+    timer->setTimeoutMS(5);
+    while (__atomic_load_n(&fired, __ATOMIC_RELAXED) == 0 && virthid_test_now() - start < 1000000000ull) {
+        IOSleep(1);
+    }
+    VIRTHID_CHECK(__atomic_load_n(&fired, __ATOMIC_RELAXED) == 1);
+    VIRTHID_CHECK(virthid_test_now() - start >= 5000000ull);
+
+    // A cancelled timeout never fires.
+    timer->setTimeoutMS(5);
+    timer->cancelTimeout();
+    IOSleep(10);
+    VIRTHID_CHECK(__atomic_load_n(&fired, __ATOMIC_RELAXED) == 1);
+
+    work_loop->removeEventSource(timer);
+    timer->release();
+    work_loop->release();
+}
+
+VIRTHID_TEST(external_method_checks_counts) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    // 'destroy' takes exactly two scalars and returns none.
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy, {0})
+                  == kIOReturnBadArgument);
+
+    uint64_t outputs[1];
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy, {0, 0}, outputs, 1)
+                  == kIOReturnBadArgument);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_count, {})
+                  == kIOReturnUnsupported);
+}
+
+VIRTHID_TEST(test_descriptors_parse) {
+    virthid_report_layout layout;
+
+    VIRTHID_CHECK(layout.parse(virthid_test_keyboard, virthid_test_keyboard_len) == virthid_parse_ok);
+    VIRTHID_CHECK(layout.parse(virthid_test_mouse, virthid_test_mouse_len) == virthid_parse_ok);
+}
+
+VIRTHID_TEST(driver_creates_and_destroys) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+    VIRTHID_CHECK(test.device(handle) != nullptr);
+
+    // Names are unique.
+    VIRTHID_CHECK(test.create("keyboard") == virthid_invalid_handle);
+
+    static const char s_name[] = "keyboard";
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_destroy,
+                                    {virthid_test_ptr(s_name), sizeof(s_name) - 1}) == kIOReturnSuccess);
+    VIRTHID_CHECK(test.device(handle) == nullptr);
+}
+
+VIRTHID_TEST(driver_sends_input_reports) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    static const uint8_t s_report[8] = {0, 0, 0x04};
+    uint64_t outputs[2];
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_handle,
+                                    {handle, virthid_test_ptr(s_report), sizeof(s_report)}, outputs, 2)
+                  == kIOReturnSuccess);
+    VIRTHID_CHECK(test.reports() == 1);
+
+    // Closing the client leaves the devices to the driver, which stops them.
+    it_kotleni_virthid_userclient *client = test.openClient();
+    VIRTHID_REQUIRE(client);
+    test.closeClient(client);
+    VIRTHID_CHECK(test.device(handle) != nullptr);
+}
+
+VIRTHID_TEST(driver_completes_buffers_on_failure) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    VIRTHID_REQUIRE(test.create("keyboard") != virthid_invalid_handle);
+
+    // The stand-in faults on a descriptor freed while prepared, so a buffer
+    // that fails to prepare must not leave the ones before it prepared.
+    static const char s_name[] = "keyboard";
+    static const uint8_t s_report[8] = {};
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send,
+                                    {virthid_test_ptr(s_name), sizeof(s_name) - 1, 0, sizeof(s_report)})
+                  == kIOReturnNoMemory);
+
+    static const char s_other[] = "other";
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_create,
+                                    {virthid_test_ptr(s_other), sizeof(s_other) - 1,
+                                     virthid_test_ptr(virthid_test_keyboard), virthid_test_keyboard_len,
+                                     0, 4, 0, 0}) == kIOReturnNoMemory);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send,
+                                    {virthid_test_ptr(s_name), sizeof(s_name) - 1,
+                                     virthid_test_ptr(s_report), sizeof(s_report)}) == kIOReturnSuccess);
+    VIRTHID_CHECK(test.reports() == 1);
+}
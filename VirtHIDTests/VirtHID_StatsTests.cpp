@@ -0,0 +1,143 @@
+//
+//  VirtHID_StatsTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "VirtHID_Stats.hpp"
+
+static const uint32_t s_threads = 8;
+
+/**
+ *  Counters shared by the threads of the contention test and benchmark.
+ */
+struct virthid_stats_worker {
+    virthid_device_stats *stats;
+    uint32_t count;
+    uint32_t index;
+};
+
+static void *virthid_stats_work(void *context) {
+    virthid_stats_worker *worker = (virthid_stats_worker *)context;
+
+    // What a device does for each report it delivers.
+    for (uint32_t i = 0; i < worker->count; i++) {
+        virthid_stat_add(&worker->stats->reports_in);
+        virthid_stat_add(&worker->stats->bytes_in, 8);
+        virthid_stat_max(&worker->stats->subscriber_queue_high_water, worker->index * worker->count + i);
+    }
+
+    return nullptr;
+}
+
+static uint64_t virthid_stats_run(virthid_device_stats *stats, uint32_t threads, uint32_t count) {
+    pthread_t workers[s_threads];
+    virthid_stats_worker contexts[s_threads];
+
+    uint64_t start = virthid_test_now();
+    for (uint32_t i = 0; i < threads; i++) {
+        contexts[i] = {stats, count, i};
+        pthread_create(&workers[i], nullptr, &virthid_stats_work, &contexts[i]);
+    }
+    for (uint32_t i = 0; i < threads; i++) pthread_join(workers[i], nullptr);
+
+    return virthid_test_now() - start;
+}
+
+VIRTHID_TEST(stats_count_under_contention) {
+    static virthid_device_stats s_stats;
+    virthid_device_stats copy;
+    uint32_t count = virthid_test_iterations(100000);
+
+    s_stats = {};
+    virthid_stats_run(&s_stats, s_threads, count);
+
+    virthid_stats_copy(&s_stats, &copy);
+    VIRTHID_CHECK(copy.reports_in == (uint64_t)s_threads * count);
+    VIRTHID_CHECK(copy.bytes_in == 8ull * s_threads * count);
+    VIRTHID_CHECK(copy.subscriber_queue_high_water == s_threads * count - 1);
+
+    // A high-water mark never goes down.
+    virthid_stat_max(&s_stats.subscriber_queue_high_water, 1);
+    VIRTHID_CHECK(s_stats.subscriber_queue_high_water == s_threads * count - 1);
+}
+
+static uint64_t virthid_stats_number(OSDictionary *dict, const char *key) {
+    OSNumber *number = OSDynamicCast(OSNumber, dict->getObject(key));
+    return number ? number->unsigned64BitValue() : UINT64_MAX;
+}
+
+VIRTHID_TEST(driver_counts_reports) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    uint8_t report[8] = {};
+    for (uint32_t i = 0; i < 100; i++) {
+        VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                        nullptr, 0, report, sizeof(report)) == kIOReturnSuccess);
+    }
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_send_inline, {handle},
+                                    nullptr, 0, report, 3) != kIOReturnSuccess);
+
+    virthid_device_stats stats = {};
+    VIRTHID_REQUIRE(virthid_test_call(test.client(), it_kotleni_virthid_method_stats, {handle},
+                                      nullptr, 0, nullptr, 0, &stats, sizeof(stats)) == kIOReturnSuccess);
+    VIRTHID_CHECK(stats.reports_in == 100 && stats.bytes_in == 800);
+    VIRTHID_CHECK(stats.reports_rejected == 1 && stats.report_failures == 0);
+
+    VIRTHID_CHECK(virthid_test_call(test.client(), it_kotleni_virthid_method_stats, {virthid_invalid_handle},
+                                    nullptr, 0, nullptr, 0, &stats, sizeof(stats)) == kIOReturnNotFound);
+
+    // The registry property follows within the publication interval.
+    OSDictionary *dict = nullptr;
+    uint64_t timeout = virthid_test_now() + 2000000000ull * virthid_stats_interval_ms / 1000;
+    while (!dict && virthid_test_now() < timeout) {
+        OSObject *object = test.device(handle)->copyProperty("Statistics");
+        dict = OSDynamicCast(OSDictionary, object);
+        if (!dict && object) object->release();
+        if (!dict) IOSleep(10);
+    }
+    VIRTHID_REQUIRE(dict);
+    VIRTHID_CHECK(virthid_stats_number(dict, "ReportsIn") == 100);
+    VIRTHID_CHECK(virthid_stats_number(dict, "BytesIn") == 800);
+    VIRTHID_CHECK(virthid_stats_number(dict, "ReportsRejected") == 1);
+    dict->release();
+}
+
+VIRTHID_TEST(bench_stats_update) {
+    static virthid_device_stats s_stats;
+    uint32_t count = virthid_test_iterations(1000000);
+
+    // The per-report cost, uncontended and with every thread on the same device.
+    for (uint32_t threads = 1; threads <= s_threads; threads *= 2) {
+        s_stats = {};
+        uint64_t elapsed = virthid_stats_run(&s_stats, threads, count);
+
+        char name[64];
+        snprintf(name, sizeof(name), "counter update (%u threads)", threads);
+        virthid_bench_report(name, (uint64_t)threads * count, elapsed);
+        VIRTHID_CHECK(s_stats.reports_in == (uint64_t)threads * count);
+    }
+
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create("keyboard");
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    virthid_device_stats stats = {};
+    uint32_t failed = virthid_bench("stats selector", count / 10, [&](uint32_t i) {
+        return virthid_test_call(test.client(), it_kotleni_virthid_method_stats, {handle},
+                                 nullptr, 0, nullptr, 0, &stats, sizeof(stats)) == kIOReturnSuccess;
+    });
+    VIRTHID_CHECK(failed == 0);
+}
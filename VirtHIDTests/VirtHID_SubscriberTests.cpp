@@ -0,0 +1,175 @@
+//
+//  VirtHID_SubscriberTests.cpp
+//  VirtHIDTests
+//
+//  Created by agent on 17.10.2026.
+//
+
+#include "VirtHIDTests.hpp"
+
+#include <stdio.h>
+
+#include "VirtHID_OutputRing.hpp"
+#include "VirtHID_Subscribers.hpp"
+
+static const char s_name[] = "keyboard";
+
+VIRTHID_TEST(subscriber_set_adds_each_once) {
+    virthid_subscriber_set<int, 2> set;
+    int subscribers[3];
+    bool added = false;
+
+    VIRTHID_CHECK(set.add(&subscribers[0], &added) && added);
+    VIRTHID_CHECK(set.add(&subscribers[0], &added) && !added);
+    VIRTHID_CHECK(set.add(&subscribers[1], &added) && added);
+    VIRTHID_CHECK(!set.add(&subscribers[2], &added) && !added);
+    VIRTHID_CHECK(set.count() == 2);
+
+    VIRTHID_CHECK(set.remove(&subscribers[0]));
+    VIRTHID_CHECK(!set.remove(&subscribers[0]));
+    VIRTHID_CHECK(set.count() == 1 && set.at(0) == &subscribers[1]);
+    VIRTHID_CHECK(set.add(&subscribers[2]) && set.contains(&subscribers[2]));
+}
+
+/**
+ *  A user client subscribed to a device, reading output reports from its
+ *  output ring.
+ */
+struct virthid_subscriber {
+    it_kotleni_virthid_userclient *client;
+    IOMemoryDescriptor *memory;
+    IOMemoryMap *map;
+    uint64_t popped;
+};
+
+static bool virthid_subscriber_open(virthid_test_driver *test, virthid_subscriber *subscriber) {
+    OSAsyncReference64 async = {};
+    IOOptionBits options = 0;
+
+    *subscriber = {};
+    subscriber->client = test->openClient();
+    if (!subscriber->client) return false;
+
+    if (subscriber->client->clientMemoryForType(virthid_memory_output_ring << virthid_memory_type_shift,
+                                                &options, &subscriber->memory) != kIOReturnSuccess) {
+        return false;
+    }
+    subscriber->map = subscriber->memory->map();
+
+    return subscriber->map &&
+           virthid_test_call(subscriber->client, it_kotleni_virthid_method_subscribe,
+                             {virthid_test_ptr(s_name), sizeof(s_name) - 1},
+                             nullptr, 0, nullptr, 0, nullptr, 0, async) == kIOReturnSuccess;
+}
+
+static void virthid_subscriber_close(virthid_test_driver *test, virthid_subscriber *subscriber) {
+    if (subscriber->map) subscriber->map->release();
+    if (subscriber->memory) subscriber->memory->release();
+    if (subscriber->client) test->closeClient(subscriber->client);
+}
+
+static void virthid_subscriber_drain(virthid_subscriber *subscriber) {
+    virthid_output_ring ring((virthid_output_ring_shared *)subscriber->map->getAddress());
+    virthid_output_record record;
+    uint8_t report[8];
+
+    while (ring.pop(&record, report, sizeof(report)) == virthid_output_ring_popped) subscriber->popped++;
+}
+
+static uint64_t virthid_subscriber_dropped(virthid_subscriber *subscriber) {
+    return virthid_output_ring((virthid_output_ring_shared *)subscriber->map->getAddress()).dropped();
+}
+
+static IOBufferMemoryDescriptor *virthid_led_report() {
+    IOBufferMemoryDescriptor *report = IOBufferMemoryDescriptor::withOptions(kIODirectionOut, 1);
+    if (report) *(uint8_t *)report->getBytesNoCopy() = 0x02;
+    return report;
+}
+
+VIRTHID_TEST(slow_subscriber_does_not_hold_back_others) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    virthid_subscriber subscribers[virthid_max_subscribers];
+    for (uint32_t i = 0; i < virthid_max_subscribers; i++) {
+        VIRTHID_REQUIRE(virthid_subscriber_open(&test, &subscribers[i]));
+    }
+
+    // One more than the device takes.
+    virthid_subscriber extra;
+    VIRTHID_CHECK(!virthid_subscriber_open(&test, &extra));
+    virthid_subscriber_close(&test, &extra);
+
+    IOBufferMemoryDescriptor *report = virthid_led_report();
+    VIRTHID_REQUIRE(report);
+
+    // The first subscriber never reads, every other one keeps up.
+    const uint32_t slow_capacity = virthid_output_ring_capacity / virthid_output_ring::recordSize(1);
+    const uint32_t total = 4 * slow_capacity;
+    for (uint32_t i = 0; i < total; i++) {
+        VIRTHID_CHECK(test.device(handle)->setReport(report, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess);
+        for (uint32_t j = 1; j < virthid_max_subscribers; j++) virthid_subscriber_drain(&subscribers[j]);
+    }
+
+    for (uint32_t j = 1; j < virthid_max_subscribers; j++) {
+        VIRTHID_CHECK(subscribers[j].popped == total);
+        VIRTHID_CHECK(virthid_subscriber_dropped(&subscribers[j]) == 0);
+    }
+
+    virthid_subscriber_drain(&subscribers[0]);
+    VIRTHID_CHECK(subscribers[0].popped == slow_capacity);
+    VIRTHID_CHECK(virthid_subscriber_dropped(&subscribers[0]) == total - slow_capacity);
+
+    virthid_device_stats stats;
+    test.device(handle)->copyStats(&stats);
+    VIRTHID_CHECK(stats.subscriber_drops == total - slow_capacity);
+
+    report->release();
+    for (uint32_t i = 0; i < virthid_max_subscribers; i++) virthid_subscriber_close(&test, &subscribers[i]);
+}
+
+VIRTHID_TEST(bench_set_report_fan_out) {
+    virthid_test_driver test;
+    VIRTHID_REQUIRE(test.ok());
+
+    UInt32 handle = test.create(s_name);
+    VIRTHID_REQUIRE(handle != virthid_invalid_handle);
+
+    IOBufferMemoryDescriptor *report = virthid_led_report();
+    VIRTHID_REQUIRE(report);
+
+    virthid_subscriber subscribers[virthid_max_subscribers];
+    uint32_t count = virthid_test_iterations(100000);
+    uint32_t subscribed = 0;
+    uint32_t failed = 0;
+
+    // Cost of one output report as subscribers are added, with rings drained
+    // well before they fill.
+    for (uint32_t target = 1; target <= virthid_max_subscribers; target *= 2) {
+        for (; subscribed < target; subscribed++) {
+            VIRTHID_REQUIRE(virthid_subscriber_open(&test, &subscribers[subscribed]));
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "setReport (%u subscribers)", subscribed);
+        failed += virthid_bench(name, count, [&](uint32_t i) {
+            if ((i & 1023) == 1023) {
+                for (uint32_t j = 0; j < subscribed; j++) virthid_subscriber_drain(&subscribers[j]);
+            }
+            return test.device(handle)->setReport(report, kIOHIDReportTypeOutput, 0) == kIOReturnSuccess;
+        });
+
+        for (uint32_t j = 0; j < subscribed; j++) virthid_subscriber_drain(&subscribers[j]);
+    }
+
+    virthid_device_stats stats;
+    test.device(handle)->copyStats(&stats);
+    VIRTHID_CHECK(failed == 0);
+    VIRTHID_CHECK(stats.subscriber_drops == 0);
+
+    report->release();
+    for (uint32_t i = 0; i < subscribed; i++) virthid_subscriber_close(&test, &subscribers[i]);
+}